@@ -8,7 +8,7 @@
 // command-line parameters
 struct whisper_params {
     int32_t n_threads = std::min(4, (int32_t) std::thread::hardware_concurrency());
-    int32_t what = 0; // what to benchmark: 0 - whisper encoder, 1 - memcpy, 2 - ggml_mul_mat
+    int32_t what = 0; // what to benchmark: 0 - whisper encoder, 1 - memcpy, 2 - ggml_mul_mat, 3 - decoder beams
 
     std::string model = "models/ggml-base.en.bin";
 
@@ -55,6 +55,7 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "                           %-7s  0 - whisper\n",                                 "");
     fprintf(stderr, "                           %-7s  1 - memcpy\n",                                  "");
     fprintf(stderr, "                           %-7s  2 - ggml_mul_mat\n",                            "");
+    fprintf(stderr, "                           %-7s  3 - decoder with 1 to 8 beams\n",               "");
     fprintf(stderr, "\n");
 }
 
@@ -155,6 +156,30 @@ static int whisper_bench_full(const whisper_params & params) {
     return 0;
 }
 
+static int whisper_bench_beams(const whisper_params & params) {
+    struct whisper_context_params cparams = whisper_context_default_params();
+
+    cparams.use_gpu    = params.use_gpu;
+    cparams.flash_attn = params.flash_attn;
+
+    struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
+
+    if (ctx == nullptr) {
+        fprintf(stderr, "error: failed to initialize whisper context\n");
+        return 2;
+    }
+
+    fprintf(stderr, "\n");
+    fprintf(stderr, "system_info: n_threads = %d / %d | %s\n", params.n_threads, std::thread::hardware_concurrency(), whisper_print_system_info());
+    fprintf(stderr, "\n");
+
+    const int ret = whisper_bench_decoder_beams(ctx, params.n_threads);
+
+    whisper_free(ctx);
+
+    return ret;
+}
+
 int main(int argc, char ** argv) {
     whisper_params params;
 
@@ -168,6 +193,7 @@ int main(int argc, char ** argv) {
         case 0: ret = whisper_bench_full(params);                break;
         case 1: ret = whisper_bench_memcpy(params.n_threads);       break;
         case 2: ret = whisper_bench_ggml_mul_mat(params.n_threads); break;
+        case 3: ret = whisper_bench_beams(params);                  break;
         default: fprintf(stderr, "error: unknown benchmark: %d\n", params.what); break;
     }
 
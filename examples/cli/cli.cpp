@@ -1,4 +1,5 @@
 #include "common.h"
+#include "common-ggml.h"
 
 #include "whisper.h"
 #include "grammar-parser.h"
@@ -45,6 +46,13 @@ struct whisper_params {
     int32_t beam_size     = whisper_full_default_params(WHISPER_SAMPLING_BEAM_SEARCH).beam_search.beam_size;
     int32_t audio_ctx     = 0;
 
+    int32_t vad_min_speech_ms  = whisper_vad_default_params().min_speech_duration_ms;
+    int32_t vad_min_silence_ms = whisper_vad_default_params().min_silence_duration_ms;
+    int32_t vad_speech_pad_ms  = whisper_vad_default_params().speech_pad_ms;
+
+    int32_t lang_detect_ms     = whisper_lang_detect_default_params().audio_ms;
+    int32_t lang_detect_layers = whisper_lang_detect_default_params().n_layers;
+
     float word_thold      =  0.01f;
     float entropy_thold   =  2.40f;
     float logprob_thold   = -1.00f;
@@ -52,6 +60,8 @@ struct whisper_params {
     float grammar_penalty = 100.0f;
     float temperature     = 0.0f;
     float temperature_inc = 0.2f;
+    float vad_thold       = whisper_vad_default_params().threshold;
+    float lang_detect_p   = whisper_lang_detect_default_params().min_prob;
 
     bool debug_mode      = false;
     bool translate       = false;
@@ -77,6 +87,8 @@ struct whisper_params {
     bool use_gpu         = true;
     bool flash_attn      = false;
     bool suppress_nst    = false;
+    bool vad             = false;
+    bool lang_detect_fast = false;
 
     std::string language  = "en";
     std::string prompt;
@@ -93,6 +105,16 @@ struct whisper_params {
 
     std::string openvino_encode_device = "CPU";
 
+    std::string cache_type_k = "auto";
+    std::string cache_type_v = "auto";
+
+    std::string numa = "";
+    int32_t numa_node       = -1;
+    bool    numa_interleave = false;
+
+    int32_t cpu_poll = 50;
+    int32_t cpu_prio = 0;
+
     std::string dtw = "";
 
     std::vector<std::string> fname_inp = {};
@@ -182,11 +204,27 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-ls"   || arg == "--log-score")       { params.log_score       = true; }
         else if (arg == "-ng"   || arg == "--no-gpu")          { params.use_gpu         = false; }
         else if (arg == "-fa"   || arg == "--flash-attn")      { params.flash_attn      = true; }
+        else if (arg == "-ctk"  || arg == "--cache-type-k")    { params.cache_type_k    = ARGV_NEXT; }
+        else if (arg == "-ctv"  || arg == "--cache-type-v")    { params.cache_type_v    = ARGV_NEXT; }
+        else if (                  arg == "--numa")            { params.numa            = ARGV_NEXT; }
+        else if (                  arg == "--numa-node")       { params.numa_node       = std::stoi(ARGV_NEXT); }
+        else if (                  arg == "--numa-interleave") { params.numa_interleave = true; }
+        else if (                  arg == "--poll")            { params.cpu_poll        = std::stoi(ARGV_NEXT); }
+        else if (                  arg == "--prio")            { params.cpu_prio        = std::stoi(ARGV_NEXT); }
         else if (arg == "-sns"  || arg == "--suppress-nst")    { params.suppress_nst    = true; }
         else if (                  arg == "--suppress-regex")  { params.suppress_regex  = ARGV_NEXT; }
         else if (                  arg == "--grammar")         { params.grammar         = ARGV_NEXT; }
         else if (                  arg == "--grammar-rule")    { params.grammar_rule    = ARGV_NEXT; }
         else if (                  arg == "--grammar-penalty") { params.grammar_penalty = std::stof(ARGV_NEXT); }
+        else if (                  arg == "--vad")             { params.vad             = true; }
+        else if (arg == "-vt"   || arg == "--vad-thold")       { params.vad_thold       = std::stof(ARGV_NEXT); }
+        else if (arg == "-vspd" || arg == "--vad-min-speech")  { params.vad_min_speech_ms  = std::stoi(ARGV_NEXT); }
+        else if (arg == "-vsd"  || arg == "--vad-min-silence") { params.vad_min_silence_ms = std::stoi(ARGV_NEXT); }
+        else if (arg == "-vp"   || arg == "--vad-speech-pad")  { params.vad_speech_pad_ms  = std::stoi(ARGV_NEXT); }
+        else if (arg == "-dlf"  || arg == "--detect-language-fast")   { params.lang_detect_fast   = true; }
+        else if (arg == "-dlms" || arg == "--detect-language-ms")     { params.lang_detect_ms     = std::stoi(ARGV_NEXT); }
+        else if (arg == "-dlnl" || arg == "--detect-language-layers") { params.lang_detect_layers = std::stoi(ARGV_NEXT); }
+        else if (arg == "-dlp"  || arg == "--detect-language-p")      { params.lang_detect_p      = std::stof(ARGV_NEXT); }
         else {
             fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
             whisper_print_usage(argc, argv, params);
@@ -250,11 +288,27 @@ static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params
     fprintf(stderr, "  -ls,       --log-score         [%-7s] log best decoder scores of tokens\n",              params.log_score?"true":"false");
     fprintf(stderr, "  -ng,       --no-gpu            [%-7s] disable GPU\n",                                    params.use_gpu ? "false" : "true");
     fprintf(stderr, "  -fa,       --flash-attn        [%-7s] flash attention\n",                                params.flash_attn ? "true" : "false");
+    fprintf(stderr, "  -ctk T,    --cache-type-k T    [%-7s] KV cache type for K (auto, f16, bf16, q8_0, q5_0, ...)\n", params.cache_type_k.c_str());
+    fprintf(stderr, "  -ctv T,    --cache-type-v T    [%-7s] KV cache type for V, quantized types require -fa\n", params.cache_type_v.c_str());
+    fprintf(stderr, "             --numa TYPE         [%-7s] NUMA thread distribution (distribute, isolate, numactl)\n", params.numa.c_str());
+    fprintf(stderr, "             --numa-node N       [%-7d] keep the weights and the compute threads on NUMA node N\n", params.numa_node);
+    fprintf(stderr, "             --numa-interleave   [%-7s] interleave the weights across the NUMA nodes\n",         params.numa_interleave ? "true" : "false");
+    fprintf(stderr, "             --poll N            [%-7d] polling level of the CPU threads between graphs (0 - 100)\n", params.cpu_poll);
+    fprintf(stderr, "             --prio N            [%-7d] priority of the CPU threads (0 - normal, 1 - medium, 2 - high, 3 - realtime)\n", params.cpu_prio);
     fprintf(stderr, "  -sns,      --suppress-nst      [%-7s] suppress non-speech tokens\n",                     params.suppress_nst ? "true" : "false");
     fprintf(stderr, "  --suppress-regex REGEX         [%-7s] regular expression matching tokens to suppress\n", params.suppress_regex.c_str());
     fprintf(stderr, "  --grammar GRAMMAR              [%-7s] GBNF grammar to guide decoding\n",                 params.grammar.c_str());
     fprintf(stderr, "  --grammar-rule RULE            [%-7s] top-level GBNF grammar rule name\n",               params.grammar_rule.c_str());
     fprintf(stderr, "  --grammar-penalty N            [%-7.1f] scales down logits of nongrammar tokens\n",      params.grammar_penalty);
+    fprintf(stderr, "  --vad                          [%-7s] transcribe only the speech detected by the VAD\n", params.vad ? "true" : "false");
+    fprintf(stderr, "  -vt N,     --vad-thold N       [%-7.2f] VAD speech probability threshold\n",             params.vad_thold);
+    fprintf(stderr, "  -vspd N,   --vad-min-speech N  [%-7d] VAD minimum speech duration in milliseconds\n",   params.vad_min_speech_ms);
+    fprintf(stderr, "  -vsd N,    --vad-min-silence N [%-7d] VAD minimum silence duration in milliseconds\n",  params.vad_min_silence_ms);
+    fprintf(stderr, "  -vp N,     --vad-speech-pad N  [%-7d] VAD padding around speech in milliseconds\n",     params.vad_speech_pad_ms);
+    fprintf(stderr, "  -dlf,      --detect-language-fast       [%-7s] detect the language with a truncated encoder first\n", params.lang_detect_fast ? "true" : "false");
+    fprintf(stderr, "  -dlms N,   --detect-language-ms N       [%-7d] audio used by the fast language detection in milliseconds\n", params.lang_detect_ms);
+    fprintf(stderr, "  -dlnl N,   --detect-language-layers N   [%-7d] encoder layers used by the fast language detection (0 - all)\n", params.lang_detect_layers);
+    fprintf(stderr, "  -dlp N,    --detect-language-p N        [%-7.2f] min language probability to accept the fast detection\n", params.lang_detect_p);
     fprintf(stderr, "\n");
 }
 
@@ -1001,10 +1055,34 @@ int main(int argc, char ** argv) {
 
     // whisper init
 
+    if (!params.numa.empty()) {
+        if      (params.numa == "distribute") whisper_numa_init(GGML_NUMA_STRATEGY_DISTRIBUTE);
+        else if (params.numa == "isolate")    whisper_numa_init(GGML_NUMA_STRATEGY_ISOLATE);
+        else if (params.numa == "numactl")    whisper_numa_init(GGML_NUMA_STRATEGY_NUMACTL);
+        else {
+            fprintf(stderr, "error: unknown NUMA strategy '%s'\n", params.numa.c_str());
+            return 3;
+        }
+    }
+
     struct whisper_context_params cparams = whisper_context_default_params();
 
     cparams.use_gpu    = params.use_gpu;
     cparams.flash_attn = params.flash_attn;
+    cparams.type_k     = params.cache_type_k == "auto" ? WHISPER_KV_TYPE_AUTO : ggml_parse_qtype(params.cache_type_k.c_str());
+    cparams.type_v     = params.cache_type_v == "auto" ? WHISPER_KV_TYPE_AUTO : ggml_parse_qtype(params.cache_type_v.c_str());
+
+    cparams.numa_node       = params.numa_node;
+    cparams.numa_interleave = params.numa_interleave;
+
+    cparams.cpu_poll = std::max(0, std::min(100, params.cpu_poll));
+    cparams.cpu_prio = (enum ggml_sched_priority) std::max(0, std::min(3, params.cpu_prio));
+
+    if ((cparams.type_k == GGML_TYPE_COUNT && params.cache_type_k != "auto") ||
+        (cparams.type_v == GGML_TYPE_COUNT && params.cache_type_v != "auto")) {
+        fprintf(stderr, "error: unknown KV cache type '%s' / '%s'\n", params.cache_type_k.c_str(), params.cache_type_v.c_str());
+        return 3;
+    }
 
     if (!params.dtw.empty()) {
         cparams.dtw_token_timestamps = true;
@@ -1151,6 +1229,17 @@ int main(int argc, char ** argv) {
 
             wparams.suppress_nst     = params.suppress_nst;
 
+            wparams.vad                                   = params.vad;
+            wparams.vad_params.threshold                  = params.vad_thold;
+            wparams.vad_params.min_speech_duration_ms     = params.vad_min_speech_ms;
+            wparams.vad_params.min_silence_duration_ms    = params.vad_min_silence_ms;
+            wparams.vad_params.speech_pad_ms              = params.vad_speech_pad_ms;
+
+            wparams.lang_detect_fast                      = params.lang_detect_fast;
+            wparams.lang_detect_params.audio_ms           = params.lang_detect_ms;
+            wparams.lang_detect_params.n_layers           = params.lang_detect_layers;
+            wparams.lang_detect_params.min_prob           = params.lang_detect_p;
+
             whisper_print_user_data user_data = { &params, &pcmf32s, 0 };
 
             const auto & grammar_parsed = params.grammar_parsed;
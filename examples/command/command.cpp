@@ -269,24 +269,19 @@ static int process_command_list(struct whisper_context * ctx, audio_async &audio
 
     for (const auto & cmd : allowed_commands) {
         whisper_token tokens[1024];
-        allowed_tokens.emplace_back();
 
-        for (int l = 0; l < (int) cmd.size(); ++l) {
-            // NOTE: very important to add the whitespace !
-            //       the reason is that the first decoded token starts with a whitespace too!
-            std::string ss = std::string(" ") + cmd.substr(0, l + 1);
+        // NOTE: very important to add the whitespace !
+        //       the reason is that the first decoded token starts with a whitespace too!
+        const std::string ss = std::string(" ") + cmd;
 
-            const int n = whisper_tokenize(ctx, ss.c_str(), tokens, 1024);
-            if (n < 0) {
-                fprintf(stderr, "%s: error: failed to tokenize command '%s'\n", __func__, cmd.c_str());
-                return 3;
-            }
-
-            if (n == 1) {
-                allowed_tokens.back().push_back(tokens[0]);
-            }
+        const int n = whisper_tokenize(ctx, ss.c_str(), tokens, 1024);
+        if (n <= 0) {
+            fprintf(stderr, "%s: error: failed to tokenize command '%s'\n", __func__, cmd.c_str());
+            return 3;
         }
 
+        allowed_tokens.emplace_back(tokens, tokens + n);
+
         max_len = std::max(max_len, (int) cmd.size());
     }
 
@@ -321,6 +316,31 @@ static int process_command_list(struct whisper_context * ctx, audio_async &audio
         k_tokens.resize(n);
     }
 
+    // the decoder prefix shared by all commands: [prev] + prompt + [sot, lang, task, notimestamps]
+    std::vector<whisper_token> k_prefix;
+    {
+        k_prefix.push_back(whisper_token_prev(ctx));
+        k_prefix.insert(k_prefix.end(), k_tokens.begin(), k_tokens.end());
+        k_prefix.push_back(whisper_token_sot(ctx));
+
+        const int lang_id = whisper_lang_id(params.language.c_str());
+        if (whisper_is_multilingual(ctx) && lang_id >= 0) {
+            k_prefix.push_back(whisper_token_lang(ctx, lang_id));
+            k_prefix.push_back(params.translate ? whisper_token_translate(ctx) : whisper_token_transcribe(ctx));
+        }
+
+        k_prefix.push_back(whisper_token_not(ctx));
+    }
+
+    std::vector<const whisper_token *> cand_tokens;
+    std::vector<int>                   cand_n_tokens;
+    for (const auto & tokens : allowed_tokens) {
+        cand_tokens.push_back(tokens.data());
+        cand_n_tokens.push_back(tokens.size());
+    }
+
+    std::vector<float> cand_logprobs(allowed_commands.size());
+
     fprintf(stderr, "\n");
     fprintf(stderr, "%s: prompt: '%s'\n", __func__, k_prompt.c_str());
     fprintf(stderr, "%s: tokens: [", __func__);
@@ -353,65 +373,34 @@ static int process_command_list(struct whisper_context * ctx, audio_async &audio
 
             const auto t_start = std::chrono::high_resolution_clock::now();
 
-            whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
-
-            wparams.print_progress   = false;
-            wparams.print_special    = params.print_special;
-            wparams.print_realtime   = false;
-            wparams.print_timestamps = !params.no_timestamps;
-            wparams.translate        = params.translate;
-            wparams.no_context       = true;
-            wparams.single_segment   = true;
-            wparams.max_tokens       = 1;
-            wparams.language         = params.language.c_str();
-            wparams.n_threads        = params.n_threads;
-
-            wparams.audio_ctx        = params.audio_ctx;
-
-            wparams.prompt_tokens    = k_tokens.data();
-            wparams.prompt_n_tokens  = k_tokens.size();
+            if (whisper_pcm_to_mel(ctx, pcmf32_cur.data(), pcmf32_cur.size(), params.n_threads) != 0) {
+                fprintf(stderr, "%s: ERROR: whisper_pcm_to_mel() failed\n", __func__);
+                break;
+            }
 
-            // run the transformer and a single decoding pass
-            if (whisper_full(ctx, wparams, pcmf32_cur.data(), pcmf32_cur.size()) != 0) {
-                fprintf(stderr, "%s: ERROR: whisper_full() failed\n", __func__);
+            // run the encoder once and score all commands in a single batched decoder pass
+            if (whisper_score_candidates(ctx, k_prefix.data(), k_prefix.size(),
+                        cand_tokens.data(), cand_n_tokens.data(), cand_tokens.size(),
+                        params.audio_ctx, params.n_threads, cand_logprobs.data()) != 0) {
+                fprintf(stderr, "%s: ERROR: whisper_score_candidates() failed\n", __func__);
                 break;
             }
 
             // estimate command probability
-            // NOTE: not optimal
+            // softmax over the length-normalized log-likelihoods of the commands
             {
-                const auto * logits = whisper_get_logits(ctx);
-
-                std::vector<float> probs(whisper_n_vocab(ctx), 0.0f);
-
-                // compute probs from logits via softmax
-                {
-                    float max = -1e9;
-                    for (int i = 0; i < (int) probs.size(); ++i) {
-                        max = std::max(max, logits[i]);
-                    }
-
-                    float sum = 0.0f;
-                    for (int i = 0; i < (int) probs.size(); ++i) {
-                        probs[i] = expf(logits[i] - max);
-                        sum += probs[i];
-                    }
+                std::vector<std::pair<float, int>> probs_id;
 
-                    for (int i = 0; i < (int) probs.size(); ++i) {
-                        probs[i] /= sum;
-                    }
+                float max = -INFINITY;
+                for (int i = 0; i < (int) allowed_commands.size(); ++i) {
+                    probs_id.emplace_back(cand_logprobs[i] / allowed_tokens[i].size(), i);
+                    max = std::max(max, probs_id.back().first);
                 }
 
-                std::vector<std::pair<float, int>> probs_id;
-
                 double psum = 0.0;
-                for (int i = 0; i < (int) allowed_commands.size(); ++i) {
-                    probs_id.emplace_back(probs[allowed_tokens[i][0]], i);
-                    for (int j = 1; j < (int) allowed_tokens[i].size(); ++j) {
-                        probs_id.back().first += probs[allowed_tokens[i][j]];
-                    }
-                    probs_id.back().first /= allowed_tokens[i].size();
-                    psum += probs_id.back().first;
+                for (auto & p : probs_id) {
+                    p.first = expf(p.first - max);
+                    psum += p.first;
                 }
 
                 // normalize
@@ -431,9 +420,9 @@ static int process_command_list(struct whisper_context * ctx, audio_async &audio
                 {
                     fprintf(stdout, "\n");
                     for (const auto & cmd : probs_id) {
-                        fprintf(stdout, "%s: %s%-*s%s = %f | ", __func__, "\033[1m", max_len, allowed_commands[cmd.second].c_str(), "\033[0m", cmd.first);
+                        fprintf(stdout, "%s: %s%-*s%s = %f | logprob = %8.3f | ", __func__, "\033[1m", max_len, allowed_commands[cmd.second].c_str(), "\033[0m", cmd.first, cand_logprobs[cmd.second]);
                         for (int token : allowed_tokens[cmd.second]) {
-                            fprintf(stdout, "'%4s' %f ", whisper_token_to_str(ctx, token), probs[token]);
+                            fprintf(stdout, "'%s' ", whisper_token_to_str(ctx, token));
                         }
                         fprintf(stdout, "\n");
                     }
@@ -1,9 +1,12 @@
 #include "common-ggml.h"
 
+#include <chrono>
+#include <cstring>
 #include <regex>
 #include <map>
 
 static const std::map<std::string, enum ggml_ftype> GGML_FTYPE_MAP = {
+    {"bf16", GGML_FTYPE_MOSTLY_BF16},
     {"q4_0", GGML_FTYPE_MOSTLY_Q4_0},
     {"q4_1", GGML_FTYPE_MOSTLY_Q4_1},
     {"q5_0", GGML_FTYPE_MOSTLY_Q5_0},
@@ -14,6 +17,15 @@ static const std::map<std::string, enum ggml_ftype> GGML_FTYPE_MAP = {
     {"q4_k", GGML_FTYPE_MOSTLY_Q4_K},
     {"q5_k", GGML_FTYPE_MOSTLY_Q5_K},
     {"q6_k", GGML_FTYPE_MOSTLY_Q6_K},
+    {"iq1_s",   GGML_FTYPE_MOSTLY_IQ1_S},
+    {"iq1_m",   GGML_FTYPE_MOSTLY_IQ1_M},
+    {"iq2_xxs", GGML_FTYPE_MOSTLY_IQ2_XXS},
+    {"iq2_xs",  GGML_FTYPE_MOSTLY_IQ2_XS},
+    {"iq2_s",   GGML_FTYPE_MOSTLY_IQ2_S},
+    {"iq3_xxs", GGML_FTYPE_MOSTLY_IQ3_XXS},
+    {"iq3_s",   GGML_FTYPE_MOSTLY_IQ3_S},
+    {"iq4_nl",  GGML_FTYPE_MOSTLY_IQ4_NL},
+    {"iq4_xs",  GGML_FTYPE_MOSTLY_IQ4_XS},
 };
 
 void ggml_print_ftypes(FILE * fp) {
@@ -24,7 +36,7 @@ void ggml_print_ftypes(FILE * fp) {
 
 enum ggml_ftype ggml_parse_ftype(const char * str) {
     enum ggml_ftype ftype;
-    if (str[0] == 'q') {
+    if (str[0] == 'q' || str[0] == 'i' || str[0] == 'b') {
         const auto it = GGML_FTYPE_MAP.find(str);
         if (it == GGML_FTYPE_MAP.end()) {
             fprintf(stderr, "%s: unknown ftype '%s'\n", __func__, str);
@@ -38,6 +50,25 @@ enum ggml_ftype ggml_parse_ftype(const char * str) {
     return ftype;
 }
 
+enum ggml_type ggml_parse_qtype(const char * str) {
+    const std::string name = str;
+
+    if (name == "f32") {
+        return GGML_TYPE_F32;
+    }
+
+    if (name == "f16") {
+        return GGML_TYPE_F16;
+    }
+
+    const auto it = GGML_FTYPE_MAP.find(name);
+    if (it == GGML_FTYPE_MAP.end()) {
+        return GGML_TYPE_COUNT;
+    }
+
+    return ggml_ftype_to_ggml_type(it->second);
+}
+
 bool ggml_common_quantize_0(
         std::ifstream & finp,
         std::ofstream & fout,
@@ -236,3 +267,185 @@ bool ggml_common_quantize_0(
 
     return true;
 }
+
+static bool ggml_common_read_tensor_info(std::ifstream & finp, ggml_common_tensor_info & info) {
+    int32_t n_dims;
+    int32_t length;
+    int32_t ttype;
+
+    finp.read(reinterpret_cast<char *>(&n_dims), sizeof(n_dims));
+    finp.read(reinterpret_cast<char *>(&length), sizeof(length));
+    finp.read(reinterpret_cast<char *>(&ttype),  sizeof(ttype));
+
+    if (finp.eof()) {
+        return false;
+    }
+
+    info.n_dims = n_dims;
+    info.type   = (ggml_type) ttype;
+
+    for (int i = 0; i < 4; ++i) {
+        info.ne[i] = 1;
+    }
+    for (int i = 0; i < n_dims; ++i) {
+        finp.read(reinterpret_cast<char *>(&info.ne[i]), sizeof(info.ne[i]));
+    }
+
+    info.name.resize(length);
+    finp.read(&info.name[0], length);
+
+    return true;
+}
+
+static size_t ggml_common_tensor_nbytes(const ggml_common_tensor_info & info, ggml_type type) {
+    return ggml_row_size(type, info.ne[0])*info.ne[1]*info.ne[2]*info.ne[3];
+}
+
+bool ggml_common_scan_tensors(
+        std::ifstream & finp,
+        std::vector<ggml_common_tensor_info> & infos) {
+    const auto pos = finp.tellg();
+
+    infos.clear();
+
+    while (true) {
+        ggml_common_tensor_info info;
+        if (!ggml_common_read_tensor_info(finp, info)) {
+            break;
+        }
+
+        if (info.type < 0 || info.type >= GGML_TYPE_COUNT) {
+            fprintf(stderr, "%s: tensor '%s' has invalid type %d\n", __func__, info.name.c_str(), info.type);
+            return false;
+        }
+
+        finp.seekg(ggml_common_tensor_nbytes(info, info.type), std::ios::cur);
+
+        infos.push_back(std::move(info));
+    }
+
+    finp.clear();
+    finp.seekg(pos);
+
+    return true;
+}
+
+bool ggml_common_quantize_1(
+        std::ifstream & finp,
+        std::ofstream & fout,
+        const std::map<std::string, ggml_type> & types,
+        const std::map<std::string, std::vector<float>> & imatrix,
+        std::vector<ggml_common_quantize_stat> * stats) {
+    size_t total_size_org = 0;
+    size_t total_size_new = 0;
+
+    std::vector<uint8_t>     data_u8;
+    std::vector<uint8_t>     work;
+    std::vector<float>       data_f32;
+
+    while (true) {
+        ggml_common_tensor_info info;
+        if (!ggml_common_read_tensor_info(finp, info)) {
+            break;
+        }
+
+        const auto t_start = std::chrono::steady_clock::now();
+
+        const int64_t nelements = (int64_t) info.ne[0]*info.ne[1]*info.ne[2]*info.ne[3];
+
+        ggml_type ttype = info.type;
+
+        const auto it = types.find(info.name);
+        if (it != types.end()) {
+            ttype = it->second;
+        }
+
+        printf("%64s - [%5d, %5d, %5d], type = %6s -> %6s ", info.name.data(), info.ne[0], info.ne[1], info.ne[2],
+                ggml_type_name(info.type), ggml_type_name(ttype));
+
+        data_u8.resize(ggml_common_tensor_nbytes(info, info.type));
+        finp.read(reinterpret_cast<char *>(data_u8.data()), data_u8.size());
+
+        const size_t size_org = data_u8.size();
+
+        if (ttype != info.type) {
+            if (info.type != GGML_TYPE_F32 && info.type != GGML_TYPE_F16 && info.type != GGML_TYPE_BF16) {
+                fprintf(stderr, "%s: unsupported ttype %d (%s) for conversion\n", __func__, info.type, ggml_type_name(info.type));
+                return false;
+            }
+
+            if (info.ne[0] % ggml_blck_size(ttype) != 0) {
+                fprintf(stderr, "%s: tensor '%s' has %d columns, not a multiple of the %s block size %d\n",
+                        __func__, info.name.c_str(), info.ne[0], ggml_type_name(ttype), (int) ggml_blck_size(ttype));
+                return false;
+            }
+
+            const float * imat = nullptr;
+
+            const auto it_imat = imatrix.find(info.name);
+            if (it_imat != imatrix.end()) {
+                if ((int64_t) it_imat->second.size() != info.ne[0]) {
+                    fprintf(stderr, "%s: importance matrix of tensor '%s' has %zu values, expected %d\n",
+                            __func__, info.name.c_str(), it_imat->second.size(), info.ne[0]);
+                    return false;
+                }
+
+                imat = it_imat->second.data();
+            }
+
+            if (imat == nullptr && ggml_quantize_requires_imatrix(ttype)) {
+                fprintf(stderr, "%s: type %s requires an importance matrix for tensor '%s'\n", __func__, ggml_type_name(ttype), info.name.c_str());
+                return false;
+            }
+
+            data_f32.resize(nelements);
+            if (info.type == GGML_TYPE_F16) {
+                ggml_fp16_to_fp32_row(reinterpret_cast<const ggml_fp16_t *>(data_u8.data()), data_f32.data(), nelements);
+            } else if (info.type == GGML_TYPE_BF16) {
+                ggml_bf16_to_fp32_row(reinterpret_cast<const ggml_bf16_t *>(data_u8.data()), data_f32.data(), nelements);
+            } else {
+                memcpy(data_f32.data(), data_u8.data(), nelements*sizeof(float));
+            }
+
+            work.resize(ggml_common_tensor_nbytes(info, ttype));
+
+            const size_t cur_size = ggml_quantize_chunk(ttype, data_f32.data(), work.data(), 0, nelements/info.ne[0], info.ne[0], imat);
+
+            data_u8.assign(work.begin(), work.begin() + cur_size);
+        }
+
+        const int32_t n_dims = info.n_dims;
+        const int32_t length = info.name.size();
+        const int32_t type   = ttype;
+
+        fout.write(reinterpret_cast<const char *>(&n_dims), sizeof(n_dims));
+        fout.write(reinterpret_cast<const char *>(&length), sizeof(length));
+        fout.write(reinterpret_cast<const char *>(&type),   sizeof(type));
+        for (int i = 0; i < n_dims; ++i) {
+            fout.write(reinterpret_cast<const char *>(&info.ne[i]), sizeof(info.ne[i]));
+        }
+        fout.write(&info.name[0], length);
+        fout.write(reinterpret_cast<const char *>(data_u8.data()), data_u8.size());
+
+        printf("size = %8.3f MB -> %8.3f MB\n", size_org/1024.0/1024.0, data_u8.size()/1024.0/1024.0);
+
+        total_size_org += size_org;
+        total_size_new += data_u8.size();
+
+        if (stats) {
+            ggml_common_quantize_stat stat;
+            stat.info     = info;
+            stat.type_dst = ttype;
+            stat.size_src = size_org;
+            stat.size_dst = data_u8.size();
+            stat.t_us     = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t_start).count();
+
+            stats->push_back(std::move(stat));
+        }
+    }
+
+    printf("%s: model size  = %8.2f MB\n", __func__, total_size_org/1024.0/1024.0);
+    printf("%s: quant size  = %8.2f MB\n", __func__, total_size_new/1024.0/1024.0);
+
+    return true;
+}
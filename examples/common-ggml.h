@@ -3,6 +3,7 @@
 #include "ggml.h"
 
 #include <fstream>
+#include <map>
 #include <vector>
 #include <string>
 
@@ -10,9 +11,49 @@ enum ggml_ftype ggml_parse_ftype(const char * str);
 
 void ggml_print_ftypes(FILE * fp = stderr);
 
+// tensor type by name: "f32", "f16", "bf16" or one of the quantization types above
+// returns GGML_TYPE_COUNT for unknown names
+enum ggml_type ggml_parse_qtype(const char * str);
+
 bool ggml_common_quantize_0(
         std::ifstream & finp,
         std::ofstream & fout,
         const ggml_ftype ftype,
         const std::vector<std::string> & to_quant,
         const std::vector<std::string> & to_skip);
+
+struct ggml_common_tensor_info {
+    std::string name;
+
+    int32_t n_dims = 0;
+    int32_t ne[4]  = { 1, 1, 1, 1 };
+
+    ggml_type type = GGML_TYPE_F32;
+};
+
+struct ggml_common_quantize_stat {
+    ggml_common_tensor_info info;
+
+    ggml_type type_dst = GGML_TYPE_F32;
+
+    size_t size_src = 0;
+    size_t size_dst = 0;
+
+    int64_t t_us = 0;
+};
+
+// read the headers of the remaining tensors in the file, then restore the read position
+bool ggml_common_scan_tensors(
+        std::ifstream & finp,
+        std::vector<ggml_common_tensor_info> & infos);
+
+// convert each tensor to the type given for its name in types (F32 and F16 sources only)
+// tensors that are not in types are copied as they are
+// imatrix holds the optional importance of each column of the tensors (see examples/imatrix)
+// if stats is not null, it receives the sizes and the time spent for each tensor
+bool ggml_common_quantize_1(
+        std::ifstream & finp,
+        std::ofstream & fout,
+        const std::map<std::string, ggml_type> & types,
+        const std::map<std::string, std::vector<float>> & imatrix,
+        std::vector<ggml_common_quantize_stat> * stats);
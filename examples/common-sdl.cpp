@@ -1,5 +1,6 @@
 #include "common-sdl.h"
 
+#include <algorithm>
 #include <cstdio>
 
 audio_async::audio_async(int len_ms) {
@@ -12,6 +13,8 @@ audio_async::~audio_async() {
     if (m_dev_id_in) {
         SDL_CloseAudioDevice(m_dev_id_in);
     }
+
+    whisper_resampler_free(m_resampler);
 }
 
 bool audio_async::init(int capture_id, int sample_rate) {
@@ -50,10 +53,10 @@ bool audio_async::init(int capture_id, int sample_rate) {
 
     if (capture_id >= 0) {
         fprintf(stderr, "%s: attempt to open capture device %d : '%s' ...\n", __func__, capture_id, SDL_GetAudioDeviceName(capture_id, SDL_TRUE));
-        m_dev_id_in = SDL_OpenAudioDevice(SDL_GetAudioDeviceName(capture_id, SDL_TRUE), SDL_TRUE, &capture_spec_requested, &capture_spec_obtained, 0);
+        m_dev_id_in = SDL_OpenAudioDevice(SDL_GetAudioDeviceName(capture_id, SDL_TRUE), SDL_TRUE, &capture_spec_requested, &capture_spec_obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
     } else {
         fprintf(stderr, "%s: attempt to open default capture device ...\n", __func__);
-        m_dev_id_in = SDL_OpenAudioDevice(nullptr, SDL_TRUE, &capture_spec_requested, &capture_spec_obtained, 0);
+        m_dev_id_in = SDL_OpenAudioDevice(nullptr, SDL_TRUE, &capture_spec_requested, &capture_spec_obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
     }
 
     if (!m_dev_id_in) {
@@ -71,9 +74,25 @@ bool audio_async::init(int capture_id, int sample_rate) {
         fprintf(stderr, "%s:     - samples per frame: %d\n",                   __func__, capture_spec_obtained.samples);
     }
 
-    m_sample_rate = capture_spec_obtained.freq;
+    // capture at the native rate of the device and convert with the whisper resampler instead of SDL's
+    if (capture_spec_obtained.freq != sample_rate) {
+        m_resampler = whisper_resampler_init(capture_spec_obtained.freq, sample_rate);
+        if (!m_resampler) {
+            fprintf(stderr, "%s: failed to initialize resampler %d -> %d Hz\n", __func__, capture_spec_obtained.freq, sample_rate);
+            return false;
+        }
+
+        fprintf(stderr, "%s: resampling capture from %d Hz to %d Hz\n", __func__, capture_spec_obtained.freq, sample_rate);
+
+        // sized once here, the callback runs on the audio thread and must not allocate
+        // twice the device buffer also covers the filter history, so the output of a callback always fits and the
+        // resampler never has to grow its own buffer
+        m_resampled.resize(whisper_resampler_n_out_max(m_resampler, 2*capture_spec_obtained.samples));
+    }
+
+    m_sample_rate = sample_rate;
 
-    m_audio.resize((m_sample_rate*m_len_ms)/1000);
+    m_ring.init((m_sample_rate*m_len_ms)/1000);
 
     return true;
 }
@@ -125,12 +144,7 @@ bool audio_async::clear() {
         return false;
     }
 
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
-
-        m_audio_pos = 0;
-        m_audio_len = 0;
-    }
+    m_ring.clear();
 
     return true;
 }
@@ -143,32 +157,16 @@ void audio_async::callback(uint8_t * stream, int len) {
 
     size_t n_samples = len / sizeof(float);
 
-    if (n_samples > m_audio.size()) {
-        n_samples = m_audio.size();
+    if (m_resampler) {
+        const int n_out = whisper_resampler_process(m_resampler, (const float *) stream, n_samples, m_resampled.data(), m_resampled.size());
 
-        stream += (len - (n_samples * sizeof(float)));
+        stream    = (uint8_t *) m_resampled.data();
+        n_samples = std::max(n_out, 0);
     }
 
-    //fprintf(stderr, "%s: %zu samples, pos %zu, len %zu\n", __func__, n_samples, m_audio_pos, m_audio_len);
-
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
-
-        if (m_audio_pos + n_samples > m_audio.size()) {
-            const size_t n0 = m_audio.size() - m_audio_pos;
+    //fprintf(stderr, "%s: %zu samples\n", __func__, n_samples);
 
-            memcpy(&m_audio[m_audio_pos], stream, n0 * sizeof(float));
-            memcpy(&m_audio[0], stream + n0 * sizeof(float), (n_samples - n0) * sizeof(float));
-
-            m_audio_pos = (m_audio_pos + n_samples) % m_audio.size();
-            m_audio_len = m_audio.size();
-        } else {
-            memcpy(&m_audio[m_audio_pos], stream, n_samples * sizeof(float));
-
-            m_audio_pos = (m_audio_pos + n_samples) % m_audio.size();
-            m_audio_len = std::min(m_audio_len + n_samples, m_audio.size());
-        }
-    }
+    m_ring.write((const float *) stream, n_samples);
 }
 
 void audio_async::get(int ms, std::vector<float> & result) {
@@ -182,36 +180,31 @@ void audio_async::get(int ms, std::vector<float> & result) {
         return;
     }
 
-    result.clear();
-
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
+    if (ms <= 0) {
+        ms = m_len_ms;
+    }
 
-        if (ms <= 0) {
-            ms = m_len_ms;
-        }
+    m_ring.get(((size_t) m_sample_rate*ms)/1000, result);
+}
 
-        size_t n_samples = (m_sample_rate * ms) / 1000;
-        if (n_samples > m_audio_len) {
-            n_samples = m_audio_len;
-        }
+void audio_async::consume(std::vector<float> & result) {
+    m_ring.consume(result);
+}
 
-        result.resize(n_samples);
+bool audio_async::wait(int ms, int timeout_ms) {
+    return m_ring.wait(((size_t) m_sample_rate*ms)/1000, timeout_ms);
+}
 
-        int s0 = m_audio_pos - n_samples;
-        if (s0 < 0) {
-            s0 += m_audio.size();
-        }
+audio_ring_view audio_async::view(int ms) const {
+    return m_ring.view(ms > 0 ? ((size_t) m_sample_rate*ms)/1000 : m_ring.capacity());
+}
 
-        if (s0 + n_samples > m_audio.size()) {
-            const size_t n0 = m_audio.size() - s0;
+size_t audio_async::n_lost(const audio_ring_view & view) const {
+    return m_ring.n_lost(view);
+}
 
-            memcpy(result.data(), &m_audio[s0], n0 * sizeof(float));
-            memcpy(&result[n0], &m_audio[0], (n_samples - n0) * sizeof(float));
-        } else {
-            memcpy(result.data(), &m_audio[s0], n_samples * sizeof(float));
-        }
-    }
+void audio_async::consume(const audio_ring_view & view) {
+    m_ring.consume(view);
 }
 
 bool sdl_poll_events() {
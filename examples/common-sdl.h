@@ -1,5 +1,8 @@
 #pragma once
 
+#include "common.h"
+#include "whisper.h"
+
 #include <SDL.h>
 #include <SDL_audio.h>
 
@@ -31,6 +34,20 @@ public:
     // get audio data from the circular buffer
     void get(int ms, std::vector<float> & audio);
 
+    // get all the audio captured since the last clear() and clear
+    void consume(std::vector<float> & audio);
+
+    // block until ms of audio have been captured since the last clear() - returns false on timeout
+    bool wait(int ms, int timeout_ms);
+
+    // zero-copy view of the last ms of captured audio (all the audio since the last clear() if ms <= 0)
+    // the capture continues meanwhile - n_lost() tells how many samples at the start were overwritten while reading
+    audio_ring_view view(int ms) const;
+    size_t n_lost(const audio_ring_view & view) const;
+
+    // drop the audio captured up to the end of the view
+    void consume(const audio_ring_view & view);
+
 private:
     SDL_AudioDeviceID m_dev_id_in = 0;
 
@@ -38,11 +55,13 @@ private:
     int m_sample_rate = 0;
 
     std::atomic_bool m_running;
-    std::mutex       m_mutex;
 
-    std::vector<float> m_audio;
-    size_t             m_audio_pos = 0;
-    size_t             m_audio_len = 0;
+    // written by the SDL callback, read by the caller of get()
+    audio_ring m_ring;
+
+    // used when the device does not capture at the requested sample rate
+    whisper_resampler * m_resampler = nullptr;
+    std::vector<float>  m_resampled;
 };
 
 // Return false if need to quit
@@ -2,11 +2,14 @@
 
 #include "common.h"
 
+#include "whisper.h"
+
 // third-party utilities
 // use your favorite implementations
 #define DR_WAV_IMPLEMENTATION
 #include "dr_wav.h"
 
+#include <chrono>
 #include <cmath>
 #include <cstring>
 #include <fstream>
@@ -24,6 +27,12 @@
 #include <io.h>
 #endif
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #ifdef WHISPER_FFMPEG
 // as implemented in ffmpeg_trancode.cpp only embedded in common lib if whisper built with ffmpeg support
 extern bool ffmpeg_decode_audio(const std::string & ifname, std::vector<uint8_t> & wav_data);
@@ -639,6 +648,153 @@ bool is_wav_buffer(const std::string buf) {
     return true;
 }
 
+// number of PCM frames decoded per iteration by read_wav()
+#define COMMON_WAV_CHUNK_FRAMES 16384
+
+// convert interleaved 16-bit PCM frames to mono float
+// stereo is downmixed as (l + r)/2
+static void wav_s16_to_mono_f32(const int16_t * src, float * dst, size_t n_frames, int n_channels) {
+    size_t i = 0;
+
+    if (n_channels == 1) {
+#if defined(__SSE2__)
+        const __m128 scale = _mm_set1_ps(1.0f/32768.0f);
+        for (; i + 8 <= n_frames; i += 8) {
+            const __m128i x  = _mm_loadu_si128((const __m128i *) (src + i));
+            const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+            const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+            _mm_storeu_ps(dst + i + 0, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+            _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+        }
+#elif defined(__ARM_NEON)
+        for (; i + 8 <= n_frames; i += 8) {
+            const int16x8_t x = vld1q_s16(src + i);
+            vst1q_f32(dst + i + 0, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16 (x))), 1.0f/32768.0f));
+            vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), 1.0f/32768.0f));
+        }
+#endif
+        for (; i < n_frames; i++) {
+            dst[i] = float(src[i])/32768.0f;
+        }
+    } else if (n_channels == 2) {
+#if defined(__SSE2__)
+        const __m128i ones  = _mm_set1_epi16(1);
+        const __m128  scale = _mm_set1_ps(1.0f/65536.0f);
+        for (; i + 4 <= n_frames; i += 4) {
+            const __m128i x = _mm_loadu_si128((const __m128i *) (src + 2*i));
+            _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_madd_epi16(x, ones)), scale));
+        }
+#elif defined(__ARM_NEON)
+        for (; i + 8 <= n_frames; i += 8) {
+            const int16x8x2_t x = vld2q_s16(src + 2*i);
+            const int32x4_t lo = vaddl_s16(vget_low_s16 (x.val[0]), vget_low_s16 (x.val[1]));
+            const int32x4_t hi = vaddl_s16(vget_high_s16(x.val[0]), vget_high_s16(x.val[1]));
+            vst1q_f32(dst + i + 0, vmulq_n_f32(vcvtq_f32_s32(lo), 1.0f/65536.0f));
+            vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(hi), 1.0f/65536.0f));
+        }
+#endif
+        for (; i < n_frames; i++) {
+            dst[i] = float(src[2*i] + src[2*i + 1])/65536.0f;
+        }
+    } else {
+        const float scale = 1.0f/(32768.0f*n_channels);
+        for (; i < n_frames; i++) {
+            int32_t sum = 0;
+            for (int c = 0; c < n_channels; c++) {
+                sum += src[i*n_channels + c];
+            }
+            dst[i] = float(sum)*scale;
+        }
+    }
+}
+
+// split interleaved 16-bit stereo PCM frames into two float channels
+static void wav_s16_deinterleave_f32(const int16_t * src, float * dst0, float * dst1, size_t n_frames) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(1.0f/32768.0f);
+    for (; i + 4 <= n_frames; i += 4) {
+        const __m128i x = _mm_loadu_si128((const __m128i *) (src + 2*i));
+        const __m128i l = _mm_srai_epi32(_mm_slli_epi32(x, 16), 16);
+        const __m128i r = _mm_srai_epi32(x, 16);
+        _mm_storeu_ps(dst0 + i, _mm_mul_ps(_mm_cvtepi32_ps(l), scale));
+        _mm_storeu_ps(dst1 + i, _mm_mul_ps(_mm_cvtepi32_ps(r), scale));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= n_frames; i += 8) {
+        const int16x8x2_t x = vld2q_s16(src + 2*i);
+        vst1q_f32(dst0 + i + 0, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16 (x.val[0]))), 1.0f/32768.0f));
+        vst1q_f32(dst0 + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x.val[0]))), 1.0f/32768.0f));
+        vst1q_f32(dst1 + i + 0, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16 (x.val[1]))), 1.0f/32768.0f));
+        vst1q_f32(dst1 + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x.val[1]))), 1.0f/32768.0f));
+    }
+#endif
+    for (; i < n_frames; i++) {
+        dst0[i] = float(src[2*i + 0])/32768.0f;
+        dst1[i] = float(src[2*i + 1])/32768.0f;
+    }
+}
+
+// downmix interleaved float frames to mono
+static void wav_f32_to_mono_f32(const float * src, float * dst, size_t n_frames, int n_channels) {
+    size_t i = 0;
+
+    if (n_channels == 2) {
+#if defined(__SSE2__)
+        const __m128 half = _mm_set1_ps(0.5f);
+        for (; i + 4 <= n_frames; i += 4) {
+            const __m128 a = _mm_loadu_ps(src + 2*i + 0);
+            const __m128 b = _mm_loadu_ps(src + 2*i + 4);
+            const __m128 l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            const __m128 r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+            _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_add_ps(l, r), half));
+        }
+#elif defined(__ARM_NEON)
+        for (; i + 4 <= n_frames; i += 4) {
+            const float32x4x2_t x = vld2q_f32(src + 2*i);
+            vst1q_f32(dst + i, vmulq_n_f32(vaddq_f32(x.val[0], x.val[1]), 0.5f));
+        }
+#endif
+        for (; i < n_frames; i++) {
+            dst[i] = (src[2*i] + src[2*i + 1])*0.5f;
+        }
+    } else {
+        const float scale = 1.0f/n_channels;
+        for (; i < n_frames; i++) {
+            float sum = 0.0f;
+            for (int c = 0; c < n_channels; c++) {
+                sum += src[i*n_channels + c];
+            }
+            dst[i] = sum*scale;
+        }
+    }
+}
+
+// split interleaved float stereo frames into two channels
+static void wav_f32_deinterleave_f32(const float * src, float * dst0, float * dst1, size_t n_frames) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    for (; i + 4 <= n_frames; i += 4) {
+        const __m128 a = _mm_loadu_ps(src + 2*i + 0);
+        const __m128 b = _mm_loadu_ps(src + 2*i + 4);
+        _mm_storeu_ps(dst0 + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(dst1 + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= n_frames; i += 4) {
+        const float32x4x2_t x = vld2q_f32(src + 2*i);
+        vst1q_f32(dst0 + i, x.val[0]);
+        vst1q_f32(dst1 + i, x.val[1]);
+    }
+#endif
+    for (; i < n_frames; i++) {
+        dst0[i] = src[2*i + 0];
+        dst1[i] = src[2*i + 1];
+    }
+}
+
 bool read_wav(const std::string & fname, std::vector<float>& pcmf32, std::vector<std::vector<float>>& pcmf32s, bool stereo) {
     drwav wav;
     std::vector<uint8_t> wav_data; // used for pipe input from stdin or ffmpeg decoding output
@@ -649,15 +805,21 @@ bool read_wav(const std::string & fname, std::vector<float>& pcmf32, std::vector
             _setmode(_fileno(stdin), _O_BINARY);
             #endif
 
-            uint8_t buf[1024];
-            while (true)
-            {
-                const size_t n = fread(buf, 1, sizeof(buf), stdin);
+            // read directly into the tail of the buffer, growing it geometrically
+            const size_t n_read = 64*1024;
+
+            size_t n_total = 0;
+            while (true) {
+                if (wav_data.size() < n_total + n_read) {
+                    wav_data.resize(std::max(2*wav_data.size(), n_total + n_read));
+                }
+                const size_t n = fread(wav_data.data() + n_total, 1, n_read, stdin);
                 if (n == 0) {
                     break;
                 }
-                wav_data.insert(wav_data.end(), buf, buf + n);
+                n_total += n;
             }
+            wav_data.resize(n_total);
         }
 
         if (drwav_init_memory(&wav, wav_data.data(), wav_data.size(), nullptr) == false) {
@@ -689,8 +851,8 @@ bool read_wav(const std::string & fname, std::vector<float>& pcmf32, std::vector
 #endif
     }
 
-    if (wav.channels != 1 && wav.channels != 2) {
-        fprintf(stderr, "%s: WAV file '%s' must be mono or stereo\n", __func__, fname.c_str());
+    if (wav.channels < 1) {
+        fprintf(stderr, "%s: WAV file '%s' has no audio channels\n", __func__, fname.c_str());
         drwav_uninit(&wav);
         return false;
     }
@@ -701,52 +863,350 @@ bool read_wav(const std::string & fname, std::vector<float>& pcmf32, std::vector
         return false;
     }
 
-    if (wav.sampleRate != COMMON_SAMPLE_RATE) {
-        fprintf(stderr, "%s: WAV file '%s' must be %i kHz\n", __func__, fname.c_str(), COMMON_SAMPLE_RATE/1000);
+    const bool is_s16 = wav.translatedFormatTag == DR_WAVE_FORMAT_PCM && wav.bitsPerSample == 16;
+
+    if (!is_s16 && wav.translatedFormatTag != DR_WAVE_FORMAT_PCM && wav.translatedFormatTag != DR_WAVE_FORMAT_IEEE_FLOAT) {
+        fprintf(stderr, "%s: WAV file '%s' must be PCM or IEEE float\n", __func__, fname.c_str());
         drwav_uninit(&wav);
         return false;
     }
 
-    if (wav.bitsPerSample != 16) {
-        fprintf(stderr, "%s: WAV file '%s' must be 16-bit\n", __func__, fname.c_str());
-        drwav_uninit(&wav);
-        return false;
+    const int n_channels = wav.channels;
+
+    // audio at other sample rates is converted on the fly with the built-in resampler
+    const bool resample = wav.sampleRate != COMMON_SAMPLE_RATE;
+
+    std::vector<whisper_resampler *> rs;
+    if (resample) {
+        fprintf(stderr, "%s: resampling '%s' from %u Hz to %d Hz\n", __func__, fname.c_str(), wav.sampleRate, COMMON_SAMPLE_RATE);
+
+        for (int i = 0; i < (stereo ? 3 : 1); i++) {
+            rs.push_back(whisper_resampler_init(wav.sampleRate, COMMON_SAMPLE_RATE));
+            if (rs.back() == nullptr) {
+                fprintf(stderr, "%s: failed to initialize resampler for '%s'\n", __func__, fname.c_str());
+                for (auto * r : rs) {
+                    whisper_resampler_free(r);
+                }
+                drwav_uninit(&wav);
+                return false;
+            }
+        }
     }
 
-    const uint64_t n = wav_data.empty() ? wav.totalPCMFrameCount : wav_data.size()/(wav.channels*wav.bitsPerSample/8);
+    // the data chunk size of piped WAV streams is often bogus, so it is only used as a capacity hint
+    uint64_t n_hint = wav.totalPCMFrameCount;
+    if (!wav_data.empty() && wav.bitsPerSample > 0) {
+        n_hint = std::max<uint64_t>(n_hint, wav_data.size()/(n_channels*(wav.bitsPerSample/8)));
+    }
+    n_hint = (n_hint*COMMON_SAMPLE_RATE)/wav.sampleRate + 1;
+
+    pcmf32.clear();
+    pcmf32.reserve(n_hint);
+
+    if (stereo) {
+        pcmf32s.resize(2);
+        pcmf32s[0].clear();
+        pcmf32s[1].clear();
+        pcmf32s[0].reserve(n_hint);
+        pcmf32s[1].reserve(n_hint);
+    }
+
+    // decode chunk by chunk straight into the output buffers
+    // only a single chunk of interleaved samples is ever held in memory
+    std::vector<int16_t> chunk_s16;
+    std::vector<float>   chunk_f32;
+
+    if (is_s16) {
+        chunk_s16.resize((size_t) COMMON_WAV_CHUNK_FRAMES*n_channels);
+    } else if (n_channels > 1) {
+        chunk_f32.resize((size_t) COMMON_WAV_CHUNK_FRAMES*n_channels);
+    }
+
+    // when resampling, the native-rate samples are staged here before being pushed through the resamplers
+    std::vector<float> chunk_mono;
+    std::vector<float> chunk_ch[2];
+
+    if (resample) {
+        chunk_mono.resize(COMMON_WAV_CHUNK_FRAMES);
+        if (stereo) {
+            chunk_ch[0].resize(COMMON_WAV_CHUNK_FRAMES);
+            chunk_ch[1].resize(COMMON_WAV_CHUNK_FRAMES);
+        }
+    }
+
+    // push n native-rate samples (or flush when n == 0) through a resampler and append the output to dst
+    const auto resample_append = [](whisper_resampler * r, const float * src, size_t n, std::vector<float> & dst) {
+        const size_t n_prev = dst.size();
+        dst.resize(n_prev + whisper_resampler_n_out_max(r, (int) n));
+        const int n_out = whisper_resampler_process(r, n > 0 ? src : nullptr, (int) n, dst.data() + n_prev, (int) (dst.size() - n_prev));
+        dst.resize(n_prev + std::max(n_out, 0));
+    };
+
+    while (true) {
+        const size_t n_prev = pcmf32.size();
+
+        float * dst_mono = chunk_mono.data();
+        float * dst_ch0  = chunk_ch[0].data();
+        float * dst_ch1  = chunk_ch[1].data();
+
+        if (!resample) {
+            pcmf32.resize(n_prev + COMMON_WAV_CHUNK_FRAMES);
+            dst_mono = pcmf32.data() + n_prev;
+
+            if (stereo) {
+                pcmf32s[0].resize(n_prev + COMMON_WAV_CHUNK_FRAMES);
+                pcmf32s[1].resize(n_prev + COMMON_WAV_CHUNK_FRAMES);
+                dst_ch0 = pcmf32s[0].data() + n_prev;
+                dst_ch1 = pcmf32s[1].data() + n_prev;
+            }
+        }
+
+        size_t n = 0;
+        if (is_s16) {
+            n = drwav_read_pcm_frames_s16(&wav, COMMON_WAV_CHUNK_FRAMES, chunk_s16.data());
+            wav_s16_to_mono_f32(chunk_s16.data(), dst_mono, n, n_channels);
+        } else if (n_channels == 1) {
+            // mono float can be decoded in-place
+            n = drwav_read_pcm_frames_f32(&wav, COMMON_WAV_CHUNK_FRAMES, dst_mono);
+        } else {
+            n = drwav_read_pcm_frames_f32(&wav, COMMON_WAV_CHUNK_FRAMES, chunk_f32.data());
+            wav_f32_to_mono_f32(chunk_f32.data(), dst_mono, n, n_channels);
+        }
+
+        if (stereo) {
+            if (is_s16) {
+                wav_s16_deinterleave_f32(chunk_s16.data(), dst_ch0, dst_ch1, n);
+            } else {
+                wav_f32_deinterleave_f32(chunk_f32.data(), dst_ch0, dst_ch1, n);
+            }
+        }
+
+        if (resample) {
+            if (n > 0) {
+                resample_append(rs[0], dst_mono, n, pcmf32);
+                if (stereo) {
+                    resample_append(rs[1], dst_ch0, n, pcmf32s[0]);
+                    resample_append(rs[2], dst_ch1, n, pcmf32s[1]);
+                }
+            }
+        } else {
+            pcmf32.resize(n_prev + n);
+            if (stereo) {
+                pcmf32s[0].resize(n_prev + n);
+                pcmf32s[1].resize(n_prev + n);
+            }
+        }
+
+        if (n < COMMON_WAV_CHUNK_FRAMES) {
+            break;
+        }
+    }
 
-    std::vector<int16_t> pcm16;
-    pcm16.resize(n*wav.channels);
-    drwav_read_pcm_frames_s16(&wav, n, pcm16.data());
     drwav_uninit(&wav);
 
-    // convert to mono, float
-    pcmf32.resize(n);
-    if (wav.channels == 1) {
-        for (uint64_t i = 0; i < n; i++) {
-            pcmf32[i] = float(pcm16[i])/32768.0f;
+    if (resample) {
+        resample_append(rs[0], nullptr, 0, pcmf32);
+        if (stereo) {
+            resample_append(rs[1], nullptr, 0, pcmf32s[0]);
+            resample_append(rs[2], nullptr, 0, pcmf32s[1]);
         }
-    } else {
-        for (uint64_t i = 0; i < n; i++) {
-            pcmf32[i] = float(pcm16[2*i] + pcm16[2*i + 1])/65536.0f;
+
+        for (auto * r : rs) {
+            whisper_resampler_free(r);
         }
     }
 
-    if (stereo) {
-        // convert to stereo, float
-        pcmf32s.resize(2);
+    return true;
+}
+
+audio_replay::audio_replay(int len_ms) {
+    m_len_ms = len_ms;
 
-        pcmf32s[0].resize(n);
-        pcmf32s[1].resize(n);
-        for (uint64_t i = 0; i < n; i++) {
-            pcmf32s[0][i] = float(pcm16[2*i])/32768.0f;
-            pcmf32s[1][i] = float(pcm16[2*i + 1])/32768.0f;
+    m_running    = false;
+    m_finished   = false;
+    m_stop       = false;
+    m_n_replayed = 0;
+}
+
+audio_replay::~audio_replay() {
+    m_stop = true;
+
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+
+    if (m_fin && m_fin != stdin) {
+        fclose(m_fin);
+    }
+}
+
+bool audio_replay::init(const std::string & fname, int sample_rate, float speed, bool raw) {
+    if (sample_rate != COMMON_SAMPLE_RATE) {
+        fprintf(stderr, "%s: unsupported sample rate %d, expected %d\n", __func__, sample_rate, COMMON_SAMPLE_RATE);
+        return false;
+    }
+
+    if (raw) {
+        if (fname == "-") {
+#ifdef _WIN32
+            _setmode(_fileno(stdin), _O_BINARY);
+#endif
+            m_fin = stdin;
+        } else {
+            m_fin = fopen(fname.c_str(), "rb");
+        }
+
+        if (m_fin == nullptr) {
+            fprintf(stderr, "%s: failed to open '%s'\n", __func__, fname.c_str());
+            return false;
+        }
+    } else {
+        std::vector<std::vector<float>> pcmf32s;
+        if (!::read_wav(fname, m_input, pcmf32s, false)) {
+            fprintf(stderr, "%s: failed to read WAV file '%s'\n", __func__, fname.c_str());
+            return false;
         }
     }
 
+    m_sample_rate = sample_rate;
+    m_speed       = speed;
+
+    m_ring.init((m_sample_rate*m_len_ms)/1000);
+
+    m_thread = std::thread(&audio_replay::worker, this);
+
+    return true;
+}
+
+bool audio_replay::resume() {
+    if (m_running) {
+        fprintf(stderr, "%s: already running!\n", __func__);
+        return false;
+    }
+
+    m_running = true;
+
+    return true;
+}
+
+bool audio_replay::pause() {
+    if (!m_running) {
+        fprintf(stderr, "%s: already paused!\n", __func__);
+        return false;
+    }
+
+    m_running = false;
+
+    return true;
+}
+
+bool audio_replay::clear() {
+    if (!m_running) {
+        fprintf(stderr, "%s: not running!\n", __func__);
+        return false;
+    }
+
+    m_ring.clear();
+
     return true;
 }
 
+size_t audio_replay::read(float * dst, size_t n) {
+    if (m_fin) {
+        int16_t buf[1024];
+
+        size_t n_read = 0;
+        while (n_read < n) {
+            const size_t n_cur = fread(buf, sizeof(int16_t), std::min(n - n_read, sizeof(buf)/sizeof(buf[0])), m_fin);
+            for (size_t i = 0; i < n_cur; ++i) {
+                dst[n_read + i] = float(buf[i])/32768.0f;
+            }
+
+            n_read += n_cur;
+
+            if (n_cur == 0) {
+                break;
+            }
+        }
+
+        return n_read;
+    }
+
+    const size_t n_read = std::min(n, m_input.size() - m_input_pos);
+
+    memcpy(dst, m_input.data() + m_input_pos, n_read*sizeof(float));
+    m_input_pos += n_read;
+
+    return n_read;
+}
+
+// produce 10 ms of audio at a time, paced by the replay speed
+void audio_replay::worker() {
+    const size_t n_block = m_sample_rate/100;
+
+    std::vector<float> block(n_block);
+
+    auto t_ref = std::chrono::steady_clock::now();
+
+    bool was_running = false;
+
+    while (!m_stop) {
+        if (!m_running) {
+            was_running = false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        // the clock does not advance while paused
+        if (!was_running) {
+            was_running = true;
+            t_ref = std::chrono::steady_clock::now() - std::chrono::microseconds(m_speed > 0.0f ? (int64_t) (1e6*m_n_replayed/(m_sample_rate*m_speed)) : 0);
+        }
+
+        const size_t n_read = read(block.data(), n_block);
+        if (n_read == 0) {
+            m_finished = true;
+            break;
+        }
+
+        m_n_replayed += n_read;
+
+        m_ring.write(block.data(), n_read);
+
+        if (m_speed > 0.0f) {
+            std::this_thread::sleep_until(t_ref + std::chrono::microseconds((int64_t) (1e6*m_n_replayed/(m_sample_rate*m_speed))));
+        }
+    }
+}
+
+void audio_replay::get(int ms, std::vector<float> & result) {
+    if (ms <= 0) {
+        ms = m_len_ms;
+    }
+
+    m_ring.get(((size_t) m_sample_rate*ms)/1000, result);
+}
+
+void audio_replay::consume(std::vector<float> & result) {
+    m_ring.consume(result);
+}
+
+bool audio_replay::wait(int ms, int timeout_ms) {
+    return m_ring.wait(((size_t) m_sample_rate*ms)/1000, timeout_ms);
+}
+
+audio_ring_view audio_replay::view(int ms) const {
+    return m_ring.view(ms > 0 ? ((size_t) m_sample_rate*ms)/1000 : m_ring.capacity());
+}
+
+size_t audio_replay::n_lost(const audio_ring_view & view) const {
+    return m_ring.n_lost(view);
+}
+
+void audio_replay::consume(const audio_ring_view & view) {
+    m_ring.consume(view);
+}
+
 void high_pass_filter(std::vector<float> & data, float cutoff, float sample_rate) {
     const float rc = 1.0f / (2.0f * M_PI * cutoff);
     const float dt = 1.0f / sample_rate;
@@ -2,8 +2,13 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
 #include <string>
 #include <map>
+#include <mutex>
 #include <vector>
 #include <random>
 #include <thread>
@@ -141,7 +146,9 @@ bool is_wav_buffer(const std::string buf);
 
 // Read WAV audio file and store the PCM data into pcmf32
 // fname can be a buffer of WAV data instead of a filename
-// The sample rate of the audio must be equal to COMMON_SAMPLE_RATE
+// Audio at other sample rates is resampled to COMMON_SAMPLE_RATE with whisper_resampler
+// Supports 8/16/24/32-bit integer PCM and 32/64-bit float WAV files with any number of channels,
+// which are downmixed to mono. The file is decoded in chunks, without an intermediate int16 copy
 // If stereo flag is set and the audio has 2 channels, the pcmf32s will contain 2 channel PCM
 bool read_wav(
         const std::string & fname,
@@ -246,6 +253,250 @@ public:
     }
 };
 
+// Zero-copy view of consecutive samples of an audio_ring, split in two parts when it wraps around the ring
+struct audio_ring_view {
+    const float * p0 = nullptr;
+    const float * p1 = nullptr;
+    size_t        n0 = 0;
+    size_t        n1 = 0;
+
+    // index of the first sample in the stream of written samples
+    uint64_t i0 = 0;
+
+    size_t size() const { return n0 + n1; }
+};
+
+// Lock-free single-producer/single-consumer ring buffer of audio samples
+// The producer (the audio callback) publishes the samples by advancing the head (release), the consumer reads up to
+// the head it loaded (acquire) and advances the tail. When the ring is full, the producer overwrites the oldest
+// samples instead of waiting - the consumer always sees the most recent audio.
+// Overruns are detected with a second counter, the pending head: the producer advances it before overwriting any
+// sample, so after reading, the consumer knows how many of the samples it read may have been overwritten meanwhile.
+// get() and consume() retry or drop those samples, users of view() check n_lost() themselves.
+// The consumer can block in wait() until enough new audio is available. The producer never locks around the samples,
+// it takes the mutex of the condition variable only to wake up a waiting consumer, once per wait().
+class audio_ring {
+public:
+    // must be called before the producer starts
+    void init(size_t n_samples) {
+        m_data.assign(n_samples, 0.0f);
+
+        m_head        .store(0);
+        m_head_pending.store(0);
+        m_tail        .store(0);
+    }
+
+    size_t capacity() const {
+        return m_data.size();
+    }
+
+    // producer: append n samples
+    void write(const float * data, size_t n) {
+        const size_t cap = m_data.size();
+
+        const uint64_t head = m_head.load(std::memory_order_relaxed);
+
+        // only the last cap samples are kept
+        const size_t n_keep = std::min(n, cap);
+        const uint64_t head_keep = head + (n - n_keep);
+
+        // the slots of [head + n - cap, head) are about to be overwritten
+        m_head_pending.store(head + n, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        const size_t pos = head_keep % cap;
+        const size_t n0  = std::min(n_keep, cap - pos);
+
+        memcpy(&m_data[pos], data + (n - n_keep),      n0           *sizeof(float));
+        memcpy(&m_data[0],   data + (n - n_keep) + n0, (n_keep - n0)*sizeof(float));
+
+        // seq_cst: ordered with the load of m_waiting below, see wait()
+        m_head.store(head + n);
+
+        if (m_waiting.load() && head + n >= m_wait_head.load(std::memory_order_relaxed) && m_waiting.exchange(false)) {
+            // the waiter is either before its check of the head or blocked in the condition variable
+            { std::lock_guard<std::mutex> lock(m_mutex); }
+            m_cv.notify_one();
+        }
+    }
+
+    // consumer: number of samples written since the last clear(), at most capacity()
+    size_t size() const {
+        const uint64_t head = m_head.load(std::memory_order_acquire);
+
+        return (size_t) std::min<uint64_t>(head - m_tail.load(std::memory_order_relaxed), m_data.size());
+    }
+
+    // consumer: zero-copy view of the last n samples (at most size())
+    // the producer keeps writing meanwhile - check n_lost() after reading the samples
+    audio_ring_view view(size_t n) const {
+        return view_at(m_head.load(std::memory_order_acquire), n);
+    }
+
+    // consumer: number of samples at the start of the view that the producer has overwritten since view()
+    // the other samples read from the view are intact
+    size_t n_lost(const audio_ring_view & view) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        const uint64_t head_pending = m_head_pending.load(std::memory_order_relaxed);
+        const uint64_t i_valid      = head_pending - std::min<uint64_t>(head_pending, m_data.size());
+
+        return (size_t) std::min<uint64_t>(i_valid > view.i0 ? i_valid - view.i0 : 0, view.size());
+    }
+
+    // consumer: copy of the last n samples (at most size())
+    void get(size_t n, std::vector<float> & result) const {
+        // the producer overwrote the start of the copy - copy again the most recent samples
+        while (copy(view(n), result) > 0) {}
+    }
+
+    // consumer: copy all the samples written since the last clear() and clear
+    // samples overwritten before they could be copied are dropped
+    void consume(std::vector<float> & result) {
+        const audio_ring_view v = view(m_data.size());
+
+        const size_t n_lost = copy(v, result);
+        result.erase(result.begin(), result.begin() + n_lost);
+
+        consume(v);
+    }
+
+    // consumer: drop the samples written up to the end of the view
+    void consume(const audio_ring_view & view) {
+        m_tail.store(view.i0 + view.size(), std::memory_order_release);
+    }
+
+    // consumer: drop the samples written so far
+    void clear() {
+        m_tail.store(m_head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    // consumer: wait until n samples have been written since the last clear()
+    // returns false on timeout
+    bool wait(size_t n, int timeout_ms) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        m_wait_head.store(m_tail.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        m_waiting.store(true);
+
+        const bool res = m_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&] {
+            return m_head.load() >= m_wait_head.load(std::memory_order_relaxed);
+        });
+
+        m_waiting.store(false);
+
+        return res;
+    }
+
+private:
+    audio_ring_view view_at(uint64_t head, size_t n) const {
+        const size_t cap = m_data.size();
+
+        n = std::min(n, (size_t) std::min<uint64_t>(head - m_tail.load(std::memory_order_relaxed), cap));
+
+        const size_t pos = (head - n) % cap;
+
+        audio_ring_view view;
+        view.p0 = m_data.data() + pos;
+        view.n0 = std::min(n, cap - pos);
+        view.p1 = m_data.data();
+        view.n1 = n - view.n0;
+        view.i0 = head - n;
+
+        return view;
+    }
+
+    // returns the number of samples at the start of the copy that were overwritten while copying
+    size_t copy(const audio_ring_view & view, std::vector<float> & result) const {
+        result.resize(view.size());
+        memcpy(result.data(),           view.p0, view.n0*sizeof(float));
+        memcpy(result.data() + view.n0, view.p1, view.n1*sizeof(float));
+
+        return n_lost(view);
+    }
+
+    std::vector<float> m_data;
+
+    // total number of samples published by the producer, and written or being written
+    std::atomic<uint64_t> m_head         { 0 };
+    std::atomic<uint64_t> m_head_pending { 0 };
+
+    // read position of the consumer
+    std::atomic<uint64_t> m_tail { 0 };
+
+    // wakeup of the consumer
+    std::mutex              m_mutex;
+    std::condition_variable m_cv;
+    std::atomic<bool>       m_waiting   { false };
+    std::atomic<uint64_t>   m_wait_head { 0 };
+};
+
+// Replay audio at a fixed speed relative to real time
+// Same interface as audio_async (see common-sdl.h), so the real-time examples can run without a capture device
+// The input is a WAV file ("-" for stdin), or raw mono 16-bit PCM at COMMON_SAMPLE_RATE ("-" for stdin) which is
+// read as it arrives, so that it can be fed from a pipe
+class audio_replay {
+public:
+    audio_replay(int len_ms);
+    ~audio_replay();
+
+    // speed: 1.0 - real time, 2.0 - twice as fast, 0.0 - as fast as possible
+    bool init(const std::string & fname, int sample_rate, float speed, bool raw);
+
+    // start replaying the audio
+    // keep last len_ms seconds of audio in a circular buffer
+    bool resume();
+    bool pause();
+    bool clear();
+
+    // get audio data from the circular buffer
+    void get(int ms, std::vector<float> & audio);
+
+    // get all the audio since the last clear() and clear
+    void consume(std::vector<float> & audio);
+
+    // wait until ms of audio are available since the last clear() - returns false on timeout
+    bool wait(int ms, int timeout_ms);
+
+    // zero-copy view of the last ms of audio (all the audio since the last clear() if ms <= 0), see audio_ring
+    audio_ring_view view(int ms) const;
+    size_t n_lost(const audio_ring_view & view) const;
+
+    // drop the audio up to the end of the view
+    void consume(const audio_ring_view & view);
+
+    // true after all the input has been replayed
+    bool is_finished() const { return m_finished; }
+
+    // number of samples replayed so far
+    int64_t n_replayed() const { return m_n_replayed; }
+
+private:
+    void worker();
+
+    // read the next n samples of the input, returns the number of samples read
+    size_t read(float * dst, size_t n);
+
+    int   m_len_ms      = 0;
+    int   m_sample_rate = 0;
+    float m_speed       = 1.0f;
+
+    // decoded WAV input
+    std::vector<float> m_input;
+    size_t             m_input_pos = 0;
+
+    // raw PCM input
+    FILE * m_fin = nullptr;
+
+    std::thread      m_thread;
+    std::atomic_bool m_running;
+    std::atomic_bool m_finished;
+    std::atomic_bool m_stop;
+
+    std::atomic<int64_t> m_n_replayed;
+
+    audio_ring m_ring;
+};
 
 // Apply a high-pass frequency filter to PCM audio
 // Suppresses frequencies below cutoff Hz
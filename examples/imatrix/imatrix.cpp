@@ -0,0 +1,277 @@
+// Importance matrix calibration
+//
+// Transcribes a set of audio files with whisper_full and records, for the input columns of every weight that is used in
+// a matrix multiplication, the mean squared activation. The result is used by the quantize tool (--imatrix) to weight
+// the quantization error of each column, which keeps the low-bit K and IQ types usable.
+//
+#include "common.h"
+#include "whisper.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+// command-line parameters
+struct whisper_params {
+    int32_t n_threads  = std::min(4, (int32_t) std::thread::hardware_concurrency());
+    int32_t beam_size  = -1;
+
+    bool translate     = false;
+    bool print_text    = false;
+    bool use_gpu       = true;
+
+    std::string language  = "en";
+    std::string model     = "models/ggml-base.en.bin";
+    std::string fname_out = "imatrix.dat";
+
+    std::vector<std::string> fname_inp;
+};
+
+static void whisper_print_usage(int argc, char ** argv, const whisper_params & params);
+
+static bool whisper_params_parse(int argc, char ** argv, whisper_params & params) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help") {
+            whisper_print_usage(argc, argv, params);
+            exit(0);
+        }
+        else if (arg == "-t"    || arg == "--threads")       { params.n_threads     = std::stoi(argv[++i]); }
+        else if (arg == "-bs"   || arg == "--beam-size")     { params.beam_size     = std::stoi(argv[++i]); }
+        else if (arg == "-tr"   || arg == "--translate")     { params.translate     = true; }
+        else if (arg == "-pt"   || arg == "--print-text")    { params.print_text    = true; }
+        else if (arg == "-l"    || arg == "--language")      { params.language      = argv[++i]; }
+        else if (arg == "-m"    || arg == "--model")         { params.model         = argv[++i]; }
+        else if (arg == "-o"    || arg == "--output")        { params.fname_out     = argv[++i]; }
+        else if (arg == "-f"    || arg == "--file")          { params.fname_inp.emplace_back(argv[++i]); }
+        else if (arg == "-ng"   || arg == "--no-gpu")        { params.use_gpu       = false; }
+        else if (arg[0] != '-')                              { params.fname_inp.emplace_back(arg); }
+        else {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            whisper_print_usage(argc, argv, params);
+            exit(0);
+        }
+    }
+
+    return true;
+}
+
+static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & params) {
+    fprintf(stderr, "\n");
+    fprintf(stderr, "usage: %s [options] file0.wav file1.wav ...\n", argv[0]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  -h,       --help          [default] show this help message and exit\n");
+    fprintf(stderr, "  -t N,     --threads N     [%-7d] number of threads to use during computation\n",    params.n_threads);
+    fprintf(stderr, "  -bs N,    --beam-size N   [%-7d] beam size for beam search (-1 - greedy)\n",        params.beam_size);
+    fprintf(stderr, "  -tr,      --translate     [%-7s] translate from source language to english\n",      params.translate ? "true" : "false");
+    fprintf(stderr, "  -pt,      --print-text    [%-7s] print the transcribed text\n",                     params.print_text ? "true" : "false");
+    fprintf(stderr, "  -l LANG,  --language LANG [%-7s] spoken language\n",                                params.language.c_str());
+    fprintf(stderr, "  -m FNAME, --model FNAME   [%-7s] model path (F16 or F32)\n",                        params.model.c_str());
+    fprintf(stderr, "  -o FNAME, --output FNAME  [%-7s] output importance matrix\n",                       params.fname_out.c_str());
+    fprintf(stderr, "  -f FNAME, --file FNAME    [%-7s] input WAV file (can be repeated)\n",               "");
+    fprintf(stderr, "  -ng,      --no-gpu        [%-7s] disable GPU inference\n",                          params.use_gpu ? "false" : "true");
+    fprintf(stderr, "\n");
+}
+
+// sum of the squared activations of each input column of a weight
+struct imatrix_entry {
+    std::vector<double> sums;
+
+    int64_t n_rows = 0;
+    int32_t n_call = 0;
+};
+
+struct imatrix_collector {
+    std::map<std::string, imatrix_entry> entries;
+
+    std::vector<float> tmp;
+
+    static bool is_weight(const ggml_tensor * w) {
+        return w->name[0] != '\0' && w->buffer && ggml_backend_buffer_get_usage(w->buffer) == GGML_BACKEND_BUFFER_USAGE_WEIGHTS;
+    }
+
+    bool collect(ggml_tensor * t, bool ask) {
+        if (ask) {
+            return t->op == GGML_OP_MUL_MAT && is_weight(t->src[0]) && t->src[1]->type == GGML_TYPE_F32;
+        }
+
+        if (t->op != GGML_OP_MUL_MAT) {
+            return true;
+        }
+
+        const ggml_tensor * w = t->src[0];
+        const ggml_tensor * x = t->src[1];
+
+        const char * data = (const char *) x->data;
+
+        // the activations can be on a device
+        if (!ggml_backend_buffer_is_host(x->buffer)) {
+            tmp.resize(ggml_nbytes(x)/sizeof(float));
+            ggml_backend_tensor_get(x, tmp.data(), 0, ggml_nbytes(x));
+            data = (const char *) tmp.data();
+        }
+
+        auto & e = entries[w->name];
+        if (e.sums.empty()) {
+            e.sums.resize(x->ne[0], 0.0);
+        }
+
+        for (int64_t i3 = 0; i3 < x->ne[3]; ++i3) {
+            for (int64_t i2 = 0; i2 < x->ne[2]; ++i2) {
+                for (int64_t i1 = 0; i1 < x->ne[1]; ++i1) {
+                    const float * row = (const float *) (data + i1*x->nb[1] + i2*x->nb[2] + i3*x->nb[3]);
+                    for (int64_t j = 0; j < x->ne[0]; ++j) {
+                        e.sums[j] += (double) row[j]*row[j];
+                    }
+                }
+            }
+        }
+
+        e.n_rows += x->ne[1]*x->ne[2]*x->ne[3];
+        e.n_call += 1;
+
+        return true;
+    }
+
+    // format: see whisper_load_imatrix in examples/quantize/quantize.cpp
+    bool save(const std::string & fname) const {
+        std::ofstream fout(fname, std::ios::binary);
+        if (!fout) {
+            return false;
+        }
+
+        const int32_t n_entries = entries.size();
+        fout.write((const char *) &n_entries, sizeof(n_entries));
+
+        std::vector<float> values;
+
+        for (const auto & it : entries) {
+            const auto & e = it.second;
+
+            values.resize(e.sums.size());
+            for (size_t j = 0; j < e.sums.size(); ++j) {
+                values[j] = e.n_rows > 0 ? e.sums[j]/e.n_rows : 0.0f;
+            }
+
+            const int32_t len  = it.first.size();
+            const int32_t nval = values.size();
+
+            fout.write((const char *) &len, sizeof(len));
+            fout.write(it.first.data(), len);
+            fout.write((const char *) &e.n_call, sizeof(e.n_call));
+            fout.write((const char *) &nval, sizeof(nval));
+            fout.write((const char *) values.data(), nval*sizeof(float));
+        }
+
+        return (bool) fout;
+    }
+};
+
+static bool imatrix_cb_eval(struct ggml_tensor * t, bool ask, void * user_data) {
+    return ((imatrix_collector *) user_data)->collect(t, ask);
+}
+
+int main(int argc, char ** argv) {
+    whisper_params params;
+
+    if (whisper_params_parse(argc, argv, params) == false) {
+        return 1;
+    }
+
+    if (params.fname_inp.empty()) {
+        fprintf(stderr, "error: no input files specified\n");
+        whisper_print_usage(argc, argv, params);
+        return 1;
+    }
+
+    imatrix_collector collector;
+
+    // whisper init
+
+    struct whisper_context_params cparams = whisper_context_default_params();
+
+    cparams.use_gpu           = params.use_gpu;
+    cparams.cb_eval           = imatrix_cb_eval;
+    cparams.cb_eval_user_data = &collector;
+
+    struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
+    if (ctx == nullptr) {
+        fprintf(stderr, "error: failed to initialize whisper context\n");
+        return 2;
+    }
+
+    whisper_full_params wparams = whisper_full_default_params(params.beam_size > 1 ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY);
+
+    wparams.print_progress   = false;
+    wparams.print_realtime   = false;
+    wparams.print_timestamps = false;
+    wparams.translate        = params.translate;
+    wparams.language         = params.language.c_str();
+    wparams.n_threads        = params.n_threads;
+
+    if (params.beam_size > 1) {
+        wparams.beam_search.beam_size = params.beam_size;
+    }
+
+    double t_audio = 0.0;
+
+    const auto t_start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < params.fname_inp.size(); ++i) {
+        const auto & fname = params.fname_inp[i];
+
+        std::vector<float> pcmf32;
+        std::vector<std::vector<float>> pcmf32s;
+
+        if (!::read_wav(fname, pcmf32, pcmf32s, false)) {
+            fprintf(stderr, "error: failed to read WAV file '%s'\n", fname.c_str());
+            continue;
+        }
+
+        const auto t0 = std::chrono::steady_clock::now();
+
+        if (whisper_full(ctx, wparams, pcmf32.data(), pcmf32.size()) != 0) {
+            fprintf(stderr, "error: failed to process '%s'\n", fname.c_str());
+            continue;
+        }
+
+        const double t_file = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+        t_audio += (double) pcmf32.size()/WHISPER_SAMPLE_RATE;
+
+        fprintf(stderr, "%s: [%zu/%zu] '%s': %.1f s of audio in %.1f s, %d segments\n", __func__,
+                i + 1, params.fname_inp.size(), fname.c_str(), (double) pcmf32.size()/WHISPER_SAMPLE_RATE, t_file, whisper_full_n_segments(ctx));
+
+        if (params.print_text) {
+            for (int j = 0; j < whisper_full_n_segments(ctx); ++j) {
+                printf("%s\n", whisper_full_get_segment_text(ctx, j));
+            }
+        }
+    }
+
+    const double t_total = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+
+    whisper_free(ctx);
+
+    if (collector.entries.empty()) {
+        fprintf(stderr, "error: no activations were collected\n");
+        return 3;
+    }
+
+    if (!collector.save(params.fname_out)) {
+        fprintf(stderr, "error: failed to write '%s'\n", params.fname_out.c_str());
+        return 4;
+    }
+
+    fprintf(stderr, "%s: %.1f s of audio in %.1f s, wrote %zu entries to '%s'\n", __func__,
+            t_audio, t_total, collector.entries.size(), params.fname_out.c_str());
+
+    return 0;
+}
@@ -42,13 +42,10 @@ struct command {
 struct commandset {
     std::vector<struct command> commands;
     std::vector<whisper_token> prompt_tokens;
-    // TODO: Store longest command?
-    // Multi-token commands should have probabilities of subsequent logits
-    // given that the prior logit is correct.
-    // In this case, all commands must be iterated.
-    // This however, is likely highly involved as different tokens
-    // almost certainly have different spoken lengths
-    // It would also have performance implications equivalent to a beam search
+    // decoder prefix shared by all commands: [prev] + prompt + [sot, lang, task, notimestamps]
+    // the commands are scored as continuations of it, so multi-token commands get the probabilities
+    // of their subsequent tokens given that the prior ones are correct
+    std::vector<whisper_token> prefix_tokens;
 };
 
 void whisper_print_usage(int argc, char ** argv, const whisper_params & params);
@@ -199,127 +196,105 @@ static json unguided_transcription(struct whisper_context * ctx, audio_async &au
 
 // command-list mode
 // guide the transcription to match the most likely command from a provided list
-static json guided_transcription(struct whisper_context * ctx, audio_async &audio, const whisper_params &params, json jparams, std::vector<struct commandset> commandset_list) {
-    struct commandset cs = commandset_list[jparams.value("commandset_index", commandset_list.size()-1)];
+static json guided_transcription(struct whisper_context * ctx, audio_async &audio, const whisper_params &params, json jparams, const std::vector<struct commandset> &commandset_list) {
+    if (commandset_list.empty()) {
+        throw json{
+            {"code", -32602},
+            {"message", "No command set has been registered"}
+        };
+    }
+    const struct commandset & cs = commandset_list.at(jparams.value("commandset_index", commandset_list.size()-1));
     std::vector<float> pcmf32;
     uint64_t unprocessed_audio_timestamp = wait_for_vad(audio, jparams, params, 2000U, pcmf32);
 
     fprintf(stderr, "%s: Speech detected! Processing ...\n", __func__);
-    whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
 
-    wparams.print_progress   = false;
-    wparams.print_special    = params.print_special;
-    wparams.print_realtime   = false;
-    wparams.print_timestamps = false;
-    wparams.translate        = params.translate;
-    wparams.no_context       = true;
-    wparams.single_segment   = true;
-    wparams.max_tokens       = 1;
-    wparams.language         = params.language.c_str();
-    wparams.n_threads        = params.n_threads;
-
-    wparams.audio_ctx        = params.audio_ctx;
-
-    // TODO: Do some time testing. Does an overly long prompt slow down processing?
-    // Set up command sets/precompute prompts
-    wparams.prompt_tokens    = cs.prompt_tokens.data();
-    wparams.prompt_n_tokens  = cs.prompt_tokens.size();
-    // TODO: properly expose as option
-    wparams.suppress_nst     = true;
-
-    // run the transformer and a single decoding pass
-    if (whisper_full(ctx, wparams, pcmf32.data(), pcmf32.size()) != 0) {
-        fprintf(stderr, "%s: ERROR: whisper_full() failed\n", __func__);
+    if (whisper_pcm_to_mel(ctx, pcmf32.data(), pcmf32.size(), params.n_threads) != 0) {
+        fprintf(stderr, "%s: ERROR: whisper_pcm_to_mel() failed\n", __func__);
         throw json{
             {"code", -32803},
-            {"message", "ERROR: whisper_full() failed"}//TODO: format string (sprintf?)
+            {"message", "ERROR: whisper_pcm_to_mel() failed"}
         };
     }
 
-    // estimate command probability
-    // NOTE: not optimal
-    {
-        const auto * logits = whisper_get_logits(ctx);
-
-        std::vector<float> probs(whisper_n_vocab(ctx), 0.0f);
-
-        // compute probs from logits via softmax
-        {
-            float max = -1e9;
-            for (int i = 0; i < (int) probs.size(); ++i) {
-                max = std::max(max, logits[i]);
-            }
-
-            float sum = 0.0f;
-            for (int i = 0; i < (int) probs.size(); ++i) {
-                probs[i] = expf(logits[i] - max);
-                sum += probs[i];
-            }
-
-            for (int i = 0; i < (int) probs.size(); ++i) {
-                probs[i] /= sum;
-            }
-        }
-
-        std::vector<std::pair<float, int>> probs_id;
+    std::vector<const whisper_token *> cand_tokens;
+    std::vector<int>                   cand_n_tokens;
+    for (const auto & cmd : cs.commands) {
+        cand_tokens.push_back(cmd.tokens.data());
+        cand_n_tokens.push_back(cmd.tokens.size());
+    }
 
-        // In my testing, the most verbose token is always the desired.
-        // TODO: Trim commandset struct once efficacy has been verified
-        for (int i = 0; i < (int) cs.commands.size(); ++i) {
-            probs_id.emplace_back(probs[cs.commands[i].tokens[0]], i);
-        }
+    // run the encoder once and decode the command trie - tokens shared by several commands are decoded once
+    std::vector<float> cand_logprobs(cs.commands.size());
+    if (whisper_score_candidates(ctx, cs.prefix_tokens.data(), cs.prefix_tokens.size(),
+                cand_tokens.data(), cand_n_tokens.data(), cand_tokens.size(),
+                params.audio_ctx, params.n_threads, cand_logprobs.data()) != 0) {
+        fprintf(stderr, "%s: ERROR: whisper_score_candidates() failed\n", __func__);
+        throw json{
+            {"code", -32803},
+            {"message", "ERROR: whisper_score_candidates() failed"}
+        };
+    }
 
-        // sort descending
-        {
-            using pair_type = decltype(probs_id)::value_type;
-            std::sort(probs_id.begin(), probs_id.end(), [](const pair_type & a, const pair_type & b) {
-                    return a.first > b.first;
-                    });
+    // pick the command with the highest length-normalized log-likelihood
+    int id = 0;
+    for (int i = 1; i < (int) cs.commands.size(); ++i) {
+        if (cand_logprobs[i] / cand_n_tokens[i] > cand_logprobs[id] / cand_n_tokens[id]) {
+            id = i;
         }
-        int id = probs_id[0].second;
-        return json{
-            {"command_index", id},
-                {"command_text", cs.commands[id].plaintext},
-                {"timestamp", unprocessed_audio_timestamp},
-        };
     }
+
+    return json{
+        {"command_index", id},
+            {"command_text", cs.commands[id].plaintext},
+            {"timestamp", unprocessed_audio_timestamp},
+    };
 }
 
-static json register_commandset(struct whisper_context * ctx, json jparams, std::vector<struct commandset> &commandset_list) {
-    // TODO: check for token collision
+static json register_commandset(struct whisper_context * ctx, const whisper_params &params, json jparams, std::vector<struct commandset> &commandset_list) {
     struct commandset cs;
 
     std::string  k_prompt = " select one from the available words: ";
-    std::set<whisper_token> token_set;
+    std::set<std::vector<whisper_token>> token_set;
     whisper_token tokens[32];
     for (std::string s : jparams) {
-        std::vector<whisper_token> token_vec;
-        // The existing command implementation uses a nested for loop to tokenize single characters
-        // I fail to see the purpose of this when ' a' has a wholly different pronunciation than the start of ' apple'
+        // tokenized once here - the whole token sequence of the command is scored on each request
         const int n = whisper_tokenize(ctx, (" " + s).c_str(), tokens, 32);
-        if (n < 0) {
+        if (n <= 0) {
             fprintf(stderr, "%s: error: failed to tokenize command '%s'\n", __func__, s.c_str());
-            return 3;
+            throw json{
+                {"code", -32602},
+                {"message", "Failed to tokenize command: " + s}
+            };
         }
-        token_vec.push_back(tokens[0]);
-        if (!token_set.insert(tokens[0]).second) {
-            fprintf(stderr, "%s: warning: %s is a duplicate of an existing token\n", __func__, s.c_str());
+        std::vector<whisper_token> token_vec(tokens, tokens + n);
+        if (!token_set.insert(token_vec).second) {
+            fprintf(stderr, "%s: warning: %s is a duplicate of an existing command\n", __func__, s.c_str());
             throw json{
                 {"code",-31000},
-                {"message", "Duplicate token in token set: " + s}
+                {"message", "Duplicate command in command set: " + s}
             };
         }
-        if (n > 1) {// empty string if n=0? Should never occur
-            fprintf(stderr, "%s: error: command is more than a single token: %s\n", __func__, s.c_str());
-        }
         struct command command = {token_vec, s};
         cs.commands.push_back(command);
-        k_prompt += s;
+        k_prompt += s + ", ";
     }
     k_prompt = k_prompt.substr(0,k_prompt.length()-2) + ". Selected word:";
     cs.prompt_tokens.resize(1024);
     int n = whisper_tokenize(ctx, k_prompt.c_str(), cs.prompt_tokens.data(), 1024);
     cs.prompt_tokens.resize(n);
+
+    cs.prefix_tokens.push_back(whisper_token_prev(ctx));
+    cs.prefix_tokens.insert(cs.prefix_tokens.end(), cs.prompt_tokens.begin(), cs.prompt_tokens.end());
+    cs.prefix_tokens.push_back(whisper_token_sot(ctx));
+    // no language token for an unknown language ("auto" included), as in the command example
+    const int lang_id = whisper_lang_id(params.language.c_str());
+    if (whisper_is_multilingual(ctx) && lang_id >= 0) {
+        cs.prefix_tokens.push_back(whisper_token_lang(ctx, lang_id));
+        cs.prefix_tokens.push_back(params.translate ? whisper_token_translate(ctx) : whisper_token_transcribe(ctx));
+    }
+    cs.prefix_tokens.push_back(whisper_token_not(ctx));
+
     // prepare response
     int index = commandset_list.size();
     commandset_list.push_back(cs);
@@ -359,7 +334,7 @@ static json parse_job(const json &body, struct whisper_context * ctx, audio_asyn
         if (method == "unguided")                { res = unguided_transcription(ctx, audio, jparams, params); }
         else if (method == "guided")             { res = guided_transcription(ctx, audio, params, jparams, commandset_list); }
         else if (method == "seek")               { res = seek(ctx, audio, jparams); }
-        else if (method == "registerCommandset") { res = register_commandset(ctx, jparams, commandset_list); }
+        else if (method == "registerCommandset") { res = register_commandset(ctx, params, jparams, commandset_list); }
         else if (method == "echo")               { res = jparams; }
 
 
@@ -9,6 +9,7 @@
 #include <cstring>
 #include <fstream>
 #include <map>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <regex>
@@ -35,8 +36,193 @@ struct whisper_filters {
     std::vector<float> data;
 };
 
+// set in the ftype of models that store a table of per-tensor types after the vocab
+// must match WHISPER_FTYPE_MIXED in src/whisper.cpp
+#define WHISPER_FTYPE_MIXED 0x10000
+
+// tensors whose name matches the regex are converted to the given type
+struct whisper_quant_rule {
+    std::string pattern;
+    ggml_type   type;
+};
+
+static bool whisper_parse_quant_rule(const std::string & pattern, const std::string & type_name, std::vector<whisper_quant_rule> & rules) {
+    const ggml_type type = ggml_parse_qtype(type_name.c_str());
+    if (type == GGML_TYPE_COUNT) {
+        fprintf(stderr, "%s: unknown type '%s' for tensors '%s'\n", __func__, type_name.c_str(), pattern.c_str());
+        return false;
+    }
+
+    try {
+        std::regex re(pattern);
+    } catch (const std::regex_error & e) {
+        fprintf(stderr, "%s: invalid regex '%s': %s\n", __func__, pattern.c_str(), e.what());
+        return false;
+    }
+
+    rules.push_back({ pattern, type });
+
+    return true;
+}
+
+// recipe file: one "<regex> <type>" rule per line, '#' starts a comment
+// the first rule that matches a tensor name decides its type
+static bool whisper_load_recipe(const std::string & fname, std::vector<whisper_quant_rule> & rules) {
+    std::ifstream fin(fname);
+    if (!fin) {
+        fprintf(stderr, "%s: failed to open recipe '%s'\n", __func__, fname.c_str());
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(fin, line)) {
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream ss(line);
+
+        std::string pattern;
+        std::string type_name;
+        if (!(ss >> pattern)) {
+            continue;
+        }
+
+        if (!(ss >> type_name)) {
+            fprintf(stderr, "%s: missing type for tensors '%s' in '%s'\n", __func__, pattern.c_str(), fname.c_str());
+            return false;
+        }
+
+        if (!whisper_parse_quant_rule(pattern, type_name, rules)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// importance matrix written by whisper-imatrix (examples/imatrix):
+//   int32 n_entries
+//   n_entries x { int32 len, char name[len], int32 ncall, int32 nval, float values[nval] }
+// the values are the mean squared activations of the input columns of each weight
+static bool whisper_load_imatrix(const std::string & fname, std::map<std::string, std::vector<float>> & imatrix) {
+    std::ifstream fin(fname, std::ios::binary);
+    if (!fin) {
+        fprintf(stderr, "%s: failed to open importance matrix '%s'\n", __func__, fname.c_str());
+        return false;
+    }
+
+    int32_t n_entries = 0;
+    fin.read((char *) &n_entries, sizeof(n_entries));
+
+    for (int i = 0; i < n_entries; ++i) {
+        int32_t len = 0;
+        fin.read((char *) &len, sizeof(len));
+
+        std::string name(len, 0);
+        fin.read(&name[0], len);
+
+        int32_t ncall = 0;
+        int32_t nval  = 0;
+        fin.read((char *) &ncall, sizeof(ncall));
+        fin.read((char *) &nval,  sizeof(nval));
+
+        if (!fin || nval <= 0) {
+            fprintf(stderr, "%s: invalid importance matrix '%s'\n", __func__, fname.c_str());
+            return false;
+        }
+
+        auto & values = imatrix[name];
+        values.resize(nval);
+        fin.read((char *) values.data(), nval*sizeof(float));
+    }
+
+    if (!fin) {
+        fprintf(stderr, "%s: failed to read importance matrix '%s'\n", __func__, fname.c_str());
+        return false;
+    }
+
+    fprintf(stderr, "%s: loaded %d importance matrix entries from '%s'\n", __func__, n_entries, fname.c_str());
+
+    return true;
+}
+
+// group the tensors of all layers, e.g. "encoder.blocks.3.mlp.0.weight" -> "encoder.blocks.N.mlp.0.weight"
+static std::string whisper_tensor_class(const std::string & name) {
+    return std::regex_replace(name, std::regex("blocks\\.[0-9]+\\."), "blocks.N.");
+}
+
+// size and speed report for the quantized model, per tensor class
+// decoding is memory bound, so its speed scales with the weight bytes that are read for each token
+static void whisper_print_quant_report(const std::vector<ggml_common_quantize_stat> & stats) {
+    struct report_row {
+        int    n      = 0;
+        size_t n_elem = 0;
+        size_t src    = 0;
+        size_t dst    = 0;
+
+        int64_t t_us = 0;
+
+        std::string types;
+    };
+
+    std::vector<std::string> order;
+    std::map<std::string, report_row> rows;
+
+    size_t size_enc = 0;
+    size_t size_dec = 0;
+    size_t size_tok = 0;
+
+    for (const auto & st : stats) {
+        const std::string cls = whisper_tensor_class(st.info.name);
+
+        if (rows.find(cls) == rows.end()) {
+            order.push_back(cls);
+        }
+
+        auto & row = rows[cls];
+
+        const std::string type = ggml_type_name(st.type_dst);
+        if (row.types.find(type) == std::string::npos) {
+            row.types += row.types.empty() ? type : "," + type;
+        }
+
+        row.n      += 1;
+        row.n_elem += (size_t) st.info.ne[0]*st.info.ne[1]*st.info.ne[2]*st.info.ne[3];
+        row.src    += st.size_src;
+        row.dst    += st.size_dst;
+        row.t_us   += st.t_us;
+
+        if (st.info.name.rfind("encoder.", 0) == 0) {
+            size_enc += st.size_dst;
+        } else {
+            size_dec += st.size_dst;
+
+            // the positional embedding rows are gathered and the cross-attention K/V are computed once per segment
+            if (st.info.name != "decoder.positional_embedding" && cls.find("cross_attn.key") == std::string::npos && cls.find("cross_attn.value") == std::string::npos) {
+                size_tok += st.size_dst;
+            }
+        }
+    }
+
+    printf("\n");
+    printf("%-48s %3s %-12s %10s %10s %6s %9s\n", "tensor class", "n", "type", "src (MB)", "dst (MB)", "bpw", "time (ms)");
+    for (const auto & cls : order) {
+        const auto & row = rows[cls];
+        printf("%-48s %3d %-12s %10.2f %10.2f %6.2f %9.2f\n", cls.c_str(), row.n, row.types.c_str(),
+                row.src/1024.0/1024.0, row.dst/1024.0/1024.0, 8.0*row.dst/row.n_elem, row.t_us/1000.0);
+    }
+    printf("\n");
+    printf("encoder weights            = %8.2f MB\n", size_enc/1024.0/1024.0);
+    printf("decoder weights            = %8.2f MB\n", size_dec/1024.0/1024.0);
+    printf("decoder weights read/token = %8.2f MB\n", size_tok/1024.0/1024.0);
+}
+
 // quantize a model
-static bool whisper_model_quantize(const std::string & fname_inp, const std::string & fname_out, ggml_ftype ftype) {
+static bool whisper_model_quantize(
+        const std::string & fname_inp,
+        const std::string & fname_out,
+        ggml_ftype ftype,
+        const std::vector<whisper_quant_rule> & rules,
+        const std::map<std::string, std::vector<float>> & imatrix) {
     gpt_vocab vocab;
 
     printf("%s: loading model from '%s'\n", __func__, fname_inp.c_str());
@@ -82,7 +268,7 @@ static bool whisper_model_quantize(const std::string & fname_inp, const std::str
         finp.read((char *) &hparams.ftype,         sizeof(hparams.ftype));
 
         const int32_t qntvr_src =    hparams.ftype / GGML_QNT_VERSION_FACTOR;
-        const int32_t ftype_dst = GGML_QNT_VERSION * GGML_QNT_VERSION_FACTOR + ftype;
+        const int32_t ftype_dst = GGML_QNT_VERSION * GGML_QNT_VERSION_FACTOR + ftype + (rules.empty() ? 0 : WHISPER_FTYPE_MIXED);
 
         fprintf(stderr, "%s: n_vocab       = %d\n", __func__, hparams.n_vocab);
         fprintf(stderr, "%s: n_audio_ctx   = %d\n", __func__, hparams.n_audio_ctx);
@@ -164,24 +350,147 @@ static bool whisper_model_quantize(const std::string & fname_inp, const std::str
         "decoder.positional_embedding",
     };
 
-    if (!ggml_common_quantize_0(finp, fout, ftype, { ".*" }, to_skip)) {
+    const ggml_type qtype = ggml_ftype_to_ggml_type(ftype);
+    if (qtype == GGML_TYPE_COUNT || (!ggml_is_quantized(qtype) && qtype != GGML_TYPE_BF16)) {
+        fprintf(stderr, "%s: invalid quantization type %d\n", __func__, ftype);
+        return false;
+    }
+
+    std::vector<ggml_common_tensor_info> infos;
+    if (!ggml_common_scan_tensors(finp, infos)) {
+        fprintf(stderr, "%s: failed to read the tensors of model '%s'\n", __func__, fname_inp.c_str());
+        return false;
+    }
+
+    // choose the type of each tensor
+    std::map<std::string, ggml_type> types;
+    for (const auto & info : infos) {
+        bool quantize = info.n_dims >= 2;
+        for (const auto & s : to_skip) {
+            if (std::regex_match(info.name, std::regex(s))) {
+                quantize = false;
+                break;
+            }
+        }
+
+        if (!quantize) {
+            types[info.name] = info.type;
+            continue;
+        }
+
+        // only the 2D tensors are quantized by default, the conv kernels are kept in F16/F32
+        ggml_type type = info.n_dims == 2 ? qtype : info.type;
+        for (const auto & rule : rules) {
+            if (std::regex_match(info.name, std::regex(rule.pattern))) {
+                type = rule.type;
+                break;
+            }
+        }
+
+        if (info.n_dims != 2 && type != GGML_TYPE_F32 && type != GGML_TYPE_F16) {
+            fprintf(stderr, "%s: tensor '%s' has %d dims and can only be stored as f32 or f16\n", __func__, info.name.c_str(), info.n_dims);
+            return false;
+        }
+
+        if (info.ne[0] % ggml_blck_size(type) != 0) {
+            const ggml_type fallback = info.ne[0] % ggml_blck_size(qtype) == 0 ? qtype : info.type;
+
+            fprintf(stderr, "%s: tensor '%s' has %d columns, not a multiple of the %s block size - using %s\n",
+                    __func__, info.name.c_str(), info.ne[0], ggml_type_name(type), ggml_type_name(fallback));
+
+            type = fallback;
+        }
+
+        types[info.name] = type;
+    }
+
+    // per-tensor types, read by the loader before the tensors are allocated
+    if (!rules.empty()) {
+        const int32_t n_types = types.size();
+        fout.write((const char *) &n_types, sizeof(n_types));
+
+        for (const auto & info : infos) {
+            const int32_t len  = info.name.size();
+            const int32_t type = types[info.name];
+
+            fout.write((const char *) &len,  sizeof(len));
+            fout.write(info.name.data(), len);
+            fout.write((const char *) &type, sizeof(type));
+        }
+    }
+
+    std::vector<ggml_common_quantize_stat> stats;
+
+    if (!ggml_common_quantize_1(finp, fout, types, imatrix, &stats)) {
         fprintf(stderr, "%s: failed to quantize model '%s'\n", __func__, fname_inp.c_str());
         return false;
     }
 
+    whisper_print_quant_report(stats);
+
     finp.close();
     fout.close();
 
     return true;
 }
 
+static void whisper_print_usage(const char * argv0) {
+    fprintf(stderr, "usage: %s [options] model-f32.bin model-quant.bin type\n", argv0);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  --recipe FNAME          per-tensor types, one \"<regex> <type>\" rule per line\n");
+    fprintf(stderr, "  --tensor-type REGEX=T   store the tensors matching REGEX as type T (can be repeated,\n");
+    fprintf(stderr, "                          checked before the recipe rules)\n");
+    fprintf(stderr, "  --imatrix FNAME         importance matrix from whisper-imatrix, required for iq1_s, iq2_xxs, iq2_xs\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "the 2D tensors without a matching rule are quantized to type, rule types can also be f16 or f32\n");
+    fprintf(stderr, "with type bf16 the model runs in BF16 end-to-end (the conv kernels stay in F16)\n");
+    fprintf(stderr, "\n");
+    ggml_print_ftypes(stderr);
+}
+
 int main(int argc, char ** argv) {
-    if (argc != 4) {
-        fprintf(stderr, "usage: %s model-f32.bin model-quant.bin type\n", argv[0]);
-        ggml_print_ftypes(stderr);
+    std::vector<whisper_quant_rule> rules_arg;
+    std::vector<whisper_quant_rule> rules_recipe;
+    std::map<std::string, std::vector<float>> imatrix;
+    std::vector<std::string> args;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+
+        if (arg == "--recipe" && i + 1 < argc) {
+            if (!whisper_load_recipe(argv[++i], rules_recipe)) {
+                return 1;
+            }
+        } else if (arg == "--imatrix" && i + 1 < argc) {
+            if (!whisper_load_imatrix(argv[++i], imatrix)) {
+                return 1;
+            }
+        } else if (arg == "--tensor-type" && i + 1 < argc) {
+            const std::string rule = argv[++i];
+
+            const size_t pos = rule.rfind('=');
+            if (pos == std::string::npos || !whisper_parse_quant_rule(rule.substr(0, pos), rule.substr(pos + 1), rules_arg)) {
+                fprintf(stderr, "%s: invalid tensor type rule '%s'\n", __func__, rule.c_str());
+                return 1;
+            }
+        } else if (arg.rfind("--", 0) == 0) {
+            fprintf(stderr, "%s: unknown argument '%s'\n", __func__, arg.c_str());
+            whisper_print_usage(argv[0]);
+            return 1;
+        } else {
+            args.push_back(arg);
+        }
+    }
+
+    if (args.size() != 3) {
+        whisper_print_usage(argv[0]);
         return 1;
     }
 
+    std::vector<whisper_quant_rule> rules = rules_arg;
+    rules.insert(rules.end(), rules_recipe.begin(), rules_recipe.end());
+
     // needed to initialize f16 tables
     {
         struct ggml_init_params params = { 0, NULL, false };
@@ -189,10 +498,10 @@ int main(int argc, char ** argv) {
         ggml_free(ctx);
     }
 
-    const std::string fname_inp = argv[1];
-    const std::string fname_out = argv[2];
+    const std::string fname_inp = args[0];
+    const std::string fname_out = args[1];
 
-    const ggml_ftype ftype = ggml_parse_ftype(argv[3]);
+    const ggml_ftype ftype = ggml_parse_ftype(args[2].c_str());
 
     const int64_t t_main_start_us = ggml_time_us();
 
@@ -202,7 +511,7 @@ int main(int argc, char ** argv) {
     {
         const int64_t t_start_us = ggml_time_us();
 
-        if (!whisper_model_quantize(fname_inp, fname_out, ggml_ftype(ftype))) {
+        if (!whisper_model_quantize(fname_inp, fname_out, ggml_ftype(ftype), rules, imatrix)) {
             fprintf(stderr, "%s: failed to quantize model from '%s'\n", __func__, fname_inp.c_str());
             return 1;
         }
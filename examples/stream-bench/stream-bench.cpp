@@ -0,0 +1,298 @@
+// Real-time streaming benchmark
+//
+// Replays a WAV file or raw PCM from a pipe at a fixed speed through the same loop as the sliding window mode of
+// whisper-stream and reports the per-step latency, the dropped audio and the delay of the stable captions.
+// No capture device is needed.
+//
+#include "common.h"
+#include "whisper.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+// command-line parameters
+struct whisper_params {
+    int32_t n_threads  = std::min(4, (int32_t) std::thread::hardware_concurrency());
+    int32_t step_ms    = 1000;
+    int32_t length_ms  = 10000;
+    int32_t keep_ms    = 200;
+    int32_t agreement  = whisper_stream_default_params().agreement_n;
+    int32_t audio_ctx  = 0;
+
+    float speed        = 1.0f;
+
+    bool translate     = false;
+    bool no_fallback   = false;
+    bool raw           = false;
+    bool print_text    = false;
+    bool use_gpu       = true;
+    bool flash_attn    = false;
+
+    std::string language  = "en";
+    std::string model     = "models/ggml-base.en.bin";
+    std::string fname_inp = "samples/jfk.wav";
+};
+
+static void whisper_print_usage(int argc, char ** argv, const whisper_params & params);
+
+static bool whisper_params_parse(int argc, char ** argv, whisper_params & params) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help") {
+            whisper_print_usage(argc, argv, params);
+            exit(0);
+        }
+        else if (arg == "-t"    || arg == "--threads")       { params.n_threads     = std::stoi(argv[++i]); }
+        else if (                  arg == "--step")          { params.step_ms       = std::stoi(argv[++i]); }
+        else if (                  arg == "--length")        { params.length_ms     = std::stoi(argv[++i]); }
+        else if (                  arg == "--keep")          { params.keep_ms       = std::stoi(argv[++i]); }
+        else if (arg == "-la"   || arg == "--agreement")     { params.agreement     = std::stoi(argv[++i]); }
+        else if (arg == "-ac"   || arg == "--audio-ctx")     { params.audio_ctx     = std::stoi(argv[++i]); }
+        else if (arg == "-s"    || arg == "--speed")         { params.speed         = std::stof(argv[++i]); }
+        else if (arg == "-tr"   || arg == "--translate")     { params.translate     = true; }
+        else if (arg == "-nf"   || arg == "--no-fallback")   { params.no_fallback   = true; }
+        else if (                  arg == "--raw")           { params.raw           = true; }
+        else if (arg == "-pt"   || arg == "--print-text")    { params.print_text    = true; }
+        else if (arg == "-l"    || arg == "--language")      { params.language      = argv[++i]; }
+        else if (arg == "-m"    || arg == "--model")         { params.model         = argv[++i]; }
+        else if (arg == "-f"    || arg == "--file")          { params.fname_inp     = argv[++i]; }
+        else if (arg == "-ng"   || arg == "--no-gpu")        { params.use_gpu       = false; }
+        else if (arg == "-fa"   || arg == "--flash-attn")    { params.flash_attn    = true; }
+        else {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            whisper_print_usage(argc, argv, params);
+            exit(0);
+        }
+    }
+
+    return true;
+}
+
+static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & params) {
+    fprintf(stderr, "\n");
+    fprintf(stderr, "usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  -h,       --help          [default] show this help message and exit\n");
+    fprintf(stderr, "  -t N,     --threads N     [%-7d] number of threads to use during computation\n",    params.n_threads);
+    fprintf(stderr, "            --step N        [%-7d] audio step size in milliseconds\n",                params.step_ms);
+    fprintf(stderr, "            --length N      [%-7d] audio length in milliseconds\n",                   params.length_ms);
+    fprintf(stderr, "            --keep N        [%-7d] audio to keep from previous step in ms\n",         params.keep_ms);
+    fprintf(stderr, "  -la N,    --agreement N   [%-7d] commit words agreed by N steps (0 - on full window)\n", params.agreement);
+    fprintf(stderr, "  -ac N,    --audio-ctx N   [%-7d] audio context size (0 - all)\n",                   params.audio_ctx);
+    fprintf(stderr, "  -s N,     --speed N       [%-7.2f] replay speed relative to real time (0 - max)\n", params.speed);
+    fprintf(stderr, "  -tr,      --translate     [%-7s] translate from source language to english\n",      params.translate ? "true" : "false");
+    fprintf(stderr, "  -nf,      --no-fallback   [%-7s] do not use temperature fallback while decoding\n", params.no_fallback ? "true" : "false");
+    fprintf(stderr, "            --raw           [%-7s] input is raw 16 kHz mono 16-bit PCM\n",            params.raw ? "true" : "false");
+    fprintf(stderr, "  -pt,      --print-text    [%-7s] print the stable text\n",                          params.print_text ? "true" : "false");
+    fprintf(stderr, "  -l LANG,  --language LANG [%-7s] spoken language\n",                                params.language.c_str());
+    fprintf(stderr, "  -m FNAME, --model FNAME   [%-7s] model path\n",                                     params.model.c_str());
+    fprintf(stderr, "  -f FNAME, --file FNAME    [%-7s] input WAV file or raw PCM ('-' for stdin)\n",      params.fname_inp.c_str());
+    fprintf(stderr, "  -ng,      --no-gpu        [%-7s] disable GPU inference\n",                          params.use_gpu ? "false" : "true");
+    fprintf(stderr, "  -fa,      --flash-attn    [%-7s] flash attention during inference\n",               params.flash_attn ? "true" : "false");
+    fprintf(stderr, "\n");
+}
+
+struct bench_stats {
+    std::vector<double> values;
+
+    void add(double v) {
+        values.push_back(v);
+    }
+
+    double percentile(double p) const {
+        if (values.empty()) {
+            return 0.0;
+        }
+
+        std::vector<double> tmp = values;
+        std::sort(tmp.begin(), tmp.end());
+
+        return tmp[std::min(tmp.size() - 1, (size_t) (p*tmp.size()))];
+    }
+
+    double mean() const {
+        double sum = 0.0;
+        for (double v : values) {
+            sum += v;
+        }
+
+        return values.empty() ? 0.0 : sum/values.size();
+    }
+
+    void print(const char * name, const char * unit) const {
+        fprintf(stdout, "%-16s: n = %5d, mean = %8.1f %s, p50 = %8.1f %s, p90 = %8.1f %s, max = %8.1f %s\n",
+                name, (int) values.size(), mean(), unit, percentile(0.5), unit, percentile(0.9), unit, percentile(1.0), unit);
+    }
+};
+
+int main(int argc, char ** argv) {
+    whisper_params params;
+
+    if (whisper_params_parse(argc, argv, params) == false) {
+        return 1;
+    }
+
+    params.keep_ms   = std::min(params.keep_ms,   params.step_ms);
+    params.length_ms = std::max(params.length_ms, params.step_ms);
+
+    const int n_samples_step = (1e-3*params.step_ms)*WHISPER_SAMPLE_RATE;
+
+    if (n_samples_step <= 0) {
+        fprintf(stderr, "error: --step must be positive\n");
+        return 1;
+    }
+
+    // whisper init
+
+    struct whisper_context_params cparams = whisper_context_default_params();
+
+    cparams.use_gpu    = params.use_gpu;
+    cparams.flash_attn = params.flash_attn;
+
+    struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
+    if (ctx == nullptr) {
+        fprintf(stderr, "error: failed to initialize whisper context\n");
+        return 2;
+    }
+
+    whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+    wparams.print_progress   = false;
+    wparams.print_realtime   = false;
+    wparams.print_timestamps = false;
+    wparams.translate        = params.translate;
+    wparams.language         = params.language.c_str();
+    wparams.n_threads        = params.n_threads;
+    wparams.audio_ctx        = params.audio_ctx;
+    wparams.temperature_inc  = params.no_fallback ? 0.0f : wparams.temperature_inc;
+
+    whisper_stream_params sparams = whisper_stream_default_params();
+
+    sparams.step_ms     = params.step_ms;
+    sparams.length_ms   = params.length_ms;
+    sparams.keep_ms     = params.keep_ms;
+    sparams.agreement_n = params.agreement;
+
+    struct whisper_stream * stream = whisper_stream_init(ctx, sparams, wparams);
+
+    // init audio
+
+    audio_replay audio(params.length_ms);
+    if (!audio.init(params.fname_inp, WHISPER_SAMPLE_RATE, params.speed, params.raw)) {
+        fprintf(stderr, "%s: audio.init() failed!\n", __func__);
+        return 1;
+    }
+
+    fprintf(stderr, "%s: replaying '%s' at %.2fx (step = %d ms, length = %d ms, keep = %d ms, agreement = %d), %d threads\n",
+            __func__, params.fname_inp.c_str(), params.speed, params.step_ms, params.length_ms, params.keep_ms, params.agreement, params.n_threads);
+
+    bench_stats stats_step;  // processing time of each step
+    bench_stats stats_delay; // audio time between the end of a caption and its commit
+
+    int     n_dropped         = 0;
+    int64_t n_dropped_samples = 0;
+
+    std::vector<float> pcmf32_new;
+
+    // handle the result of a step, measuring the caption delay against the audio replayed so far
+    auto process_result = [&]() {
+        const double t_now_ms = (1000.0*audio.n_replayed())/WHISPER_SAMPLE_RATE;
+
+        const int n_segments = whisper_stream_n_segments(stream);
+        for (int i = 0; i < n_segments; ++i) {
+            if (!whisper_stream_get_segment_stable(stream, i)) {
+                continue;
+            }
+
+            const int64_t t0 = whisper_stream_get_segment_t0(stream, i);
+            const int64_t t1 = whisper_stream_get_segment_t1(stream, i);
+
+            stats_delay.add(std::max(0.0, t_now_ms - 10.0*t1));
+
+            if (params.print_text) {
+                printf("[%s --> %s]  %s\n", to_timestamp(t0).c_str(), to_timestamp(t1).c_str(), whisper_stream_get_segment_text(stream, i));
+                fflush(stdout);
+            }
+        }
+    };
+
+    const auto t_start = std::chrono::steady_clock::now();
+
+    audio.resume();
+
+    // main audio loop - same as the sliding window mode of whisper-stream
+    while (true) {
+        bool finished = false;
+
+        while (true) {
+            finished = audio.is_finished();
+
+            // block until a full step of new audio has been replayed
+            if (!audio.wait(params.step_ms, 100) && !finished) {
+                continue;
+            }
+
+            audio.consume(pcmf32_new);
+
+            if ((int) pcmf32_new.size() > 2*n_samples_step) {
+                fprintf(stderr, "\n%s: WARNING: cannot process audio fast enough, dropping audio ...\n", __func__);
+
+                n_dropped         += 1;
+                n_dropped_samples += pcmf32_new.size();
+
+                continue;
+            }
+
+            break;
+        }
+
+        if (finished) {
+            whisper_stream_push(stream, pcmf32_new.data(), pcmf32_new.size());
+            break;
+        }
+
+        const auto t0 = std::chrono::steady_clock::now();
+
+        whisper_stream_push(stream, pcmf32_new.data(), pcmf32_new.size());
+
+        const int ret = whisper_stream_process(stream);
+        if (ret < 0) {
+            fprintf(stderr, "%s: failed to process audio\n", argv[0]);
+            return 6;
+        }
+
+        const auto t1 = std::chrono::steady_clock::now();
+
+        if (ret > 0) {
+            stats_step.add(std::chrono::duration<double, std::milli>(t1 - t0).count());
+            process_result();
+        }
+    }
+
+    if (whisper_stream_flush(stream) > 0) {
+        process_result();
+    }
+
+    const double t_total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count();
+    const double t_audio_ms = (1000.0*audio.n_replayed())/WHISPER_SAMPLE_RATE;
+
+    fprintf(stdout, "\n");
+    fprintf(stdout, "audio           : %8.1f ms replayed in %8.1f ms\n", t_audio_ms, t_total_ms);
+    stats_step.print ("step latency",  "ms");
+    stats_delay.print("caption delay", "ms");
+    fprintf(stdout, "dropped audio   : %d events, %.1f ms\n", n_dropped, (1000.0*n_dropped_samples)/WHISPER_SAMPLE_RATE);
+    fprintf(stdout, "real time factor: %.3f\n", t_audio_ms > 0.0 ? (stats_step.mean()*stats_step.values.size())/t_audio_ms : 0.0);
+
+    whisper_stream_free(stream);
+
+    whisper_print_timings(ctx);
+    whisper_free(ctx);
+
+    return 0;
+}
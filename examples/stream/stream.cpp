@@ -23,6 +23,7 @@ struct whisper_params {
     int32_t capture_id = -1;
     int32_t max_tokens = 32;
     int32_t audio_ctx  = 0;
+    int32_t agreement  = whisper_stream_default_params().agreement_n;
 
     float vad_thold    = 0.6f;
     float freq_thold   = 100.0f;
@@ -59,6 +60,7 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-c"    || arg == "--capture")       { params.capture_id    = std::stoi(argv[++i]); }
         else if (arg == "-mt"   || arg == "--max-tokens")    { params.max_tokens    = std::stoi(argv[++i]); }
         else if (arg == "-ac"   || arg == "--audio-ctx")     { params.audio_ctx     = std::stoi(argv[++i]); }
+        else if (arg == "-la"   || arg == "--agreement")     { params.agreement     = std::stoi(argv[++i]); }
         else if (arg == "-vth"  || arg == "--vad-thold")     { params.vad_thold     = std::stof(argv[++i]); }
         else if (arg == "-fth"  || arg == "--freq-thold")    { params.freq_thold    = std::stof(argv[++i]); }
         else if (arg == "-tr"   || arg == "--translate")     { params.translate     = true; }
@@ -96,6 +98,7 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "  -c ID,    --capture ID    [%-7d] capture device ID\n",                              params.capture_id);
     fprintf(stderr, "  -mt N,    --max-tokens N  [%-7d] maximum number of tokens per audio chunk\n",       params.max_tokens);
     fprintf(stderr, "  -ac N,    --audio-ctx N   [%-7d] audio context size (0 - all)\n",                   params.audio_ctx);
+    fprintf(stderr, "  -la N,    --agreement N   [%-7d] commit words agreed by N steps (0 - on full window)\n", params.agreement);
     fprintf(stderr, "  -vth N,   --vad-thold N   [%-7.2f] voice activity detection threshold\n",           params.vad_thold);
     fprintf(stderr, "  -fth N,   --freq-thold N  [%-7.2f] high-pass frequency cutoff\n",                   params.freq_thold);
     fprintf(stderr, "  -tr,      --translate     [%-7s] translate from source language to english\n",      params.translate ? "true" : "false");
@@ -129,8 +132,6 @@ int main(int argc, char ** argv) {
 
     const bool use_vad = n_samples_step <= 0; // sliding window mode uses VAD
 
-    const int n_new_line = !use_vad ? std::max(1, params.length_ms / params.step_ms - 1) : 1; // number of steps to print new line
-
     params.no_timestamps  = !use_vad;
     params.no_context    |= use_vad;
     params.max_tokens     = 0;
@@ -160,11 +161,8 @@ int main(int argc, char ** argv) {
     struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
 
     std::vector<float> pcmf32    (n_samples_30s, 0.0f);
-    std::vector<float> pcmf32_old;
     std::vector<float> pcmf32_new(n_samples_30s, 0.0f);
 
-    std::vector<whisper_token> prompt_tokens;
-
     // print some info about the processing
     {
         fprintf(stderr, "\n");
@@ -187,7 +185,7 @@ int main(int argc, char ** argv) {
                 params.no_timestamps ? 0 : 1);
 
         if (!use_vad) {
-            fprintf(stderr, "%s: n_new_line = %d, no_context = %d\n", __func__, n_new_line, params.no_context);
+            fprintf(stderr, "%s: no_context = %d\n", __func__, params.no_context);
         } else {
             fprintf(stderr, "%s: using VAD, will transcribe on speech activity\n", __func__);
         }
@@ -195,6 +193,42 @@ int main(int argc, char ** argv) {
         fprintf(stderr, "\n");
     }
 
+    whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+    wparams.print_progress   = false;
+    wparams.print_special    = params.print_special;
+    wparams.print_realtime   = false;
+    wparams.print_timestamps = !params.no_timestamps;
+    wparams.translate        = params.translate;
+    wparams.max_tokens       = params.max_tokens;
+    wparams.language         = params.language.c_str();
+    wparams.n_threads        = params.n_threads;
+
+    wparams.audio_ctx        = params.audio_ctx;
+
+    wparams.tdrz_enable      = params.tinydiarize; // [TDRZ]
+
+    // disable temperature fallback
+    //wparams.temperature_inc  = -1.0f;
+    wparams.temperature_inc  = params.no_fallback ? 0.0f : wparams.temperature_inc;
+
+    // in sliding window mode, the stream keeps the audio and the mel of the current window between the steps
+    // and passes the text that became stable as prompt, unless the context is disabled
+    struct whisper_stream * stream = nullptr;
+    if (!use_vad) {
+        whisper_stream_params sparams = whisper_stream_default_params();
+
+        sparams.step_ms   = params.step_ms;
+        sparams.length_ms = params.length_ms;
+        sparams.keep_ms   = params.keep_ms;
+
+        sparams.agreement_n = params.agreement;
+
+        wparams.n_max_text_ctx = params.no_context ? 0 : wparams.n_max_text_ctx;
+
+        stream = whisper_stream_init(ctx, sparams, wparams);
+    }
+
     int n_iter = 0;
 
     bool is_running = true;
@@ -204,6 +238,8 @@ int main(int argc, char ** argv) {
         fout.open(params.fname_out);
         if (!fout.is_open()) {
             fprintf(stderr, "%s: failed to open output file '%s'!\n", __func__, params.fname_out.c_str());
+            whisper_stream_free(stream);
+            whisper_free(ctx);
             return 1;
         }
     }
@@ -219,6 +255,34 @@ int main(int argc, char ** argv) {
 
         wavWriter.open(filename, WHISPER_SAMPLE_RATE, 16, 1);
     }
+    // print the stable segments once and the tentative ones on the current line
+    const auto print_stream_segments = [&]() {
+        printf("\33[2K\r");
+
+        // print long empty line to clear the previous line
+        printf("%s", std::string(100, ' ').c_str());
+
+        printf("\33[2K\r");
+
+        const int n_segments = whisper_stream_n_segments(stream);
+        for (int i = 0; i < n_segments; ++i) {
+            const char * text = whisper_stream_get_segment_text(stream, i);
+
+            printf("%s", text);
+
+            if (whisper_stream_get_segment_stable(stream, i)) {
+                printf("\n");
+
+                if (params.fname_out.length() > 0) {
+                    fout << text << std::endl;
+                }
+            }
+        }
+        fflush(stdout);
+    };
+
+    int ret = 0;
+
     printf("[Start speaking]\n");
     fflush(stdout);
 
@@ -240,39 +304,47 @@ int main(int argc, char ** argv) {
         // process new audio
 
         if (!use_vad) {
+            audio_ring_view view;
+
             while (true) {
-                audio.get(params.step_ms, pcmf32_new);
+                // block until a full step of new audio has been captured, handling Ctrl + C while waiting
+                if (!audio.wait(params.step_ms, 100)) {
+                    is_running = sdl_poll_events();
+                    if (!is_running) {
+                        break;
+                    }
 
-                if ((int) pcmf32_new.size() > 2*n_samples_step) {
-                    fprintf(stderr, "\n\n%s: WARNING: cannot process audio fast enough, dropping audio ...\n\n", __func__);
-                    audio.clear();
                     continue;
                 }
 
-                if ((int) pcmf32_new.size() >= n_samples_step) {
-                    audio.clear();
-                    break;
+                view = audio.view(0);
+
+                if ((int) view.size() > 2*n_samples_step) {
+                    fprintf(stderr, "\n\n%s: WARNING: cannot process audio fast enough, dropping audio ...\n\n", __func__);
+                    audio.consume(view);
+                    continue;
                 }
 
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                break;
             }
 
-            const int n_samples_new = pcmf32_new.size();
-
-            // take up to params.length_ms audio from previous iteration
-            const int n_samples_take = std::min((int) pcmf32_old.size(), std::max(0, n_samples_keep + n_samples_len - n_samples_new));
-
-            //printf("processing: take = %d, new = %d, old = %d\n", n_samples_take, n_samples_new, (int) pcmf32_old.size());
-
-            pcmf32.resize(n_samples_new + n_samples_take);
+            if (!is_running) {
+                break;
+            }
 
-            for (int i = 0; i < n_samples_take; i++) {
-                pcmf32[i] = pcmf32_old[pcmf32_old.size() - n_samples_take + i];
+            // the new audio is pushed straight from the capture ring
+            whisper_stream_push(stream, view.p0, view.n0);
+            whisper_stream_push(stream, view.p1, view.n1);
+            if (params.save_audio) {
+                wavWriter.write(view.p0, view.n0);
+                wavWriter.write(view.p1, view.n1);
             }
 
-            memcpy(pcmf32.data() + n_samples_take, pcmf32_new.data(), n_samples_new*sizeof(float));
+            if (audio.n_lost(view) > 0) {
+                fprintf(stderr, "\n\n%s: WARNING: audio overrun, %zu samples were overwritten while reading\n\n", __func__, audio.n_lost(view));
+            }
 
-            pcmf32_old = pcmf32;
+            audio.consume(view);
         } else {
             const auto t_now  = std::chrono::high_resolution_clock::now();
             const auto t_diff = std::chrono::duration_cast<std::chrono::milliseconds>(t_now - t_last).count();
@@ -297,82 +369,59 @@ int main(int argc, char ** argv) {
         }
 
         // run the inference
-        {
-            whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
-
-            wparams.print_progress   = false;
-            wparams.print_special    = params.print_special;
-            wparams.print_realtime   = false;
-            wparams.print_timestamps = !params.no_timestamps;
-            wparams.translate        = params.translate;
-            wparams.single_segment   = !use_vad;
-            wparams.max_tokens       = params.max_tokens;
-            wparams.language         = params.language.c_str();
-            wparams.n_threads        = params.n_threads;
-
-            wparams.audio_ctx        = params.audio_ctx;
+        if (!use_vad) {
+            const int res = whisper_stream_process(stream);
+            if (res < 0) {
+                fprintf(stderr, "%s: failed to process audio\n", argv[0]);
+                ret = 6;
+                break;
+            }
 
-            wparams.tdrz_enable      = params.tinydiarize; // [TDRZ]
+            if (res == 0) {
+                continue;
+            }
 
-            // disable temperature fallback
-            //wparams.temperature_inc  = -1.0f;
-            wparams.temperature_inc  = params.no_fallback ? 0.0f : wparams.temperature_inc;
+            print_stream_segments();
 
-            wparams.prompt_tokens    = params.no_context ? nullptr : prompt_tokens.data();
-            wparams.prompt_n_tokens  = params.no_context ? 0       : prompt_tokens.size();
+            ++n_iter;
+        } else {
+            wparams.single_segment = false;
 
             if (whisper_full(ctx, wparams, pcmf32.data(), pcmf32.size()) != 0) {
                 fprintf(stderr, "%s: failed to process audio\n", argv[0]);
-                return 6;
+                ret = 6;
+                break;
             }
 
             // print result;
             {
-                if (!use_vad) {
-                    printf("\33[2K\r");
-
-                    // print long empty line to clear the previous line
-                    printf("%s", std::string(100, ' ').c_str());
-
-                    printf("\33[2K\r");
-                } else {
-                    const int64_t t1 = (t_last - t_start).count()/1000000;
-                    const int64_t t0 = std::max(0.0, t1 - pcmf32.size()*1000.0/WHISPER_SAMPLE_RATE);
+                const int64_t t1 = (t_last - t_start).count()/1000000;
+                const int64_t t0 = std::max(0.0, t1 - pcmf32.size()*1000.0/WHISPER_SAMPLE_RATE);
 
-                    printf("\n");
-                    printf("### Transcription %d START | t0 = %d ms | t1 = %d ms\n", n_iter, (int) t0, (int) t1);
-                    printf("\n");
-                }
+                printf("\n");
+                printf("### Transcription %d START | t0 = %d ms | t1 = %d ms\n", n_iter, (int) t0, (int) t1);
+                printf("\n");
 
                 const int n_segments = whisper_full_n_segments(ctx);
                 for (int i = 0; i < n_segments; ++i) {
                     const char * text = whisper_full_get_segment_text(ctx, i);
 
-                    if (params.no_timestamps) {
-                        printf("%s", text);
-                        fflush(stdout);
-
-                        if (params.fname_out.length() > 0) {
-                            fout << text;
-                        }
-                    } else {
-                        const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-                        const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+                    const int64_t seg_t0 = whisper_full_get_segment_t0(ctx, i);
+                    const int64_t seg_t1 = whisper_full_get_segment_t1(ctx, i);
 
-                        std::string output = "[" + to_timestamp(t0, false) + " --> " + to_timestamp(t1, false) + "]  " + text;
+                    std::string output = "[" + to_timestamp(seg_t0, false) + " --> " + to_timestamp(seg_t1, false) + "]  " + text;
 
-                        if (whisper_full_get_segment_speaker_turn_next(ctx, i)) {
-                            output += " [SPEAKER_TURN]";
-                        }
+                    if (whisper_full_get_segment_speaker_turn_next(ctx, i)) {
+                        output += " [SPEAKER_TURN]";
+                    }
 
-                        output += "\n";
+                    output += "\n";
 
-                        printf("%s", output.c_str());
-                        fflush(stdout);
+                    printf("%s", output.c_str());
+                    fflush(stdout);
 
-                        if (params.fname_out.length() > 0) {
-                            fout << output;
-                        }
+                    if (params.fname_out.length() > 0) {
+                        fout << output;
                     }
                 }
 
@@ -380,41 +429,39 @@ int main(int argc, char ** argv) {
                     fout << std::endl;
                 }
 
-                if (use_vad) {
-                    printf("\n");
-                    printf("### Transcription %d END\n", n_iter);
-                }
+                printf("\n");
+                printf("### Transcription %d END\n", n_iter);
             }
 
             ++n_iter;
 
-            if (!use_vad && (n_iter % n_new_line) == 0) {
-                printf("\n");
-
-                // keep part of the audio for next iteration to try to mitigate word boundary issues
-                pcmf32_old = std::vector<float>(pcmf32.end() - n_samples_keep, pcmf32.end());
-
-                // Add tokens of the last full length segment as the prompt
-                if (!params.no_context) {
-                    prompt_tokens.clear();
-
-                    const int n_segments = whisper_full_n_segments(ctx);
-                    for (int i = 0; i < n_segments; ++i) {
-                        const int token_count = whisper_full_n_tokens(ctx, i);
-                        for (int j = 0; j < token_count; ++j) {
-                            prompt_tokens.push_back(whisper_full_get_token_id(ctx, i, j));
-                        }
-                    }
-                }
-            }
             fflush(stdout);
         }
     }
 
     audio.pause();
 
+    // decode the audio captured since the last step and print the text that was not committed yet
+    if (stream && ret == 0) {
+        audio.consume(pcmf32_new);
+        if (params.save_audio) {
+            wavWriter.write(pcmf32_new.data(), pcmf32_new.size());
+        }
+        whisper_stream_push(stream, pcmf32_new.data(), pcmf32_new.size());
+
+        const int res = whisper_stream_flush(stream);
+        if (res < 0) {
+            fprintf(stderr, "%s: failed to process audio\n", argv[0]);
+            ret = 6;
+        } else if (res > 0) {
+            print_stream_segments();
+        }
+    }
+
+    whisper_stream_free(stream);
+
     whisper_print_timings(ctx);
     whisper_free(ctx);
 
-    return 0;
+    return ret;
 }
@@ -7,8 +7,12 @@
 #include "llama.h"
 
 #include <cassert>
+#include <condition_variable>
 #include <cstdio>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <mutex>
 #include <regex>
 #include <string>
 #include <thread>
@@ -54,6 +58,7 @@ static std::string llama_token_to_piece(const struct llama_context * ctx, llama_
 // command-line parameters
 struct whisper_params {
     int32_t n_threads  = std::min(4, (int32_t) std::thread::hardware_concurrency());
+    int32_t n_threads_llama = n_threads;
     int32_t voice_ms   = 10000;
     int32_t capture_id = -1;
     int32_t max_tokens = 32;
@@ -70,6 +75,7 @@ struct whisper_params {
     bool verbose_prompt = false;
     bool use_gpu        = true;
     bool flash_attn     = false;
+    bool pipeline       = false;
 
     std::string person      = "Georgi";
     std::string bot_name    = "LLaMA";
@@ -88,6 +94,8 @@ struct whisper_params {
 void whisper_print_usage(int argc, char ** argv, const whisper_params & params);
 
 static bool whisper_params_parse(int argc, char ** argv, whisper_params & params) {
+    bool has_threads_llama = false;
+
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
 
@@ -96,6 +104,7 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
             exit(0);
         }
         else if (arg == "-t"   || arg == "--threads")        { params.n_threads      = std::stoi(argv[++i]); }
+        else if (arg == "-tl"  || arg == "--threads-llama")  { params.n_threads_llama = std::stoi(argv[++i]); has_threads_llama = true; }
         else if (arg == "-vms" || arg == "--voice-ms")       { params.voice_ms       = std::stoi(argv[++i]); }
         else if (arg == "-c"   || arg == "--capture")        { params.capture_id     = std::stoi(argv[++i]); }
         else if (arg == "-mt"  || arg == "--max-tokens")     { params.max_tokens     = std::stoi(argv[++i]); }
@@ -109,6 +118,7 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-vp"  || arg == "--verbose-prompt") { params.verbose_prompt = true; }
         else if (arg == "-ng"  || arg == "--no-gpu")         { params.use_gpu        = false; }
         else if (arg == "-fa"  || arg == "--flash-attn")     { params.flash_attn     = true; }
+        else if (arg == "-pl"  || arg == "--pipeline")       { params.pipeline       = true; }
         else if (arg == "-p"   || arg == "--person")         { params.person         = argv[++i]; }
         else if (arg == "-bn"   || arg == "--bot-name")      { params.bot_name       = argv[++i]; }
         else if (arg == "--session")                         { params.path_session   = argv[++i]; }
@@ -134,6 +144,10 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         }
     }
 
+    if (!has_threads_llama) {
+        params.n_threads_llama = params.n_threads;
+    }
+
     return true;
 }
 
@@ -142,33 +156,35 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "usage: %s [options]\n", argv[0]);
     fprintf(stderr, "\n");
     fprintf(stderr, "options:\n");
-    fprintf(stderr, "  -h,       --help           [default] show this help message and exit\n");
-    fprintf(stderr, "  -t N,     --threads N      [%-7d] number of threads to use during computation\n", params.n_threads);
-    fprintf(stderr, "  -vms N,   --voice-ms N     [%-7d] voice duration in milliseconds\n",              params.voice_ms);
-    fprintf(stderr, "  -c ID,    --capture ID     [%-7d] capture device ID\n",                           params.capture_id);
-    fprintf(stderr, "  -mt N,    --max-tokens N   [%-7d] maximum number of tokens per audio chunk\n",    params.max_tokens);
-    fprintf(stderr, "  -ac N,    --audio-ctx N    [%-7d] audio context size (0 - all)\n",                params.audio_ctx);
-    fprintf(stderr, "  -ngl N,   --n-gpu-layers N [%-7d] number of layers to store in VRAM\n",           params.n_gpu_layers);
-    fprintf(stderr, "  -vth N,   --vad-thold N    [%-7.2f] voice activity detection threshold\n",        params.vad_thold);
-    fprintf(stderr, "  -fth N,   --freq-thold N   [%-7.2f] high-pass frequency cutoff\n",                params.freq_thold);
-    fprintf(stderr, "  -tr,      --translate      [%-7s] translate from source language to english\n",   params.translate ? "true" : "false");
-    fprintf(stderr, "  -ps,      --print-special  [%-7s] print special tokens\n",                        params.print_special ? "true" : "false");
-    fprintf(stderr, "  -pe,      --print-energy   [%-7s] print sound energy (for debugging)\n",          params.print_energy ? "true" : "false");
-    fprintf(stderr, "  -vp,      --verbose-prompt [%-7s] print prompt at start\n",                       params.verbose_prompt ? "true" : "false");
-    fprintf(stderr, "  -ng,      --no-gpu         [%-7s] disable GPU\n",                                 params.use_gpu ? "false" : "true");
-    fprintf(stderr, "  -fa,      --flash-attn     [%-7s] flash attention\n",                             params.flash_attn ? "true" : "false");
-    fprintf(stderr, "  -p NAME,  --person NAME    [%-7s] person name (for prompt selection)\n",          params.person.c_str());
-    fprintf(stderr, "  -bn NAME, --bot-name NAME  [%-7s] bot name (to display)\n",                       params.bot_name.c_str());
-    fprintf(stderr, "  -w TEXT,  --wake-command T [%-7s] wake-up command to listen for\n",               params.wake_cmd.c_str());
-    fprintf(stderr, "  -ho TEXT, --heard-ok TEXT  [%-7s] said by TTS before generating reply\n",         params.heard_ok.c_str());
-    fprintf(stderr, "  -l LANG,  --language LANG  [%-7s] spoken language\n",                             params.language.c_str());
-    fprintf(stderr, "  -mw FILE, --model-whisper  [%-7s] whisper model file\n",                          params.model_wsp.c_str());
-    fprintf(stderr, "  -ml FILE, --model-llama    [%-7s] llama model file\n",                            params.model_llama.c_str());
-    fprintf(stderr, "  -s FILE,  --speak TEXT     [%-7s] command for TTS\n",                             params.speak.c_str());
-    fprintf(stderr, "  -sf FILE, --speak-file     [%-7s] file to pass to TTS\n",                         params.speak_file.c_str());
-    fprintf(stderr, "  --prompt-file FNAME        [%-7s] file with custom prompt to start dialog\n",     "");
-    fprintf(stderr, "  --session FNAME                   file to cache model state in (may be large!) (default: none)\n");
-    fprintf(stderr, "  -f FNAME, --file FNAME     [%-7s] text output file name\n",                       params.fname_out.c_str());
+    fprintf(stderr, "  -h,       --help            [default] show this help message and exit\n");
+    fprintf(stderr, "  -t N,     --threads N       [%-7d] number of threads to use during computation\n", params.n_threads);
+    fprintf(stderr, "  -tl N,    --threads-llama N [%-7d] number of threads to use for LLaMA inference\n",  params.n_threads_llama);
+    fprintf(stderr, "  -vms N,   --voice-ms N      [%-7d] voice duration in milliseconds\n",              params.voice_ms);
+    fprintf(stderr, "  -c ID,    --capture ID      [%-7d] capture device ID\n",                           params.capture_id);
+    fprintf(stderr, "  -mt N,    --max-tokens N    [%-7d] maximum number of tokens per audio chunk\n",    params.max_tokens);
+    fprintf(stderr, "  -ac N,    --audio-ctx N     [%-7d] audio context size (0 - all)\n",                params.audio_ctx);
+    fprintf(stderr, "  -ngl N,   --n-gpu-layers N  [%-7d] number of layers to store in VRAM\n",           params.n_gpu_layers);
+    fprintf(stderr, "  -vth N,   --vad-thold N     [%-7.2f] voice activity detection threshold\n",        params.vad_thold);
+    fprintf(stderr, "  -fth N,   --freq-thold N    [%-7.2f] high-pass frequency cutoff\n",                params.freq_thold);
+    fprintf(stderr, "  -tr,      --translate       [%-7s] translate from source language to english\n",   params.translate ? "true" : "false");
+    fprintf(stderr, "  -ps,      --print-special   [%-7s] print special tokens\n",                        params.print_special ? "true" : "false");
+    fprintf(stderr, "  -pe,      --print-energy    [%-7s] print sound energy (for debugging)\n",          params.print_energy ? "true" : "false");
+    fprintf(stderr, "  -vp,      --verbose-prompt  [%-7s] print prompt at start\n",                       params.verbose_prompt ? "true" : "false");
+    fprintf(stderr, "  -ng,      --no-gpu          [%-7s] disable GPU\n",                                 params.use_gpu ? "false" : "true");
+    fprintf(stderr, "  -fa,      --flash-attn      [%-7s] flash attention\n",                             params.flash_attn ? "true" : "false");
+    fprintf(stderr, "  -pl,      --pipeline        [%-7s] prefill LLaMA while whisper is still transcribing\n", params.pipeline ? "true" : "false");
+    fprintf(stderr, "  -p NAME,  --person NAME     [%-7s] person name (for prompt selection)\n",          params.person.c_str());
+    fprintf(stderr, "  -bn NAME, --bot-name NAME   [%-7s] bot name (to display)\n",                       params.bot_name.c_str());
+    fprintf(stderr, "  -w TEXT,  --wake-command T  [%-7s] wake-up command to listen for\n",               params.wake_cmd.c_str());
+    fprintf(stderr, "  -ho TEXT, --heard-ok TEXT   [%-7s] said by TTS before generating reply\n",         params.heard_ok.c_str());
+    fprintf(stderr, "  -l LANG,  --language LANG   [%-7s] spoken language\n",                             params.language.c_str());
+    fprintf(stderr, "  -mw FILE, --model-whisper   [%-7s] whisper model file\n",                          params.model_wsp.c_str());
+    fprintf(stderr, "  -ml FILE, --model-llama     [%-7s] llama model file\n",                            params.model_llama.c_str());
+    fprintf(stderr, "  -s FILE,  --speak TEXT      [%-7s] command for TTS\n",                             params.speak.c_str());
+    fprintf(stderr, "  -sf FILE, --speak-file      [%-7s] file to pass to TTS\n",                         params.speak_file.c_str());
+    fprintf(stderr, "  --prompt-file FNAME         [%-7s] file with custom prompt to start dialog\n",     "");
+    fprintf(stderr, "  --session FNAME                    file to cache model state in (may be large!) (default: none)\n");
+    fprintf(stderr, "  -f FNAME, --file FNAME      [%-7s] text output file name\n",                       params.fname_out.c_str());
     fprintf(stderr, "\n");
 }
 
@@ -239,6 +255,178 @@ static std::string transcribe(
     return result;
 }
 
+// text handed from the whisper thread to the LLaMA prefill thread
+struct text_queue {
+    std::mutex              mutex;
+    std::condition_variable cv;
+    std::deque<std::string> texts;
+    bool                    closed = false;
+
+    void push(const std::string & text) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            texts.push_back(text);
+        }
+        cv.notify_one();
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        cv.notify_one();
+    }
+
+    // blocks until a text is available - returns false once the queue is closed and drained
+    bool pop(std::string & text) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return !texts.empty() || closed; });
+        if (texts.empty()) {
+            return false;
+        }
+        text = std::move(texts.front());
+        texts.pop_front();
+        return true;
+    }
+};
+
+struct transcribe_pipelined_data {
+    std::function<void(const std::string &)> on_text;
+
+    float prob   = 0.0f;
+    int   prob_n = 0;
+};
+
+static void transcribe_pipelined_new_segment(struct whisper_context * ctx, struct whisper_state * /*state*/, int n_new, void * user_data) {
+    auto & data = *(transcribe_pipelined_data *) user_data;
+
+    const int n_segments = whisper_full_n_segments(ctx);
+    for (int i = n_segments - n_new; i < n_segments; ++i) {
+        const int n_tokens = whisper_full_n_tokens(ctx, i);
+        for (int j = 0; j < n_tokens; ++j) {
+            data.prob += whisper_full_get_token_data(ctx, i, j).p;
+            ++data.prob_n;
+        }
+
+        data.on_text(whisper_full_get_segment_text(ctx, i));
+    }
+}
+
+// transcribe the speech regions of the audio one by one, handing each new segment to on_text as soon as it is decoded
+// this lets the caller start consuming the beginning of the utterance while the rest is still being transcribed
+static void transcribe_pipelined(
+        whisper_context * ctx,
+        const whisper_params & params,
+        const std::vector<float> & pcmf32,
+        const std::string prompt_text,
+        const std::function<void(const std::string &)> & on_text,
+        float & prob,
+        int64_t & t_ms) {
+    const auto t_start = std::chrono::high_resolution_clock::now();
+
+    prob = 0.0f;
+    t_ms = 0;
+
+    // split the audio on short pauses
+    std::vector<std::pair<int, int>> regions;
+    {
+        whisper_vad_params vparams = whisper_vad_default_params();
+        vparams.min_silence_duration_ms = 300;
+
+        whisper_vad_segments * segments = whisper_vad_segments_from_samples(vparams, pcmf32.data(), pcmf32.size(), params.n_threads);
+        if (segments) {
+            for (int i = 0; i < whisper_vad_segments_n_segments(segments); ++i) {
+                const int i0 = std::max<int64_t>(0,             whisper_vad_segments_get_segment_t0(segments, i)*WHISPER_SAMPLE_RATE/100);
+                const int i1 = std::min<int64_t>(pcmf32.size(), whisper_vad_segments_get_segment_t1(segments, i)*WHISPER_SAMPLE_RATE/100);
+                if (i1 > i0) {
+                    regions.emplace_back(i0, i1);
+                }
+            }
+            whisper_vad_free_segments(segments);
+        }
+
+        if (regions.empty()) {
+            regions.emplace_back(0, (int) pcmf32.size());
+        }
+    }
+
+    transcribe_pipelined_data data;
+    data.on_text = on_text;
+
+    // the text heard so far is used as prompt for the next region
+    std::string heard;
+
+    for (const auto & region : regions) {
+        std::vector<whisper_token> prompt_tokens(1024);
+        const std::string prompt = prompt_text + heard;
+        prompt_tokens.resize(std::max(0, whisper_tokenize(ctx, prompt.c_str(), prompt_tokens.data(), prompt_tokens.size())));
+
+        whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+        wparams.print_progress   = false;
+        wparams.print_special    = params.print_special;
+        wparams.print_realtime   = false;
+        wparams.print_timestamps = !params.no_timestamps;
+        wparams.translate        = params.translate;
+        wparams.no_context       = true;
+        wparams.single_segment   = true;
+        wparams.max_tokens       = params.max_tokens;
+        wparams.language         = params.language.c_str();
+        wparams.n_threads        = params.n_threads;
+
+        wparams.prompt_tokens    = prompt_tokens.empty() ? nullptr : prompt_tokens.data();
+        wparams.prompt_n_tokens  = prompt_tokens.empty() ? 0       : prompt_tokens.size();
+
+        wparams.audio_ctx        = params.audio_ctx;
+
+        wparams.new_segment_callback           = transcribe_pipelined_new_segment;
+        wparams.new_segment_callback_user_data = &data;
+
+        if (whisper_full(ctx, wparams, pcmf32.data() + region.first, region.second - region.first) != 0) {
+            break;
+        }
+
+        for (int i = 0; i < whisper_full_n_segments(ctx); ++i) {
+            heard += whisper_full_get_segment_text(ctx, i);
+        }
+    }
+
+    if (data.prob_n > 0) {
+        prob = data.prob / data.prob_n;
+    }
+
+    const auto t_end = std::chrono::high_resolution_clock::now();
+    t_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t_end - t_start).count();
+}
+
+// keep only the spoken text of a transcription
+static std::string clean_heard(std::string text) {
+    // remove text between brackets using regex
+    {
+        std::regex re("\\[.*?\\]");
+        text = std::regex_replace(text, re, "");
+    }
+
+    // remove text between brackets using regex
+    {
+        std::regex re("\\(.*?\\)");
+        text = std::regex_replace(text, re, "");
+    }
+
+    // remove all characters, except for letters, numbers, punctuation and ':', '\'', '-', ' '
+    text = std::regex_replace(text, std::regex("[^a-zA-Z0-9\\.,\\?!\\s\\:\\'\\-]"), "");
+
+    // take first line
+    text = text.substr(0, text.find_first_of('\n'));
+
+    // remove leading and trailing whitespace
+    text = std::regex_replace(text, std::regex("^\\s+"), "");
+    text = std::regex_replace(text, std::regex("\\s+$"), "");
+
+    return text;
+}
+
 static std::vector<std::string> get_words(const std::string &txt) {
     std::vector<std::string> words;
 
@@ -320,7 +508,8 @@ int main(int argc, char ** argv) {
 
     // tune these to your liking
     lcparams.n_ctx      = 2048;
-    lcparams.n_threads  = params.n_threads;
+    lcparams.n_threads  = params.n_threads_llama;
+    lcparams.n_threads_batch = params.n_threads_llama;
     lcparams.flash_attn = params.flash_attn;
 
     struct llama_context * ctx_llama = llama_init_from_model(model_llama, lcparams);
@@ -336,12 +525,14 @@ int main(int argc, char ** argv) {
                 fprintf(stderr, "%s: WARNING: model is not multilingual, ignoring language and translation options\n", __func__);
             }
         }
-        fprintf(stderr, "%s: processing, %d threads, lang = %s, task = %s, timestamps = %d ...\n",
+        fprintf(stderr, "%s: processing, %d + %d threads (whisper + llama), lang = %s, task = %s, timestamps = %d, pipeline = %d ...\n",
                 __func__,
                 params.n_threads,
+                params.n_threads_llama,
                 params.language.c_str(),
                 params.translate ? "translate" : "transcribe",
-                params.no_timestamps ? 0 : 1);
+                params.no_timestamps ? 0 : 1,
+                params.pipeline ? 1 : 0);
 
         fprintf(stderr, "\n");
     }
@@ -545,6 +736,80 @@ int main(int argc, char ** argv) {
         params.person + chat_symb,
     };
 
+    // evaluate the pending tokens and append them to the context
+    auto eval_embd = [&](std::vector<llama_token> & tokens) {
+        if (tokens.size() > 0) {
+            if (n_past + (int) tokens.size() > n_ctx) {
+                n_past = n_keep;
+
+                // insert n_left/2 tokens at the start of embd from last_n_tokens
+                tokens.insert(tokens.begin(), embd_inp.begin() + embd_inp.size() - n_prev, embd_inp.end());
+                // stop saving session if we run out of context
+                path_session = "";
+                //printf("\n---\n");
+                //printf("resetting: '");
+                //for (int i = 0; i < (int) tokens.size(); i++) {
+                //    printf("%s", llama_token_to_piece(ctx_llama, tokens[i]));
+                //}
+                //printf("'\n");
+                //printf("\n---\n");
+            }
+
+            // try to reuse a matching prefix from the loaded session instead of re-eval (via n_past)
+            // REVIEW
+            if (n_session_consumed < (int) session_tokens.size()) {
+                size_t i = 0;
+                for ( ; i < tokens.size(); i++) {
+                    if (tokens[i] != session_tokens[n_session_consumed]) {
+                        session_tokens.resize(n_session_consumed);
+                        break;
+                    }
+
+                    n_past++;
+                    n_session_consumed++;
+
+                    if (n_session_consumed >= (int) session_tokens.size()) {
+                        i++;
+                        break;
+                    }
+                }
+                if (i > 0) {
+                    tokens.erase(tokens.begin(), tokens.begin() + i);
+                }
+            }
+
+            if (tokens.size() > 0 && !path_session.empty()) {
+                session_tokens.insert(session_tokens.end(), tokens.begin(), tokens.end());
+                n_session_consumed = session_tokens.size();
+            }
+
+            // prepare batch
+            {
+                batch.n_tokens = tokens.size();
+
+                for (int i = 0; i < batch.n_tokens; i++) {
+                    batch.token[i]     = tokens[i];
+                    batch.pos[i]       = n_past + i;
+                    batch.n_seq_id[i]  = 1;
+                    batch.seq_id[i][0] = 0;
+                    batch.logits[i]    = i == batch.n_tokens - 1;
+                }
+            }
+
+            if (llama_decode(ctx_llama, batch)) {
+                fprintf(stderr, "%s : failed to decode\n", __func__);
+                return false;
+            }
+        }
+
+        embd_inp.insert(embd_inp.end(), tokens.begin(), tokens.end());
+        n_past += tokens.size();
+
+        tokens.clear();
+
+        return true;
+    };
+
     // main loop
     while (is_running) {
         // handle Ctrl + C
@@ -565,161 +830,181 @@ int main(int argc, char ** argv) {
             if (::vad_simple(pcmf32_cur, WHISPER_SAMPLE_RATE, 1250, params.vad_thold, params.freq_thold, params.print_energy) || force_speak) {
                 //fprintf(stdout, "%s: Speech detected! Processing ...\n", __func__);
 
+                const auto t_speech_end = std::chrono::high_resolution_clock::now();
+
                 audio.get(params.voice_ms, pcmf32_cur);
 
-                std::string all_heard;
+                if (params.pipeline && !force_speak) {
+                    // the LLaMA prompt is prefilled on a separate thread with the heard text, while whisper keeps
+                    // transcribing the rest of the utterance
+                    text_queue queue;
 
-                if (!force_speak) {
-                    all_heard = ::trim(::transcribe(ctx_wsp, params, pcmf32_cur, prompt_whisper, prob0, t_ms));
-                }
+                    bool prefill_ok = true;
 
-                const auto words = get_words(all_heard);
+                    std::thread prefill([&]() {
+                        std::string text;
+                        while (queue.pop(text)) {
+                            std::vector<llama_token> tokens = ::llama_tokenize(ctx_llama, text, false);
+                            if (!eval_embd(tokens)) {
+                                prefill_ok = false;
+                                break;
+                            }
+                        }
+                    });
 
-                std::string wake_cmd_heard;
-                std::string text_heard;
+                    std::string all_heard;
+                    bool        accepted = false; // the wake-up command has been heard, if enabled
+                    bool        rejected = false;
+                    int         n_sent   = 0;     // number of words handed to the prefill thread
+                    int         n_pushed = 0;     // number of non-empty texts handed to the prefill thread
 
-                for (int i = 0; i < (int) words.size(); ++i) {
-                    if (i < wake_cmd_length) {
-                        wake_cmd_heard += words[i] + " ";
-                    } else {
-                        text_heard += words[i] + " ";
-                    }
-                }
+                    auto on_text = [&](const std::string & text) {
+                        if (rejected) {
+                            return;
+                        }
 
-                // check if audio starts with the wake-up command if enabled
-                if (use_wake_cmd) {
-                    const float sim = similarity(wake_cmd_heard, wake_cmd);
+                        all_heard += text;
 
-                    if ((sim < 0.7f) || (text_heard.empty())) {
-                        audio.clear();
-                        continue;
-                    }
-                }
+                        const auto words = get_words(all_heard);
 
-                // optionally give audio feedback that the current text is being processed
-                if (!params.heard_ok.empty()) {
-                    speak_with_file(params.speak, params.heard_ok, params.speak_file, voice_id);
-                }
+                        if (!accepted) {
+                            if ((int) words.size() <= wake_cmd_length) {
+                                return;
+                            }
 
-                // remove text between brackets using regex
-                {
-                    std::regex re("\\[.*?\\]");
-                    text_heard = std::regex_replace(text_heard, re, "");
-                }
+                            if (use_wake_cmd) {
+                                std::string wake_cmd_heard;
+                                for (int i = 0; i < wake_cmd_length; ++i) {
+                                    wake_cmd_heard += words[i] + " ";
+                                }
 
-                // remove text between brackets using regex
-                {
-                    std::regex re("\\(.*?\\)");
-                    text_heard = std::regex_replace(text_heard, re, "");
-                }
+                                if (similarity(wake_cmd_heard, wake_cmd) < 0.7f) {
+                                    rejected = true;
+                                    return;
+                                }
+                            }
 
-                // remove all characters, except for letters, numbers, punctuation and ':', '\'', '-', ' '
-                text_heard = std::regex_replace(text_heard, std::regex("[^a-zA-Z0-9\\.,\\?!\\s\\:\\'\\-]"), "");
+                            accepted = true;
+                            n_sent   = wake_cmd_length;
+                        }
 
-                // take first line
-                text_heard = text_heard.substr(0, text_heard.find_first_of('\n'));
+                        std::string text_new;
+                        for (int i = n_sent; i < (int) words.size(); ++i) {
+                            text_new += words[i] + " ";
+                        }
+                        n_sent = words.size();
 
-                // remove leading and trailing whitespace
-                text_heard = std::regex_replace(text_heard, std::regex("^\\s+"), "");
-                text_heard = std::regex_replace(text_heard, std::regex("\\s+$"), "");
+                        text_new = clean_heard(text_new);
+                        if (text_new.empty()) {
+                            return;
+                        }
 
-                const std::vector<llama_token> tokens = llama_tokenize(ctx_llama, text_heard.c_str(), false);
+                        text_new.insert(0, 1, ' ');
+                        fprintf(stdout, "%s%s%s", "\033[1m", text_new.c_str(), "\033[0m");
+                        fflush(stdout);
 
-                if (text_heard.empty() || tokens.empty() || force_speak) {
-                    //fprintf(stdout, "%s: Heard nothing, skipping ...\n", __func__);
-                    audio.clear();
+                        queue.push(text_new);
+                        n_pushed++;
+                    };
 
-                    continue;
-                }
+                    ::transcribe_pipelined(ctx_wsp, params, pcmf32_cur, prompt_whisper, on_text, prob0, t_ms);
 
-                force_speak = false;
+                    const bool heard = accepted && !rejected && n_pushed > 0;
 
-                text_heard.insert(0, 1, ' ');
-                text_heard += "\n" + params.bot_name + chat_symb;
-                fprintf(stdout, "%s%s%s", "\033[1m", text_heard.c_str(), "\033[0m");
-                fflush(stdout);
+                    if (heard) {
+                        const std::string text_bot = "\n" + params.bot_name + chat_symb;
+                        fprintf(stdout, "%s%s%s", "\033[1m", text_bot.c_str(), "\033[0m");
+                        fflush(stdout);
 
-                embd = ::llama_tokenize(ctx_llama, text_heard, false);
+                        queue.push(text_bot);
+                    }
 
-                // Append the new input tokens to the session_tokens vector
-                if (!path_session.empty()) {
-                    session_tokens.insert(session_tokens.end(), tokens.begin(), tokens.end());
-                }
+                    queue.close();
+                    prefill.join();
 
-                // text inference
-                bool done = false;
-                std::string text_to_speak;
-                while (true) {
-                    // predict
-                    if (embd.size() > 0) {
-                        if (n_past + (int) embd.size() > n_ctx) {
-                            n_past = n_keep;
-
-                            // insert n_left/2 tokens at the start of embd from last_n_tokens
-                            embd.insert(embd.begin(), embd_inp.begin() + embd_inp.size() - n_prev, embd_inp.end());
-                            // stop saving session if we run out of context
-                            path_session = "";
-                            //printf("\n---\n");
-                            //printf("resetting: '");
-                            //for (int i = 0; i < (int) embd.size(); i++) {
-                            //    printf("%s", llama_token_to_piece(ctx_llama, embd[i]));
-                            //}
-                            //printf("'\n");
-                            //printf("\n---\n");
-                        }
+                    if (!prefill_ok) {
+                        return 1;
+                    }
 
-                        // try to reuse a matching prefix from the loaded session instead of re-eval (via n_past)
-                        // REVIEW
-                        if (n_session_consumed < (int) session_tokens.size()) {
-                            size_t i = 0;
-                            for ( ; i < embd.size(); i++) {
-                                if (embd[i] != session_tokens[n_session_consumed]) {
-                                    session_tokens.resize(n_session_consumed);
-                                    break;
-                                }
+                    if (!heard) {
+                        audio.clear();
+                        continue;
+                    }
 
-                                n_past++;
-                                n_session_consumed++;
+                    // optionally give audio feedback that the current text is being processed
+                    if (!params.heard_ok.empty()) {
+                        speak_with_file(params.speak, params.heard_ok, params.speak_file, voice_id);
+                    }
+                } else {
+                    std::string all_heard;
 
-                                if (n_session_consumed >= (int) session_tokens.size()) {
-                                    i++;
-                                    break;
-                                }
-                            }
-                            if (i > 0) {
-                                embd.erase(embd.begin(), embd.begin() + i);
-                            }
-                        }
+                    if (!force_speak) {
+                        all_heard = ::trim(::transcribe(ctx_wsp, params, pcmf32_cur, prompt_whisper, prob0, t_ms));
+                    }
 
-                        if (embd.size() > 0 && !path_session.empty()) {
-                            session_tokens.insert(session_tokens.end(), embd.begin(), embd.end());
-                            n_session_consumed = session_tokens.size();
-                        }
+                    const auto words = get_words(all_heard);
 
-                        // prepare batch
-                        {
-                            batch.n_tokens = embd.size();
+                    std::string wake_cmd_heard;
+                    std::string text_heard;
 
-                            for (int i = 0; i < batch.n_tokens; i++) {
-                                batch.token[i]     = embd[i];
-                                batch.pos[i]       = n_past + i;
-                                batch.n_seq_id[i]  = 1;
-                                batch.seq_id[i][0] = 0;
-                                batch.logits[i]    = i == batch.n_tokens - 1;
-                            }
+                    for (int i = 0; i < (int) words.size(); ++i) {
+                        if (i < wake_cmd_length) {
+                            wake_cmd_heard += words[i] + " ";
+                        } else {
+                            text_heard += words[i] + " ";
                         }
+                    }
+
+                    // check if audio starts with the wake-up command if enabled
+                    if (use_wake_cmd) {
+                        const float sim = similarity(wake_cmd_heard, wake_cmd);
 
-                        if (llama_decode(ctx_llama, batch)) {
-                            fprintf(stderr, "%s : failed to decode\n", __func__);
-                            return 1;
+                        if ((sim < 0.7f) || (text_heard.empty())) {
+                            audio.clear();
+                            continue;
                         }
                     }
 
+                    // optionally give audio feedback that the current text is being processed
+                    if (!params.heard_ok.empty()) {
+                        speak_with_file(params.speak, params.heard_ok, params.speak_file, voice_id);
+                    }
 
-                    embd_inp.insert(embd_inp.end(), embd.begin(), embd.end());
-                    n_past += embd.size();
+                    text_heard = clean_heard(text_heard);
 
-                    embd.clear();
+                    const std::vector<llama_token> tokens = llama_tokenize(ctx_llama, text_heard.c_str(), false);
+
+                    if (text_heard.empty() || tokens.empty() || force_speak) {
+                        //fprintf(stdout, "%s: Heard nothing, skipping ...\n", __func__);
+                        audio.clear();
+
+                        continue;
+                    }
+
+                    text_heard.insert(0, 1, ' ');
+                    text_heard += "\n" + params.bot_name + chat_symb;
+                    fprintf(stdout, "%s%s%s", "\033[1m", text_heard.c_str(), "\033[0m");
+                    fflush(stdout);
+
+                    embd = ::llama_tokenize(ctx_llama, text_heard, false);
+
+                    // Append the new input tokens to the session_tokens vector
+                    if (!path_session.empty()) {
+                        session_tokens.insert(session_tokens.end(), tokens.begin(), tokens.end());
+                    }
+                }
+
+                force_speak = false;
+
+                // text inference
+                bool done = false;
+                bool first = true;
+                std::string text_to_speak;
+                while (true) {
+                    // predict
+                    if (!eval_embd(embd)) {
+                        return 1;
+                    }
 
                     if (done) break;
 
@@ -733,6 +1018,14 @@ int main(int argc, char ** argv) {
 
                         const llama_token id = llama_sampler_sample(smpl, ctx_llama, -1);
 
+                        if (first && params.pipeline) {
+                            first = false;
+
+                            const auto t_first = std::chrono::high_resolution_clock::now();
+                            fprintf(stderr, " [transcribed in %d ms, first reply token after %d ms] ", (int) t_ms,
+                                    (int) std::chrono::duration_cast<std::chrono::milliseconds>(t_first - t_speech_end).count());
+                        }
+
                         if (id != llama_vocab_eos(vocab_llama)) {
                             // add it to the context
                             embd.push_back(id);
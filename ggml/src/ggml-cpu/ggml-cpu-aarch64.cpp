@@ -52,6 +52,14 @@ struct block_iq4_nlx4 {
 
 static_assert(sizeof(block_iq4_nlx4) == 4 * sizeof(ggml_half) + QK4_NL * 2, "wrong iq4_nlx4 block size/padding");
 
+struct block_q5_0x8 {
+    ggml_half d[8];            // deltas for 8 q5_0 blocks
+    uint8_t   qh[QK5_0];       // 5-th bits for 8 q5_0 blocks, byte k of each block's qh interleaved
+    uint8_t   qs[QK5_0 * 4];   // nibbles for 8 q5_0 blocks
+};
+
+static_assert(sizeof(block_q5_0x8) == 8 * sizeof(ggml_half) + QK5_0 * 5, "wrong q5_0x8 block size/padding");
+
 #if defined(__GNUC__)
 #pragma GCC diagnostic ignored "-Woverlength-strings"
 #elif defined(_MSC_VER)
@@ -114,7 +122,7 @@ static inline __m512 __avx512_repeat_f32cx16_load(__m128i x) {
     return _mm512_loadu_ps(tmp);
 }
 #endif
-static inline __m256 __avx_f32cx8_load(ggml_fp16_t *x) {
+static inline __m256 __avx_f32cx8_load(const ggml_fp16_t *x) {
     float tmp[8];
 
     for (int i = 0; i < 8; i++) {
@@ -223,6 +231,132 @@ static inline __m256i mul_sum_i8_pairs_int32x8(const __m256i x, const __m256i y)
 }
 #endif
 
+#if defined(__AVX2__)
+// quants of the chunk k (values 8*k .. 8*k + 7) of the interleaved rows 0-3 (lo) and 4-7 (hi) as int8
+static inline void load_q8_0x8_chunk(const block_q8_0x8 * b, int k, __m256i & lo, __m256i & hi) {
+    lo = _mm256_loadu_si256((const __m256i *) (b->qs + (k * 8 + 0) * 8));
+    hi = _mm256_loadu_si256((const __m256i *) (b->qs + (k * 8 + 4) * 8));
+}
+
+// 4 interleaved rows of q5_0 nibbles (the low or the high ones) + the 4 matching bytes of their 5-th bits -> int8
+static inline __m256i unpack_q5_0x4_rows(const uint8_t * qs, const uint8_t * qh, int shift) {
+    const __m256i m4   = _mm256_set1_epi8(0x0F);
+    const __m256i bits = _mm256_set1_epi64x(0x8040201008040201);
+    const __m256i shuf = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                          2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+
+    const __m256i q = _mm256_and_si256(_mm256_srl_epi16(_mm256_loadu_si256((const __m256i *) qs), _mm_cvtsi32_si128(shift)), m4);
+
+    int32_t h;
+    memcpy(&h, qh, sizeof(h));
+
+    // 0xFF where the 5-th bit is set
+    __m256i hb = _mm256_shuffle_epi8(_mm256_set1_epi32(h), shuf);
+    hb = _mm256_cmpeq_epi8(_mm256_and_si256(hb, bits), bits);
+
+    // (q | h << 4) - 16 == q | 0xF0 when the bit is not set
+    return _mm256_or_si256(q, _mm256_andnot_si256(hb, _mm256_set1_epi8((char) 0xF0)));
+}
+
+static inline void load_q5_0x8_chunk(const block_q5_0x8 * b, int k, __m256i & lo, __m256i & hi) {
+    const int c     = k % 2;
+    const int shift = (k / 2) * 4;
+
+    lo = unpack_q5_0x4_rows(b->qs + (c * 8 + 0) * 8, b->qh + k * 8 + 0, shift);
+    hi = unpack_q5_0x4_rows(b->qs + (c * 8 + 4) * 8, b->qh + k * 8 + 4, shift);
+}
+
+// sums of the 2 partial sums per row of the rows 0-3 (lo) and 4-7 (hi) in row order
+static inline __m256i hsum_rows_x8(const __m256i lo, const __m256i hi) {
+    const __m256i perm = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+    return _mm256_permutevar8x32_epi32(_mm256_hadd_epi32(lo, hi), perm);
+}
+
+// gemv / gemm for 8 interleaved rows of 8-bit or 5-bit quants with blocks of 8 bytes
+template <typename block_tx8, void (*load_chunk)(const block_tx8 *, int, __m256i &, __m256i &)>
+static void gemv_x8_q8_0_avx2(int n, float * GGML_RESTRICT s, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nc) {
+    const int nb = n / QK8_0;
+
+    const block_q8_0 * a_ptr = (const block_q8_0 *) vy;
+
+    for (int x = 0; x < nc / 8; x++) {
+        const block_tx8 * b_ptr = (const block_tx8 *) vx + (x * nb);
+
+        __m256 acc = _mm256_setzero_ps();
+
+        for (int l = 0; l < nb; l++) {
+            __m256i isum_lo = _mm256_setzero_si256();
+            __m256i isum_hi = _mm256_setzero_si256();
+
+            for (int k = 0; k < 4; k++) {
+                __m256i w_lo, w_hi;
+                load_chunk(b_ptr + l, k, w_lo, w_hi);
+
+                int64_t a;
+                memcpy(&a, a_ptr[l].qs + k * 8, sizeof(a));
+                const __m256i av = _mm256_set1_epi64x(a);
+
+                isum_lo = _mm256_add_epi32(isum_lo, mul_sum_i8_pairs_int32x8(w_lo, av));
+                isum_hi = _mm256_add_epi32(isum_hi, mul_sum_i8_pairs_int32x8(w_hi, av));
+            }
+
+            const __m256 d = _mm256_mul_ps(GGML_F32Cx8_LOAD(b_ptr[l].d), _mm256_set1_ps(GGML_FP16_TO_FP32(a_ptr[l].d)));
+
+            acc = _mm256_fmadd_ps(_mm256_cvtepi32_ps(hsum_rows_x8(isum_lo, isum_hi)), d, acc);
+        }
+
+        _mm256_storeu_ps(s + x * 8, acc);
+    }
+}
+
+template <typename block_tx8, void (*load_chunk)(const block_tx8 *, int, __m256i &, __m256i &)>
+static void gemm_x8_q8_0_avx2(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int nb = n / QK8_0;
+
+    for (int y = 0; y < nr / 4; y++) {
+        const block_q8_0x4 * a_ptr = (const block_q8_0x4 *) vy + (y * nb);
+
+        for (int x = 0; x < nc / 8; x++) {
+            const block_tx8 * b_ptr = (const block_tx8 *) vx + (x * nb);
+
+            __m256 acc[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+
+            for (int l = 0; l < nb; l++) {
+                // the weights are unpacked once and used for the 4 rows of the activations
+                __m256i w_lo[4], w_hi[4];
+                for (int k = 0; k < 4; k++) {
+                    load_chunk(b_ptr + l, k, w_lo[k], w_hi[k]);
+                }
+
+                const __m256 d_w = GGML_F32Cx8_LOAD(b_ptr[l].d);
+
+                for (int m = 0; m < 4; m++) {
+                    __m256i isum_lo = _mm256_setzero_si256();
+                    __m256i isum_hi = _mm256_setzero_si256();
+
+                    for (int k = 0; k < 4; k++) {
+                        int64_t a;
+                        memcpy(&a, a_ptr[l].qs + (k * 4 + m) * 8, sizeof(a));
+                        const __m256i av = _mm256_set1_epi64x(a);
+
+                        isum_lo = _mm256_add_epi32(isum_lo, mul_sum_i8_pairs_int32x8(w_lo[k], av));
+                        isum_hi = _mm256_add_epi32(isum_hi, mul_sum_i8_pairs_int32x8(w_hi[k], av));
+                    }
+
+                    const __m256 d = _mm256_mul_ps(d_w, _mm256_set1_ps(GGML_FP16_TO_FP32(a_ptr[l].d[m])));
+
+                    acc[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(hsum_rows_x8(isum_lo, isum_hi)), d, acc[m]);
+                }
+            }
+
+            for (int m = 0; m < 4; m++) {
+                _mm256_storeu_ps(s + (y * 4 + m) * bs + x * 8, acc[m]);
+            }
+        }
+    }
+}
+#endif
+
 static const int8_t kvalues_iq4nl[16] = {-127, -104, -83, -65, -49, -35, -22, -10, 1, 13, 25, 38, 53, 69, 89, 113};
 
 static void quantize_q8_0_4x4(const float * GGML_RESTRICT x, void * GGML_RESTRICT vy, int64_t k) {
@@ -1090,6 +1224,89 @@ static void ggml_gemv_iq4_nl_4x4_q8_0(int n, float * GGML_RESTRICT s, size_t bs,
     }
 }
 
+// value i (0 .. QK8_0 - 1) of the interleaved row j
+static inline int q8_0x8_value(const block_q8_0x8 * b, int j, int i) {
+    return b->qs[((i / 8) * 8 + j) * 8 + i % 8];
+}
+
+static inline int q5_0x8_value(const block_q5_0x8 * b, int j, int i) {
+    const int c = (i % 16) / 8;
+    const int q = b->qs[(c * 8 + j) * 8 + i % 8];
+    const int h = (b->qh[(i / 8) * 8 + j] >> (i % 8)) & 1;
+
+    return ((i < 16 ? q & 0x0F : q >> 4) | (h << 4)) - 16;
+}
+
+static void ggml_gemv_q8_0_8x8_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+
+    assert (n % qk == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    UNUSED(bs);
+    UNUSED(nr);
+
+#if defined(__AVX2__)
+    gemv_x8_q8_0_avx2<block_q8_0x8, load_q8_0x8_chunk>(n, s, vx, vy, nc);
+    return;
+#endif
+    {
+        const block_q8_0 * a_ptr = (const block_q8_0 *) vy;
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_q8_0x8 * b_ptr = (const block_q8_0x8 *) vx + (x * nb);
+
+            float sumf[8] = { 0.0f };
+            for (int l = 0; l < nb; l++) {
+                for (int j = 0; j < ncols_interleaved; j++) {
+                    int sumi = 0;
+                    for (int i = 0; i < qk; ++i) {
+                        sumi += q8_0x8_value(&b_ptr[l], j, i) * a_ptr[l].qs[i];
+                    }
+                    sumf[j] += sumi * GGML_FP16_TO_FP32(b_ptr[l].d[j]) * GGML_FP16_TO_FP32(a_ptr[l].d);
+                }
+            }
+            for (int j = 0; j < ncols_interleaved; j++) s[x * ncols_interleaved + j] = sumf[j];
+        }
+    }
+}
+
+static void ggml_gemv_q5_0_8x8_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+
+    assert (n % qk == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    UNUSED(bs);
+    UNUSED(nr);
+
+#if defined(__AVX2__)
+    gemv_x8_q8_0_avx2<block_q5_0x8, load_q5_0x8_chunk>(n, s, vx, vy, nc);
+    return;
+#endif
+    {
+        const block_q8_0 * a_ptr = (const block_q8_0 *) vy;
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_q5_0x8 * b_ptr = (const block_q5_0x8 *) vx + (x * nb);
+
+            float sumf[8] = { 0.0f };
+            for (int l = 0; l < nb; l++) {
+                for (int j = 0; j < ncols_interleaved; j++) {
+                    int sumi = 0;
+                    for (int i = 0; i < qk; ++i) {
+                        sumi += q5_0x8_value(&b_ptr[l], j, i) * a_ptr[l].qs[i];
+                    }
+                    sumf[j] += sumi * GGML_FP16_TO_FP32(b_ptr[l].d[j]) * GGML_FP16_TO_FP32(a_ptr[l].d);
+                }
+            }
+            for (int j = 0; j < ncols_interleaved; j++) s[x * ncols_interleaved + j] = sumf[j];
+        }
+    }
+}
+
 static void ggml_gemm_q4_0_4x4_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
     const int qk = QK8_0;
     const int nb = n / qk;
@@ -3591,6 +3808,94 @@ static void ggml_gemm_iq4_nl_4x4_q8_0(int n, float * GGML_RESTRICT s, size_t bs,
     }
 }
 
+static void ggml_gemm_q8_0_8x8_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+    const int blocklen = 8;
+
+    assert (n % qk == 0);
+    assert (nr % 4 == 0);
+    assert (nc % ncols_interleaved == 0);
+
+#if defined(__AVX2__)
+    gemm_x8_q8_0_avx2<block_q8_0x8, load_q8_0x8_chunk>(n, s, bs, vx, vy, nr, nc);
+    return;
+#endif
+    {
+        float sumf[4][8];
+
+        for (int y = 0; y < nr / 4; y++) {
+            const block_q8_0x4 * a_ptr = (const block_q8_0x4 *) vy + (y * nb);
+            for (int x = 0; x < nc / ncols_interleaved; x++) {
+                const block_q8_0x8 * b_ptr = (const block_q8_0x8 *) vx + (x * nb);
+                for (int m = 0; m < 4; m++) {
+                    for (int j = 0; j < ncols_interleaved; j++) sumf[m][j] = 0.0;
+                }
+                for (int l = 0; l < nb; l++) {
+                    for (int m = 0; m < 4; m++) {
+                        for (int j = 0; j < ncols_interleaved; j++) {
+                            int sumi = 0;
+                            for (int i = 0; i < qk; ++i) {
+                                sumi += q8_0x8_value(&b_ptr[l], j, i) * a_ptr[l].qs[((i / blocklen) * 4 + m) * blocklen + i % blocklen];
+                            }
+                            sumf[m][j] += sumi * GGML_FP16_TO_FP32(b_ptr[l].d[j]) * GGML_FP16_TO_FP32(a_ptr[l].d[m]);
+                        }
+                    }
+                }
+                for (int m = 0; m < 4; m++) {
+                    for (int j = 0; j < ncols_interleaved; j++)
+                        s[(y * 4 + m) * bs + x * ncols_interleaved + j] = sumf[m][j];
+                }
+            }
+        }
+    }
+}
+
+static void ggml_gemm_q5_0_8x8_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+    const int blocklen = 8;
+
+    assert (n % qk == 0);
+    assert (nr % 4 == 0);
+    assert (nc % ncols_interleaved == 0);
+
+#if defined(__AVX2__)
+    gemm_x8_q8_0_avx2<block_q5_0x8, load_q5_0x8_chunk>(n, s, bs, vx, vy, nr, nc);
+    return;
+#endif
+    {
+        float sumf[4][8];
+
+        for (int y = 0; y < nr / 4; y++) {
+            const block_q8_0x4 * a_ptr = (const block_q8_0x4 *) vy + (y * nb);
+            for (int x = 0; x < nc / ncols_interleaved; x++) {
+                const block_q5_0x8 * b_ptr = (const block_q5_0x8 *) vx + (x * nb);
+                for (int m = 0; m < 4; m++) {
+                    for (int j = 0; j < ncols_interleaved; j++) sumf[m][j] = 0.0;
+                }
+                for (int l = 0; l < nb; l++) {
+                    for (int m = 0; m < 4; m++) {
+                        for (int j = 0; j < ncols_interleaved; j++) {
+                            int sumi = 0;
+                            for (int i = 0; i < qk; ++i) {
+                                sumi += q5_0x8_value(&b_ptr[l], j, i) * a_ptr[l].qs[((i / blocklen) * 4 + m) * blocklen + i % blocklen];
+                            }
+                            sumf[m][j] += sumi * GGML_FP16_TO_FP32(b_ptr[l].d[j]) * GGML_FP16_TO_FP32(a_ptr[l].d[m]);
+                        }
+                    }
+                }
+                for (int m = 0; m < 4; m++) {
+                    for (int j = 0; j < ncols_interleaved; j++)
+                        s[(y * 4 + m) * bs + x * ncols_interleaved + j] = sumf[m][j];
+                }
+            }
+        }
+    }
+}
+
 static block_q4_0x4 make_block_q4_0x4(block_q4_0 * in, unsigned int blck_size_interleave) {
     block_q4_0x4 out;
 
@@ -3789,6 +4094,109 @@ static int repack_iq4_nl_to_iq4_nl_4_bl(struct ggml_tensor * t, int interleave_b
     GGML_UNUSED(data_size);
 }
 
+// interleave 8 block_q8_0s in blocks of 8 bytes
+static block_q8_0x8 make_block_q8_0x8(block_q8_0 * in) {
+    block_q8_0x8 out;
+
+    for (int i = 0; i < 8; i++) {
+        out.d[i] = in[i].d;
+    }
+
+    for (int i = 0; i < QK8_0; ++i) {
+        const int src_id     = i % 8;
+        const int src_offset = (i / 8) * 8;
+
+        memcpy(&out.qs[i * 8], &in[src_id].qs[src_offset], 8);
+    }
+
+    return out;
+}
+
+// interleave 8 block_q5_0s: the nibbles in blocks of 8 bytes and the 5-th bits in blocks of 1 byte, so that
+// the bits of a block of 8 values come from the same qh byte as their nibbles
+static block_q5_0x8 make_block_q5_0x8(block_q5_0 * in) {
+    block_q5_0x8 out;
+
+    for (int i = 0; i < 8; i++) {
+        out.d[i] = in[i].d;
+    }
+
+    for (int i = 0; i < QK5_0 * 4 / 8; ++i) {
+        const int src_id     = i % 8;
+        const int src_offset = (i / 8) * 8;
+
+        memcpy(&out.qs[i * 8], &in[src_id].qs[src_offset], 8);
+    }
+
+    for (int i = 0; i < QK5_0; ++i) {
+        out.qh[i] = in[i % 8].qh[i / 8];
+    }
+
+    return out;
+}
+
+static int repack_q8_0_to_q8_0_8_bl(struct ggml_tensor * t, int interleave_block, const void * GGML_RESTRICT data, size_t data_size) {
+    GGML_ASSERT(t->type == GGML_TYPE_Q8_0);
+    GGML_ASSERT(interleave_block == 8);
+    constexpr int nrows_interleaved = 8;
+
+    block_q8_0x8 * dst = (block_q8_0x8 *)t->data;
+    const block_q8_0 * src = (const block_q8_0 *) data;
+    block_q8_0 dst_tmp[8];
+    int nrow = ggml_nrows(t);
+    int nblocks = t->ne[0] / QK8_0;
+
+    GGML_ASSERT(data_size == nrow * nblocks * sizeof(block_q8_0));
+
+    if (t->ne[1] % nrows_interleaved != 0) {
+        return -1;
+    }
+
+    for (int b = 0; b < nrow; b += nrows_interleaved) {
+        for (int64_t x = 0; x < nblocks; x++) {
+            for (int i = 0; i < nrows_interleaved; i++) {
+                dst_tmp[i] = src[x + i * nblocks];
+            }
+            *dst++ = make_block_q8_0x8(dst_tmp);
+        }
+        src += nrows_interleaved * nblocks;
+    }
+    return 0;
+
+    GGML_UNUSED(data_size);
+}
+
+static int repack_q5_0_to_q5_0_8_bl(struct ggml_tensor * t, int interleave_block, const void * GGML_RESTRICT data, size_t data_size) {
+    GGML_ASSERT(t->type == GGML_TYPE_Q5_0);
+    GGML_ASSERT(interleave_block == 8);
+    constexpr int nrows_interleaved = 8;
+
+    block_q5_0x8 * dst = (block_q5_0x8 *)t->data;
+    const block_q5_0 * src = (const block_q5_0 *) data;
+    block_q5_0 dst_tmp[8];
+    int nrow = ggml_nrows(t);
+    int nblocks = t->ne[0] / QK5_0;
+
+    GGML_ASSERT(data_size == nrow * nblocks * sizeof(block_q5_0));
+
+    if (t->ne[1] % nrows_interleaved != 0) {
+        return -1;
+    }
+
+    for (int b = 0; b < nrow; b += nrows_interleaved) {
+        for (int64_t x = 0; x < nblocks; x++) {
+            for (int i = 0; i < nrows_interleaved; i++) {
+                dst_tmp[i] = src[x + i * nblocks];
+            }
+            *dst++ = make_block_q5_0x8(dst_tmp);
+        }
+        src += nrows_interleaved * nblocks;
+    }
+    return 0;
+
+    GGML_UNUSED(data_size);
+}
+
 namespace ggml::cpu::aarch64 {
 // repack
 template <typename BLOC_TYPE, int64_t INTER_SIZE, int64_t NB_COLS>
@@ -3807,6 +4215,14 @@ template <> int repack<block_q4_0, 8, 8>(struct ggml_tensor * t, const void * da
     return repack_q4_0_to_q4_0_8_bl(t, 8, data, data_size);
 }
 
+template <> int repack<block_q8_0, 8, 8>(struct ggml_tensor * t, const void * data, size_t data_size) {
+    return repack_q8_0_to_q8_0_8_bl(t, 8, data, data_size);
+}
+
+template <> int repack<block_q5_0, 8, 8>(struct ggml_tensor * t, const void * data, size_t data_size) {
+    return repack_q5_0_to_q5_0_8_bl(t, 8, data, data_size);
+}
+
 template <> int repack<block_iq4_nl, 4, 4>(struct ggml_tensor * t, const void * data, size_t data_size) {
     return repack_iq4_nl_to_iq4_nl_4_bl(t, 4, data, data_size);
 }
@@ -3832,6 +4248,14 @@ template <> void gemv<block_q4_0, 8, 8>(int n, float * s, size_t bs, const void
     ggml_gemv_q4_0_8x8_q8_0(n, s, bs, vx, vy, nr, nc);
 }
 
+template <> void gemv<block_q8_0, 8, 8>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemv_q8_0_8x8_q8_0(n, s, bs, vx, vy, nr, nc);
+}
+
+template <> void gemv<block_q5_0, 8, 8>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemv_q5_0_8x8_q8_0(n, s, bs, vx, vy, nr, nc);
+}
+
 template <>
 void gemv<block_iq4_nl, 4, 4>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
     ggml_gemv_iq4_nl_4x4_q8_0(n, s, bs, vx, vy, nr, nc);
@@ -3853,6 +4277,14 @@ template <> void gemm<block_q4_0, 8, 8>(int n, float * s, size_t bs, const void
     ggml_gemm_q4_0_8x8_q8_0(n, s, bs, vx, vy, nr, nc);
 }
 
+template <> void gemm<block_q8_0, 8, 8>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemm_q8_0_8x8_q8_0(n, s, bs, vx, vy, nr, nc);
+}
+
+template <> void gemm<block_q5_0, 8, 8>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemm_q5_0_8x8_q8_0(n, s, bs, vx, vy, nr, nc);
+}
+
 template <>
 void gemm<block_iq4_nl, 4, 4>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
     ggml_gemm_iq4_nl_4x4_q8_0(n, s, bs, vx, vy, nr, nc);
@@ -4105,6 +4537,10 @@ static const tensor_traits<block_q4_0, 8, 8> q4_0_8x8_q8_0;
 // instance for IQ4
 static const tensor_traits<block_iq4_nl, 4, 4> iq4_nl_4x4_q8_0;
 
+// instances for Q8 and Q5
+static const tensor_traits<block_q8_0, 8, 8> q8_0_8x8_q8_0;
+static const tensor_traits<block_q5_0, 8, 8> q5_0_8x8_q8_0;
+
 }  // namespace ggml::cpu::aarch64
 
 static const ggml::cpu::tensor_traits * ggml_aarch64_get_optimal_repack_type(const struct ggml_tensor * cur) {
@@ -4130,6 +4566,18 @@ static const ggml::cpu::tensor_traits * ggml_aarch64_get_optimal_repack_type(con
                 return &ggml::cpu::aarch64::iq4_nl_4x4_q8_0;
             }
         }
+    } else if (cur->type == GGML_TYPE_Q8_0) {
+        if (ggml_cpu_has_avx2()) {
+            if (cur->ne[1] % 8 == 0) {
+                return &ggml::cpu::aarch64::q8_0_8x8_q8_0;
+            }
+        }
+    } else if (cur->type == GGML_TYPE_Q5_0) {
+        if (ggml_cpu_has_avx2()) {
+            if (cur->ne[1] % 8 == 0) {
+                return &ggml::cpu::aarch64::q5_0_8x8_q8_0;
+            }
+        }
     }
 
     return nullptr;
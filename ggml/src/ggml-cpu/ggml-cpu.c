@@ -249,6 +249,7 @@ static const size_t CACHE_LINE_SIZE_F32 = CACHE_LINE_SIZE/sizeof(float);
 static void ggml_vec_dot_f32(int n, float * restrict s, size_t bs, const float * restrict x, size_t bx, const float * restrict y, size_t by, int nrc);
 static void ggml_vec_dot_f16(int n, float * restrict s, size_t bs, ggml_fp16_t * restrict x, size_t bx, ggml_fp16_t * restrict y, size_t by, int nrc);
 static void ggml_vec_dot_bf16(int n, float * restrict s, size_t bs, ggml_bf16_t * restrict x, size_t bx, ggml_bf16_t * restrict y, size_t by, int nrc);
+static void ggml_cpu_fp32_to_bf16(const float * restrict x, ggml_bf16_t * restrict y, int64_t n);
 
 static const struct ggml_type_traits_cpu type_traits_cpu[GGML_TYPE_COUNT] = {
     [GGML_TYPE_F32] = {
@@ -398,7 +399,7 @@ static const struct ggml_type_traits_cpu type_traits_cpu[GGML_TYPE_COUNT] = {
         .from_float               = quantize_row_q8_K,
     },
     [GGML_TYPE_BF16] = {
-        .from_float               = (ggml_from_float_t) ggml_fp32_to_bf16_row,
+        .from_float               = (ggml_from_float_t) ggml_cpu_fp32_to_bf16,
         .vec_dot                  = (ggml_vec_dot_t) ggml_vec_dot_bf16,
         .vec_dot_type             = GGML_TYPE_BF16,
         .nrows                    = 1,
@@ -1311,6 +1312,8 @@ struct ggml_threadpool {
     int32_t      prio;        // Scheduling priority
     uint32_t     poll;        // Polling level (0 - no polling)
 
+    int          id;          // Unique id, tells the threadpools apart even when one is allocated at the address of a freed one
+
     enum ggml_status ec;
 };
 
@@ -1318,10 +1321,10 @@ struct ggml_threadpool {
 struct ggml_compute_state {
 #ifndef GGML_USE_OPENMP
     ggml_thread_t thrd;
-    bool cpumask[GGML_MAX_N_THREADS];
     int  last_graph;
     bool pending;
 #endif
+    bool cpumask[GGML_MAX_N_THREADS];
     struct ggml_threadpool * threadpool;
     int ith;
 };
@@ -1418,8 +1421,8 @@ static void ggml_vec_dot_bf16(int n, float * restrict s, size_t bs, ggml_bf16_t
     __m512 c1 = _mm512_setzero_ps();
     __m512 c2 = _mm512_setzero_ps();
     for (; i + 32 <= n; i += 32) {
-        c1 = _mm512_add_ps(_mm512_mul_ps(LOAD(x + i), LOAD(y + i)), c1);
-        c2 = _mm512_add_ps(_mm512_mul_ps(LOAD(x + i + 16), LOAD(y + i + 16)), c2);
+        c1 = _mm512_fmadd_ps(LOAD(x + i), LOAD(y + i), c1);
+        c2 = _mm512_fmadd_ps(LOAD(x + i + 16), LOAD(y + i + 16), c2);
     }
     sumf += (ggml_float)_mm512_reduce_add_ps(c1);
     sumf += (ggml_float)_mm512_reduce_add_ps(c2);
@@ -1436,10 +1439,17 @@ static void ggml_vec_dot_bf16(int n, float * restrict s, size_t bs, ggml_bf16_t
     __m256 c3 = _mm256_setzero_ps();
     __m256 c4 = _mm256_setzero_ps();
     for (; i + 32 <= n; i += 32) {
+#if defined(__FMA__)
+        c1 = _mm256_fmadd_ps(LOAD(x + i), LOAD(y + i), c1);
+        c2 = _mm256_fmadd_ps(LOAD(x + i + 8), LOAD(y + i + 8), c2);
+        c3 = _mm256_fmadd_ps(LOAD(x + i + 16), LOAD(y + i + 16), c3);
+        c4 = _mm256_fmadd_ps(LOAD(x + i + 24), LOAD(y + i + 24), c4);
+#else
         c1 = _mm256_add_ps(_mm256_mul_ps(LOAD(x + i), LOAD(y + i)), c1);
         c2 = _mm256_add_ps(_mm256_mul_ps(LOAD(x + i + 8), LOAD(y + i + 8)), c2);
         c3 = _mm256_add_ps(_mm256_mul_ps(LOAD(x + i + 16), LOAD(y + i + 16)), c3);
         c4 = _mm256_add_ps(_mm256_mul_ps(LOAD(x + i + 24), LOAD(y + i + 24)), c4);
+#endif
     }
     __m128 g;
     c1 = _mm256_add_ps(_mm256_add_ps(c1, c3),
@@ -1460,6 +1470,52 @@ static void ggml_vec_dot_bf16(int n, float * restrict s, size_t bs, ggml_bf16_t
     *s = sumf;
 }
 
+#if defined(__AVX2__)
+// 8 floats to the bf16 bits in the low halves of the 32-bit lanes
+static inline __m256i ggml_cpu_fp32_to_bf16_avx2(const __m256 f) {
+    const __m256i u   = _mm256_castps_si256(f);
+    const __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(u, 16), _mm256_set1_epi32(1));
+    const __m256i r   = _mm256_srli_epi32(_mm256_add_epi32(u, _mm256_add_epi32(lsb, _mm256_set1_epi32(0x7fff))), 16);
+    const __m256i q   = _mm256_or_si256(_mm256_srli_epi32(u, 16), _mm256_set1_epi32(64));
+
+    return _mm256_blendv_epi8(r, q, _mm256_castps_si256(_mm256_cmp_ps(f, f, _CMP_UNORD_Q)));
+}
+#endif
+
+// ggml_fp32_to_bf16_row is built without the CPU flags, this is the variant used for the rows of the matrix multiplications
+// the AVX512F/AVX2 paths give the same bits as GGML_FP32_TO_BF16 (round to nearest even, NaNs quieted by setting bit 6)
+// the AVX512-BF16 path (vcvtne2ps2bf16) does not: it flushes subnormal inputs to signed zero and quiets NaNs with the
+// rules of the instruction, so the results of the two paths can differ for these inputs
+static void ggml_cpu_fp32_to_bf16(const float * restrict x, ggml_bf16_t * restrict y, int64_t n) {
+    int64_t i = 0;
+
+#if defined(__AVX512BF16__)
+    for (; i + 32 <= n; i += 32) {
+        _mm512_storeu_si512((__m512i *)(y + i), m512i(_mm512_cvtne2ps_pbh(_mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(x + i))));
+    }
+#elif defined(__AVX512F__)
+    for (; i + 16 <= n; i += 16) {
+        const __m512  f   = _mm512_loadu_ps(x + i);
+        const __m512i u   = _mm512_castps_si512(f);
+        const __m512i lsb = _mm512_and_si512(_mm512_srli_epi32(u, 16), _mm512_set1_epi32(1));
+        const __m512i r   = _mm512_srli_epi32(_mm512_add_epi32(u, _mm512_add_epi32(lsb, _mm512_set1_epi32(0x7fff))), 16);
+        const __m512i q   = _mm512_or_si512(_mm512_srli_epi32(u, 16), _mm512_set1_epi32(64));
+        const __m512i b   = _mm512_mask_blend_epi32(_mm512_cmp_ps_mask(f, f, _CMP_UNORD_Q), r, q);
+        _mm256_storeu_si256((__m256i *)(y + i), _mm512_cvtepi32_epi16(b));
+    }
+#elif defined(__AVX2__)
+    for (; i + 16 <= n; i += 16) {
+        const __m256i b0 = ggml_cpu_fp32_to_bf16_avx2(_mm256_loadu_ps(x + i));
+        const __m256i b1 = ggml_cpu_fp32_to_bf16_avx2(_mm256_loadu_ps(x + i + 8));
+        _mm256_storeu_si256((__m256i *)(y + i), _mm256_permute4x64_epi64(_mm256_packus_epi32(b0, b1), 0xD8));
+    }
+#endif
+
+    for (; i < n; ++i) {
+        y[i] = GGML_FP32_TO_BF16(x[i]);
+    }
+}
+
 static void ggml_vec_dot_f16(int n, float * restrict s, size_t bs, ggml_fp16_t * restrict x, size_t bx, ggml_fp16_t * restrict y, size_t by, int nrc) {
     assert(nrc == 1);
     UNUSED(nrc);
@@ -1619,6 +1675,67 @@ inline static void ggml_vec_mad_f16(const int n, ggml_fp16_t * restrict y, const
 #endif
 }
 
+// y += x*v for a row of quantized blocks, without an intermediate FP32 copy of x
+inline static void ggml_vec_mad_q8_0(const int n, float * restrict y, const block_q8_0 * restrict x, const float v) {
+    for (int ib = 0; ib < n/QK8_0; ++ib) {
+        const float d = v*GGML_FP16_TO_FP32(x[ib].d);
+
+        float * restrict yb = y + ib*QK8_0;
+        for (int j = 0; j < QK8_0; ++j) {
+            yb[j] += d*x[ib].qs[j];
+        }
+    }
+}
+
+inline static void ggml_vec_mad_q4_0(const int n, float * restrict y, const block_q4_0 * restrict x, const float v) {
+    for (int ib = 0; ib < n/QK4_0; ++ib) {
+        const float d = v*GGML_FP16_TO_FP32(x[ib].d);
+
+        float * restrict yb = y + ib*QK4_0;
+#if defined(__AVX2__) && defined(__FMA__)
+        const __m128i qs = _mm_loadu_si128((const __m128i *) x[ib].qs);
+        const __m128i m4 = _mm_set1_epi8(0x0F);
+        const __m128i o8 = _mm_set1_epi8(8);
+        const __m128i lo = _mm_sub_epi8(_mm_and_si128(qs, m4), o8);
+        const __m128i hi = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(qs, 4), m4), o8);
+        const __m256  vd = _mm256_set1_ps(d);
+
+        const __m128i q[4] = { lo, _mm_srli_si128(lo, 8), hi, _mm_srli_si128(hi, 8) };
+        for (int k = 0; k < 4; ++k) {
+            const __m256 qf = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(q[k]));
+            _mm256_storeu_ps(yb + 8*k, _mm256_fmadd_ps(qf, vd, _mm256_loadu_ps(yb + 8*k)));
+        }
+#else
+        for (int j = 0; j < QK4_0/2; ++j) {
+            yb[j]           += d*((x[ib].qs[j] & 0x0F) - 8);
+            yb[j + QK4_0/2] += d*((x[ib].qs[j] >>   4) - 8);
+        }
+#endif
+    }
+}
+
+inline static void ggml_vec_mad_bf16(const int n, float * restrict y, const ggml_bf16_t * restrict x, const float v) {
+    int i = 0;
+
+#if defined(__AVX512F__)
+    const __m512 vv = _mm512_set1_ps(v);
+    for (; i + 16 <= n; i += 16) {
+        const __m512 xf = _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(x + i))), 16));
+        _mm512_storeu_ps(y + i, _mm512_fmadd_ps(xf, vv, _mm512_loadu_ps(y + i)));
+    }
+#elif defined(__AVX2__) && defined(__FMA__)
+    const __m256 vv = _mm256_set1_ps(v);
+    for (; i + 8 <= n; i += 8) {
+        const __m256 xf = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(x + i))), 16));
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(xf, vv, _mm256_loadu_ps(y + i)));
+    }
+#endif
+
+    for (; i < n; ++i) {
+        y[i] += GGML_BF16_TO_FP32(x[i])*v;
+    }
+}
+
 // xs and vs are byte strides of x and v
 inline static void ggml_vec_mad_f32_unroll(const int n, const int xs, const int vs, float * restrict y, const float * restrict xv, const float * restrict vv) {
 
@@ -10995,10 +11112,18 @@ static void ggml_compute_forward_flash_attn_ext_f16(
                     vs = expf(s - M);
                 }
 
-                v_to_float(v_data, V32, D);
-
                 // V += v*expf(s - M)
-                ggml_vec_mad_f32(D, VKQ32, V32, vs);
+                if (v->type == GGML_TYPE_Q8_0) {
+                    ggml_vec_mad_q8_0(D, VKQ32, (const block_q8_0 *) v_data, vs);
+                } else if (v->type == GGML_TYPE_Q4_0) {
+                    ggml_vec_mad_q4_0(D, VKQ32, (const block_q4_0 *) v_data, vs);
+                } else if (v->type == GGML_TYPE_BF16) {
+                    ggml_vec_mad_bf16(D, VKQ32, (const ggml_bf16_t *) v_data, vs);
+                } else {
+                    v_to_float(v_data, V32, D);
+
+                    ggml_vec_mad_f32(D, VKQ32, V32, vs);
+                }
             }
 
             S = S*ms + vs; // scale and increment sum with partial sum
@@ -13448,6 +13573,42 @@ static bool ggml_thread_apply_priority(int32_t prio) {
     return true;
 }
 
+struct ggml_thread_sched {
+    int       prio;
+    DWORD_PTR mask;
+};
+
+static inline bool ggml_thread_save_sched(struct ggml_thread_sched * sched) {
+    HANDLE h = GetCurrentThread();
+
+    sched->prio = GetThreadPriority(h);
+    if (sched->prio == THREAD_PRIORITY_ERROR_RETURN) {
+        return false;
+    }
+
+    DWORD_PTR mask_proc = 0;
+    DWORD_PTR mask_sys  = 0;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &mask_proc, &mask_sys)) {
+        return false;
+    }
+
+    // there is no getter for the affinity of a thread, the setter returns the previous mask
+    sched->mask = SetThreadAffinityMask(h, mask_proc);
+    if (sched->mask == 0) {
+        return false;
+    }
+    SetThreadAffinityMask(h, sched->mask);
+
+    return true;
+}
+
+static inline void ggml_thread_restore_sched(const struct ggml_thread_sched * sched) {
+    HANDLE h = GetCurrentThread();
+
+    SetThreadPriority(h, sched->prio);
+    SetThreadAffinityMask(h, sched->mask);
+}
+
 #elif defined(__APPLE__)
 #include <sys/types.h>
 #include <sys/resource.h>
@@ -13482,6 +13643,19 @@ static bool ggml_thread_apply_priority(int32_t prio) {
     return true;
 }
 
+struct ggml_thread_sched {
+    int                policy;
+    struct sched_param param;
+};
+
+static inline bool ggml_thread_save_sched(struct ggml_thread_sched * sched) {
+    return pthread_getschedparam(pthread_self(), &sched->policy, &sched->param) == 0;
+}
+
+static inline void ggml_thread_restore_sched(const struct ggml_thread_sched * sched) {
+    pthread_setschedparam(pthread_self(), sched->policy, &sched->param);
+}
+
 #elif defined(__gnu_linux__)
 // TODO: this may not work on BSD, to be verified
 
@@ -13538,6 +13712,34 @@ static bool ggml_thread_apply_priority(int32_t prio) {
     return true;
 }
 
+struct ggml_thread_sched {
+    int                policy;
+    struct sched_param param;
+    cpu_set_t          cpuset;
+};
+
+static inline bool ggml_thread_save_sched(struct ggml_thread_sched * sched) {
+    if (pthread_getschedparam(pthread_self(), &sched->policy, &sched->param) != 0) {
+        return false;
+    }
+
+#ifdef __ANDROID__
+    return sched_getaffinity(0, sizeof(sched->cpuset), &sched->cpuset) == 0;
+#else
+    return pthread_getaffinity_np(pthread_self(), sizeof(sched->cpuset), &sched->cpuset) == 0;
+#endif
+}
+
+static inline void ggml_thread_restore_sched(const struct ggml_thread_sched * sched) {
+    pthread_setschedparam(pthread_self(), sched->policy, &sched->param);
+
+#ifdef __ANDROID__
+    sched_setaffinity(0, sizeof(sched->cpuset), &sched->cpuset);
+#else
+    pthread_setaffinity_np(pthread_self(), sizeof(sched->cpuset), &sched->cpuset);
+#endif
+}
+
 #else // unsupported platforms
 
 static bool ggml_thread_apply_affinity(const bool * mask) {
@@ -13550,6 +13752,19 @@ static bool ggml_thread_apply_priority(int32_t prio) {
     return true;
 }
 
+struct ggml_thread_sched {
+    int unused;
+};
+
+static inline bool ggml_thread_save_sched(struct ggml_thread_sched * sched) {
+    UNUSED(sched);
+    return true;
+}
+
+static inline void ggml_thread_restore_sched(const struct ggml_thread_sched * sched) {
+    UNUSED(sched);
+}
+
 #endif
 
 static bool ggml_thread_cpumask_is_valid(const bool * mask) {
@@ -13559,6 +13774,59 @@ static bool ggml_thread_cpumask_is_valid(const bool * mask) {
     return false;
 }
 
+static atomic_int ggml_threadpool_n_created = 0;
+
+#ifdef GGML_USE_OPENMP
+
+// the priority and the CPU placement of a worker, if the threadpool sets any
+static bool ggml_threadpool_has_sched(const struct ggml_threadpool * tp, const struct ggml_compute_state * state) {
+    return tp->prio != GGML_SCHED_PRIO_NORMAL || ggml_thread_cpumask_is_valid(state->cpumask);
+}
+
+static void ggml_threadpool_apply_sched(const struct ggml_threadpool * tp, const struct ggml_compute_state * state) {
+    ggml_thread_apply_priority(tp->prio);
+    if (ggml_thread_cpumask_is_valid(state->cpumask)) {
+        ggml_thread_apply_affinity(state->cpumask);
+    }
+}
+
+#if defined(_MSC_VER)
+#define GGML_THREAD_LOCAL __declspec(thread)
+#else
+#define GGML_THREAD_LOCAL _Thread_local
+#endif
+
+// the OpenMP threads outlive the graphs: the threadpool and the worker an OpenMP thread last took the placement of,
+// and the state the thread had before the first threadpool changed it
+static GGML_THREAD_LOCAL int                      ggml_omp_sched_tp    = -1;
+static GGML_THREAD_LOCAL int                      ggml_omp_sched_ith   = -1;
+static GGML_THREAD_LOCAL bool                     ggml_omp_sched_saved = false;
+static GGML_THREAD_LOCAL struct ggml_thread_sched ggml_omp_sched_orig;
+
+// applied once per thread of the team, the syscalls are not repeated for every graph
+static void ggml_omp_thread_apply_sched(const struct ggml_compute_state * state) {
+    const struct ggml_threadpool * tp = state->threadpool;
+
+    if (ggml_omp_sched_tp == tp->id && ggml_omp_sched_ith == state->ith) {
+        return;
+    }
+
+    ggml_omp_sched_tp  = tp->id;
+    ggml_omp_sched_ith = state->ith;
+
+    if (ggml_omp_sched_saved) {
+        ggml_thread_restore_sched(&ggml_omp_sched_orig);
+        ggml_omp_sched_saved = false;
+    }
+
+    if (ggml_threadpool_has_sched(tp, state)) {
+        ggml_omp_sched_saved = ggml_thread_save_sched(&ggml_omp_sched_orig);
+        ggml_threadpool_apply_sched(tp, state);
+    }
+}
+
+#endif // GGML_USE_OPENMP
+
 static void ggml_thread_cpumask_next(const bool * global_mask, bool * local_mask, bool strict, int32_t* iter) {
     if (!strict) {
         memcpy(local_mask, global_mask, GGML_MAX_N_THREADS);
@@ -14037,6 +14305,7 @@ static struct ggml_threadpool * ggml_threadpool_new_impl(
         threadpool->n_threads_cur    = tpp->n_threads;
         threadpool->poll             = tpp->poll;
         threadpool->prio             = tpp->prio;
+        threadpool->id               = atomic_fetch_add(&ggml_threadpool_n_created, 1);
         threadpool->ec               = GGML_STATUS_SUCCESS;
     }
 
@@ -14052,24 +14321,28 @@ static struct ggml_threadpool * ggml_threadpool_new_impl(
 
     threadpool->workers = workers;
 
+    // CPU placements of the workers
+    // Place the main thread last (towards the higher numbered CPU cores).
+    {
+        int32_t cpumask_iter = 0;
+
+        for (int j = 1; j < tpp->n_threads; j++) {
+            ggml_thread_cpumask_next(tpp->cpumask, workers[j].cpumask, tpp->strict_cpu, &cpumask_iter);
+        }
+
+        ggml_thread_cpumask_next(tpp->cpumask, workers[0].cpumask, tpp->strict_cpu, &cpumask_iter);
+    }
+
 #ifndef GGML_USE_OPENMP
     ggml_mutex_init(&threadpool->mutex);
     ggml_cond_init(&threadpool->cond);
 
-    // Spin the threads for all workers, and update CPU placements.
-    // Place the main thread last (towards the higher numbered CPU cores).
-
-    int32_t cpumask_iter = 0;
-
+    // Spin the threads for all workers
     for (int j = 1; j < tpp->n_threads; j++) {
-        ggml_thread_cpumask_next(tpp->cpumask, workers[j].cpumask, tpp->strict_cpu, &cpumask_iter);
-
         int32_t rc = ggml_thread_create(&workers[j].thrd, NULL, ggml_graph_compute_secondary_thread, &workers[j]);
         GGML_ASSERT(rc == 0);
     }
 
-    ggml_thread_cpumask_next(tpp->cpumask, workers[0].cpumask, tpp->strict_cpu, &cpumask_iter);
-
     if (!threadpool->pause) {
         // Update main thread prio and affinity at the start, otherwise we'll do it in resume
         ggml_thread_apply_priority(threadpool->prio);
@@ -14114,7 +14387,20 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
         threadpool->ec               = GGML_STATUS_SUCCESS;
     }
 
+    if (n_threads > threadpool->n_threads_max) {
+        GGML_LOG_WARN("cplan requested more threads (%d) than available (%d)\n", n_threads, threadpool->n_threads_max);
+        n_threads = threadpool->n_threads_max;
+    }
+
 #ifdef GGML_USE_OPENMP
+    // the OpenMP threads follow the priority and the CPU placement of the threadpool, if any
+    // the caller is thread 0 - it keeps them only for this graph
+    struct ggml_thread_sched caller_sched;
+    const bool caller_sched_saved = ggml_threadpool_has_sched(threadpool, &threadpool->workers[0]) && ggml_thread_save_sched(&caller_sched);
+    if (caller_sched_saved) {
+        ggml_threadpool_apply_sched(threadpool, &threadpool->workers[0]);
+    }
+
     if (n_threads > 1) {
         #pragma omp parallel num_threads(n_threads)
         {
@@ -14125,17 +14411,19 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
                 atomic_store_explicit(&threadpool->n_threads_cur, n_threads, memory_order_relaxed);
             }
 
-            ggml_graph_compute_thread(&threadpool->workers[omp_get_thread_num()]);
+            struct ggml_compute_state * state = &threadpool->workers[omp_get_thread_num()];
+
+            if (state->ith > 0) {
+                ggml_omp_thread_apply_sched(state);
+            }
+
+            ggml_graph_compute_thread(state);
         }
     } else {
         atomic_store_explicit(&threadpool->n_threads_cur, 1, memory_order_relaxed);
         ggml_graph_compute_thread(&threadpool->workers[0]);
     }
 #else
-    if (n_threads > threadpool->n_threads_max) {
-        GGML_LOG_WARN("cplan requested more threads (%d) than available (%d)\n", n_threads, threadpool->n_threads_max);
-        n_threads = threadpool->n_threads_max;
-    }
 
     // Kick all threads to start the new graph
     ggml_graph_compute_kickoff(threadpool, n_threads);
@@ -14147,6 +14435,12 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
     // don't leave affinity set on the main thread
     clear_numa_thread_affinity();
 
+#ifdef GGML_USE_OPENMP
+    if (caller_sched_saved) {
+        ggml_thread_restore_sched(&caller_sched);
+    }
+#endif
+
     enum ggml_status ret = threadpool->ec;
 
     if (disposable_threadpool) {
@@ -2,6 +2,7 @@
 #define WHISPER_H
 
 #include "ggml.h"
+#include "ggml-backend.h"
 #include "ggml-cpu.h"
 
 #include <stddef.h>
@@ -35,6 +36,9 @@
 #define WHISPER_HOP_LENGTH  160
 #define WHISPER_CHUNK_SIZE  30
 
+// KV cache type that follows the intermediate type of the model (F16, or BF16 for BF16 models)
+#define WHISPER_KV_TYPE_AUTO GGML_TYPE_COUNT
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -118,6 +122,33 @@ extern "C" {
         bool  flash_attn;
         int   gpu_device;  // CUDA device
 
+        // type of the self-attention and cross-attention K/V caches (default: WHISPER_KV_TYPE_AUTO)
+        // WHISPER_KV_TYPE_AUTO is resolved when the model is loaded: BF16 for BF16 models, F16 otherwise
+        // quantized types (e.g. GGML_TYPE_Q8_0, GGML_TYPE_Q4_0) reduce the memory of each state
+        // GGML_TYPE_BF16 keeps the range of the activations, for use with BF16 models
+        // a quantized V cache requires flash_attn
+        enum ggml_type type_k;
+        enum ggml_type type_v;
+
+        // share the compute buffers between the states created on the same thread (default: false)
+        // an idle state then only holds its K/V caches - the states that share the buffers must not be used concurrently
+        bool share_compute_buffers;
+
+        // NUMA placement of the weights in host memory and of the CPU threads of the states (Linux only)
+        // numa_node >= 0: bind the weights to this node and run the compute threads of the states on its CPUs
+        //                 with one context per node, each node holds a replica of the weights and the requests
+        //                 can be routed to the context of the node they run on
+        // numa_interleave: interleave the weights across all the nodes (used when numa_node < 0)
+        int  numa_node;
+        bool numa_interleave;
+
+        // CPU threads of the states: each state (or group of states sharing the compute buffers) keeps its threads
+        // between the graphs - after a graph, the threads poll for new work before sleeping
+        // cpu_poll: polling level, 0 - sleep right away, 100 - aggressive polling (default: 50)
+        // cpu_prio: scheduling priority of the threads (default: GGML_SCHED_PRIO_NORMAL)
+        uint32_t cpu_poll;
+        enum ggml_sched_priority cpu_prio;
+
         // [EXPERIMENTAL] Token-level timestamps with DTW
         bool dtw_token_timestamps;
         enum whisper_alignment_heads_preset dtw_aheads_preset;
@@ -126,6 +157,11 @@ extern "C" {
         struct whisper_aheads dtw_aheads;
 
         size_t dtw_mem_size; // TODO: remove
+
+        // called for the nodes of the encoder and decoder graphs during evaluation (e.g. to collect activation statistics)
+        // when set, the fused CPU kernels are not used, so that all linear layers are GGML_OP_MUL_MAT nodes
+        ggml_backend_sched_eval_callback cb_eval;
+        void * cb_eval_user_data;
     };
 
     typedef struct whisper_token_data {
@@ -229,6 +265,13 @@ extern "C" {
 
     WHISPER_API struct whisper_state * whisper_init_state(struct whisper_context * ctx);
 
+    // Process-wide distribution of the CPU threads over the NUMA nodes (see ggml_numa_strategy).
+    // Call once, before creating any context. For per-context placement, see whisper_context_params.numa_node.
+    WHISPER_API void whisper_numa_init(enum ggml_numa_strategy numa);
+
+    // Number of NUMA nodes of the host (0 if unknown)
+    WHISPER_API int whisper_numa_n_nodes(void);
+
     // Given a context, enable use of OpenVINO for encode inference.
     // model_path: Optional path to OpenVINO encoder IR model. If set to nullptr,
     //                      the path will be generated from the ggml model path that was passed
@@ -275,6 +318,66 @@ extern "C" {
                                int   n_samples,
                                int   n_threads);
 
+    // Resample RAW PCM audio, e.g. from 8/44.1/48 kHz to WHISPER_SAMPLE_RATE, using a polyphase windowed-sinc filter.
+    // The resampler keeps the filter history, so audio can be pushed in blocks of any size (e.g. from a live
+    // capture device) and the output is continuous across calls. Its buffers are allocated in whisper_resampler_init(),
+    // so whisper_resampler_process() does not allocate as long as out holds whisper_resampler_n_out_max() samples.
+    struct whisper_resampler;
+
+    WHISPER_API struct whisper_resampler * whisper_resampler_init(int sample_rate_in, int sample_rate_out);
+    WHISPER_API void                       whisper_resampler_free(struct whisper_resampler * rs);
+
+    // Upper bound of the number of output samples produced by the next call to whisper_resampler_process()
+    // with n_samples input samples (or with a flush)
+    WHISPER_API int whisper_resampler_n_out_max(struct whisper_resampler * rs, int n_samples);
+
+    // Push n_samples input samples and write the resampled output that is ready into out.
+    // Call with samples == NULL and n_samples == 0 at the end of the stream to flush the remaining output,
+    // after which the resampler can be reused for a new stream.
+    // Returns the number of samples written to out (at most n_out_max) or a negative number on failure
+    WHISPER_API int whisper_resampler_process(
+            struct whisper_resampler * rs,
+                         const float * samples,
+                                 int   n_samples,
+                               float * out,
+                                 int   n_out_max);
+
+    // Resample a complete buffer at once. out must hold at least n_samples*sample_rate_out/sample_rate_in + 1 samples
+    // Returns the number of samples written to out or a negative number on failure
+    WHISPER_API int whisper_pcm_resample(
+                         const float * samples,
+                                 int   n_samples,
+                                 int   sample_rate_in,
+                               float * out,
+                                 int   n_out_max,
+                                 int   sample_rate_out);
+
+    // [EXPERIMENTAL] Voice activity detection
+    // Frame-level detector based on the speech-band energy and the spectral flatness of the audio.
+    // Input audio must be mono 16 kHz. Segment timestamps are in units of 10 ms
+    struct whisper_vad_segments;
+
+    typedef struct whisper_vad_params {
+        float threshold;               // speech probability threshold [0, 1]
+        int   min_speech_duration_ms;  // drop speech regions shorter than this
+        int   min_silence_duration_ms; // split speech regions only on silence longer than this
+        int   speech_pad_ms;           // padding added on both sides of each speech region
+    } whisper_vad_params;
+
+    WHISPER_API struct whisper_vad_params whisper_vad_default_params(void);
+
+    WHISPER_API struct whisper_vad_segments * whisper_vad_segments_from_samples(
+             struct whisper_vad_params   params,
+                           const float * samples,
+                                   int   n_samples,
+                                   int   n_threads);
+
+    WHISPER_API int     whisper_vad_segments_n_segments    (struct whisper_vad_segments * segments);
+    WHISPER_API int64_t whisper_vad_segments_get_segment_t0(struct whisper_vad_segments * segments, int i_segment);
+    WHISPER_API int64_t whisper_vad_segments_get_segment_t1(struct whisper_vad_segments * segments, int i_segment);
+
+    WHISPER_API void whisper_vad_free_segments(struct whisper_vad_segments * segments);
+
     // This can be used to set a custom log mel spectrogram inside the default state of the provided whisper context.
     // Use this instead of whisper_pcm_to_mel() if you want to provide your own log mel spectrogram.
     // n_mel must be 80
@@ -377,6 +480,65 @@ extern "C" {
                                int   n_threads,
                              float * lang_probs);
 
+    // Early-exit language detection
+    // The first pass encodes only the first audio_ms of the window with the first n_layers encoder layers
+    // If the probability of the top language is below min_prob, the detection is repeated with the full encoder
+    typedef struct whisper_lang_detect_params {
+        int   audio_ms; // audio encoded by the first pass (0 - full window)
+        int   n_layers; // encoder layers used by the first pass (0 - all layers)
+        float min_prob; // min probability of the top language to accept the first pass
+    } whisper_lang_detect_params;
+
+    WHISPER_API struct whisper_lang_detect_params whisper_lang_detect_default_params(void);
+
+    // Same as whisper_lang_auto_detect(), but tries the truncated encoder first
+    // The first pass is skipped when the encoder runs externally (Core ML, OpenVINO)
+    WHISPER_API int whisper_lang_auto_detect_fast(
+            struct whisper_context * ctx,
+                               int   offset_ms,
+                               int   n_threads,
+      struct whisper_lang_detect_params   params,
+                             float * lang_probs);
+
+    WHISPER_API int whisper_lang_auto_detect_fast_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+                               int   offset_ms,
+                               int   n_threads,
+      struct whisper_lang_detect_params   params,
+                             float * lang_probs);
+
+    // Score a set of candidate token sequences against the current mel data
+    // Make sure to call whisper_pcm_to_mel() or whisper_set_mel() first
+    // The audio is encoded once and the prefix (e.g. [prev] + prompt + [sot, lang, task, notimestamps]) is decoded once.
+    // The candidates are then arranged in a token trie and decoded breadth-first, one batched decoder call per depth.
+    // Tokens shared by several candidates are decoded only once - each trie node forks the KV cache sequence of its parent
+    // On success, fills logprobs[i] with the sum of the log-probabilities of the tokens of candidate i
+    // audio_ctx: if > 0, overrides the audio context size of the encoder (see whisper_full_params.audio_ctx)
+    // Returns 0 on success, negative on failure
+    WHISPER_API int whisper_score_candidates(
+            struct whisper_context * ctx,
+             const whisper_token * prefix,
+                               int   n_prefix,
+             const whisper_token * const * candidates,
+                         const int * n_candidate_tokens,
+                               int   n_candidates,
+                               int   audio_ctx,
+                               int   n_threads,
+                             float * logprobs);
+
+    WHISPER_API int whisper_score_candidates_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+             const whisper_token * prefix,
+                               int   n_prefix,
+             const whisper_token * const * candidates,
+                         const int * n_candidate_tokens,
+                               int   n_candidates,
+                               int   audio_ctx,
+                               int   n_threads,
+                             float * logprobs);
+
     WHISPER_API int whisper_n_len           (struct whisper_context * ctx); // mel length
     WHISPER_API int whisper_n_len_from_state(struct whisper_state * state); // mel length
     WHISPER_API int whisper_n_vocab         (struct whisper_context * ctx);
@@ -570,6 +732,15 @@ extern "C" {
         size_t                           n_grammar_rules;
         size_t                           i_start_rule;
         float                            grammar_penalty;
+
+        // [EXPERIMENTAL] run the VAD on the input audio and transcribe only the detected speech
+        // the timestamps of the results refer to the input audio
+        bool vad;
+        struct whisper_vad_params vad_params;
+
+        // [EXPERIMENTAL] use the early-exit language detection when detect_language is set or language is "auto"
+        bool lang_detect_fast;
+        struct whisper_lang_detect_params lang_detect_params;
     };
 
     // NOTE: this function allocates memory, and it is the responsibility of the caller to free the pointer - see whisper_free_context_params & whisper_free_params()
@@ -594,11 +765,12 @@ extern "C" {
                            const float * samples,
                                    int   n_samples);
 
-    // Split the input audio in chunks and process each chunk separately using whisper_full_with_state()
+    // Split the input audio in chunks and process the chunks on a pool of n_processors states using whisper_full_with_state()
+    // The audio is split at the quietest point near each boundary and the chunks overlap slightly. The results are
+    // stitched by timestamp, so that every segment is reported once
+    // With n_max_text_ctx == 0, the chunks are single 30 s windows and idle workers steal the pending windows of busy ones
     // Result is stored in the default state of the context
     // Not thread safe if executed in parallel on the same context.
-    // It seems this approach can offer some speedup in some cases.
-    // However, the transcription accuracy can be worse at the beginning and end of each chunk.
     WHISPER_API int whisper_full_parallel(
                 struct whisper_context * ctx,
             struct whisper_full_params   params,
@@ -654,6 +826,73 @@ extern "C" {
 
     ////////////////////////////////////////////////////////////////////////////
 
+    // [EXPERIMENTAL] Incremental streaming
+    //
+    // Audio is pushed in small pieces with whisper_stream_push(). The log mel frames are computed once, when the
+    // audio arrives, and kept for as long as they are in the current window. whisper_stream_process() runs the
+    // encoder and the decoder on the current window only when at least step_ms of new audio has arrived.
+    // The stable text is reported once, its tokens are used as the decoder prompt for the next windows, and the window
+    // is moved past it - see whisper_stream_params for when text becomes stable.
+    // The rest of the text is tentative and can change with more audio.
+    //
+    // The strings in the whisper_full_params (language, initial_prompt, ...) must stay valid while the stream is used
+    // Timestamps are in units of 10 ms from the start of the stream
+
+    struct whisper_stream;
+
+    struct whisper_stream_params {
+        int step_ms;   // minimum amount of new audio between two decodes
+        int length_ms; // maximum length of the window
+
+        // without agreement, when the window is full: the segments that end before its last keep_ms become stable and
+        // the window is moved to the end of the last of them - if they all end within the last keep_ms (e.g. a single
+        // segment covers the window), they all become stable; the last keep_ms of audio are carried over to the next
+        // window only when the full window has no segment at all
+        int keep_ms;
+
+        // LocalAgreement-n: the words on which the last agreement_n hypotheses agree become stable and the window is
+        // moved past them (requires token timestamps, enabled automatically)
+        // 0 - segments become stable only when the window is full
+        int agreement_n;
+    };
+
+    WHISPER_API struct whisper_stream_params whisper_stream_default_params(void);
+
+    // The stream uses the default state of the context
+    WHISPER_API struct whisper_stream * whisper_stream_init(
+                struct whisper_context * ctx,
+          struct whisper_stream_params   sparams,
+            struct whisper_full_params   params);
+
+    WHISPER_API struct whisper_stream * whisper_stream_init_with_state(
+                struct whisper_context * ctx,
+                  struct whisper_state * state,
+          struct whisper_stream_params   sparams,
+            struct whisper_full_params   params);
+
+    WHISPER_API void whisper_stream_free(struct whisper_stream * stream);
+
+    // Push mono 16 kHz audio
+    // Returns 0 on success
+    WHISPER_API int whisper_stream_push(struct whisper_stream * stream, const float * samples, int n_samples);
+
+    // Decode the current window if enough new audio has been pushed since the last decode
+    // Returns 1 if the segments were updated, 0 if there was nothing to do, or a negative number on failure
+    WHISPER_API int whisper_stream_process(struct whisper_stream * stream);
+
+    // Decode all the remaining audio and make all the segments stable
+    // Returns 1 if the segments were updated, 0 if there was nothing to do, or a negative number on failure
+    WHISPER_API int whisper_stream_flush(struct whisper_stream * stream);
+
+    // The segments of the last decode: the segments that just became stable, followed by the tentative ones
+    WHISPER_API int          whisper_stream_n_segments         (struct whisper_stream * stream);
+    WHISPER_API const char * whisper_stream_get_segment_text   (struct whisper_stream * stream, int i_segment);
+    WHISPER_API int64_t      whisper_stream_get_segment_t0     (struct whisper_stream * stream, int i_segment);
+    WHISPER_API int64_t      whisper_stream_get_segment_t1     (struct whisper_stream * stream, int i_segment);
+    WHISPER_API bool         whisper_stream_get_segment_stable (struct whisper_stream * stream, int i_segment);
+
+    ////////////////////////////////////////////////////////////////////////////
+
     // Temporary helpers needed for exposing ggml interface
 
     WHISPER_API int          whisper_bench_memcpy          (int n_threads);
@@ -661,6 +900,11 @@ extern "C" {
     WHISPER_API int          whisper_bench_ggml_mul_mat    (int n_threads);
     WHISPER_API const char * whisper_bench_ggml_mul_mat_str(int n_threads);
 
+    // Decoding with 1 to 8 parallel sequences (e.g. beam search), masked vs sequence-aware self-attention
+    // Make sure the context has a state (e.g. whisper_init_from_file_with_params())
+    WHISPER_API int          whisper_bench_decoder_beams    (struct whisper_context * ctx, int n_threads);
+    WHISPER_API const char * whisper_bench_decoder_beams_str(struct whisper_context * ctx, int n_threads);
+
     // Control logging output; default behavior is to print to stderr
 
     WHISPER_API void whisper_log_set(ggml_log_callback log_callback, void * user_data);
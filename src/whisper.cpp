@@ -22,8 +22,11 @@
 #include <cstdio>
 #include <cstdarg>
 #include <cstring>
+#include <deque>
 #include <fstream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <thread>
@@ -33,6 +36,17 @@
 #include <functional>
 #include <codecvt>
 
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 // dummy
 
 #if defined(_MSC_VER)
@@ -169,7 +183,8 @@ static bool ggml_graph_compute_helper(
 static bool ggml_graph_compute_helper(
       ggml_backend_sched_t   sched,
         struct ggml_cgraph * graph,
-                       int   n_threads) {
+                       int   n_threads,
+         ggml_threadpool_t   threadpool = nullptr) {
 
     for (int i = 0; i < ggml_backend_sched_get_n_backends(sched); ++i) {
         ggml_backend_t backend = ggml_backend_sched_get_backend(sched, i);
@@ -180,6 +195,10 @@ static bool ggml_graph_compute_helper(
         if (fn_set_n_threads) {
             fn_set_n_threads(backend, n_threads);
         }
+
+        if (threadpool && ggml_backend_is_cpu(backend)) {
+            ggml_backend_cpu_set_threadpool(backend, threadpool);
+        }
     }
 
     bool t = ggml_backend_sched_graph_compute(sched, graph) == GGML_STATUS_SUCCESS;
@@ -518,28 +537,46 @@ static size_t whisper_sched_size(struct whisper_sched & allocr) {
     return size;
 }
 
-// measure the memory usage of a graph and prepare the allocr's internal data buffer
-static bool whisper_sched_graph_init(struct whisper_sched & allocr, std::vector<ggml_backend_t> backends, std::function<struct ggml_cgraph *()> && get_graph) {
-    auto & sched = allocr.sched;
-    auto & meta  = allocr.meta;
-
-    sched = ggml_backend_sched_new(backends.data(), nullptr, backends.size(), WHISPER_MAX_NODES, false);
-
-    meta.resize(ggml_tensor_overhead()*WHISPER_MAX_NODES + ggml_graph_overhead());
-
-    // since there are dependencies between the different graphs,
-    // we need to allocate them instead of only reserving to get the correct compute buffer size
-    if (!ggml_backend_sched_alloc_graph(sched, get_graph())) {
+// measure the memory usage of a graph and grow the compute buffer of the scheduler to fit it
+static bool whisper_sched_graph_reserve(struct whisper_sched & allocr, std::function<struct ggml_cgraph *()> && get_graph) {
+    if (!ggml_backend_sched_reserve(allocr.sched, get_graph())) {
         // failed to allocate the compute buffer
         WHISPER_LOG_ERROR("%s: failed to allocate the compute buffer\n", __func__);
         return false;
     }
 
-    ggml_backend_sched_reset(sched);
+    ggml_backend_sched_reset(allocr.sched);
 
     return true;
 }
 
+// the backends and the scheduler of a state
+// the graphs of a state are evaluated one after the other, so they all use the same scheduler and compute buffer
+// with whisper_context_params.share_compute_buffers, so do the states created on the same thread
+struct whisper_compute {
+    std::vector<ggml_backend_t> backends;
+
+    whisper_sched sched;
+
+    // CPU threads of the graphs, kept alive between the graphs (and on the CPUs of whisper_context_params.numa_node)
+    ggml_threadpool_t threadpool = nullptr;
+    int n_threads_pool = 0;
+};
+
+static void whisper_compute_free(struct whisper_compute * compute) {
+    ggml_backend_sched_free(compute->sched.sched);
+
+    for (auto & backend : compute->backends) {
+        ggml_backend_free(backend);
+    }
+
+    if (compute->threadpool) {
+        ggml_threadpool_free(compute->threadpool);
+    }
+
+    delete compute;
+}
+
 // medium
 // hparams: {
 // 'n_mels': 80,
@@ -684,6 +721,20 @@ struct whisper_kv_cache {
     std::vector<uint8_t> ctx_buf;
 };
 
+// sequence-aware self-attention of the decoder (CPU only)
+// with several sequences in the batch (beam search, best_of), each token attends only to the cells of its own sequence
+// instead of computing the attention over all n_kv cells and masking the rest
+struct whisper_kv_seq_attn {
+    bool enabled  = false;
+    bool disabled = false; // force the masked attention (used by the benchmark)
+
+    int32_t n_head = 0;
+    int32_t n_max  = 0; // max number of cells per token
+
+    std::vector<int32_t> cells; // the cells attended by each token, [offs[j], offs[j + 1])
+    std::vector<int32_t> offs;
+};
+
 struct whisper_model {
     e_model type = MODEL_UNKNOWN;
 
@@ -724,6 +775,9 @@ struct whisper_model {
     // the model backend data is read-only and can be shared between processors
     ggml_backend_buffer_t buffer = nullptr;
 
+    // buffers of the CPU extra buffer types (e.g. repacked weights) for the quantized linear weights
+    std::vector<ggml_backend_buffer_t> buffers_extra;
+
     // tensors
     int n_loaded;
     std::map<std::string, struct ggml_tensor *> tensors;
@@ -735,8 +789,9 @@ struct whisper_partial_utf8 {
 };
 
 struct whisper_grammar {
-    /*const*/ std::vector<std::vector<whisper_grammar_element>> rules;
-    std::vector<std::vector<const whisper_grammar_element *>>   stacks;
+    // the rules are shared by all copies of the grammar, so the stacks of all decoders point into the same memory
+    std::shared_ptr<const std::vector<std::vector<whisper_grammar_element>>> rules;
+    std::vector<std::vector<const whisper_grammar_element *>>                stacks;
 
     // buffer for partially generated UTF-8 sequence from accepted tokens
     whisper_partial_utf8 partial_utf8;
@@ -748,6 +803,26 @@ struct whisper_grammar_candidate {
     whisper_partial_utf8   partial_utf8;
 };
 
+struct whisper_grammar_trie_node {
+    std::vector<std::pair<uint32_t, int32_t>> children; // (code point, node index), sorted by code point
+
+    // range of the tokens in this subtree (indices in whisper_grammar_cache::trie_ids)
+    int32_t i0;
+    int32_t i1;
+};
+
+// the vocabulary compiled into a trie of code points + the tokens rejected for each set of parse stacks
+struct whisper_grammar_cache {
+    std::vector<whisper_grammar_trie_node> trie;
+    std::vector<whisper_token>             trie_ids;    // tokens in depth-first order of the trie
+    std::vector<whisper_token>             partial_ids; // tokens that do not decode to complete code points
+
+    // the rejected tokens are valid only for these rules
+    std::shared_ptr<const std::vector<std::vector<whisper_grammar_element>>> rules;
+
+    std::map<std::vector<std::vector<const whisper_grammar_element *>>, std::vector<whisper_token>> rejects;
+};
+
 struct whisper_sequence {
     std::vector<whisper_token_data> tokens;
 
@@ -794,6 +869,13 @@ struct whisper_aheads_masks {
     ggml_backend_buffer_t buffer = nullptr;
 };
 
+// a speech region of the input audio and its position in the audio that is actually processed
+struct whisper_vad_region {
+    int64_t i_orig; // first sample in the input audio
+    int64_t i_proc; // first sample in the processed audio
+    int64_t n;      // number of samples
+};
+
 struct whisper_state {
     int64_t t_sample_us = 0;
     int64_t t_encode_us = 0;
@@ -823,23 +905,16 @@ struct whisper_state {
     // padded buffer for flash-attention
     whisper_kv_cache kv_pad;
 
+    whisper_kv_seq_attn kv_seq_attn;
+
     whisper_mel mel;
 
     whisper_batch batch;
 
     whisper_decoder decoders[WHISPER_MAX_DECODERS];
 
-    std::vector<ggml_backend_t> backends;
-
-    // - stores meta info about the intermediate tensors into the `meta` buffers
-    whisper_sched sched_conv;
-    whisper_sched sched_encode;
-    whisper_sched sched_cross;
-    whisper_sched sched_decode;
-
-    // result of the encoder
-    struct ggml_tensor * embd_conv = nullptr;
-    struct ggml_tensor * embd_enc  = nullptr;
+    // backends, scheduler and compute buffer - possibly shared with other states
+    std::shared_ptr<whisper_compute> compute;
 
     // helpers for GPU offloading
     std::vector<float> inp_mel;
@@ -851,6 +926,12 @@ struct whisper_state {
     std::vector<whisper_segment> result_all;
     std::vector<whisper_token>   prompt_past;
 
+    // [EXPERIMENTAL] speech regions kept by the VAD pre-pass, used to map the timestamps back to the input audio
+    std::vector<whisper_vad_region> vad_regions;
+
+    // token acceptance cache for grammar-constrained decoding
+    whisper_grammar_cache grammar_cache;
+
     int lang_id = 0; // english by default
 
     std::string path_model; // populated by whisper_init_from_file_with_params()
@@ -879,6 +960,10 @@ struct whisper_state {
 
     // [EXPERIMENTAL] speed-up techniques
     int32_t exp_n_audio_ctx = 0; // 0 - use default
+    int32_t exp_n_audio_layer = 0; // 0 - use all encoder layers
+
+    // use the fused CPU kernels for the norms and the linear layers (set when the CPU is the only backend)
+    bool fused_ops = false;
 };
 
 struct whisper_context {
@@ -886,7 +971,7 @@ struct whisper_context {
     int64_t t_start_us = 0;
 
     ggml_type wtype = ggml_type::GGML_TYPE_F16; // weight type (FP32 / FP16 / QX)
-    ggml_type itype = ggml_type::GGML_TYPE_F16; // intermediate type (FP32 or FP16)
+    ggml_type itype = ggml_type::GGML_TYPE_F16; // intermediate type (FP16 or BF16)
 
     whisper_context_params params;
 
@@ -895,6 +980,10 @@ struct whisper_context {
 
     whisper_state * state = nullptr;
 
+    // the compute resources of the states created on each thread, with params.share_compute_buffers
+    std::mutex compute_mutex;
+    std::map<std::thread::id, std::weak_ptr<whisper_compute>> compute_shared;
+
     std::string path_model; // populated by whisper_init_from_file_with_params()
 };
 
@@ -915,7 +1004,8 @@ static void read_safe(whisper_model_loader * loader, T & dest) {
 static bool whisper_kv_cache_init(
              struct whisper_kv_cache & cache,
                       ggml_backend_t   backend,
-                           ggml_type   wtype,
+                           ggml_type   type_k,
+                           ggml_type   type_v,
                              int64_t   n_text_state,
                              int64_t   n_text_layer,
                                  int   n_ctx) {
@@ -943,8 +1033,8 @@ static bool whisper_kv_cache_init(
         return false;
     }
 
-    cache.k = ggml_new_tensor_1d(ctx, wtype, n_elements);
-    cache.v = ggml_new_tensor_1d(ctx, wtype, n_elements);
+    cache.k = ggml_new_tensor_1d(ctx, type_k, n_elements);
+    cache.v = ggml_new_tensor_1d(ctx, type_v, n_elements);
 
     cache.buffer = ggml_backend_alloc_ctx_tensors(ctx, backend);
     if (!cache.buffer) {
@@ -1323,6 +1413,179 @@ static ggml_backend_buffer_type_t whisper_default_buffer_type(const whisper_cont
     return result;
 }
 
+// the extra buffer types of the CPU device (e.g. AMX, CPU_AARCH64) store the weights in a layout that is
+// repacked for the matrix multiplication kernels of the host CPU
+static std::vector<ggml_backend_buffer_type_t> whisper_cpu_extra_buffer_types() {
+    std::vector<ggml_backend_buffer_type_t> result;
+
+    ggml_backend_dev_t dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    if (!dev) {
+        return result;
+    }
+
+    ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(dev);
+    auto get_extra_bufts = (ggml_backend_dev_get_extra_bufts_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_dev_get_extra_bufts");
+    if (!get_extra_bufts) {
+        return result;
+    }
+
+    for (ggml_backend_buffer_type_t * buft = get_extra_bufts(dev); buft && *buft; ++buft) {
+        result.push_back(*buft);
+    }
+
+    return result;
+}
+
+// the CPUs of a NUMA node, from /sys/devices/system/node/node<N>/cpulist (e.g. "0-15,32-47")
+static std::vector<int> whisper_numa_node_cpus(int node) {
+    std::vector<int> result;
+
+    std::ifstream fin("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+
+    std::string list;
+    if (!std::getline(fin, list)) {
+        return result;
+    }
+
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+
+        const std::string range = list.substr(pos, end - pos);
+        const size_t dash = range.find('-');
+
+        const int c0 = std::stoi(range.substr(0, dash));
+        const int c1 = dash == std::string::npos ? c0 : std::stoi(range.substr(dash + 1));
+
+        for (int c = c0; c <= c1; ++c) {
+            result.push_back(c);
+        }
+
+        pos = end + 1;
+    }
+
+    return result;
+}
+
+// set the NUMA policy of the pages of a host buffer, before they are first touched:
+// bind them to the given node, or interleave them across all the nodes when node < 0
+static bool whisper_numa_set_policy(void * data, size_t size, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+    // from <numaif.h>
+    constexpr int MPOL_BIND       = 2;
+    constexpr int MPOL_INTERLEAVE = 3;
+    constexpr int MPOL_MF_MOVE    = 1 << 1;
+
+    const int n_nodes = whisper_numa_n_nodes();
+    if (n_nodes < 1 || node >= n_nodes || size == 0) {
+        return false;
+    }
+
+    constexpr int n_bits = 8*sizeof(unsigned long);
+
+    std::vector<unsigned long> mask((n_nodes + n_bits - 1)/n_bits, 0);
+    for (int i = 0; i < n_nodes; ++i) {
+        if (node < 0 || i == node) {
+            mask[i/n_bits] |= 1UL << (i%n_bits);
+        }
+    }
+
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    const uintptr_t p0   = (uintptr_t) data & ~(page - 1);
+    const uintptr_t p1   = (uintptr_t) data + size;
+
+    return syscall(SYS_mbind, p0, p1 - p0, node < 0 ? MPOL_INTERLEAVE : MPOL_BIND, mask.data(), mask.size()*n_bits + 1, MPOL_MF_MOVE) == 0;
+#else
+    GGML_UNUSED(data);
+    GGML_UNUSED(size);
+    GGML_UNUSED(node);
+
+    return false;
+#endif
+}
+
+// the threadpool for evaluating the graphs of a state with n_threads threads
+// it is created on first use and grown when more threads are requested, so that the threads stay alive between the
+// graphs: after a graph, the workers poll for new work (params.cpu_poll) before going to sleep, which saves the thread
+// wake-up of the consecutive decoder graphs - with OpenMP, the OpenMP runtime keeps the threads and controls the polling
+static ggml_threadpool_t whisper_compute_threadpool(whisper_compute & compute, const whisper_context_params & params, int n_threads) {
+    if (compute.threadpool && compute.n_threads_pool >= n_threads) {
+        return compute.threadpool;
+    }
+
+    struct ggml_threadpool_params tpp = ggml_threadpool_params_default(n_threads);
+
+    tpp.poll = params.cpu_poll;
+    tpp.prio = params.cpu_prio;
+
+    if (params.numa_node >= 0) {
+        for (int cpu : whisper_numa_node_cpus(params.numa_node)) {
+            if (cpu < GGML_MAX_N_THREADS) {
+                tpp.cpumask[cpu] = true;
+            }
+        }
+    }
+
+    ggml_threadpool_t threadpool = ggml_threadpool_new(&tpp);
+    if (!threadpool) {
+        WHISPER_LOG_ERROR("%s: failed to create a threadpool of %d threads\n", __func__, n_threads);
+        return compute.threadpool;
+    }
+
+    // the backends switch to the new threadpool before the old one is freed
+    for (auto & backend : compute.backends) {
+        if (ggml_backend_is_cpu(backend)) {
+            ggml_backend_cpu_set_threadpool(backend, threadpool);
+        }
+    }
+
+    if (compute.threadpool) {
+        ggml_threadpool_free(compute.threadpool);
+    }
+
+    compute.threadpool     = threadpool;
+    compute.n_threads_pool = n_threads;
+
+    return threadpool;
+}
+
+// check if the CPU device can compute ggml_mul_mat(w, x) with the weight w stored in a buffer of type buft
+static bool whisper_cpu_buft_supports_weight(ggml_backend_buffer_type_t buft, ggml_tensor * w) {
+    ggml_backend_dev_t dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+
+    ggml_init_params params = {
+        /*.mem_size   =*/ 2*ggml_tensor_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+
+    ggml_context * ctx = ggml_init(params);
+    if (!ctx) {
+        return false;
+    }
+
+    ggml_tensor * x  = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, w->ne[0], 32);
+    ggml_tensor * op = ggml_mul_mat(ctx, w, x);
+
+    // the support check only looks at the buffer type of the weight, so a dummy buffer is enough
+    ggml_backend_buffer_t buf = ggml_backend_buft_alloc_buffer(buft, 0);
+    w->buffer = buf;
+
+    const bool result = buf && ggml_backend_dev_supports_op(dev, op);
+
+    w->buffer = nullptr;
+    ggml_backend_buffer_free(buf);
+    ggml_free(ctx);
+
+    return result;
+}
+
+// set in the ftype of models with mixed tensor types (see examples/quantize)
+#define WHISPER_FTYPE_MIXED 0x10000
+
 // load the model from a ggml file
 //
 // file format:
@@ -1330,6 +1593,7 @@ static ggml_backend_buffer_type_t whisper_default_buffer_type(const whisper_cont
 //   - hparams
 //   - pre-computed mel filters
 //   - vocab
+//   - per-tensor types (only if WHISPER_FTYPE_MIXED is set in the ftype)
 //   - weights
 //
 // see the convert-pt-to-ggml.py script for details
@@ -1344,6 +1608,10 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
     auto & model = wctx.model;
     auto & vocab = wctx.vocab;
 
+    // per-tensor types of mixed-precision models
+    bool mixed = false;
+    std::map<std::string, ggml_type> tensor_types;
+
     // verify magic
     {
         uint32_t magic;
@@ -1398,6 +1666,10 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
             }
         }
 
+        mixed = hparams.ftype & WHISPER_FTYPE_MIXED;
+
+        hparams.ftype &= ~WHISPER_FTYPE_MIXED;
+
         const int32_t qntvr = hparams.ftype / GGML_QNT_VERSION_FACTOR;
 
         hparams.ftype %= GGML_QNT_VERSION_FACTOR;
@@ -1410,6 +1682,9 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
             return false;
         }
 
+        // BF16 models keep the range of FP32, the K/V casts and the padded KV cache of the encoder use BF16 too
+        wctx.itype = wctx.wtype == GGML_TYPE_BF16 ? GGML_TYPE_BF16 : GGML_TYPE_F16;
+
         WHISPER_LOG_INFO("%s: n_vocab       = %d\n", __func__, hparams.n_vocab);
         WHISPER_LOG_INFO("%s: n_audio_ctx   = %d\n", __func__, hparams.n_audio_ctx);
         WHISPER_LOG_INFO("%s: n_audio_state = %d\n", __func__, hparams.n_audio_state);
@@ -1526,6 +1801,37 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
         WHISPER_LOG_INFO("%s: n_langs       = %d\n", __func__, vocab.num_languages());
     }
 
+    // load per-tensor types
+    if (mixed) {
+        int32_t n_types = 0;
+        read_safe(loader, n_types);
+
+        std::string name;
+        std::vector<char> tmp;
+
+        for (int i = 0; i < n_types; ++i) {
+            int32_t len;
+            int32_t type;
+
+            read_safe(loader, len);
+
+            tmp.resize(len);
+            loader->read(loader->context, &tmp[0], tmp.size());
+            name.assign(&tmp[0], tmp.size());
+
+            read_safe(loader, type);
+
+            if (type < 0 || type >= GGML_TYPE_COUNT) {
+                WHISPER_LOG_ERROR("%s: invalid type %d for tensor '%s'\n", __func__, type, name.c_str());
+                return false;
+            }
+
+            tensor_types[name] = (ggml_type) type;
+        }
+
+        WHISPER_LOG_INFO("%s: mixed types   = %d tensors\n", __func__, n_types);
+    }
+
     const ggml_type wtype = wctx.wtype;
     const ggml_type vtype = wctx.wtype == GGML_TYPE_F32 ? GGML_TYPE_F32 : GGML_TYPE_F16; // conv type
 
@@ -1747,7 +2053,113 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
         }
     }
 
-    // allocate tensors in the backend buffers
+    // name the tensors, so that the weights can be identified in the graphs (e.g. by the eval callback)
+    for (auto & it : model.tensors) {
+        ggml_set_name(it.second, it.first.c_str());
+    }
+
+    // the weights of the linear layers
+    std::vector<ggml_tensor *> weights;
+
+    for (const auto & layer : model.layers_encoder) {
+        for (ggml_tensor * w : { layer.attn_q_w, layer.attn_k_w, layer.attn_v_w, layer.attn_ln_1_w, layer.mlp_0_w, layer.mlp_1_w }) {
+            weights.push_back(w);
+        }
+    }
+
+    for (const auto & layer : model.layers_decoder) {
+        for (ggml_tensor * w : { layer.attn_q_w, layer.attn_k_w, layer.attn_v_w, layer.attn_ln_1_w,
+                                 layer.cross_attn_q_w, layer.cross_attn_k_w, layer.cross_attn_v_w, layer.cross_attn_ln_1_w,
+                                 layer.mlp_0_w, layer.mlp_1_w }) {
+            weights.push_back(w);
+        }
+    }
+
+    // apply the per-tensor types before the tensors are allocated
+    for (const auto & it : tensor_types) {
+        if (model.tensors.find(it.first) == model.tensors.end()) {
+            WHISPER_LOG_ERROR("%s: unknown tensor '%s' in the tensor types\n", __func__, it.first.c_str());
+            return false;
+        }
+
+        ggml_tensor * tensor = model.tensors[it.first];
+
+        const ggml_type type = it.second;
+        if (type == tensor->type) {
+            continue;
+        }
+
+        // only the weights can change type, the conv kernels are limited to F16/F32
+        const bool is_conv   = tensor == model.e_conv_1_w || tensor == model.e_conv_2_w;
+        const bool is_weight = tensor == model.d_te || std::find(weights.begin(), weights.end(), tensor) != weights.end();
+
+        const bool ok = is_conv ? (type == GGML_TYPE_F16 || type == GGML_TYPE_F32) : is_weight && tensor->ne[0] % ggml_blck_size(type) == 0;
+        if (!ok) {
+            WHISPER_LOG_ERROR("%s: tensor '%s' cannot be stored as %s\n", __func__, it.first.c_str(), ggml_type_name(type));
+            return false;
+        }
+
+        tensor->type  = type;
+        tensor->nb[0] = ggml_type_size(type);
+        tensor->nb[1] = ggml_row_size(type, tensor->ne[0]);
+        for (int i = 2; i < GGML_MAX_DIMS; ++i) {
+            tensor->nb[i] = tensor->nb[i - 1]*tensor->ne[i - 1];
+        }
+    }
+
+    // place the quantized linear weights in the CPU extra buffer types that support them
+    // the F16/BF16/F32 weights stay in the standard layout, the extra buffer types only repack quantized types
+    if (whisper_default_buffer_type(wctx.params) == ggml_backend_cpu_buffer_type()) {
+        const auto extra_bufts = whisper_cpu_extra_buffer_types();
+
+        std::vector<std::vector<ggml_tensor *>> placed(extra_bufts.size());
+
+        for (ggml_tensor * w : weights) {
+            if (!ggml_is_quantized(w->type)) {
+                continue;
+            }
+
+            for (size_t i = 0; i < extra_bufts.size(); ++i) {
+                if (whisper_cpu_buft_supports_weight(extra_bufts[i], w)) {
+                    placed[i].push_back(w);
+                    break;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < extra_bufts.size(); ++i) {
+            if (placed[i].empty()) {
+                continue;
+            }
+
+            const size_t align = ggml_backend_buft_get_alignment(extra_bufts[i]);
+
+            std::vector<size_t> offs;
+            size_t size = 0;
+            for (ggml_tensor * w : placed[i]) {
+                offs.push_back(size);
+                size += GGML_PAD(ggml_backend_buft_get_alloc_size(extra_bufts[i], w), align);
+            }
+
+            ggml_backend_buffer_t buf = ggml_backend_buft_alloc_buffer(extra_bufts[i], size);
+            if (!buf) {
+                WHISPER_LOG_ERROR("%s: failed to allocate %s buffer for the model\n", __func__, ggml_backend_buft_name(extra_bufts[i]));
+                return false;
+            }
+
+            ggml_backend_buffer_set_usage(buf, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+            model.buffers_extra.push_back(buf);
+
+            char * base = (char *) ggml_backend_buffer_get_base(buf);
+            for (size_t j = 0; j < placed[i].size(); ++j) {
+                ggml_backend_tensor_alloc(buf, placed[i][j], base + offs[j]);
+            }
+
+            WHISPER_LOG_INFO("%s: %8s total size = %8.2f MB (%zu tensors)\n", __func__, ggml_backend_buffer_name(buf), size / 1e6, placed[i].size());
+        }
+    }
+
+    // allocate the remaining tensors in the backend buffers
     model.buffer = ggml_backend_alloc_ctx_tensors_from_buft(model.ctx, whisper_default_buffer_type(wctx.params));
     if (!model.buffer) {
         WHISPER_LOG_ERROR("%s: failed to allocate memory for the model\n", __func__);
@@ -1757,6 +2169,26 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
     size_t size_main = ggml_backend_buffer_get_size(model.buffer);
     WHISPER_LOG_INFO("%s: %8s total size = %8.2f MB\n", __func__, ggml_backend_buffer_name(model.buffer), size_main / 1e6);
 
+    // NUMA placement of the weights in host memory - the pages are not touched until the weights are loaded below
+    if ((wctx.params.numa_node >= 0 || wctx.params.numa_interleave) && whisper_default_buffer_type(wctx.params) == ggml_backend_cpu_buffer_type()) {
+        const int node = wctx.params.numa_node;
+
+        std::vector<ggml_backend_buffer_t> buffers = model.buffers_extra;
+        buffers.push_back(model.buffer);
+
+        for (ggml_backend_buffer_t buf : buffers) {
+            if (!whisper_numa_set_policy(ggml_backend_buffer_get_base(buf), ggml_backend_buffer_get_size(buf), node)) {
+                WHISPER_LOG_WARN("%s: failed to set the NUMA policy of the %s buffer\n", __func__, ggml_backend_buffer_name(buf));
+            }
+        }
+
+        if (node >= 0) {
+            WHISPER_LOG_INFO("%s: weights bound to NUMA node %d\n", __func__, node);
+        } else {
+            WHISPER_LOG_INFO("%s: weights interleaved across %d NUMA nodes\n", __func__, whisper_numa_n_nodes());
+        }
+    }
+
     // load weights
     {
         size_t total_size = 0;
@@ -1822,7 +2254,7 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
 
             //printf("%s: [%5.5s] %s\n", __func__, ggml_backend_name(backend), name.c_str());
 
-            if (ggml_backend_buffer_is_host(model.buffer)) {
+            if (ggml_backend_buffer_is_host(tensor->buffer)) {
                 // for the CPU and Metal backend, we can read directly into the tensor
                 loader->read(loader->context, tensor->data, ggml_nbytes(tensor));
                 BYTESWAP_TENSOR(tensor);
@@ -1875,98 +2307,340 @@ static bool whisper_encode_external(const whisper_state & wstate) {
     return use_coreml || use_openvino;
 }
 
-static struct ggml_cgraph * whisper_build_graph_conv(
-        whisper_context & wctx,
-          whisper_state & wstate) {
-    const auto & model   = wctx.model;
-    const auto & hparams = model.hparams;
+// GELU as computed by the CPU backend (ggml_gelu): the result for the F16-rounded input is looked up in a table
+// y and x can be the same array
+static void whisper_vec_gelu_f32(int n, float * y, const float * x) {
+    static const std::vector<ggml_fp16_t> table = [] {
+        std::vector<ggml_fp16_t> result(1 << 16);
+        for (int i = 0; i < (1 << 16); ++i) {
+            ggml_fp16_t h;
+            const uint16_t u = i;
+            memcpy(&h, &u, sizeof(u));
 
-    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
-    const int n_state = hparams.n_audio_state; GGML_UNUSED(n_state);
+            const float f = ggml_fp16_to_fp32(h);
+            result[i] = ggml_fp32_to_fp16(0.5f*f*(1.0f + tanhf(0.79788456080286535587989211986876f*f*(1.0f + 0.044715f*f*f))));
+        }
+        return result;
+    }();
 
-    const int n_mels = hparams.n_mels;
+    static const ggml_from_float_t to_f16 = ggml_get_type_traits_cpu(GGML_TYPE_F16)->from_float;
 
-    struct ggml_init_params params = {
-        /*.mem_size   =*/ wstate.sched_conv.meta.size(),
-        /*.mem_buffer =*/ wstate.sched_conv.meta.data(),
-        /*.no_alloc   =*/ true,
-    };
+    thread_local std::vector<ggml_fp16_t> buf;
+    thread_local std::vector<float>       res;
 
-    struct ggml_context * ctx0 = ggml_init(params);
+    buf.resize(n);
+    res.resize(n);
 
-    ggml_cgraph * gf = ggml_new_graph(ctx0);
+    to_f16(x, buf.data(), n);
 
-    struct ggml_tensor * mel = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, 2*n_ctx, n_mels);
-    ggml_set_name(mel, "mel");
-    ggml_set_input(mel);
+    for (int i = 0; i < n; ++i) {
+        uint16_t u;
+        memcpy(&u, &buf[i], sizeof(u));
+        buf[i] = table[u];
+    }
 
-    struct ggml_tensor * cur = nullptr;
+    ggml_fp16_to_fp32_row(buf.data(), res.data(), n);
 
-    if (!whisper_encode_external(wstate)) {
-        // convolution + gelu
-        {
-            cur = ggml_conv_1d_ph(ctx0, model.e_conv_1_w, mel, 1, 1);
-            cur = ggml_add(ctx0, cur, model.e_conv_1_b);
+    for (int i = 0; i < n; ++i) {
+        y[i] = x[i] <= -10.0f ? 0.0f : x[i] >= 10.0f ? x[i] : res[i];
+    }
+}
 
-            cur = ggml_gelu(ctx0, cur);
+// direct 1D convolution with padding K/2, fused with the bias and the GELU activation (CPU only)
+// the input patches are built per tile of output positions, so the im2col matrix of ggml_conv_1d_ph is never materialized
+// the patches use the im2col layout and the dot products use the same CPU kernel, so the results match ggml_conv_1d_ph
+//   dst:   [L_out, C_out]   (F32)
+//   x:     [L_in, C_in]     (F32), the stride is L_in/L_out
+//   w:     [K, C_in, C_out] (F16/F32)
+//   bias:  [1, C_out]       (F32)
+static void whisper_conv_1d_gelu_compute(
+        struct ggml_tensor * dst,
+  const struct ggml_tensor * x,
+  const struct ggml_tensor * w,
+  const struct ggml_tensor * bias,
+                       int   ith,
+                       int   nth,
+                      void * /*userdata*/) {
+    const int K     = w->ne[0];
+    const int C_in  = w->ne[1];
+    const int C_out = w->ne[2];
+    const int L_in  = x->ne[0];
+    const int L_out = dst->ne[0];
 
-            cur = ggml_conv_1d_ph(ctx0, model.e_conv_2_w, cur, 2, 1);
-            cur = ggml_add(ctx0, cur, model.e_conv_2_b);
+    const int s  = L_in/L_out;
+    const int p0 = K/2;
 
-            cur = ggml_gelu(ctx0, cur);
-        }
+    const auto * traits = ggml_get_type_traits_cpu(w->type);
 
-        ggml_set_name(cur, "embd_conv");
-        wstate.embd_conv = cur;
-    } else {
-        ggml_build_forward_expand(gf, mel);
+    const ggml_from_float_t from_float = ggml_get_type_traits_cpu(traits->vec_dot_type)->from_float;
 
-        cur = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, n_ctx);
-        ggml_set_input(cur); // the external encoder will write into this tensor
+    const int    n_patch  = K*C_in;
+    const size_t row_size = ggml_row_size(traits->vec_dot_type, n_patch);
 
-        ggml_set_name(cur, "embd_enc");
-        wstate.embd_enc = cur;
-    }
+    // output positions per tile
+    const int n_tile = 32;
 
-    ggml_set_output(cur);
+    thread_local std::vector<float>   patch_f32;
+    thread_local std::vector<uint8_t> patch;
 
-    ggml_build_forward_expand(gf, cur);
+    patch_f32.resize(n_patch);
+    patch.resize(n_tile*row_size);
 
-    ggml_free(ctx0);
+    // the output channels are split between the threads, so each thread keeps its slice of the weights in cache
+    const int o0 = (C_out*(ith + 0))/nth;
+    const int o1 = (C_out*(ith + 1))/nth;
 
-    return gf;
-}
+    for (int t0 = 0; t0 < L_out; t0 += n_tile) {
+        const int nt = std::min(n_tile, L_out - t0);
 
-static struct ggml_cgraph * whisper_build_graph_encoder(
-        whisper_context & wctx,
-          whisper_state & wstate) {
-    const auto & model   = wctx.model;
-    const auto & hparams = model.hparams;
+        for (int it = 0; it < nt; ++it) {
+            const int t = t0 + it;
 
-    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
-    const int n_state = hparams.n_audio_state;
-    const int n_head  = hparams.n_audio_head;
-    const int n_layer = hparams.n_audio_layer;
+            for (int c = 0; c < C_in; ++c) {
+                const float * xc = (const float *) ((const char *) x->data + c*x->nb[1]);
 
-    const int n_state_head = n_state/n_head;
+                for (int k = 0; k < K; ++k) {
+                    const int idx = s*t + k - p0;
 
-    auto & kv_pad = wstate.kv_pad;
+                    patch_f32[c*K + k] = idx >= 0 && idx < L_in ? xc[idx] : 0.0f;
+                }
+            }
 
-    WHISPER_ASSERT(!!kv_pad.buffer);
+            if (from_float) {
+                from_float(patch_f32.data(), patch.data() + it*row_size, n_patch);
+            } else {
+                memcpy(patch.data() + it*row_size, patch_f32.data(), n_patch*sizeof(float));
+            }
+        }
 
-    const int n_ctx_pad = GGML_PAD(n_ctx, 256);
+        for (int o = o0; o < o1; ++o) {
+            const char  * wo = (const char *) w->data + o*w->nb[2];
+            const float   b  = *(const float *) ((const char *) bias->data + o*bias->nb[1]);
 
-    struct ggml_init_params params = {
-        /*.mem_size   =*/ wstate.sched_encode.meta.size(),
-        /*.mem_buffer =*/ wstate.sched_encode.meta.data(),
-        /*.no_alloc   =*/ true,
-    };
+            float * y = (float *) ((char *) dst->data + o*dst->nb[1]) + t0;
 
-    struct ggml_context * ctx0 = ggml_init(params);
+            for (int it = 0; it < nt; ++it) {
+                traits->vec_dot(n_patch, &y[it], 0, patch.data() + it*row_size, 0, wo, 0, 1);
+                y[it] += b;
+            }
 
-    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+            whisper_vec_gelu_f32(nt, y, y);
+        }
+    }
+}
 
-    struct ggml_tensor * cur = ggml_view_tensor(ctx0, wstate.embd_conv);
+// ggml_map_custom3 with a 2D F32 result of the given shape - ggml_map_custom3 gives the result the shape of its first source
+// a fresh tensor as first source would work too, but it would be a graph leaf and the allocator keeps all leafs alive
+static struct ggml_tensor * whisper_map_custom3_2d(
+        struct ggml_context * ctx0,
+                    int64_t   ne0,
+                    int64_t   ne1,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * c,
+          ggml_custom3_op_t   fun) {
+    struct ggml_tensor * result = ggml_map_custom3(ctx0, a, b, c, fun, GGML_N_TASKS_MAX, nullptr);
+
+    // the graphs are built in no_alloc contexts, so only the metadata has to be updated
+    GGML_ASSERT(result->data == nullptr && result->type == GGML_TYPE_F32);
+
+    result->ne[0] = ne0;
+    result->ne[1] = ne1;
+    result->ne[2] = 1;
+    result->ne[3] = 1;
+
+    result->nb[1] = result->nb[0]*ne0;
+    result->nb[2] = result->nb[1]*ne1;
+    result->nb[3] = result->nb[2];
+
+    return result;
+}
+
+// gelu(conv_1d_ph(w, x, stride) + b)
+static struct ggml_tensor * whisper_conv_1d_gelu(
+        struct ggml_context * ctx0,
+        struct ggml_tensor  * w,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * x,
+                        int   stride,
+                       bool   direct) {
+    if (direct) {
+        return whisper_map_custom3_2d(ctx0, x->ne[0]/stride, w->ne[2], x, w, b, whisper_conv_1d_gelu_compute);
+    }
+
+    struct ggml_tensor * cur = ggml_conv_1d_ph(ctx0, w, x, stride, 1);
+    cur = ggml_add(ctx0, cur, b);
+
+    return ggml_gelu(ctx0, cur);
+}
+
+// dst = norm(x)*w + b for each row of x
+// the arithmetic follows ggml_norm (double accumulators), ggml_mul and ggml_add, so the result is the same as the unfused ops
+//   x:     [n, N]   (F32, contiguous)
+//   w, b:  [n]      (F32)
+//   eps:   passed as userdata
+static void whisper_norm_affine_compute(
+        struct ggml_tensor * dst,
+  const struct ggml_tensor * x,
+  const struct ggml_tensor * w,
+  const struct ggml_tensor * b,
+                       int   ith,
+                       int   nth,
+                      void * userdata) {
+    const float eps = *(const float *) userdata;
+
+    const int64_t n     = x->ne[0];
+    const int64_t nrows = ggml_nrows(x);
+
+    const float * wd = (const float *) w->data;
+    const float * bd = (const float *) b->data;
+
+    for (int64_t ir = ith; ir < nrows; ir += nth) {
+        const float * xr = (const float *) ((const char *) x->data   + ir*x->nb[1]);
+              float * yr = (float *)       ((char *)       dst->data + ir*dst->nb[1]);
+
+        double sum = 0.0;
+        for (int64_t i = 0; i < n; ++i) {
+            sum += (double) xr[i];
+        }
+
+        const float mean = sum/n;
+
+        double sum2 = 0.0;
+        for (int64_t i = 0; i < n; ++i) {
+            const float v = xr[i] - mean;
+            yr[i] = v;
+            sum2 += (double) (v*v);
+        }
+
+        const float variance = sum2/n;
+        const float scale    = 1.0f/sqrtf(variance + eps);
+
+        for (int64_t i = 0; i < n; ++i) {
+            yr[i] = (yr[i]*scale)*wd[i] + bd[i];
+        }
+    }
+}
+
+// dst = gelu(x + b) in a single pass over x, the epilogue of the matrix multiplications in whisper_linear
+//   x:     [M, N]   (F32)
+//   b:     [M]      (F32)
+static void whisper_bias_gelu_compute(
+        struct ggml_tensor * dst,
+  const struct ggml_tensor * x,
+  const struct ggml_tensor * b,
+                       int   ith,
+                       int   nth,
+                      void * /*userdata*/) {
+    const int64_t M     = x->ne[0];
+    const int64_t nrows = ggml_nrows(x);
+
+    const float * bd = (const float *) b->data;
+
+    for (int64_t ir = ith; ir < nrows; ir += nth) {
+        const float * xr = (const float *) ((const char *) x->data   + ir*x->nb[1]);
+              float * yr = (float *)       ((char *)       dst->data + ir*dst->nb[1]);
+
+        for (int64_t i = 0; i < M; ++i) {
+            yr[i] = xr[i] + bd[i];
+        }
+
+        whisper_vec_gelu_f32(M, yr, yr);
+    }
+}
+
+// norm(x)*w + b
+static struct ggml_tensor * whisper_norm_affine(
+        struct ggml_context * ctx0,
+        struct ggml_tensor  * x,
+        struct ggml_tensor  * w,
+        struct ggml_tensor  * b,
+                const float & eps,
+                       bool   fused) {
+    if (fused) {
+        return ggml_map_custom3(ctx0, x, w, b, whisper_norm_affine_compute, GGML_N_TASKS_MAX, (void *) &eps);
+    }
+
+    struct ggml_tensor * cur = ggml_norm(ctx0, x, eps);
+
+    return ggml_add(ctx0, ggml_mul(ctx0, cur, w), b);
+}
+
+// w*x + b, optionally followed by GELU (b can be null)
+static struct ggml_tensor * whisper_linear(
+        struct ggml_context * ctx0,
+        struct ggml_tensor  * w,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * x,
+                       bool   gelu,
+                       bool   fused) {
+    struct ggml_tensor * cur = ggml_mul_mat(ctx0, w, x);
+
+    // the multi-threaded matrix multiplication is left to ggml, only the bias + GELU epilogue is fused
+    if (fused && gelu && b) {
+        return ggml_map_custom2_inplace(ctx0, cur, b, whisper_bias_gelu_compute, GGML_N_TASKS_MAX, nullptr);
+    }
+
+    if (b) {
+        cur = ggml_add(ctx0, cur, b);
+    }
+
+    return gelu ? ggml_gelu(ctx0, cur) : cur;
+}
+
+// convolution + gelu of the mel spectrogram
+static struct ggml_tensor * whisper_build_conv(
+        struct ggml_context * ctx0,
+            whisper_context & wctx,
+              whisper_state & wstate,
+         struct ggml_tensor * mel) {
+    const auto & model = wctx.model;
+
+    // the direct convolution is a CPU custom op, like the other fused ops it needs the CPU as the only backend
+    // (host memory alone is not enough, e.g. Metal buffers are host buffers too)
+    const auto is_direct = [&wstate](const ggml_tensor * w, const ggml_tensor * b) {
+        return wstate.fused_ops &&
+               w->buffer && ggml_backend_buffer_is_host(w->buffer) &&
+               b->buffer && ggml_backend_buffer_is_host(b->buffer) &&
+               (w->type == GGML_TYPE_F16 || w->type == GGML_TYPE_F32) && b->type == GGML_TYPE_F32;
+    };
+
+    struct ggml_tensor * cur = nullptr;
+
+    cur = whisper_conv_1d_gelu(ctx0, model.e_conv_1_w, model.e_conv_1_b, mel, 1, is_direct(model.e_conv_1_w, model.e_conv_1_b));
+    cur = whisper_conv_1d_gelu(ctx0, model.e_conv_2_w, model.e_conv_2_b, cur, 2, is_direct(model.e_conv_2_w, model.e_conv_2_b));
+
+    ggml_set_name(cur, "embd_conv");
+
+    return cur;
+}
+
+// the transformer layers of the encoder
+static struct ggml_tensor * whisper_build_encoder(
+        struct ggml_context * ctx0,
+         struct ggml_cgraph * gf,
+            whisper_context & wctx,
+              whisper_state & wstate,
+         struct ggml_tensor * embd_conv) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+    const int n_state = hparams.n_audio_state;
+    const int n_head  = hparams.n_audio_head;
+    const int n_layer = wstate.exp_n_audio_layer > 0 ? std::min(wstate.exp_n_audio_layer, hparams.n_audio_layer) : hparams.n_audio_layer;
+
+    const int n_state_head = n_state/n_head;
+
+    const bool fused = wstate.fused_ops;
+
+    auto & kv_pad = wstate.kv_pad;
+
+    WHISPER_ASSERT(!!kv_pad.buffer);
+
+    const int n_ctx_pad = GGML_PAD(n_ctx, 256);
+
+    struct ggml_tensor * cur = embd_conv;
 
     const float KQscale = 1.0f/sqrtf(float(n_state_head));
 
@@ -2002,36 +2676,22 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
 
         // norm
         {
-            cur = ggml_norm(ctx0, inpL, hparams.eps);
-
-            // cur = ln_0_w*cur + ln_0_b
-            cur = ggml_add(ctx0,
-                    ggml_mul(ctx0, cur, layer.attn_ln_0_w),
-                    layer.attn_ln_0_b);
+            // cur = ln_0_w*norm(inpL) + ln_0_b
+            cur = whisper_norm_affine(ctx0, inpL, layer.attn_ln_0_w, layer.attn_ln_0_b, hparams.eps, fused);
         }
 
         // self-attention
         {
-            struct ggml_tensor * Qcur = ggml_mul_mat(ctx0,
-                    layer.attn_q_w,
-                    cur);
-
-            Qcur = ggml_add(ctx0, Qcur, layer.attn_q_b);
+            struct ggml_tensor * Qcur = whisper_linear(ctx0, layer.attn_q_w, layer.attn_q_b, cur, false, fused);
 
             //Qcur = ggml_scale(ctx0, Qcur, pow(float(n_state_head), -0.25));
 
             // note: no bias for Key
-            struct ggml_tensor * Kcur = ggml_mul_mat(ctx0,
-                    layer.attn_k_w,
-                    cur);
+            struct ggml_tensor * Kcur = whisper_linear(ctx0, layer.attn_k_w, nullptr, cur, false, fused);
 
             //Kcur = ggml_scale(ctx0, Kcur, pow(float(n_state_head), -0.25));
 
-            struct ggml_tensor * Vcur = ggml_mul_mat(ctx0,
-                    layer.attn_v_w,
-                    cur);
-
-            Vcur = ggml_add(ctx0, Vcur, layer.attn_v_b);
+            struct ggml_tensor * Vcur = whisper_linear(ctx0, layer.attn_v_w, layer.attn_v_b, cur, false, fused);
 
             // ------
 
@@ -2093,11 +2753,7 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
 
         // projection
         {
-            cur = ggml_mul_mat(ctx0,
-                    layer.attn_ln_1_w,
-                    cur);
-
-            cur = ggml_add(ctx0, cur, layer.attn_ln_1_b);
+            cur = whisper_linear(ctx0, layer.attn_ln_1_w, layer.attn_ln_1_b, cur, false, fused);
         }
 
         // add the input
@@ -2109,30 +2765,15 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
         {
             // norm
             {
-                cur = ggml_norm(ctx0, inpFF, hparams.eps);
-
-                // cur = mlp_ln_w*cur + mlp_ln_b
-                cur = ggml_add(ctx0,
-                        ggml_mul(ctx0, cur, layer.mlp_ln_w),
-                        layer.mlp_ln_b);
+                // cur = mlp_ln_w*norm(inpFF) + mlp_ln_b
+                cur = whisper_norm_affine(ctx0, inpFF, layer.mlp_ln_w, layer.mlp_ln_b, hparams.eps, fused);
             }
 
-            // fully connected
-            cur = ggml_mul_mat(ctx0,
-                    layer.mlp_0_w,
-                    cur);
-
-            cur = ggml_add(ctx0, cur, layer.mlp_0_b);
-
-            // GELU activation
-            cur = ggml_gelu(ctx0, cur);
+            // fully connected + GELU activation
+            cur = whisper_linear(ctx0, layer.mlp_0_w, layer.mlp_0_b, cur, true, fused);
 
             // projection
-            cur = ggml_mul_mat(ctx0,
-                    layer.mlp_1_w,
-                    cur);
-
-            cur = ggml_add(ctx0, cur, layer.mlp_1_b);
+            cur = whisper_linear(ctx0, layer.mlp_1_w, layer.mlp_1_b, cur, false, fused);
         }
 
         inpL = ggml_add(ctx0, cur, inpFF);
@@ -2142,17 +2783,11 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
 
     // norm
     {
-        cur = ggml_norm(ctx0, cur, hparams.eps);
-
-        // cur = ln_f_g*cur + ln_f_b
-        cur = ggml_add(ctx0,
-                ggml_mul(ctx0, cur, model.e_ln_w),
-                model.e_ln_b);
+        // cur = ln_f_g*norm(cur) + ln_f_b
+        cur = whisper_norm_affine(ctx0, cur, model.e_ln_w, model.e_ln_b, hparams.eps, fused);
     }
 
-    ggml_build_forward_expand(gf, cur);
-
-    wstate.embd_enc = cur;
+    ggml_set_name(cur, "embd_enc");
 
     //ggml_graph_print(gf);
 
@@ -2165,15 +2800,16 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
     //        wstate.get_buf_max_mem(2)/1e6,
     //        wstate.get_buf_max_mem(3)/1e6);
 
-    ggml_free(ctx0);
-
-    return gf;
+    return cur;
 }
 
 // pre-compute cross-attention memory
-static struct ggml_cgraph * whisper_build_graph_cross(
-        whisper_context & wctx,
-          whisper_state & wstate) {
+static void whisper_build_cross(
+        struct ggml_context * ctx0,
+         struct ggml_cgraph * gf,
+            whisper_context & wctx,
+              whisper_state & wstate,
+         struct ggml_tensor * embd_enc) {
     const auto & model   = wctx.model;
     const auto & hparams = model.hparams;
 
@@ -2185,17 +2821,7 @@ static struct ggml_cgraph * whisper_build_graph_cross(
 
     const int n_ctx_pad = GGML_PAD(n_ctx, 256);
 
-    struct ggml_init_params params = {
-        /*.mem_size   =*/ wstate.sched_cross.meta.size(),
-        /*.mem_buffer =*/ wstate.sched_cross.meta.data(),
-        /*.no_alloc   =*/ true,
-    };
-
-    struct ggml_context * ctx0 = ggml_init(params);
-
-    ggml_cgraph * gf = ggml_new_graph(ctx0);
-
-    struct ggml_tensor * cur = ggml_view_tensor(ctx0, wstate.embd_enc);
+    struct ggml_tensor * cur = embd_enc;
 
     const float  Kscale = pow(float(n_state_head), -0.25);
 
@@ -2221,15 +2847,15 @@ static struct ggml_cgraph * whisper_build_graph_cross(
 
         if (wctx.params.flash_attn) {
             k = ggml_view_1d(ctx0, wstate.kv_cross.k, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.k)*n_state)*(il*n_ctx_pad));
+                    ggml_row_size(wstate.kv_cross.k->type, n_state)*(il*n_ctx_pad));
 
             v = ggml_view_1d(ctx0, wstate.kv_cross.v, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.v)*n_state)*(il*n_ctx_pad));
+                    ggml_row_size(wstate.kv_cross.v->type, n_state)*(il*n_ctx_pad));
         } else {
             Vcross = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcross, n_state, n_ctx));
 
             k = ggml_view_1d(ctx0, wstate.kv_cross.k, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.k)*n_state)*(il*n_ctx));
+                    ggml_row_size(wstate.kv_cross.k->type, n_state)*(il*n_ctx));
 
             v = ggml_view_2d(ctx0, wstate.kv_cross.v, n_ctx, n_state,
                     (   n_ctx)*ggml_element_size(wstate.kv_cross.v),
@@ -2239,6 +2865,48 @@ static struct ggml_cgraph * whisper_build_graph_cross(
         ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcross, k));
         ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vcross, v));
     }
+}
+
+// conv + encoder + cross-attention memory, evaluated as a single graph so that nothing has to be kept in the compute
+// buffer between the stages - with an external encoder, only the cross-attention memory is computed from "embd_enc"
+static struct ggml_cgraph * whisper_build_graph_encoder(
+        whisper_context & wctx,
+          whisper_state & wstate) {
+    const auto & hparams = wctx.model.hparams;
+
+    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+    const int n_state = hparams.n_audio_state;
+    const int n_mels  = hparams.n_mels;
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ wstate.compute->sched.meta.size(),
+        /*.mem_buffer =*/ wstate.compute->sched.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+
+    struct ggml_tensor * mel = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, 2*n_ctx, n_mels);
+    ggml_set_name(mel, "mel");
+    ggml_set_input(mel);
+
+    struct ggml_tensor * cur = nullptr;
+
+    if (!whisper_encode_external(wstate)) {
+        cur = whisper_build_conv(ctx0, wctx, wstate, mel);
+        cur = whisper_build_encoder(ctx0, gf, wctx, wstate, cur);
+    } else {
+        ggml_build_forward_expand(gf, mel);
+
+        cur = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, n_ctx);
+        ggml_set_input(cur); // the external encoder will write into this tensor
+
+        ggml_set_name(cur, "embd_enc");
+    }
+
+    whisper_build_cross(ctx0, gf, wctx, wstate, cur);
 
     //ggml_graph_print(gf);
 
@@ -2266,11 +2934,11 @@ static bool whisper_encode_internal(
                    void * abort_callback_data) {
     const int64_t t_start_us = ggml_time_us();
 
-    // conv
+    // conv + encoder + cross
     {
-        auto & sched = wstate.sched_conv.sched;
+        auto & sched = wstate.compute->sched.sched;
 
-        ggml_cgraph * gf = whisper_build_graph_conv(wctx, wstate);
+        ggml_cgraph * gf = whisper_build_graph_encoder(wctx, wstate);
 
         if (!ggml_backend_sched_alloc_graph(sched, gf)) {
             // should never happen as we pre-allocate the memory
@@ -2304,55 +2972,194 @@ static bool whisper_encode_internal(
             ggml_backend_tensor_set(mel, wstate.inp_mel.data(), 0, ggml_nelements(mel)*sizeof(float));
         }
 
-        if (!whisper_encode_external(wstate)) {
-            if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
-                return false;
-            }
-        } else {
+        if (whisper_encode_external(wstate)) {
+            struct ggml_tensor * embd_enc = ggml_graph_get_tensor(gf, "embd_enc");
+            GGML_UNUSED(embd_enc);
+
 #if defined(WHISPER_USE_COREML)
-            whisper_coreml_encode(wstate.ctx_coreml, mel->ne[0], mel->ne[1], (float *) mel->data, (float *) wstate.embd_enc->data);
+            whisper_coreml_encode(wstate.ctx_coreml, mel->ne[0], mel->ne[1], (float *) mel->data, (float *) embd_enc->data);
 #elif defined(WHISPER_USE_OPENVINO)
-            whisper_openvino_encode(wstate.ctx_openvino, mel, wstate.embd_enc);
+            whisper_openvino_encode(wstate.ctx_openvino, mel, embd_enc);
 #endif
         }
+
+        if (!ggml_graph_compute_helper(sched, gf, n_threads, whisper_compute_threadpool(*wstate.compute, wctx.params, n_threads))) {
+            return false;
+        }
     }
 
-    // encoder
-    if (!whisper_encode_external(wstate)) {
-        auto & sched = wstate.sched_encode.sched;
+    wstate.t_encode_us += ggml_time_us() - t_start_us;
+    wstate.n_encode++;
 
-        ggml_cgraph * gf = whisper_build_graph_encoder(wctx, wstate);
+    return !(abort_callback && abort_callback(abort_callback_data));
+}
 
-        if (!ggml_backend_sched_alloc_graph(sched, gf)) {
-            // should never happen as we pre-allocate the memory
-            return false;
-        }
+// the V*p dot products of a token gather its cells from the rows of the transposed V when the cells are at most
+// 1/WHISPER_SEQ_ATTN_GATHER of the range they span, otherwise they run over the whole range with zeros for the other cells
+// (a gathered element costs about as much as WHISPER_SEQ_ATTN_GATHER elements of a SIMD dot product)
+#define WHISPER_SEQ_ATTN_GATHER 8
+
+// dst = softmax(K*q)*V for each token and head, over the cells listed in whisper_kv_seq_attn
+// q and p are converted to the vec_dot types of K and V and the dot products use the same CPU kernels, like ggml_mul_mat
+//   q: [n_state, n_tokens] (F32, scaled)
+//   k: [n_state, n_kv]     (view of the layer, scaled, any type with a vec_dot)
+//   v: [n_kv, n_state]     (view of the transposed layer, F16/BF16/F32)
+static void whisper_kv_seq_attn_compute(
+        struct ggml_tensor * dst,
+  const struct ggml_tensor * q,
+  const struct ggml_tensor * k,
+  const struct ggml_tensor * v,
+                       int   ith,
+                       int   nth,
+                      void * userdata) {
+    const auto & sa = *(const whisper_kv_seq_attn *) userdata;
+
+    const int n_tokens     = q->ne[1];
+    const int n_head       = sa.n_head;
+    const int n_state_head = q->ne[0]/n_head;
+
+    const auto * traits_k = ggml_get_type_traits_cpu(k->type);
+    const auto * traits_v = ggml_get_type_traits_cpu(v->type);
+
+    const ggml_from_float_t q_from_float = ggml_get_type_traits_cpu(traits_k->vec_dot_type)->from_float;
+    const ggml_from_float_t p_from_float = ggml_get_type_traits_cpu(traits_v->vec_dot_type)->from_float;
+
+    const size_t q_row_size = ggml_row_size(traits_k->vec_dot_type, n_state_head);
+    const size_t k_offs     = ggml_row_size(k->type, n_state_head);
+    const size_t v_el_size  = ggml_type_size(v->type);
+    const size_t p_el_size  = ggml_type_size(traits_v->vec_dot_type);
+
+    thread_local std::vector<float>   buf_s; // probabilities of each token over its cells
+    thread_local std::vector<float>   buf_r; // probabilities of a token over the range of its cells
+    thread_local std::vector<uint8_t> buf_q; // q in the vec_dot type of K
+    thread_local std::vector<uint8_t> buf_p; // probabilities of each token in the vec_dot type of V
+    thread_local std::vector<uint8_t> buf_v; // cells of a row of V gathered for a token
+
+    // the heads are split between the threads, each thread processes a block of tokens of the same head
+    // so the rows of V are reused by all the tokens of the block while in cache
+    const int n_tb = std::max(1, std::min(n_tokens, nth/n_head));
+
+    for (int ir = ith; ir < n_head*n_tb; ir += nth) {
+        const int h  = ir%n_head;
+        const int j0 = ((ir/n_head + 0)*n_tokens)/n_tb;
+        const int j1 = ((ir/n_head + 1)*n_tokens)/n_tb;
+
+        buf_s.resize((j1 - j0)*sa.n_max);
+        buf_q.resize(q_row_size);
+
+        // softmax(K*q) - the max and the double sum follow ggml_soft_max_ext, the masked cells only add zeros there
+        for (int j = j0; j < j1; ++j) {
+            const float * qh = (const float *) ((const char *) q->data + j*q->nb[1]) + h*n_state_head;
+
+            const int32_t * cells = sa.cells.data() + sa.offs[j];
+            const int       n_c   = sa.offs[j + 1] - sa.offs[j];
+
+            float * S = buf_s.data() + (j - j0)*sa.n_max;
+
+            const void * qd = qh;
+            if (q_from_float) {
+                q_from_float(qh, buf_q.data(), n_state_head);
+                qd = buf_q.data();
+            }
 
-        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
-            return false;
-        }
-    }
+            float smax = -INFINITY;
+            for (int c = 0; c < n_c; ++c) {
+                traits_k->vec_dot(n_state_head, &S[c], 0, (const char *) k->data + cells[c]*k->nb[1] + h*k_offs, 0, qd, 0, 1);
 
-    // cross
-    {
-        auto & sched = wstate.sched_cross.sched;
+                smax = std::max(smax, S[c]);
+            }
 
-        ggml_cgraph * gf = whisper_build_graph_cross(wctx, wstate);
+            double sum = 0.0;
+            for (int c = 0; c < n_c; ++c) {
+                S[c] = expf(S[c] - smax);
+                sum += S[c];
+            }
 
-        if (!ggml_backend_sched_alloc_graph(sched, gf)) {
-            // should never happen as we pre-allocate the memory
-            return false;
+            const float scale = sum > 0.0 ? 1.0/sum : 0.0f;
+            for (int c = 0; c < n_c; ++c) {
+                S[c] *= scale;
+            }
         }
 
-        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
-            return false;
+        // the probabilities in the vec_dot type of V, either over the cells (gathered) or over their range (dense)
+        const int64_t n_kv = v->ne[0];
+
+        buf_p.resize((j1 - j0)*n_kv*p_el_size);
+
+        for (int j = j0; j < j1; ++j) {
+            const int32_t * cells = sa.cells.data() + sa.offs[j];
+            const int       n_c   = sa.offs[j + 1] - sa.offs[j];
+
+            const float * S = buf_s.data() + (j - j0)*sa.n_max;
+            uint8_t     * P = buf_p.data() + (j - j0)*n_kv*p_el_size;
+
+            const float * src = S;
+            int           n   = n_c;
+
+            if (n_c > 0 && n_c*WHISPER_SEQ_ATTN_GATHER > cells[n_c - 1] + 1 - cells[0]) {
+                n = cells[n_c - 1] + 1 - cells[0];
+
+                buf_r.assign(n, 0.0f);
+                for (int c = 0; c < n_c; ++c) {
+                    buf_r[cells[c] - cells[0]] = S[c];
+                }
+
+                src = buf_r.data();
+            }
+
+            if (p_from_float) {
+                p_from_float(src, P, n);
+            } else {
+                memcpy(P, src, n*sizeof(float));
+            }
         }
-    }
 
-    wstate.t_encode_us += ggml_time_us() - t_start_us;
-    wstate.n_encode++;
+        // KQ_soft_max*V
+        for (int j = j0; j < j1; ++j) {
+            const int32_t * cells = sa.cells.data() + sa.offs[j];
+            const int       n_c   = sa.offs[j + 1] - sa.offs[j];
 
-    return !(abort_callback && abort_callback(abort_callback_data));
+            const uint8_t * P   = buf_p.data() + (j - j0)*n_kv*p_el_size;
+                  float   * out = (float *) ((char *) dst->data + j*dst->nb[1]) + h*n_state_head;
+
+            if (n_c == 0) {
+                std::fill(out, out + n_state_head, 0.0f);
+                continue;
+            }
+
+            const int c0 = cells[0];
+            const int n  = cells[n_c - 1] + 1 - c0;
+
+            const bool gather = n_c*WHISPER_SEQ_ATTN_GATHER <= n;
+
+            if (gather) {
+                buf_v.resize(n_c*v_el_size);
+            }
+
+            for (int i = 0; i < n_state_head; ++i) {
+                const char * vi = (const char *) v->data + (h*n_state_head + i)*v->nb[1];
+
+                if (!gather) {
+                    traits_v->vec_dot(n, &out[i], 0, vi + c0*v_el_size, 0, P, 0, 1);
+                    continue;
+                }
+
+                if (v_el_size == sizeof(uint16_t)) {
+                    uint16_t * dst_v = (uint16_t *) buf_v.data();
+                    for (int c = 0; c < n_c; ++c) {
+                        dst_v[c] = ((const uint16_t *) vi)[cells[c]];
+                    }
+                } else {
+                    float * dst_v = (float *) buf_v.data();
+                    for (int c = 0; c < n_c; ++c) {
+                        dst_v[c] = ((const float *) vi)[cells[c]];
+                    }
+                }
+
+                traits_v->vec_dot(n_c, &out[i], 0, buf_v.data(), 0, P, 0, 1);
+            }
+        }
+    }
 }
 
 static struct ggml_cgraph * whisper_build_graph_decoder(
@@ -2383,11 +3190,15 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
     const int32_t n_kv    = worst_case ? n_ctx            : kv_self.n;
     const int32_t kv_head = worst_case ? n_ctx - n_tokens : kv_self.head;
 
+    const bool fused = wstate.fused_ops;
+
+    const bool seq_attn = !worst_case && wstate.kv_seq_attn.enabled;
+
     //WHISPER_LOG_DEBUG("%s: n_past = %d, n_tokens = %d, n_audio_ctx = %d, n_ctx = %d\n", __func__, n_past, n_tokens, n_audio_ctx, n_ctx);
 
     struct ggml_init_params params = {
-        /*.mem_size   =*/ wstate.sched_decode.meta.size(),
-        /*.mem_buffer =*/ wstate.sched_decode.meta.data(),
+        /*.mem_size   =*/ wstate.compute->sched.meta.size(),
+        /*.mem_buffer =*/ wstate.compute->sched.meta.data(),
         /*.no_alloc   =*/ true,
     };
 
@@ -2405,11 +3216,16 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
 
     const float KQscale = pow(float(n_state_head), -0.25);
 
-    struct ggml_tensor * KQ_mask = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_kv, GGML_PAD(n_tokens, GGML_KQ_MASK_PAD), 1);
-    ggml_set_name(KQ_mask, "KQ_mask");
-    ggml_set_input(KQ_mask);
+    struct ggml_tensor * KQ_mask     = nullptr;
+    struct ggml_tensor * KQ_mask_f16 = nullptr;
 
-    struct ggml_tensor * KQ_mask_f16 = ggml_cast(ctx0, KQ_mask, GGML_TYPE_F16);
+    if (!seq_attn) {
+        KQ_mask = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_kv, GGML_PAD(n_tokens, GGML_KQ_MASK_PAD), 1);
+        ggml_set_name(KQ_mask, "KQ_mask");
+        ggml_set_input(KQ_mask);
+
+        KQ_mask_f16 = ggml_cast(ctx0, KQ_mask, GGML_TYPE_F16);
+    }
 
     // token encoding + position encoding
     struct ggml_tensor * cur =
@@ -2427,59 +3243,39 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
 
         // norm
         {
-            cur = ggml_norm(ctx0, inpL, hparams.eps);
-
-            // cur = ln_0_w*cur + ln_0_b
-            cur = ggml_add(ctx0,
-                    ggml_mul(ctx0,
-                        cur,
-                        layer.attn_ln_0_w),
-                    layer.attn_ln_0_b);
+            // cur = ln_0_w*norm(inpL) + ln_0_b
+            cur = whisper_norm_affine(ctx0, inpL, layer.attn_ln_0_w, layer.attn_ln_0_b, hparams.eps, fused);
         }
 
         // self-attention
         {
-            struct ggml_tensor * Qcur = ggml_mul_mat(ctx0,
-                    layer.attn_q_w,
-                    cur);
-
-            Qcur = ggml_add(ctx0,
-                        Qcur,
-                        layer.attn_q_b);
+            struct ggml_tensor * Qcur = whisper_linear(ctx0, layer.attn_q_w, layer.attn_q_b, cur, false, fused);
 
             Qcur = ggml_scale(ctx0, Qcur, KQscale);
 
             // note: no bias for Key
-            struct ggml_tensor * Kcur = ggml_mul_mat(ctx0,
-                    layer.attn_k_w,
-                    cur);
+            struct ggml_tensor * Kcur = whisper_linear(ctx0, layer.attn_k_w, nullptr, cur, false, fused);
 
             Kcur = ggml_scale(ctx0, Kcur, KQscale);
 
             // store key and value to memory
             {
-                struct ggml_tensor * Vcur = ggml_mul_mat(ctx0,
-                        layer.attn_v_w,
-                        cur);
-
-                Vcur = ggml_add(ctx0,
-                            Vcur,
-                            layer.attn_v_b);
+                struct ggml_tensor * Vcur = whisper_linear(ctx0, layer.attn_v_w, layer.attn_v_b, cur, false, fused);
 
                 struct ggml_tensor * k;
                 struct ggml_tensor * v;
 
                 if (wctx.params.flash_attn) {
                     k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state,
-                            (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + kv_head));
+                            ggml_row_size(kv_self.k->type, n_state)*(il*n_ctx + kv_head));
 
                     v = ggml_view_1d(ctx0, kv_self.v, n_tokens*n_state,
-                            (ggml_element_size(kv_self.v)*n_state)*(il*n_ctx + kv_head));
+                            ggml_row_size(kv_self.v->type, n_state)*(il*n_ctx + kv_head));
                 } else {
                     Vcur = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcur, n_state, n_tokens));
 
                     k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state,
-                            (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + kv_head));
+                            ggml_row_size(kv_self.k->type, n_state)*(il*n_ctx + kv_head));
 
                     v = ggml_view_2d(ctx0, kv_self.v, n_tokens, n_state,
                             (   n_ctx)*ggml_element_size(kv_self.v),
@@ -2500,17 +3296,31 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
             struct ggml_tensor * K =
                 ggml_view_3d(ctx0, kv_self.k,
                         n_state_head, n_kv, n_head,
-                        ggml_element_size(kv_self.k)*n_state,
-                        ggml_element_size(kv_self.k)*n_state_head,
-                        ggml_element_size(kv_self.k)*n_state*n_ctx*il);
+                        ggml_row_size(kv_self.k->type, n_state),
+                        ggml_row_size(kv_self.k->type, n_state_head),
+                        ggml_row_size(kv_self.k->type, n_state)*n_ctx*il);
+
+            if (seq_attn) {
+                struct ggml_tensor * K2 =
+                    ggml_view_2d(ctx0, kv_self.k,
+                            n_state, n_kv,
+                            ggml_row_size(kv_self.k->type, n_state),
+                            ggml_row_size(kv_self.k->type, n_state)*n_ctx*il);
+
+                struct ggml_tensor * V2 =
+                    ggml_view_2d(ctx0, kv_self.v,
+                            n_kv, n_state,
+                            n_ctx*ggml_element_size(kv_self.v),
+                            n_ctx*ggml_element_size(kv_self.v)*n_state*il);
 
-            if (wctx.params.flash_attn) {
+                cur = ggml_map_custom3(ctx0, Qcur, K2, V2, whisper_kv_seq_attn_compute, GGML_N_TASKS_MAX, &wstate.kv_seq_attn);
+            } else if (wctx.params.flash_attn) {
                 struct ggml_tensor * V =
                     ggml_view_3d(ctx0, kv_self.v,
                             n_state_head, n_kv, n_head,
-                            ggml_element_size(kv_self.v)*n_state,
-                            ggml_element_size(kv_self.v)*n_state_head,
-                            ggml_element_size(kv_self.v)*n_state*n_ctx*il);
+                            ggml_row_size(kv_self.v->type, n_state),
+                            ggml_row_size(kv_self.v->type, n_state_head),
+                            ggml_row_size(kv_self.v->type, n_state)*n_ctx*il);
 
                 cur = ggml_flash_attn_ext(ctx0, Q, K, V, KQ_mask_f16, 1.0f, 0.0f, 0.0f);
 
@@ -2538,13 +3348,7 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
 
         // projection
         {
-            cur = ggml_mul_mat(ctx0,
-                    layer.attn_ln_1_w,
-                    cur);
-
-            cur = ggml_add(ctx0,
-                    cur,
-                    layer.attn_ln_1_b);
+            cur = whisper_linear(ctx0, layer.attn_ln_1_w, layer.attn_ln_1_b, cur, false, fused);
         }
 
         // add the input
@@ -2552,25 +3356,13 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
 
         // norm
         {
-            cur = ggml_norm(ctx0, inpCA, hparams.eps); // note: we use inpCA here
-
-            // cur = ln_0_w*cur + ln_0_b
-            cur = ggml_add(ctx0,
-                    ggml_mul(ctx0,
-                        cur,
-                        layer.cross_attn_ln_0_w),
-                    layer.cross_attn_ln_0_b);
+            // cur = ln_0_w*norm(inpCA) + ln_0_b
+            cur = whisper_norm_affine(ctx0, inpCA, layer.cross_attn_ln_0_w, layer.cross_attn_ln_0_b, hparams.eps, fused); // note: we use inpCA here
         }
 
         // cross-attention
         {
-            struct ggml_tensor * Qcur = ggml_mul_mat(ctx0,
-                    layer.cross_attn_q_w,
-                    cur);
-
-            Qcur = ggml_add(ctx0,
-                        Qcur,
-                        layer.cross_attn_q_b);
+            struct ggml_tensor * Qcur = whisper_linear(ctx0, layer.cross_attn_q_w, layer.cross_attn_q_b, cur, false, fused);
 
             struct ggml_tensor * Q =
                 ggml_permute(ctx0,
@@ -2581,16 +3373,16 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
                 struct ggml_tensor * Kcross =
                     ggml_view_3d(ctx0, wstate.kv_cross.k,
                             n_state_head, n_audio_ctx_pad, n_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state,
-                            ggml_element_size(wstate.kv_cross.k)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state*n_audio_ctx_pad*il);
+                            ggml_row_size(wstate.kv_cross.k->type, n_state),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state_head),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state)*n_audio_ctx_pad*il);
 
                 struct ggml_tensor * Vcross =
                     ggml_view_3d(ctx0, wstate.kv_cross.v,
                             n_state_head, n_audio_ctx_pad, n_head,
-                            ggml_element_size(wstate.kv_cross.v)*n_state,
-                            ggml_element_size(wstate.kv_cross.v)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.v)*n_state*n_audio_ctx_pad*il);
+                            ggml_row_size(wstate.kv_cross.v->type, n_state),
+                            ggml_row_size(wstate.kv_cross.v->type, n_state_head),
+                            ggml_row_size(wstate.kv_cross.v->type, n_state)*n_audio_ctx_pad*il);
 
                 cur = ggml_flash_attn_ext(ctx0, Q, Kcross, Vcross, nullptr, KQscale, 0.0f, 0.0f);
 
@@ -2599,9 +3391,9 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
                 struct ggml_tensor * Kcross =
                     ggml_view_3d(ctx0, wstate.kv_cross.k,
                             n_state_head, n_audio_ctx, n_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state,
-                            ggml_element_size(wstate.kv_cross.k)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state*n_audio_ctx*il);
+                            ggml_row_size(wstate.kv_cross.k->type, n_state),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state_head),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state)*n_audio_ctx*il);
 
                 struct ggml_tensor * Vcross =
                     ggml_view_3d(ctx0, wstate.kv_cross.v,
@@ -2645,13 +3437,7 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
 
         // projection
         {
-            cur = ggml_mul_mat(ctx0,
-                    layer.cross_attn_ln_1_w,
-                    cur);
-
-            cur = ggml_add(ctx0,
-                    cur,
-                    layer.cross_attn_ln_1_b);
+            cur = whisper_linear(ctx0, layer.cross_attn_ln_1_w, layer.cross_attn_ln_1_b, cur, false, fused);
         }
 
         // add the input
@@ -2663,36 +3449,15 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
         {
             // norm
             {
-                cur = ggml_norm(ctx0, inpFF, hparams.eps);
-
-                // cur = mlp_ln_w*cur + mlp_ln_b
-                cur = ggml_add(ctx0,
-                        ggml_mul(ctx0,
-                            cur,
-                            layer.mlp_ln_w),
-                        layer.mlp_ln_b);
+                // cur = mlp_ln_w*norm(inpFF) + mlp_ln_b
+                cur = whisper_norm_affine(ctx0, inpFF, layer.mlp_ln_w, layer.mlp_ln_b, hparams.eps, fused);
             }
 
-            // fully connected
-            cur = ggml_mul_mat(ctx0,
-                    layer.mlp_0_w,
-                    cur);
-
-            cur = ggml_add(ctx0,
-                    cur,
-                    layer.mlp_0_b);
-
-            // GELU activation
-            cur = ggml_gelu(ctx0, cur);
+            // fully connected + GELU activation
+            cur = whisper_linear(ctx0, layer.mlp_0_w, layer.mlp_0_b, cur, true, fused);
 
             // projection
-            cur = ggml_mul_mat(ctx0,
-                    layer.mlp_1_w,
-                    cur);
-
-            cur = ggml_add(ctx0,
-                    cur,
-                    layer.mlp_1_b);
+            cur = whisper_linear(ctx0, layer.mlp_1_w, layer.mlp_1_b, cur, false, fused);
         }
 
         inpL = ggml_add(ctx0, cur, inpFF);
@@ -2702,13 +3467,7 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
 
     // norm
     {
-        cur = ggml_norm(ctx0, cur, hparams.eps);
-
-        cur = ggml_add(ctx0,
-                ggml_mul(ctx0,
-                    cur,
-                    model.d_ln_w),
-                model.d_ln_b);
+        cur = whisper_norm_affine(ctx0, cur, model.d_ln_w, model.d_ln_b, hparams.eps, fused);
     }
 
     // compute logits only for the last token
@@ -2778,11 +3537,57 @@ static bool whisper_decode_internal(
 
         //kv_self.n = std::min((int32_t) hparams.n_text_ctx, std::max(32, whisper_kv_cache_cell_max(kv_self)));
         //printf("n_tokens = %5d, kv_self.head = %5d, kv_self.n = %5d, seq_id = %5d\n", batch.n_tokens, kv_self.head, kv_self.n, batch.seq_id[0][0]);
+
+        // use the sequence-aware self-attention when the batch mixes several sequences and most of the cells
+        // belong to the other sequences
+        auto & sa = wstate.kv_seq_attn;
+
+        sa.enabled = false;
+
+        bool multi_seq = false;
+        for (int j = 1; j < n_tokens; ++j) {
+            multi_seq = multi_seq || batch.seq_id[j][0] != batch.seq_id[0][0];
+        }
+
+        // a custom CPU op like the other fused ops, the V cache is transposed without flash attention
+        // note: the CPU flash-attention kernel already skips the masked cells
+        const bool supported =
+            wstate.fused_ops && !wctx.params.flash_attn &&
+            ggml_backend_buffer_is_host(kv_self.buffer) &&
+            ggml_get_type_traits_cpu(kv_self.k->type)->vec_dot != nullptr &&
+            (kv_self.v->type == GGML_TYPE_F16 || kv_self.v->type == GGML_TYPE_BF16 || kv_self.v->type == GGML_TYPE_F32);
+
+        if (multi_seq && supported && !sa.disabled) {
+            const int32_t n_kv = kv_self.n;
+
+            sa.n_head = hparams.n_text_head;
+            sa.n_max  = 0;
+
+            sa.cells.clear();
+            sa.offs.resize(n_tokens + 1);
+            sa.offs[0] = 0;
+
+            for (int j = 0; j < n_tokens; ++j) {
+                const whisper_pos    pos    = batch.pos[j];
+                const whisper_seq_id seq_id = batch.seq_id[j][0];
+
+                for (int i = 0; i < n_kv; ++i) {
+                    if (kv_self.cells[i].has_seq_id(seq_id) && kv_self.cells[i].pos <= pos) {
+                        sa.cells.push_back(i);
+                    }
+                }
+
+                sa.offs[j + 1] = sa.cells.size();
+                sa.n_max = std::max(sa.n_max, sa.offs[j + 1] - sa.offs[j]);
+            }
+
+            sa.enabled = 2*sa.cells.size() <= (size_t) n_tokens*n_kv;
+        }
     }
 
     // decoder
     {
-        auto & sched = wstate.sched_decode.sched;
+        auto & sched = wstate.compute->sched.sched;
 
         ggml_cgraph * gf = whisper_build_graph_decoder(wctx, wstate, batch, save_alignment_heads_QKs, false);
 
@@ -2805,7 +3610,7 @@ static bool whisper_decode_internal(
             }
         }
 
-        {
+        if (!wstate.kv_seq_attn.enabled) {
             struct ggml_tensor * KQ_mask = ggml_graph_get_tensor(gf, "KQ_mask");
 
             auto & kv_self = wstate.kv_self;
@@ -2841,7 +3646,7 @@ static bool whisper_decode_internal(
 
         logits = ggml_graph_node(gf, -1);
 
-        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
+        if (!ggml_graph_compute_helper(sched, gf, n_threads, whisper_compute_threadpool(*wstate.compute, wctx.params, n_threads))) {
             return false;
         }
     }
@@ -3001,60 +3806,72 @@ static void fft(float* in, int N, float* out) {
     }
 }
 
+// compute the (not normalized) log mel values of a single frame
+// x holds n_x samples of the frame, the rest of the frame is zero
+// the n_mel results are written to dst with the given stride
+static void log_mel_spectrogram_frame(const float * hann, const float * x, int n_x, int frame_size,
+                                      const whisper_filters & filters, int n_mel,
+                                      std::vector<float> & fft_in, std::vector<float> & fft_out,
+                                      float * dst, int dst_stride) {
+    const int n_fft = filters.n_fft;
+
+    // apply Hann window (~10% faster)
+    for (int j = 0; j < std::min(frame_size, n_x); j++) {
+        fft_in[j] = hann[j] * x[j];
+    }
+
+    // fill the rest with zeros
+    if (n_x < frame_size) {
+        std::fill(fft_in.begin() + std::max(0, n_x), fft_in.end(), 0.0);
+    }
+
+    // FFT
+    fft(fft_in.data(), frame_size, fft_out.data());
+
+    // Calculate modulus^2 of complex numbers
+    // Use pow(fft_out[2 * j + 0], 2) + pow(fft_out[2 * j + 1], 2) causes inference quality problem? Interesting.
+    for (int j = 0; j < n_fft; j++) {
+        fft_out[j] = (fft_out[2 * j + 0] * fft_out[2 * j + 0] + fft_out[2 * j + 1] * fft_out[2 * j + 1]);
+    }
+
+    // mel spectrogram
+    for (int j = 0; j < n_mel; j++) {
+        double sum = 0.0;
+        // unroll loop (suggested by GH user @lunixbochs)
+        int k = 0;
+        for (k = 0; k < n_fft - 3; k += 4) {
+            sum +=
+                    fft_out[k + 0] * filters.data[j * n_fft + k + 0] +
+                    fft_out[k + 1] * filters.data[j * n_fft + k + 1] +
+                    fft_out[k + 2] * filters.data[j * n_fft + k + 2] +
+                    fft_out[k + 3] * filters.data[j * n_fft + k + 3];
+        }
+        // handle n_fft remainder
+        for (; k < n_fft; k++) {
+            sum += fft_out[k] * filters.data[j * n_fft + k];
+        }
+        sum = log10(std::max(sum, 1e-10));
+        dst[j * dst_stride] = sum;
+    }
+}
+
 static void log_mel_spectrogram_worker_thread(int ith, const float * hann, const std::vector<float> & samples,
                                               int n_samples, int frame_size, int frame_step, int n_threads,
                                               const whisper_filters & filters, whisper_mel & mel) {
     std::vector<float> fft_in(frame_size * 2, 0.0);
     std::vector<float> fft_out(frame_size * 2 * 2 * 2);
 
-    int n_fft = filters.n_fft;
     int i = ith;
 
     // make sure n_fft == 1 + (WHISPER_N_FFT / 2), bin_0 to bin_nyquist
-    assert(n_fft == 1 + (frame_size / 2));
+    assert(filters.n_fft == 1 + (frame_size / 2));
 
     // calculate FFT only when fft_in are not all zero
     for (; i < std::min(n_samples / frame_step + 1, mel.n_len); i += n_threads) {
         const int offset = i * frame_step;
 
-        // apply Hann window (~10% faster)
-        for (int j = 0; j < std::min(frame_size, n_samples - offset); j++) {
-            fft_in[j] = hann[j] * samples[offset + j];
-        }
-
-        // fill the rest with zeros
-        if (n_samples - offset < frame_size) {
-            std::fill(fft_in.begin() + (n_samples - offset), fft_in.end(), 0.0);
-        }
-
-        // FFT
-        fft(fft_in.data(), frame_size, fft_out.data());
-
-        // Calculate modulus^2 of complex numbers
-        // Use pow(fft_out[2 * j + 0], 2) + pow(fft_out[2 * j + 1], 2) causes inference quality problem? Interesting.
-        for (int j = 0; j < n_fft; j++) {
-            fft_out[j] = (fft_out[2 * j + 0] * fft_out[2 * j + 0] + fft_out[2 * j + 1] * fft_out[2 * j + 1]);
-        }
-
-        // mel spectrogram
-        for (int j = 0; j < mel.n_mel; j++) {
-            double sum = 0.0;
-            // unroll loop (suggested by GH user @lunixbochs)
-            int k = 0;
-            for (k = 0; k < n_fft - 3; k += 4) {
-                sum +=
-                        fft_out[k + 0] * filters.data[j * n_fft + k + 0] +
-                        fft_out[k + 1] * filters.data[j * n_fft + k + 1] +
-                        fft_out[k + 2] * filters.data[j * n_fft + k + 2] +
-                        fft_out[k + 3] * filters.data[j * n_fft + k + 3];
-            }
-            // handle n_fft remainder
-            for (; k < n_fft; k++) {
-                sum += fft_out[k] * filters.data[j * n_fft + k];
-            }
-            sum = log10(std::max(sum, 1e-10));
-            mel.data[j * mel.n_len + i] = sum;
-        }
+        log_mel_spectrogram_frame(hann, samples.data() + offset, n_samples - offset, frame_size, filters, mel.n_mel,
+                                  fft_in, fft_out, mel.data.data() + i, mel.n_len);
     }
 
     // Otherwise fft_out are all zero
@@ -3159,6 +3976,389 @@ static bool log_mel_spectrogram(
     return true;
 }
 
+//
+// resampling
+//
+
+// max number of filter phases kept in the coefficient table
+// rates with a larger reduced ratio use the nearest of WHISPER_RESAMPLER_MAX_PHASES phases
+#define WHISPER_RESAMPLER_MAX_PHASES 1024
+
+// zero crossings of the windowed sinc on each side of the center at the filter cutoff
+#define WHISPER_RESAMPLER_ZERO_CROSSINGS 16
+
+// input samples consumed per pass - larger inputs are processed in blocks of this size, so that the pending input
+// never outgrows the buffer reserved in whisper_resampler_init() (e.g. when called from an audio callback)
+#define WHISPER_RESAMPLER_BLOCK 4096
+
+// polyphase windowed-sinc (Kaiser) resampler
+// ref: https://ccrma.stanford.edu/~jos/resample/
+struct whisper_resampler {
+    int sr_in  = 0;
+    int sr_out = 0;
+
+    // reduced ratio: n_up/n_down = sr_out/sr_in
+    int64_t n_up   = 1;
+    int64_t n_down = 1;
+
+    int n_phases = 0;
+    int n_half   = 0; // taps on each side of the center
+    int n_taps   = 0; // n_half*2
+
+    // [n_phases + 1][n_taps] - the last phase is a full input sample ahead, for rounding up to the next sample
+    std::vector<float> coef;
+
+    // pending input - buf[0] corresponds to the absolute input index buf_off
+    // the capacity is reserved once for the filter history, the flush padding and one block of input
+    std::vector<float> buf;
+    int64_t buf_off = 0;
+
+    // absolute input position of the next output sample: pos_i + pos_num/n_up
+    int64_t pos_i   = 0;
+    int64_t pos_num = 0;
+
+    int64_t n_in_total  = 0;
+    int64_t n_out_total = 0;
+};
+
+// zeroth order modified Bessel function of the first kind
+static double whisper_bessel_i0(double x) {
+    double sum  = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 64; ++k) {
+        term *= (x/(2.0*k))*(x/(2.0*k));
+        sum  += term;
+        if (term < 1e-12*sum) {
+            break;
+        }
+    }
+    return sum;
+}
+
+static int64_t whisper_gcd(int64_t a, int64_t b) {
+    while (b != 0) {
+        const int64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static void whisper_resampler_reset(whisper_resampler & rs) {
+    // the first output sample is centered on input sample 0, so the history before it is zero
+    rs.buf.assign(rs.n_half - 1, 0.0f);
+    rs.buf_off = -(rs.n_half - 1);
+
+    rs.pos_i   = 0;
+    rs.pos_num = 0;
+
+    rs.n_in_total  = 0;
+    rs.n_out_total = 0;
+}
+
+static float whisper_resampler_dot(const float * x, const float * h, int n) {
+    int i = 0;
+    float sum = 0.0f;
+
+#if defined(__SSE__)
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + i + 0), _mm_loadu_ps(h + i + 0)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(h + i + 4)));
+    }
+    float tmp[4];
+    _mm_storeu_ps(tmp, _mm_add_ps(acc0, acc1));
+    sum = (tmp[0] + tmp[1]) + (tmp[2] + tmp[3]);
+#elif defined(__ARM_NEON)
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(x + i + 0), vld1q_f32(h + i + 0));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(x + i + 4), vld1q_f32(h + i + 4));
+    }
+    const float32x4_t acc = vaddq_f32(acc0, acc1);
+    sum = (vgetq_lane_f32(acc, 0) + vgetq_lane_f32(acc, 1)) + (vgetq_lane_f32(acc, 2) + vgetq_lane_f32(acc, 3));
+#endif
+
+    for (; i < n; ++i) {
+        sum += x[i]*h[i];
+    }
+
+    return sum;
+}
+
+// produce all output samples whose filter support lies inside the pending input
+static int whisper_resampler_run(whisper_resampler & rs, float * out, int n_out_max, int64_t n_out_limit) {
+    int n_out = 0;
+
+    const int64_t buf_end = rs.buf_off + (int64_t) rs.buf.size();
+
+    while (n_out < n_out_max && rs.n_out_total < n_out_limit && rs.pos_i + rs.n_half < buf_end) {
+        const int64_t i0    = rs.pos_i - rs.n_half + 1 - rs.buf_off;
+        const int     phase = (int) ((2*rs.pos_num*rs.n_phases + rs.n_up)/(2*rs.n_up)); // nearest, up to n_phases
+
+        out[n_out++] = whisper_resampler_dot(rs.buf.data() + i0, rs.coef.data() + (size_t) phase*rs.n_taps, rs.n_taps);
+
+        rs.n_out_total++;
+
+        rs.pos_num += rs.n_down;
+        rs.pos_i   += rs.pos_num/rs.n_up;
+        rs.pos_num %= rs.n_up;
+    }
+
+    // drop the input that is no longer needed by any future output
+    const int64_t n_drop = std::min<int64_t>(rs.pos_i - rs.n_half + 1 - rs.buf_off, (int64_t) rs.buf.size());
+    if (n_drop > 0) {
+        rs.buf.erase(rs.buf.begin(), rs.buf.begin() + n_drop);
+        rs.buf_off += n_drop;
+    }
+
+    return n_out;
+}
+
+//
+// voice activity detection
+//
+
+// frequency band used for the speech energy and the spectral flatness
+#define WHISPER_VAD_BAND_LO  300 // Hz
+#define WHISPER_VAD_BAND_HI 4000 // Hz
+
+// silence inserted between the speech regions of the processed audio
+#define WHISPER_VAD_GAP_MS 100
+
+struct whisper_vad_segments {
+    // [i0, i1) sample ranges of the detected speech
+    std::vector<std::pair<int64_t, int64_t>> data;
+};
+
+// per-frame features: log speech-band energy and spectral flatness of the speech band
+// frames are WHISPER_N_FFT samples long, centered at multiples of WHISPER_HOP_LENGTH
+static void whisper_vad_features_worker_thread(int ith, int n_threads, const float * samples, int n_samples,
+                                               std::vector<float> & energy, std::vector<float> & flatness) {
+    const int n_fft   = WHISPER_N_FFT;
+    const int n_bins  = n_fft/2 + 1;
+    const int n_frame = energy.size();
+
+    const int k0 = std::max(1, (WHISPER_VAD_BAND_LO*n_fft)/WHISPER_SAMPLE_RATE);
+    const int k1 = std::min(n_bins - 1, (WHISPER_VAD_BAND_HI*n_fft)/WHISPER_SAMPLE_RATE);
+
+    const float * hann = global_cache.hann_window;
+
+    std::vector<float> fft_in(n_fft*2, 0.0f);
+    std::vector<float> fft_out(n_fft*2*2*2);
+
+    for (int i = ith; i < n_frame; i += n_threads) {
+        const int offset = i*WHISPER_HOP_LENGTH - n_fft/2;
+
+        for (int j = 0; j < n_fft; j++) {
+            const int idx = offset + j;
+            fft_in[j] = (idx >= 0 && idx < n_samples) ? hann[j]*samples[idx] : 0.0f;
+        }
+
+        fft(fft_in.data(), n_fft, fft_out.data());
+
+        double sum     = 0.0;
+        double sum_log = 0.0;
+        for (int k = k0; k <= k1; k++) {
+            const double p = fft_out[2*k + 0]*fft_out[2*k + 0] + fft_out[2*k + 1]*fft_out[2*k + 1] + 1e-10;
+            sum     += p;
+            sum_log += log(p);
+        }
+
+        const int n_band = k1 - k0 + 1;
+
+        energy[i]   = 10.0*log10(sum);
+        flatness[i] = exp(sum_log/n_band)/(sum/n_band);
+    }
+}
+
+// frame-level statistical VAD
+// each 10 ms frame gets a speech probability from its speech-band energy above the estimated noise floor and its
+// spectral flatness (voiced speech is harmonic, stationary noise is flat); the probabilities are then smoothed and
+// turned into speech regions with hysteresis, minimum durations and padding
+static std::vector<std::pair<int64_t, int64_t>> whisper_vad_detect(
+        const whisper_vad_params & params,
+                     const float * samples,
+                             int   n_samples,
+                             int   n_threads) {
+    std::vector<std::pair<int64_t, int64_t>> result;
+
+    const int n_frame = n_samples/WHISPER_HOP_LENGTH;
+    if (n_frame == 0) {
+        return result;
+    }
+
+    std::vector<float> energy  (n_frame);
+    std::vector<float> flatness(n_frame);
+
+    n_threads = std::max(1, std::min(n_threads, n_frame));
+
+    {
+        std::vector<std::thread> workers(n_threads - 1);
+        for (int iw = 0; iw < n_threads - 1; ++iw) {
+            workers[iw] = std::thread(
+                    whisper_vad_features_worker_thread, iw + 1, n_threads, samples, n_samples,
+                    std::ref(energy), std::ref(flatness));
+        }
+
+        whisper_vad_features_worker_thread(0, n_threads, samples, n_samples, energy, flatness);
+
+        for (int iw = 0; iw < n_threads - 1; ++iw) {
+            workers[iw].join();
+        }
+    }
+
+    // noise floor: 10th percentile of the frame energies
+    float noise_db = 0.0f;
+    {
+        std::vector<float> tmp = energy;
+        std::nth_element(tmp.begin(), tmp.begin() + n_frame/10, tmp.end());
+        noise_db = tmp[n_frame/10];
+    }
+
+    std::vector<float> probs(n_frame);
+    for (int i = 0; i < n_frame; i++) {
+        const float snr_db = energy[i] - noise_db;
+
+        const float p_energy = 1.0f/(1.0f + expf(-(snr_db - 10.0f)/2.5f));
+        const float p_tonal  = 1.0f/(1.0f + expf(-(0.35f - flatness[i])/0.08f));
+
+        probs[i] = p_energy*(0.6f + 0.4f*p_tonal);
+    }
+
+    // smooth over +/- 2 frames
+    {
+        std::vector<float> tmp = probs;
+        for (int i = 0; i < n_frame; i++) {
+            const int j0 = std::max(0, i - 2);
+            const int j1 = std::min(n_frame - 1, i + 2);
+
+            float sum = 0.0f;
+            for (int j = j0; j <= j1; j++) {
+                sum += tmp[j];
+            }
+            probs[i] = sum/(j1 - j0 + 1);
+        }
+    }
+
+    const int frame_ms = (1000*WHISPER_HOP_LENGTH)/WHISPER_SAMPLE_RATE;
+
+    const float thold_on  = params.threshold;
+    const float thold_off = std::max(0.0f, params.threshold - 0.15f);
+
+    const int min_speech_frames  = params.min_speech_duration_ms/frame_ms;
+    const int min_silence_frames = params.min_silence_duration_ms/frame_ms;
+
+    // [f0, f1) frame ranges
+    std::vector<std::pair<int, int>> regions;
+    {
+        bool triggered = false;
+
+        int f_start = 0;
+        int f_end   = -1; // first frame of the current candidate silence
+
+        for (int i = 0; i < n_frame; i++) {
+            if (probs[i] >= thold_on) {
+                f_end = -1;
+                if (!triggered) {
+                    triggered = true;
+                    f_start   = i;
+                }
+                continue;
+            }
+
+            if (triggered && probs[i] < thold_off) {
+                if (f_end < 0) {
+                    f_end = i;
+                }
+                if (i - f_end >= min_silence_frames) {
+                    if (f_end - f_start >= min_speech_frames) {
+                        regions.push_back({ f_start, f_end });
+                    }
+                    triggered = false;
+                    f_end     = -1;
+                }
+            }
+        }
+
+        if (triggered) {
+            const int f1 = f_end < 0 ? n_frame : f_end;
+            if (f1 - f_start >= min_speech_frames) {
+                regions.push_back({ f_start, f1 });
+            }
+        }
+    }
+
+    // pad and merge
+    const int64_t n_pad = ((int64_t) params.speech_pad_ms*WHISPER_SAMPLE_RATE)/1000;
+
+    for (const auto & r : regions) {
+        const int64_t i0 = std::max<int64_t>(0,         (int64_t) r.first *WHISPER_HOP_LENGTH - n_pad);
+        const int64_t i1 = std::min<int64_t>(n_samples, (int64_t) r.second*WHISPER_HOP_LENGTH + n_pad);
+
+        if (!result.empty() && i0 <= result.back().second) {
+            result.back().second = std::max(result.back().second, i1);
+        } else {
+            result.push_back({ i0, i1 });
+        }
+    }
+
+    return result;
+}
+
+// map a processed-audio timestamp (in units of 10 ms) back to the input audio
+static int64_t whisper_vad_map_time(const whisper_state & state, int64_t t) {
+    const auto & regions = state.vad_regions;
+    if (regions.empty() || t < 0) {
+        return t;
+    }
+
+    const int64_t i = (t*WHISPER_SAMPLE_RATE)/100;
+
+    size_t k = 0;
+    while (k + 1 < regions.size() && regions[k + 1].i_proc <= i) {
+        k++;
+    }
+
+    const auto & r = regions[k];
+
+    int64_t i_orig = r.i_orig + (i - r.i_proc);
+
+    // inside the silence gap that separates two regions - interpolate between them
+    if (i > r.i_proc + r.n && k + 1 < regions.size()) {
+        const auto & rn = regions[k + 1];
+
+        const int64_t gap_proc = rn.i_proc - (r.i_proc + r.n);
+        const int64_t gap_orig = rn.i_orig - (r.i_orig + r.n);
+
+        i_orig = r.i_orig + r.n + ((i - (r.i_proc + r.n))*gap_orig)/std::max<int64_t>(1, gap_proc);
+    }
+
+    return (i_orig*100)/WHISPER_SAMPLE_RATE;
+}
+
+// map the timestamps of all segments starting at i_segment back to the input audio
+static void whisper_vad_map_segments(whisper_state & state, int i_segment) {
+    if (state.vad_regions.empty()) {
+        return;
+    }
+
+    for (int i = i_segment; i < (int) state.result_all.size(); i++) {
+        auto & segment = state.result_all[i];
+
+        segment.t0 = whisper_vad_map_time(state, segment.t0);
+        segment.t1 = whisper_vad_map_time(state, segment.t1);
+
+        for (auto & token : segment.tokens) {
+            token.t0    = whisper_vad_map_time(state, token.t0);
+            token.t1    = whisper_vad_map_time(state, token.t1);
+            token.t_dtw = whisper_vad_map_time(state, token.t_dtw);
+        }
+    }
+}
+
 // split text into tokens
 //
 // ref: https://github.com/openai/gpt-2/blob/a74da5d99abaaba920de8131d64da2862a8f213b/src/encoder.py#L53
@@ -3271,20 +4471,65 @@ static std::string whisper_openvino_get_path_cache(std::string path_bin) {
 }
 #endif
 
-struct whisper_state * whisper_init_state(whisper_context * ctx) {
-    whisper_state * state = new whisper_state;
+// get the compute resources for a new state - when sharing, reuse the ones of the live states created on this thread
+static std::shared_ptr<whisper_compute> whisper_compute_get(whisper_context * ctx, bool share) {
+    std::unique_lock<std::mutex> lock(ctx->compute_mutex, std::defer_lock);
+
+    if (share) {
+        lock.lock();
+
+        for (auto it = ctx->compute_shared.begin(); it != ctx->compute_shared.end(); ) {
+            it = it->second.expired() ? ctx->compute_shared.erase(it) : std::next(it);
+        }
+
+        auto it = ctx->compute_shared.find(std::this_thread::get_id());
+        if (it != ctx->compute_shared.end()) {
+            return it->second.lock();
+        }
+    }
 
-    state->backends = whisper_backend_init(ctx->params);
-    if (state->backends.empty()) {
+    std::vector<ggml_backend_t> backends = whisper_backend_init(ctx->params);
+    if (backends.empty()) {
         WHISPER_LOG_ERROR("%s: whisper_backend_init() failed\n", __func__);
+        return nullptr;
+    }
+
+    std::shared_ptr<whisper_compute> compute(new whisper_compute, whisper_compute_free);
+
+    compute->backends = std::move(backends);
+
+    auto & sched = compute->sched;
+
+    sched.sched = ggml_backend_sched_new(compute->backends.data(), nullptr, compute->backends.size(), WHISPER_MAX_NODES, false);
+    sched.meta.resize(ggml_tensor_overhead()*WHISPER_MAX_NODES + ggml_graph_overhead_custom(WHISPER_MAX_NODES, false));
+
+    if (ctx->params.cb_eval) {
+        ggml_backend_sched_set_eval_callback(sched.sched, ctx->params.cb_eval, ctx->params.cb_eval_user_data);
+    }
+
+    if (share) {
+        ctx->compute_shared[std::this_thread::get_id()] = compute;
+    }
+
+    return compute;
+}
+
+static struct whisper_state * whisper_init_state(whisper_context * ctx, bool share_compute) {
+    whisper_state * state = new whisper_state;
+
+    state->compute = whisper_compute_get(ctx, share_compute);
+    if (!state->compute) {
         whisper_free_state(state);
         return nullptr;
     }
 
+    // the fused kernels are custom CPU ops - with other backends they would force the graphs to be split
+    state->fused_ops = state->compute->backends.size() == 1 && ggml_backend_is_cpu(state->compute->backends[0]) && !ctx->params.cb_eval;
+
     // at this point, we don't know yet how many decoders will be used
     // later during decoding, if more decoders are used, we will recreate the KV cache respectively
     state->kv_self_n_dec = 1;
-    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], ctx->itype,
+    if (!whisper_kv_cache_init(state->kv_self, state->compute->backends[0], ctx->params.type_k, ctx->params.type_v,
                 ctx->model.hparams.n_text_state,
                 ctx->model.hparams.n_text_layer,
                 GGML_PAD(ctx->model.hparams.n_text_ctx, 256))) {
@@ -3298,7 +4543,7 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
         WHISPER_LOG_INFO("%s: kv self size  = %7.2f MB\n", __func__, memory_size / 1e6);
     }
 
-    if (!whisper_kv_cache_init(state->kv_cross, state->backends[0], ctx->itype,
+    if (!whisper_kv_cache_init(state->kv_cross, state->compute->backends[0], ctx->params.type_k, ctx->params.type_v,
                 ctx->model.hparams.n_text_state,
                 ctx->model.hparams.n_text_layer,
                 GGML_PAD(ctx->model.hparams.n_audio_ctx, 256))) {
@@ -3312,7 +4557,7 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
         WHISPER_LOG_INFO("%s: kv cross size = %7.2f MB\n", __func__, memory_size / 1e6);
     }
 
-    if (!whisper_kv_cache_init(state->kv_pad, state->backends[0], ctx->itype,
+    if (!whisper_kv_cache_init(state->kv_pad, state->compute->backends[0], ctx->itype, ctx->itype,
                 ctx->model.hparams.n_audio_state,
                 1,
                 GGML_PAD(ctx->model.hparams.n_audio_ctx, 256))) {
@@ -3328,7 +4573,7 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
 
     // [EXPERIMENTAL] Token-level timestamps with DTW
     if (ctx->params.dtw_token_timestamps) {
-        if (!aheads_masks_init(ctx->params, ctx->model.hparams, state->aheads_masks, state->backends[0])) {
+        if (!aheads_masks_init(ctx->params, ctx->model.hparams, state->aheads_masks, state->compute->backends[0])) {
             WHISPER_LOG_ERROR("%s: aheads_masks_init() failed for alignment heads masks\n", __func__);
             whisper_free_state(state);
             return nullptr;
@@ -3369,25 +4614,11 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
 
     state->decoders[0].rng = std::mt19937(0);
 
-    // conv allocator
+    // the compute buffer must fit both the encoder and the decoder graphs
     {
-        bool ok = whisper_sched_graph_init(state->sched_conv, state->backends,
-                [&]() {
-                    return whisper_build_graph_conv(*ctx, *state);
-                });
-
-        if (!ok) {
-            WHISPER_LOG_ERROR("%s: failed to init conv allocator\n", __func__);
-            whisper_free_state(state);
-            return nullptr;
-        }
-
-        WHISPER_LOG_INFO("%s: compute buffer (conv)   = %7.2f MB\n", __func__, whisper_sched_size(state->sched_conv) / 1e6);
-    }
+        auto & sched = state->compute->sched;
 
-    // encoder allocator
-    if (!whisper_encode_external(*state)) {
-        bool ok = whisper_sched_graph_init(state->sched_encode, state->backends,
+        bool ok = whisper_sched_graph_reserve(sched,
                 [&]() {
                     return whisper_build_graph_encoder(*ctx, *state);
                 });
@@ -3398,28 +4629,7 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
             return nullptr;
         }
 
-        WHISPER_LOG_INFO("%s: compute buffer (encode) = %7.2f MB\n", __func__, whisper_sched_size(state->sched_encode) / 1e6);
-    }
-
-    // cross allocator
-    {
-        bool ok = whisper_sched_graph_init(state->sched_cross, state->backends,
-                [&]() {
-                    return whisper_build_graph_cross(*ctx, *state);
-                });
-
-        if (!ok) {
-            WHISPER_LOG_ERROR("%s: failed to init cross allocator\n", __func__);
-            whisper_free_state(state);
-            return nullptr;
-        }
-
-        WHISPER_LOG_INFO("%s: compute buffer (cross)  = %7.2f MB\n", __func__, whisper_sched_size(state->sched_cross) / 1e6);
-    }
-
-    // decoder allocator
-    {
-        bool ok = whisper_sched_graph_init(state->sched_decode, state->backends,
+        ok = whisper_sched_graph_reserve(sched,
                 [&]() {
                     const auto & hparams = ctx->model.hparams;
 
@@ -3438,12 +4648,37 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
             return nullptr;
         }
 
-        WHISPER_LOG_INFO("%s: compute buffer (decode) = %7.2f MB\n", __func__, whisper_sched_size(state->sched_decode) / 1e6);
+        const long n_shared = state->compute.use_count();
+
+        if (n_shared > 1) {
+            WHISPER_LOG_INFO("%s: compute buffer   = %7.2f MB (shared by %ld states)\n", __func__, whisper_sched_size(sched) / 1e6, n_shared);
+        } else {
+            WHISPER_LOG_INFO("%s: compute buffer   = %7.2f MB\n", __func__, whisper_sched_size(sched) / 1e6);
+        }
     }
 
     return state;
 }
 
+struct whisper_state * whisper_init_state(whisper_context * ctx) {
+    return whisper_init_state(ctx, ctx->params.share_compute_buffers);
+}
+
+void whisper_numa_init(enum ggml_numa_strategy numa) {
+    if (numa != GGML_NUMA_STRATEGY_DISABLED) {
+        ggml_numa_init(numa);
+    }
+}
+
+int whisper_numa_n_nodes(void) {
+    int n_nodes = 0;
+    while (std::ifstream("/sys/devices/system/node/node" + std::to_string(n_nodes) + "/cpulist").good()) {
+        ++n_nodes;
+    }
+
+    return n_nodes;
+}
+
 int whisper_ctx_init_openvino_encoder_with_state(
         struct whisper_context * ctx,
           struct whisper_state * state,
@@ -3509,6 +4744,17 @@ struct whisper_context_params whisper_context_default_params() {
         /*.flash_attn           =*/ false,
         /*.gpu_device           =*/ 0,
 
+        /*.type_k               =*/ WHISPER_KV_TYPE_AUTO,
+        /*.type_v               =*/ WHISPER_KV_TYPE_AUTO,
+
+        /*.share_compute_buffers =*/ false,
+
+        /*.numa_node            =*/ -1,
+        /*.numa_interleave      =*/ false,
+
+        /*.cpu_poll             =*/ 50,
+        /*.cpu_prio             =*/ GGML_SCHED_PRIO_NORMAL,
+
         /*.dtw_token_timestamps =*/ false,
         /*.dtw_aheads_preset    =*/ WHISPER_AHEADS_NONE,
         /*.dtw_n_top            =*/ -1,
@@ -3517,6 +4763,9 @@ struct whisper_context_params whisper_context_default_params() {
             /*.heads            =*/ NULL,
         },
         /*.dtw_mem_size         =*/ 1024*1024*128,
+
+        /*.cb_eval              =*/ nullptr,
+        /*.cb_eval_user_data    =*/ nullptr,
     };
     return result;
 }
@@ -3610,6 +4859,17 @@ struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_
         params.dtw_token_timestamps = false;
     }
 
+    // the V cache is stored transposed without flash attention, which is not possible with quantized blocks
+    if (!params.flash_attn && params.type_v != WHISPER_KV_TYPE_AUTO && ggml_is_quantized(params.type_v)) {
+        WHISPER_LOG_WARN("%s: quantized V cache (%s) requires flash_attn - using f16\n", __func__, ggml_type_name(params.type_v));
+        params.type_v = GGML_TYPE_F16;
+    }
+
+    if (params.numa_node >= whisper_numa_n_nodes()) {
+        WHISPER_LOG_WARN("%s: NUMA node %d not found (%d nodes) - ignoring\n", __func__, params.numa_node, whisper_numa_n_nodes());
+        params.numa_node = -1;
+    }
+
     WHISPER_LOG_INFO("%s: use gpu    = %d\n", __func__, params.use_gpu);
     WHISPER_LOG_INFO("%s: flash attn = %d\n", __func__, params.flash_attn);
     WHISPER_LOG_INFO("%s: gpu_device = %d\n", __func__, params.gpu_device);
@@ -3629,6 +4889,24 @@ struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_
 
     loader->close(loader->context);
 
+    // the rows of each attention head must hold whole blocks of the cache types
+    {
+        const int n_state_head = ctx->model.hparams.n_text_state/ctx->model.hparams.n_text_head;
+
+        for (ggml_type * type : { &ctx->params.type_k, &ctx->params.type_v }) {
+            if (*type == WHISPER_KV_TYPE_AUTO) {
+                *type = ctx->itype;
+            }
+
+            if (n_state_head % ggml_blck_size(*type) != 0) {
+                WHISPER_LOG_WARN("%s: KV cache type %s does not fit the head size %d - using f16\n", __func__, ggml_type_name(*type), n_state_head);
+                *type = GGML_TYPE_F16;
+            }
+        }
+
+        WHISPER_LOG_INFO("%s: kv types   = %s, %s\n", __func__, ggml_type_name(ctx->params.type_k), ggml_type_name(ctx->params.type_v));
+    }
+
     return ctx;
 }
 
@@ -3723,14 +5001,8 @@ void whisper_free_state(struct whisper_state * state) {
 
         whisper_batch_free(state->batch);
 
-        ggml_backend_sched_free(state->sched_conv.sched);
-        ggml_backend_sched_free(state->sched_encode.sched);
-        ggml_backend_sched_free(state->sched_cross.sched);
-        ggml_backend_sched_free(state->sched_decode.sched);
-
-        for (auto & backend : state->backends) {
-            ggml_backend_free(backend);
-        }
+        // the backends and the scheduler are freed with the last state that uses them
+        state->compute.reset();
 
         // [EXPERIMENTAL] Token-level timestamps with DTW
         aheads_masks_free(state->aheads_masks);
@@ -3745,6 +5017,10 @@ void whisper_free(struct whisper_context * ctx) {
 
         ggml_backend_buffer_free(ctx->model.buffer);
 
+        for (auto & buf : ctx->model.buffers_extra) {
+            ggml_backend_buffer_free(buf);
+        }
+
         whisper_free_state(ctx->state);
 
         delete ctx;
@@ -3776,32 +5052,190 @@ int whisper_pcm_to_mel(struct whisper_context * ctx, const float * samples, int
     return whisper_pcm_to_mel_with_state(ctx, ctx->state, samples, n_samples, n_threads);
 }
 
-int whisper_set_mel_with_state(
-        struct whisper_context * ctx,
-          struct whisper_state * state,
-                   const float * data,
-                           int   n_len,
-                           int   n_mel) {
-    if (n_mel != ctx->model.filters.n_mel) {
-        WHISPER_LOG_ERROR("%s: invalid number of mel bands: %d (expected %d)\n", __func__, n_mel, ctx->model.filters.n_mel);
-        return -1;
+struct whisper_resampler * whisper_resampler_init(int sample_rate_in, int sample_rate_out) {
+    if (sample_rate_in <= 0 || sample_rate_out <= 0) {
+        WHISPER_LOG_ERROR("%s: invalid sample rates: %d -> %d\n", __func__, sample_rate_in, sample_rate_out);
+        return nullptr;
     }
 
-    state->mel.n_len     = n_len;
-    state->mel.n_len_org = n_len;
-    state->mel.n_mel     = n_mel;
+    whisper_resampler * rs = new whisper_resampler;
 
-    state->mel.data.resize(n_len*n_mel);
-    memcpy(state->mel.data.data(), data, n_len*n_mel*sizeof(float));
+    const int64_t g = whisper_gcd(sample_rate_in, sample_rate_out);
 
-    return 0;
-}
+    rs->sr_in  = sample_rate_in;
+    rs->sr_out = sample_rate_out;
+    rs->n_up   = sample_rate_out/g;
+    rs->n_down = sample_rate_in/g;
 
-int whisper_set_mel(
-        struct whisper_context * ctx,
-        const float * data,
-        int n_len,
-        int n_mel) {
+    // cutoff relative to the input Nyquist frequency, slightly below the lower of the two Nyquist frequencies
+    const double rolloff = 0.945;
+    const double fc      = rolloff*std::min(1.0, (double) rs->n_up/rs->n_down);
+    const double beta    = 8.6; // ~80 dB stopband attenuation
+
+    rs->n_phases = (int) std::min<int64_t>(rs->n_up, WHISPER_RESAMPLER_MAX_PHASES);
+    rs->n_half   = (int) std::ceil(WHISPER_RESAMPLER_ZERO_CROSSINGS/fc);
+    rs->n_taps   = 2*rs->n_half;
+
+    rs->coef.resize((size_t) (rs->n_phases + 1)*rs->n_taps);
+
+    // tap j of phase p weighs input sample (pos_i - n_half + 1 + j) for an output at pos_i + p/n_phases
+    // for p == n_phases, tap 0 falls on the edge of the window and is zero, so the taps still fit in the buffer
+    for (int p = 0; p <= rs->n_phases; ++p) {
+        const double frac = (double) p/rs->n_phases;
+
+        double sum = 0.0;
+        for (int j = 0; j < rs->n_taps; ++j) {
+            const double t = (rs->n_half - 1 - j) + frac;
+            const double r = t/rs->n_half;
+
+            const double sinc = t == 0.0 ? 1.0 : std::sin(M_PI*fc*t)/(M_PI*fc*t);
+            const double win  = std::fabs(r) >= 1.0 ? 0.0 : whisper_bessel_i0(beta*std::sqrt(1.0 - r*r))/whisper_bessel_i0(beta);
+
+            rs->coef[(size_t) p*rs->n_taps + j] = fc*sinc*win;
+            sum += fc*sinc*win;
+        }
+
+        // unity DC gain for every phase
+        for (int j = 0; j < rs->n_taps; ++j) {
+            rs->coef[(size_t) p*rs->n_taps + j] /= sum;
+        }
+    }
+
+    rs->buf.reserve(rs->n_taps + rs->n_half + 1 + WHISPER_RESAMPLER_BLOCK);
+
+    whisper_resampler_reset(*rs);
+
+    return rs;
+}
+
+void whisper_resampler_free(struct whisper_resampler * rs) {
+    if (rs) {
+        delete rs;
+    }
+}
+
+int whisper_resampler_n_out_max(struct whisper_resampler * rs, int n_samples) {
+    return (int) (((int64_t) rs->buf.size() + n_samples + rs->n_half + 1)*rs->n_up/rs->n_down + 1);
+}
+
+int whisper_resampler_process(struct whisper_resampler * rs, const float * samples, int n_samples, float * out, int n_out_max) {
+    if (n_samples < 0 || (n_samples > 0 && samples == nullptr)) {
+        return -1;
+    }
+
+    if (n_samples > 0) {
+        int n_out = 0;
+
+        while (n_samples > 0) {
+            // the buffer only has to grow when out is too small to drain it (see whisper_resampler_n_out_max())
+            const int n_free = (int) (rs->buf.capacity() - rs->buf.size());
+            const int n      = n_free > 0 ? std::min(n_samples, n_free) : n_samples;
+
+            rs->buf.insert(rs->buf.end(), samples, samples + n);
+            rs->n_in_total += n;
+
+            samples   += n;
+            n_samples -= n;
+
+            n_out += whisper_resampler_run(*rs, out + n_out, n_out_max - n_out, INT64_MAX);
+        }
+
+        return n_out;
+    }
+
+    // flush: pad with silence and emit ceil(n_in_total*n_up/n_down) samples in total
+    const int64_t n_out_limit = (rs->n_in_total*rs->n_up + rs->n_down - 1)/rs->n_down;
+
+    rs->buf.resize(rs->buf.size() + rs->n_half + 1, 0.0f);
+
+    const int n_out = whisper_resampler_run(*rs, out, n_out_max, n_out_limit);
+
+    if (rs->n_out_total >= n_out_limit) {
+        whisper_resampler_reset(*rs);
+    }
+
+    return n_out;
+}
+
+int whisper_pcm_resample(const float * samples, int n_samples, int sample_rate_in, float * out, int n_out_max, int sample_rate_out) {
+    whisper_resampler * rs = whisper_resampler_init(sample_rate_in, sample_rate_out);
+    if (rs == nullptr) {
+        return -1;
+    }
+
+    int n_out = whisper_resampler_process(rs, samples, n_samples, out, n_out_max);
+    if (n_out >= 0) {
+        n_out += whisper_resampler_process(rs, nullptr, 0, out + n_out, n_out_max - n_out);
+    }
+
+    whisper_resampler_free(rs);
+
+    return n_out;
+}
+
+struct whisper_vad_params whisper_vad_default_params(void) {
+    struct whisper_vad_params result = {
+        /*.threshold               =*/ 0.5f,
+        /*.min_speech_duration_ms  =*/ 250,
+        /*.min_silence_duration_ms =*/ 500,
+        /*.speech_pad_ms           =*/ 200,
+    };
+
+    return result;
+}
+
+struct whisper_vad_segments * whisper_vad_segments_from_samples(struct whisper_vad_params params, const float * samples, int n_samples, int n_threads) {
+    whisper_vad_segments * segments = new whisper_vad_segments;
+
+    segments->data = whisper_vad_detect(params, samples, n_samples, n_threads);
+
+    return segments;
+}
+
+int whisper_vad_segments_n_segments(struct whisper_vad_segments * segments) {
+    return segments->data.size();
+}
+
+int64_t whisper_vad_segments_get_segment_t0(struct whisper_vad_segments * segments, int i_segment) {
+    return (segments->data[i_segment].first*100)/WHISPER_SAMPLE_RATE;
+}
+
+int64_t whisper_vad_segments_get_segment_t1(struct whisper_vad_segments * segments, int i_segment) {
+    return (segments->data[i_segment].second*100)/WHISPER_SAMPLE_RATE;
+}
+
+void whisper_vad_free_segments(struct whisper_vad_segments * segments) {
+    if (segments) {
+        delete segments;
+    }
+}
+
+int whisper_set_mel_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+                   const float * data,
+                           int   n_len,
+                           int   n_mel) {
+    if (n_mel != ctx->model.filters.n_mel) {
+        WHISPER_LOG_ERROR("%s: invalid number of mel bands: %d (expected %d)\n", __func__, n_mel, ctx->model.filters.n_mel);
+        return -1;
+    }
+
+    state->mel.n_len     = n_len;
+    state->mel.n_len_org = n_len;
+    state->mel.n_mel     = n_mel;
+
+    state->mel.data.resize(n_len*n_mel);
+    memcpy(state->mel.data.data(), data, n_len*n_mel*sizeof(float));
+
+    return 0;
+}
+
+int whisper_set_mel(
+        struct whisper_context * ctx,
+        const float * data,
+        int n_len,
+        int n_mel) {
     return whisper_set_mel_with_state(ctx, ctx->state, data, n_len, n_mel);
 }
 
@@ -3909,30 +5343,13 @@ const char * whisper_lang_str_full(int id) {
     return nullptr;
 }
 
-int whisper_lang_auto_detect_with_state(
+// decode the SOT token with the current encoder output and rank the language tokens
+static int whisper_lang_auto_detect_decode(
         struct whisper_context * ctx,
           struct whisper_state * state,
-                           int   offset_ms,
                            int   n_threads,
-                         float * lang_probs) {
-    const int seek = offset_ms/10;
-
-    if (seek < 0) {
-        WHISPER_LOG_ERROR("%s: offset %dms is before the start of the audio\n", __func__, offset_ms);
-        return -1;
-    }
-
-    if (seek >= state->mel.n_len_org) {
-        WHISPER_LOG_ERROR("%s: offset %dms is past the end of the audio (%dms)\n", __func__, offset_ms, state->mel.n_len_org*10);
-        return -2;
-    }
-
-    // run the encoder
-    if (whisper_encode_with_state(ctx, state, seek, n_threads) != 0) {
-        WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
-        return -6;
-    }
-
+                         float * lang_probs,
+                         float * p_top) {
     const std::vector<whisper_token> prompt = { whisper_token_sot(ctx) };
 
     if (whisper_decode_with_state(ctx, state, prompt.data(), prompt.size(), 0, n_threads) != 0) {
@@ -3981,136 +5398,509 @@ int whisper_lang_auto_detect_with_state(
         }
     }
 
+    if (p_top) {
+        *p_top = logits_id[0].first;
+    }
+
     return logits_id[0].second;
 }
 
-int whisper_lang_auto_detect(
+int whisper_lang_auto_detect_with_state(
         struct whisper_context * ctx,
+          struct whisper_state * state,
                            int   offset_ms,
                            int   n_threads,
                          float * lang_probs) {
-    return whisper_lang_auto_detect_with_state(ctx, ctx->state, offset_ms, n_threads, lang_probs);
-}
+    const int seek = offset_ms/10;
 
-int whisper_model_n_vocab(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_vocab;
-}
+    if (seek < 0) {
+        WHISPER_LOG_ERROR("%s: offset %dms is before the start of the audio\n", __func__, offset_ms);
+        return -1;
+    }
 
-int whisper_model_n_audio_ctx(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_audio_ctx;
-}
+    if (seek >= state->mel.n_len_org) {
+        WHISPER_LOG_ERROR("%s: offset %dms is past the end of the audio (%dms)\n", __func__, offset_ms, state->mel.n_len_org*10);
+        return -2;
+    }
 
-int whisper_model_n_audio_state(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_audio_state;
-}
+    // run the encoder
+    if (whisper_encode_with_state(ctx, state, seek, n_threads) != 0) {
+        WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
+        return -6;
+    }
 
-int whisper_model_n_audio_head(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_audio_head;
+    return whisper_lang_auto_detect_decode(ctx, state, n_threads, lang_probs, nullptr);
 }
 
-int whisper_model_n_audio_layer(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_audio_layer;
+struct whisper_lang_detect_params whisper_lang_detect_default_params(void) {
+    return {
+        /*.audio_ms =*/ 5000,
+        /*.n_layers =*/ 0,
+        /*.min_prob =*/ 0.75f,
+    };
 }
 
-int whisper_model_n_text_ctx(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_text_ctx;
-}
+int whisper_lang_auto_detect_fast_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+                           int   offset_ms,
+                           int   n_threads,
+    struct whisper_lang_detect_params   params,
+                         float * lang_probs) {
+    const int seek = offset_ms/10;
 
-int whisper_model_n_text_state(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_text_state;
-}
+    if (seek < 0) {
+        WHISPER_LOG_ERROR("%s: offset %dms is before the start of the audio\n", __func__, offset_ms);
+        return -1;
+    }
 
-int whisper_model_n_text_head(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_text_head;
-}
+    if (seek >= state->mel.n_len_org) {
+        WHISPER_LOG_ERROR("%s: offset %dms is past the end of the audio (%dms)\n", __func__, offset_ms, state->mel.n_len_org*10);
+        return -2;
+    }
 
-int whisper_model_n_text_layer(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_text_layer;
-}
+    const int n_audio_ctx   = state->exp_n_audio_ctx > 0 ? state->exp_n_audio_ctx : ctx->model.hparams.n_audio_ctx;
+    const int n_audio_layer = ctx->model.hparams.n_audio_layer;
 
-int whisper_model_n_mels(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_mels;
-}
+    // each encoder position covers 20 ms of audio
+    const int n_ctx_fast   = params.audio_ms > 0 ? std::min(n_audio_ctx,   std::max(1, params.audio_ms/20)) : n_audio_ctx;
+    const int n_layer_fast = params.n_layers > 0 ? std::min(n_audio_layer, params.n_layers)                 : n_audio_layer;
 
-int whisper_model_ftype(struct whisper_context * ctx) {
-    return ctx->model.hparams.ftype;
-}
+    // the external encoders (Core ML, OpenVINO) always process the full window with all the layers
+    if (!whisper_encode_external(*state) && (n_ctx_fast < n_audio_ctx || n_layer_fast < n_audio_layer)) {
+        const int32_t exp_n_audio_ctx_prev = state->exp_n_audio_ctx;
 
-int whisper_model_type(struct whisper_context * ctx) {
-    return ctx->model.type;
-}
+        state->exp_n_audio_ctx   = n_ctx_fast;
+        state->exp_n_audio_layer = n_layer_fast;
 
-const char *whisper_model_type_readable(struct whisper_context * ctx) {
-    switch (ctx->model.type) {
-    case e_model::MODEL_TINY:
-        return "tiny";
-    case e_model::MODEL_BASE:
-        return "base";
-    case e_model::MODEL_SMALL:
-        return "small";
-    case e_model::MODEL_MEDIUM:
-        return "medium";
-    case e_model::MODEL_LARGE:
-        return "large";
-    default:
-        return "unknown";
-    }
-}
+        float p_top = 0.0f;
 
-int whisper_n_len_from_state(struct whisper_state * state) {
-    return state->mel.n_len_org;
-}
+        int lang_id = -6;
+        if (whisper_encode_with_state(ctx, state, seek, n_threads) != 0) {
+            WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
+        } else {
+            // the decoder reads the cross-attention KV with the truncated context, so restore after decoding
+            lang_id = whisper_lang_auto_detect_decode(ctx, state, n_threads, lang_probs, &p_top);
+        }
 
-int whisper_n_len(struct whisper_context * ctx) {
-    return ctx->state->mel.n_len_org;
-}
+        state->exp_n_audio_ctx   = exp_n_audio_ctx_prev;
+        state->exp_n_audio_layer = 0;
 
-int whisper_n_vocab(struct whisper_context * ctx) {
-    return ctx->vocab.n_vocab;
-}
+        if (lang_id < 0 || p_top >= params.min_prob) {
+            return lang_id;
+        }
 
-int whisper_n_text_ctx(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_text_ctx;
-}
+        WHISPER_LOG_DEBUG("%s: uncertain fast detection (%s, p = %f), falling back to the full encoder\n", __func__, whisper_lang_str(lang_id), p_top);
+    }
 
-int whisper_n_audio_ctx(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_audio_ctx;
+    return whisper_lang_auto_detect_with_state(ctx, state, offset_ms, n_threads, lang_probs);
 }
 
-int whisper_is_multilingual(struct whisper_context * ctx) {
-    return ctx->vocab.is_multilingual() ? 1 : 0;
+int whisper_lang_auto_detect_fast(
+        struct whisper_context * ctx,
+                           int   offset_ms,
+                           int   n_threads,
+    struct whisper_lang_detect_params   params,
+                         float * lang_probs) {
+    return whisper_lang_auto_detect_fast_with_state(ctx, ctx->state, offset_ms, n_threads, params, lang_probs);
 }
 
-float * whisper_get_logits(struct whisper_context * ctx) {
-    return ctx->state->logits.data();
+int whisper_lang_auto_detect(
+        struct whisper_context * ctx,
+                           int   offset_ms,
+                           int   n_threads,
+                         float * lang_probs) {
+    return whisper_lang_auto_detect_with_state(ctx, ctx->state, offset_ms, n_threads, lang_probs);
 }
 
-float * whisper_get_logits_from_state(struct whisper_state * state) {
-    return state->logits.data();
-}
+// log(sum(exp(logits))) of a row of logits
+static float whisper_logits_logsumexp(const float * logits, int n_vocab) {
+    float max = -INFINITY;
+    for (int i = 0; i < n_vocab; ++i) {
+        max = std::max(max, logits[i]);
+    }
 
-const char * whisper_token_to_str(struct whisper_context * ctx, whisper_token token) {
-    return ctx->vocab.id_to_token.at(token).c_str();
-}
+    double sum = 0.0;
+    for (int i = 0; i < n_vocab; ++i) {
+        sum += expf(logits[i] - max);
+    }
 
-whisper_token whisper_token_eot(struct whisper_context * ctx) {
-    return ctx->vocab.token_eot;
+    return max + logf(sum);
 }
 
-whisper_token whisper_token_sot(struct whisper_context * ctx) {
-    return ctx->vocab.token_sot;
-}
+// node of the token trie of the candidates - each node is a token following the prefix of its parent
+struct whisper_score_node {
+    whisper_token token;
+    int32_t       parent;   // -1 - the common prefix
+    int32_t       depth;    // 0 - first token after the common prefix
+    int32_t       n_child;
+    float         logprob;  // sum of the log-probabilities of the tokens from the root to this node
 
-whisper_token whisper_token_solm(struct whisper_context * ctx) {
-    return ctx->vocab.token_solm;
-}
+    whisper_seq_id seq_id;  // KV cache sequence of the node, if it has been decoded
+    int32_t        i_batch; // index of the node in the batch of its depth
+};
 
-whisper_token whisper_token_prev(struct whisper_context * ctx) {
-    return ctx->vocab.token_prev;
-}
+int whisper_score_candidates_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+         const whisper_token * prefix,
+                           int   n_prefix,
+         const whisper_token * const * candidates,
+                     const int * n_candidate_tokens,
+                           int   n_candidates,
+                           int   audio_ctx,
+                           int   n_threads,
+                         float * logprobs) {
+    const int n_vocab    = ctx->vocab.n_vocab;
+    const int n_text_ctx = ctx->model.hparams.n_text_ctx;
 
-whisper_token whisper_token_nosp(struct whisper_context * ctx) {
-    return ctx->vocab.token_nosp;
+    if (state->mel.n_len_org <= 0) {
+        WHISPER_LOG_ERROR("%s: no mel data - call whisper_pcm_to_mel() first\n", __func__);
+        return -1;
+    }
+
+    if (n_prefix <= 0 || n_prefix >= n_text_ctx) {
+        WHISPER_LOG_ERROR("%s: invalid prefix length %d (max %d)\n", __func__, n_prefix, n_text_ctx - 1);
+        return -2;
+    }
+
+    for (int i = 0; i < n_candidates; ++i) {
+        if (n_candidate_tokens[i] <= 0 || n_prefix + n_candidate_tokens[i] > n_text_ctx) {
+            WHISPER_LOG_ERROR("%s: candidate %d has invalid length %d\n", __func__, i, n_candidate_tokens[i]);
+            return -3;
+        }
+    }
+
+    state->exp_n_audio_ctx = audio_ctx;
+
+    // run the encoder
+    if (whisper_encode_with_state(ctx, state, 0, n_threads) != 0) {
+        WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
+        return -6;
+    }
+
+    auto & kv_self = state->kv_self;
+    auto & batch   = state->batch;
+
+    // decode the shared prefix in sequence 0
+    whisper_kv_cache_clear(kv_self);
+
+    whisper_batch_prep_legacy(batch, prefix, n_prefix, 0, 0);
+
+    if (!whisper_decode_internal(*ctx, *state, batch, n_threads, false, nullptr, nullptr)) {
+        WHISPER_LOG_ERROR("%s: failed to decode prefix\n", __func__);
+        return -7;
+    }
+
+    // the last prefix token predicts the first token of every candidate
+    const std::vector<float> logits_prefix(state->logits.begin() + (n_prefix - 1)*n_vocab, state->logits.begin() + n_prefix*n_vocab);
+    const float lse_prefix = whisper_logits_logsumexp(logits_prefix.data(), n_vocab);
+
+    // sort the candidates by their tokens, so that candidates sharing a prefix are next to each other
+    std::vector<int> order(n_candidates);
+    for (int i = 0; i < n_candidates; ++i) {
+        order[i] = i;
+    }
+
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        return std::lexicographical_compare(
+                candidates[a], candidates[a] + n_candidate_tokens[a],
+                candidates[b], candidates[b] + n_candidate_tokens[b]);
+    });
+
+    // every token that is followed by another one in some candidate has to be decoded - it is decoded once in a
+    // separate KV cache sequence forked from the sequence of its parent
+    // the candidates are split in groups, so that the decoded tokens of a group fit in the batch and in the KV cache
+    const int n_decode_max = std::min(n_text_ctx, (int) kv_self.size - n_prefix);
+
+    std::vector<whisper_score_node> nodes;
+    std::vector<int32_t>            leaf(n_candidates);
+    std::vector<int32_t>            path;
+    std::vector<int32_t>            level;
+    std::vector<int32_t>            level_next;
+    std::vector<float>              lse;
+
+    int k0 = 0;
+    while (k0 < n_candidates) {
+        // build the trie of the group
+        nodes.clear();
+        path.clear(); // path[d] - the node at depth d of the previous candidate
+
+        int n_decode = 0;
+        int k1 = k0;
+
+        for (; k1 < n_candidates; ++k1) {
+            const int i = order[k1];
+
+            const whisper_token * cur   = candidates[i];
+            const int             n_cur = n_candidate_tokens[i];
+
+            int n_common = 0;
+            if (k1 > k0) {
+                const int j = order[k1 - 1];
+                while (n_common < n_cur && n_common < n_candidate_tokens[j] && cur[n_common] == candidates[j][n_common]) {
+                    ++n_common;
+                }
+            }
+
+            // the nodes that become internal by adding this candidate
+            int n_new = 0;
+            for (int d = 0; d < n_cur - 1; ++d) {
+                if (d >= n_common || nodes[path[d]].n_child == 0) {
+                    ++n_new;
+                }
+            }
+
+            if (n_decode + n_new > n_decode_max && k1 > k0) {
+                break;
+            }
+
+            n_decode += n_new;
+
+            path.resize(n_common);
+            for (int d = n_common; d < n_cur; ++d) {
+                const int32_t parent = d > 0 ? path[d - 1] : -1;
+                if (parent >= 0) {
+                    nodes[parent].n_child++;
+                }
+
+                path.push_back(nodes.size());
+                nodes.push_back({ cur[d], parent, d, 0, 0.0f, -1, -1 });
+            }
+
+            leaf[i] = path.back();
+        }
+
+        if (n_decode > n_decode_max) {
+            WHISPER_LOG_ERROR("%s: candidate %d does not fit in the KV cache\n", __func__, order[k0]);
+            return -4;
+        }
+
+        // the first tokens are scored with the logits of the prefix
+        level.clear();
+        for (int32_t j = 0; j < (int32_t) nodes.size(); ++j) {
+            auto & node = nodes[j];
+
+            if (node.depth == 0) {
+                node.logprob = logits_prefix[node.token] - lse_prefix;
+                if (node.n_child > 0) {
+                    level.push_back(j);
+                }
+            }
+        }
+
+        // decode the trie breadth-first - one decoder call per depth
+        whisper_seq_id seq_id_next = 1;
+
+        while (!level.empty()) {
+            batch.n_tokens = 0;
+
+            for (const int32_t j : level) {
+                auto & node = nodes[j];
+
+                node.seq_id = seq_id_next++;
+
+                whisper_kv_cache_seq_cp(kv_self, node.parent >= 0 ? nodes[node.parent].seq_id : 0, node.seq_id, -1, -1);
+
+                const int k = batch.n_tokens++;
+
+                node.i_batch = k;
+
+                batch.token   [k]    = node.token;
+                batch.pos     [k]    = n_prefix + node.depth;
+                batch.n_seq_id[k]    = 1;
+                batch.seq_id  [k][0] = node.seq_id;
+                batch.logits  [k]    = 1;
+            }
+
+            // the sequences of the parents have been forked into their children
+            for (const int32_t j : level) {
+                if (nodes[j].parent >= 0 && nodes[nodes[j].parent].seq_id > 0) {
+                    whisper_kv_cache_seq_rm(kv_self, nodes[nodes[j].parent].seq_id, -1, -1);
+                    nodes[nodes[j].parent].seq_id = 0;
+                }
+            }
+
+            if (!whisper_decode_internal(*ctx, *state, batch, n_threads, false, nullptr, nullptr)) {
+                WHISPER_LOG_ERROR("%s: failed to decode candidates\n", __func__);
+                return -8;
+            }
+
+            // score the children of the decoded nodes
+            lse.resize(level.size());
+            for (int k = 0; k < (int) level.size(); ++k) {
+                lse[k] = whisper_logits_logsumexp(state->logits.data() + k*n_vocab, n_vocab);
+            }
+
+            const int32_t depth = nodes[level[0]].depth + 1;
+
+            level_next.clear();
+            for (int32_t j = 0; j < (int32_t) nodes.size(); ++j) {
+                auto & node = nodes[j];
+
+                if (node.depth != depth) {
+                    continue;
+                }
+
+                const auto & parent = nodes[node.parent];
+
+                node.logprob = parent.logprob + state->logits[parent.i_batch*n_vocab + node.token] - lse[parent.i_batch];
+
+                if (node.n_child > 0) {
+                    level_next.push_back(j);
+                }
+            }
+
+            level.swap(level_next);
+        }
+
+        for (int k = k0; k < k1; ++k) {
+            logprobs[order[k]] = nodes[leaf[order[k]]].logprob;
+        }
+
+        // drop the sequences of the group, keeping only the prefix
+        for (whisper_seq_id s = 1; s < seq_id_next; ++s) {
+            whisper_kv_cache_seq_rm(kv_self, s, -1, -1);
+        }
+
+        k0 = k1;
+    }
+
+    return 0;
+}
+
+int whisper_score_candidates(
+        struct whisper_context * ctx,
+         const whisper_token * prefix,
+                           int   n_prefix,
+         const whisper_token * const * candidates,
+                     const int * n_candidate_tokens,
+                           int   n_candidates,
+                           int   audio_ctx,
+                           int   n_threads,
+                         float * logprobs) {
+    return whisper_score_candidates_with_state(ctx, ctx->state, prefix, n_prefix, candidates, n_candidate_tokens, n_candidates, audio_ctx, n_threads, logprobs);
+}
+
+int whisper_model_n_vocab(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_vocab;
+}
+
+int whisper_model_n_audio_ctx(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_audio_ctx;
+}
+
+int whisper_model_n_audio_state(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_audio_state;
+}
+
+int whisper_model_n_audio_head(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_audio_head;
+}
+
+int whisper_model_n_audio_layer(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_audio_layer;
+}
+
+int whisper_model_n_text_ctx(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_text_ctx;
+}
+
+int whisper_model_n_text_state(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_text_state;
+}
+
+int whisper_model_n_text_head(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_text_head;
+}
+
+int whisper_model_n_text_layer(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_text_layer;
+}
+
+int whisper_model_n_mels(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_mels;
+}
+
+int whisper_model_ftype(struct whisper_context * ctx) {
+    return ctx->model.hparams.ftype;
+}
+
+int whisper_model_type(struct whisper_context * ctx) {
+    return ctx->model.type;
+}
+
+const char *whisper_model_type_readable(struct whisper_context * ctx) {
+    switch (ctx->model.type) {
+    case e_model::MODEL_TINY:
+        return "tiny";
+    case e_model::MODEL_BASE:
+        return "base";
+    case e_model::MODEL_SMALL:
+        return "small";
+    case e_model::MODEL_MEDIUM:
+        return "medium";
+    case e_model::MODEL_LARGE:
+        return "large";
+    default:
+        return "unknown";
+    }
+}
+
+int whisper_n_len_from_state(struct whisper_state * state) {
+    return state->mel.n_len_org;
+}
+
+int whisper_n_len(struct whisper_context * ctx) {
+    return ctx->state->mel.n_len_org;
+}
+
+int whisper_n_vocab(struct whisper_context * ctx) {
+    return ctx->vocab.n_vocab;
+}
+
+int whisper_n_text_ctx(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_text_ctx;
+}
+
+int whisper_n_audio_ctx(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_audio_ctx;
+}
+
+int whisper_is_multilingual(struct whisper_context * ctx) {
+    return ctx->vocab.is_multilingual() ? 1 : 0;
+}
+
+float * whisper_get_logits(struct whisper_context * ctx) {
+    return ctx->state->logits.data();
+}
+
+float * whisper_get_logits_from_state(struct whisper_state * state) {
+    return state->logits.data();
+}
+
+const char * whisper_token_to_str(struct whisper_context * ctx, whisper_token token) {
+    return ctx->vocab.id_to_token.at(token).c_str();
+}
+
+whisper_token whisper_token_eot(struct whisper_context * ctx) {
+    return ctx->vocab.token_eot;
+}
+
+whisper_token whisper_token_sot(struct whisper_context * ctx) {
+    return ctx->vocab.token_sot;
+}
+
+whisper_token whisper_token_solm(struct whisper_context * ctx) {
+    return ctx->vocab.token_solm;
+}
+
+whisper_token whisper_token_prev(struct whisper_context * ctx) {
+    return ctx->vocab.token_prev;
+}
+
+whisper_token whisper_token_nosp(struct whisper_context * ctx) {
+    return ctx->vocab.token_nosp;
 }
 
 whisper_token whisper_token_not(struct whisper_context * ctx) {
@@ -4531,10 +6321,13 @@ static std::vector<whisper_grammar_candidate> whisper_grammar_reject_candidates(
     return rejects;
 }
 
+// prev: rules parsed by a previous call - they are reused when the grammar is the same, so that the parse stacks
+//       point into the same memory and the cached rejects of the state stay valid across whisper_full calls
 static struct whisper_grammar whisper_grammar_init(
             const whisper_grammar_element ** rules,
                                  size_t      n_rules,
-                                 size_t      i_start_rule) {
+                                 size_t      i_start_rule,
+        const std::shared_ptr<const std::vector<std::vector<whisper_grammar_element>>> & prev) {
     const whisper_grammar_element * pos;
 
     // copy rule definitions into vectors
@@ -4546,16 +6339,37 @@ static struct whisper_grammar whisper_grammar_init(
         vec_rules[i].push_back({WHISPER_GRETYPE_END, 0});
     }
 
+    const auto same_rules = [&]() {
+        if (!prev || prev->size() != vec_rules.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < n_rules; i++) {
+            const auto & a = (*prev)[i];
+            const auto & b = vec_rules[i];
+            if (a.size() != b.size()) {
+                return false;
+            }
+            for (size_t j = 0; j < a.size(); j++) {
+                if (a[j].type != b[j].type || a[j].value != b[j].value) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    };
+
+    auto shared = same_rules() ? prev : std::make_shared<const std::vector<std::vector<whisper_grammar_element>>>(std::move(vec_rules));
+
     // loop over alternates of start rule to build initial stacks
     std::vector<std::vector<const whisper_grammar_element *>> stacks;
-    pos = rules[i_start_rule];
+    pos = (*shared)[i_start_rule].data();
     do {
         std::vector<const whisper_grammar_element *> stack;
         if (!whisper_grammar_is_end_of_sequence(pos)) {
             // if alternate is nonempty, add to stack
             stack.push_back(pos);
         }
-        whisper_grammar_advance_stack(vec_rules, stack, stacks);
+        whisper_grammar_advance_stack(*shared, stack, stacks);
         while (!whisper_grammar_is_end_of_sequence(pos)) {
             // scan to end of alternate def
             pos++;
@@ -4568,47 +6382,191 @@ static struct whisper_grammar whisper_grammar_init(
         }
     } while (true);
 
-    return { std::move(vec_rules), std::move(stacks), {} };
+    return { std::move(shared), std::move(stacks), {} };
 }
 
-static void whisper_suppress_invalid_grammar(
-             whisper_context  & ctx,
-    const whisper_full_params & params,
-           std::vector<float> & logits,
-    const     whisper_grammar & grammar) {
-
-    if (grammar.rules.empty() || grammar.stacks.empty()) {
-        return;
-    }
-
-    //bool allow_eot = false;
-    //for (const auto & stack : grammar.stacks) {
-    //    if (stack.empty()) {
-    //        allow_eot = true;
-    //        break;
-    //    }
-    //}
+// compile the vocabulary into a trie of code points
+// tokens are sorted by their code points, so each trie node owns a contiguous range of the sorted tokens
+static void whisper_grammar_cache_init_trie(const whisper_vocab & vocab, whisper_grammar_cache & cache) {
+    std::vector<std::pair<std::vector<uint32_t>, whisper_token>> seqs;
 
-    const whisper_token eot = whisper_token_eot(&ctx);
+    for (whisper_token id = 0; id < vocab.token_eot; ++id) {
+        const auto it = vocab.id_to_token.find(id);
+        if (it == vocab.id_to_token.end() || it->second.empty()) {
+            continue;
+        }
 
-    std::vector<std::pair<std::vector<uint32_t>, whisper_partial_utf8>> candidates_decoded;
-    std::vector<whisper_grammar_candidate>                              candidates_grammar;
+        const std::string & text = it->second;
 
-    for (whisper_token id = 0; id < eot; ++id) {
-        const std::string & text = ctx.vocab.id_to_token[id];
-        if (!text.empty()) {
-            candidates_decoded.push_back(decode_utf8(text.c_str(), grammar.partial_utf8));
-            candidates_grammar.push_back({ id, candidates_decoded.back().first.data(), candidates_decoded.back().second });
+        auto decoded = decode_utf8(text.c_str(), { 0, 0 });
+        if (decoded.second.n_remain != 0) {
+            cache.partial_ids.push_back(id);
+            continue;
         }
+
+        decoded.first.pop_back(); // terminating 0
+        seqs.emplace_back(std::move(decoded.first), id);
     }
 
-    const auto rejects = whisper_grammar_reject_candidates(grammar.rules, grammar.stacks, candidates_grammar);
+    std::sort(seqs.begin(), seqs.end());
 
-    for (const auto & reject : rejects) {
-        logits[reject.id] -= params.grammar_penalty;
-    }
+    const int32_t n = seqs.size();
 
-    // when the grammar allows a continuation, we penalize the end-of-text token
+    cache.trie.clear();
+    cache.trie.push_back({ {}, 0, n });
+    cache.trie_ids.resize(n);
+
+    // path[d] - the node at depth d for the previous token
+    std::vector<int32_t> path = { 0 };
+
+    for (int32_t k = 0; k < n; ++k) {
+        const auto & cur = seqs[k].first;
+
+        size_t n_common = 0;
+        if (k > 0) {
+            const auto & prev = seqs[k - 1].first;
+            while (n_common < cur.size() && n_common < prev.size() && cur[n_common] == prev[n_common]) {
+                ++n_common;
+            }
+        }
+
+        while (path.size() > n_common + 1) {
+            cache.trie[path.back()].i1 = k;
+            path.pop_back();
+        }
+
+        for (size_t d = n_common; d < cur.size(); ++d) {
+            const int32_t idx = cache.trie.size();
+            cache.trie[path.back()].children.emplace_back(cur[d], idx);
+            cache.trie.push_back({ {}, k, n });
+            path.push_back(idx);
+        }
+
+        cache.trie_ids[k] = seqs[k].second;
+    }
+
+    while (path.size() > 1) {
+        cache.trie[path.back()].i1 = n;
+        path.pop_back();
+    }
+}
+
+// walk the trie depth-first, advancing the parse stacks one code point at a time
+// a subtree is rejected as a whole as soon as no stack can accept its prefix
+static void whisper_grammar_trie_reject(
+        const std::vector<std::vector<whisper_grammar_element>>         & rules,
+        const whisper_grammar_cache                                     & cache,
+        int32_t                                                           node,
+        const std::vector<std::vector<const whisper_grammar_element *>> & stacks,
+        std::vector<whisper_token>                                      & rejects) {
+    for (const auto & child : cache.trie[node].children) {
+        const auto next_stacks = whisper_grammar_accept(rules, stacks, child.first);
+
+        if (next_stacks.empty()) {
+            const auto & cnode = cache.trie[child.second];
+            rejects.insert(rejects.end(), cache.trie_ids.begin() + cnode.i0, cache.trie_ids.begin() + cnode.i1);
+        } else {
+            whisper_grammar_trie_reject(rules, cache, child.second, next_stacks, rejects);
+        }
+    }
+}
+
+// the tokens rejected by the grammar, computed with the trie and cached per set of parse stacks
+static const std::vector<whisper_token> & whisper_grammar_cache_rejects(
+        const whisper_vocab   & vocab,
+        whisper_grammar_cache & cache,
+        const whisper_grammar & grammar) {
+    if (cache.trie.empty()) {
+        whisper_grammar_cache_init_trie(vocab, cache);
+    }
+
+    if (cache.rules != grammar.rules) {
+        cache.rules = grammar.rules;
+        cache.rejects.clear();
+    }
+
+    auto it = cache.rejects.find(grammar.stacks);
+    if (it != cache.rejects.end()) {
+        return it->second;
+    }
+
+    std::vector<whisper_token> rejects;
+
+    whisper_grammar_trie_reject(*grammar.rules, cache, 0, grammar.stacks, rejects);
+
+    // tokens ending with an incomplete UTF-8 sequence are checked one by one
+    {
+        std::vector<std::pair<std::vector<uint32_t>, whisper_partial_utf8>> candidates_decoded;
+        std::vector<whisper_grammar_candidate>                              candidates_grammar;
+
+        candidates_decoded.reserve(cache.partial_ids.size());
+
+        for (const whisper_token id : cache.partial_ids) {
+            candidates_decoded.push_back(decode_utf8(vocab.id_to_token.at(id).c_str(), { 0, 0 }));
+            candidates_grammar.push_back({ id, candidates_decoded.back().first.data(), candidates_decoded.back().second });
+        }
+
+        for (const auto & reject : whisper_grammar_reject_candidates(*grammar.rules, grammar.stacks, candidates_grammar)) {
+            rejects.push_back(reject.id);
+        }
+    }
+
+    // bound the memory used by large grammars
+    if (cache.rejects.size() >= 1024) {
+        cache.rejects.clear();
+    }
+
+    return cache.rejects.emplace(grammar.stacks, std::move(rejects)).first->second;
+}
+
+static void whisper_suppress_invalid_grammar(
+             whisper_context  & ctx,
+       whisper_grammar_cache  & cache,
+    const whisper_full_params & params,
+           std::vector<float> & logits,
+    const     whisper_grammar & grammar) {
+
+    if (!grammar.rules || grammar.stacks.empty()) {
+        return;
+    }
+
+    //bool allow_eot = false;
+    //for (const auto & stack : grammar.stacks) {
+    //    if (stack.empty()) {
+    //        allow_eot = true;
+    //        break;
+    //    }
+    //}
+
+    if (grammar.partial_utf8.n_remain == 0) {
+        for (const whisper_token id : whisper_grammar_cache_rejects(ctx.vocab, cache, grammar)) {
+            logits[id] -= params.grammar_penalty;
+        }
+
+        return;
+    }
+
+    // the previous token ended in the middle of a UTF-8 sequence - the trie cannot be used
+    const whisper_token eot = whisper_token_eot(&ctx);
+
+    std::vector<std::pair<std::vector<uint32_t>, whisper_partial_utf8>> candidates_decoded;
+    std::vector<whisper_grammar_candidate>                              candidates_grammar;
+
+    for (whisper_token id = 0; id < eot; ++id) {
+        const std::string & text = ctx.vocab.id_to_token[id];
+        if (!text.empty()) {
+            candidates_decoded.push_back(decode_utf8(text.c_str(), grammar.partial_utf8));
+            candidates_grammar.push_back({ id, candidates_decoded.back().first.data(), candidates_decoded.back().second });
+        }
+    }
+
+    const auto rejects = whisper_grammar_reject_candidates(*grammar.rules, grammar.stacks, candidates_grammar);
+
+    for (const auto & reject : rejects) {
+        logits[reject.id] -= params.grammar_penalty;
+    }
+
+    // when the grammar allows a continuation, we penalize the end-of-text token
     //if (!allow_eot) {
     //    logits[eot] -= params.grammar_penalty;
     //}
@@ -4616,7 +6574,7 @@ static void whisper_suppress_invalid_grammar(
 }
 
 static void whisper_grammar_accept_token(whisper_context & ctx, whisper_grammar & grammar, whisper_token token) {
-    if (grammar.rules.empty() || grammar.stacks.empty()) {
+    if (!grammar.rules || grammar.stacks.empty()) {
         return;
     }
 
@@ -4634,7 +6592,7 @@ static void whisper_grammar_accept_token(whisper_context & ctx, whisper_grammar
     const auto   decoded     = decode_utf8(text.c_str(), grammar.partial_utf8);
     const auto & code_points = decoded.first;
     for (auto it = code_points.begin(), end = code_points.end() - 1; it != end; ++it) {
-        grammar.stacks = whisper_grammar_accept(grammar.rules, grammar.stacks, *it);
+        grammar.stacks = whisper_grammar_accept(*grammar.rules, grammar.stacks, *it);
     }
     grammar.partial_utf8 = decoded.second;
 }
@@ -4741,6 +6699,12 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
         /*.n_grammar_rules =*/ 0,
         /*.i_start_rule    =*/ 0,
         /*.grammar_penalty =*/ 100.0f,
+
+        /*.vad        =*/ false,
+        /*.vad_params =*/ whisper_vad_default_params(),
+
+        /*.lang_detect_fast   =*/ false,
+        /*.lang_detect_params =*/ whisper_lang_detect_default_params(),
     };
 
     switch (strategy) {
@@ -4778,6 +6742,14 @@ static inline bool should_split_on_word(const char * txt, bool split_on_word) {
     return txt[0] == ' ';
 }
 
+// a token starts a word if it begins with a space, or with a character of the scripts that are written without spaces
+// between the words (Thai, kana, CJK, ... - the 3-byte UTF-8 sequences), which are then cut between any two characters
+static inline bool whisper_is_word_start(const char * txt) {
+    const unsigned char c = txt[0];
+
+    return c == ' ' || (c >= 0xE0 && c < 0xF0);
+}
+
 static void whisper_exp_compute_token_level_timestamps_dtw(
             struct whisper_context * ctx,
               struct whisper_state * state,
@@ -5078,7 +7050,7 @@ static void whisper_process_logits(
                 }
             } else {
                 if (params.n_grammar_rules > 0) {
-                    whisper_suppress_invalid_grammar(ctx, params, logits, decoder.grammar);
+                    whisper_suppress_invalid_grammar(ctx, state.grammar_cache, params, logits, decoder.grammar);
 
                     // populate the logprobs array (log_softmax)
                     {
@@ -5368,6 +7340,63 @@ int whisper_full_with_state(
 
     result_all.clear();
 
+    state->vad_regions.clear();
+
+    // [EXPERIMENTAL] VAD pre-pass - keep only the detected speech, separated by short gaps of silence
+    std::vector<float> samples_vad;
+    if (params.vad && n_samples > 0) {
+        const int64_t t_start_us = ggml_time_us();
+
+        // apply the offset and duration on the input audio, before removing the silence
+        const int i_offset = std::min(n_samples, (int) (((int64_t) params.offset_ms*WHISPER_SAMPLE_RATE)/1000));
+
+        int n_input = n_samples - i_offset;
+        if (params.duration_ms > 0) {
+            n_input = std::min(n_input, (int) (((int64_t) params.duration_ms*WHISPER_SAMPLE_RATE)/1000));
+        }
+
+        const auto regions = whisper_vad_detect(params.vad_params, samples + i_offset, n_input, params.n_threads);
+
+        const int64_t n_gap = ((int64_t) WHISPER_VAD_GAP_MS*WHISPER_SAMPLE_RATE)/1000;
+
+        int64_t n_speech = 0;
+        for (const auto & r : regions) {
+            n_speech += r.second - r.first;
+        }
+
+        samples_vad.reserve(n_speech + n_gap*regions.size());
+
+        for (const auto & r : regions) {
+            if (!samples_vad.empty()) {
+                samples_vad.resize(samples_vad.size() + n_gap, 0.0f);
+            }
+
+            state->vad_regions.push_back({ i_offset + r.first, (int64_t) samples_vad.size(), r.second - r.first });
+
+            samples_vad.insert(samples_vad.end(), samples + i_offset + r.first, samples + i_offset + r.second);
+        }
+
+        WHISPER_LOG_INFO("%s: VAD kept %d speech regions, %.2f s out of %.2f s\n", __func__,
+                (int) regions.size(), (float) n_speech/WHISPER_SAMPLE_RATE, (float) n_input/WHISPER_SAMPLE_RATE);
+
+        state->t_mel_us += ggml_time_us() - t_start_us;
+
+        if (samples_vad.empty()) {
+            return 0;
+        }
+
+        // the decoder needs at least 1 s of audio
+        if (samples_vad.size() < WHISPER_SAMPLE_RATE + n_gap) {
+            samples_vad.resize(WHISPER_SAMPLE_RATE + n_gap, 0.0f);
+        }
+
+        samples   = samples_vad.data();
+        n_samples = samples_vad.size();
+
+        params.offset_ms   = 0;
+        params.duration_ms = 0;
+    }
+
     if (n_samples > 0) {
         // compute log mel spectrogram
         if (whisper_pcm_to_mel_with_state(ctx, state, samples, n_samples, params.n_threads) != 0) {
@@ -5380,7 +7409,9 @@ int whisper_full_with_state(
     if (params.language == nullptr || strlen(params.language) == 0 || strcmp(params.language, "auto") == 0 || params.detect_language) {
         std::vector<float> probs(whisper_lang_max_id() + 1, 0.0f);
 
-        const auto lang_id = whisper_lang_auto_detect_with_state(ctx, state, 0, params.n_threads, probs.data());
+        const auto lang_id = params.lang_detect_fast ?
+            whisper_lang_auto_detect_fast_with_state(ctx, state, 0, params.n_threads, params.lang_detect_params, probs.data()) :
+            whisper_lang_auto_detect_with_state     (ctx, state, 0, params.n_threads, probs.data());
         if (lang_id < 0) {
             WHISPER_LOG_ERROR("%s: failed to auto-detect language\n", __func__);
             return -3;
@@ -5460,6 +7491,13 @@ int whisper_full_with_state(
         decoder.rng = std::mt19937(0);
     }
 
+    // the grammar is parsed once - the decoders share its rules and the token acceptance cache of the state,
+    // which is kept across the calls with the same grammar (e.g. the chunks of a stream)
+    whisper_grammar grammar = {};
+    if (params.grammar_rules != nullptr) {
+        grammar = whisper_grammar_init(params.grammar_rules, params.n_grammar_rules, params.i_start_rule, state->grammar_cache.rules);
+    }
+
     // the accumulated text context so far
     auto & prompt_past = state->prompt_past;
     if (params.no_context) {
@@ -5624,11 +7662,7 @@ int whisper_full_with_state(
                 decoder.completed = false;
                 decoder.has_ts    = false;
 
-                if (params.grammar_rules != nullptr) {
-                    decoder.grammar = whisper_grammar_init(params.grammar_rules, params.n_grammar_rules, params.i_start_rule);
-                } else {
-                    decoder.grammar = {};
-                }
+                decoder.grammar = grammar;
             }
 
             // init prompt and kv cache for the current iteration
@@ -5663,7 +7697,7 @@ int whisper_full_with_state(
                     // overallocate to workaround KV cache fragmentation issues
                     const int factor = n_decoders_cur > 1 ? n_decoders_cur + 2 : 1;
 
-                    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], ctx->itype,
+                    if (!whisper_kv_cache_init(state->kv_self, state->compute->backends[0], ctx->params.type_k, ctx->params.type_v,
                                 ctx->model.hparams.n_text_state,
                                 ctx->model.hparams.n_text_layer,
                                 GGML_PAD(ctx->model.hparams.n_text_ctx, 256)*factor)) {
@@ -6140,260 +8174,1091 @@ int whisper_full_with_state(
                 std::string text;
                 bool speaker_turn_next = false;
 
-                for (int i = 0; i < (int) tokens_cur.size(); i++) {
-                    //printf("%s: %18s %6.3f %18s %6.3f\n", __func__,
-                    //        ctx->vocab.id_to_token[tokens_cur[i].id].c_str(), tokens_cur[i].p,
-                    //        ctx->vocab.id_to_token[tokens_cur[i].tid].c_str(), tokens_cur[i].pt);
+                for (int i = 0; i < (int) tokens_cur.size(); i++) {
+                    //printf("%s: %18s %6.3f %18s %6.3f\n", __func__,
+                    //        ctx->vocab.id_to_token[tokens_cur[i].id].c_str(), tokens_cur[i].p,
+                    //        ctx->vocab.id_to_token[tokens_cur[i].tid].c_str(), tokens_cur[i].pt);
+
+                    if (params.print_special || tokens_cur[i].id < whisper_token_eot(ctx)) {
+                        text += whisper_token_to_str(ctx, tokens_cur[i].id);
+                    }
+
+                    // [TDRZ] record if speaker turn was predicted after current segment
+                    if (params.tdrz_enable && tokens_cur[i].id == whisper_token_solm(ctx)) {
+                        speaker_turn_next = true;
+                    }
+
+                    if (tokens_cur[i].id > whisper_token_beg(ctx) && !params.single_segment) {
+                        const auto t1 = seek + 2*(tokens_cur[i].tid - whisper_token_beg(ctx));
+
+                        if (!text.empty()) {
+                            const auto tt0 = t0;
+                            const auto tt1 = t1;
+
+                            if (params.print_realtime) {
+                                if (params.print_timestamps) {
+                                    printf("[%s --> %s]  %s\n", to_timestamp(whisper_vad_map_time(*state, tt0)).c_str(), to_timestamp(whisper_vad_map_time(*state, tt1)).c_str(), text.c_str());
+                                } else {
+                                    printf("%s", text.c_str());
+                                    fflush(stdout);
+                                }
+                            }
+
+                            //printf("tt0 = %d, tt1 = %d, text = %s, token = %s, token_id = %d, tid = %d\n", tt0, tt1, text.c_str(), ctx->vocab.id_to_token[tokens_cur[i].id].c_str(), tokens_cur[i].id, tokens_cur[i].tid);
+
+                            result_all.push_back({ tt0, tt1, text, state->no_speech_prob, {}, speaker_turn_next });
+                            for (int j = i0; j <= i; j++) {
+                                result_all.back().tokens.push_back(tokens_cur[j]);
+                            }
+
+                            int n_new = 1;
+
+                            if (params.token_timestamps) {
+                                whisper_exp_compute_token_level_timestamps(
+                                        *ctx, *state, result_all.size() - 1, params.thold_pt, params.thold_ptsum);
+
+                                if (params.max_len > 0) {
+                                    n_new = whisper_wrap_segment(*ctx, *state, params.max_len, params.split_on_word);
+                                }
+                            }
+                            if (!ctx->params.dtw_token_timestamps) {
+                                whisper_vad_map_segments(*state, result_all.size() - n_new);
+
+                                if (params.new_segment_callback) {
+                                    params.new_segment_callback(ctx, state, n_new, params.new_segment_callback_user_data);
+                                }
+                            }
+                        }
+                        text = "";
+                        while (i < (int) tokens_cur.size() && tokens_cur[i].id > whisper_token_beg(ctx)) {
+                            i++;
+                        }
+                        i--;
+                        t0 = t1;
+                        i0 = i + 1;
+                        speaker_turn_next = false;
+                    }
+                }
+
+                if (!text.empty()) {
+                    const auto t1 = seek + seek_delta;
+
+                    const auto tt0 = t0;
+                    const auto tt1 = t1;
+
+                    if (params.print_realtime) {
+                        if (params.print_timestamps) {
+                            printf("[%s --> %s]  %s\n", to_timestamp(whisper_vad_map_time(*state, tt0)).c_str(), to_timestamp(whisper_vad_map_time(*state, tt1)).c_str(), text.c_str());
+                        } else {
+                            printf("%s", text.c_str());
+                            fflush(stdout);
+                        }
+                    }
+
+                    result_all.push_back({ tt0, tt1, text, state->no_speech_prob, {}, speaker_turn_next });
+                    for (int j = i0; j < (int) tokens_cur.size(); j++) {
+                        result_all.back().tokens.push_back(tokens_cur[j]);
+                    }
+
+                    int n_new = 1;
+
+                    if (params.token_timestamps) {
+                        whisper_exp_compute_token_level_timestamps(
+                                *ctx, *state, result_all.size() - 1, params.thold_pt, params.thold_ptsum);
+
+                        if (params.max_len > 0) {
+                            n_new = whisper_wrap_segment(*ctx, *state, params.max_len, params.split_on_word);
+                        }
+                    }
+                    if (!ctx->params.dtw_token_timestamps) {
+                        whisper_vad_map_segments(*state, result_all.size() - n_new);
+
+                        if (params.new_segment_callback) {
+                            params.new_segment_callback(ctx, state, n_new, params.new_segment_callback_user_data);
+                        }
+                    }
+                }
+            }
+
+            // FIXME: will timestamp offsets be correct?
+            // [EXPERIMENTAL] Token-level timestamps with DTW
+            {
+                const int n_segments = state->result_all.size() - n_segments_before;
+                if (ctx->params.dtw_token_timestamps && n_segments) {
+                    const int n_frames = std::min(std::min(WHISPER_CHUNK_SIZE * 100, seek_delta), seek_end - seek);
+                    whisper_exp_compute_token_level_timestamps_dtw(
+                            ctx, state, params, result_all.size() - n_segments, n_segments, seek, n_frames, 7, params.n_threads);
+                    whisper_vad_map_segments(*state, result_all.size() - n_segments);
+                    if (params.new_segment_callback) {
+                        for (int seg = (int) result_all.size() - n_segments; seg < n_segments; seg++) {
+                            params.new_segment_callback(ctx, state, seg, params.new_segment_callback_user_data);
+                        }
+                    }
+                }
+            }
+
+            // ref: https://github.com/ggerganov/whisper.cpp/pull/2629
+            const bool single_timestamp_ending = tokens_cur.size() > 1 &&
+                tokens_cur[tokens_cur.size() - 2].id < whisper_token_beg(ctx) &&
+                tokens_cur[tokens_cur.size() - 1].id > whisper_token_beg(ctx);
+            if (single_timestamp_ending) {
+                WHISPER_LOG_DEBUG("single timestamp ending - skip entire chunk\n");
+                seek_delta = std::min(seek_end - seek, WHISPER_CHUNK_SIZE * 100);
+            }
+
+            // update audio window
+            seek += seek_delta;
+
+            WHISPER_LOG_DEBUG("seek = %d, seek_delta = %d\n", seek, seek_delta);
+        }
+    }
+
+    return 0;
+}
+
+int whisper_full(
+        struct whisper_context * ctx,
+    struct whisper_full_params   params,
+                   const float * samples,
+                           int   n_samples) {
+    return whisper_full_with_state(ctx, ctx->state, params, samples, n_samples);
+}
+
+// chunks processed by whisper_full_parallel() are between WHISPER_PARALLEL_CHUNK_MIN_S and WHISPER_PARALLEL_CHUNK_MAX_S
+// seconds long (unless the audio is shorter), so that long audio is split in more chunks than processors and the
+// workers stay busy until the end
+#define WHISPER_PARALLEL_CHUNK_MIN_S  30
+#define WHISPER_PARALLEL_CHUNK_MAX_S 300
+
+// each chunk is extended by this much audio on both sides
+#define WHISPER_PARALLEL_OVERLAP_MS 1000
+
+// the split points are moved to the quietest WHISPER_PARALLEL_SILENCE_MS of audio within this distance
+#define WHISPER_PARALLEL_SEARCH_MS 5000
+#define WHISPER_PARALLEL_SILENCE_MS 200
+
+// without text context, the audio is split in windows of this length, so that together with the overlap and the search
+// for the split point each task fits in a single 30 s encoder window
+#define WHISPER_PARALLEL_WINDOW_MS 24000
+#define WHISPER_PARALLEL_WINDOW_SEARCH_MS 2000
+
+// choose n_chunks - 1 split points in [i_begin, i_end), each one in the quietest part of the audio within search_ms
+// of the position of an even split
+// returns the n_chunks + 1 chunk boundaries
+static std::vector<int> whisper_parallel_split_points(const float * samples, int i_begin, int i_end, int n_chunks, int search_ms) {
+    std::vector<int> result = { i_begin };
+
+    const int n_frame_samples = WHISPER_HOP_LENGTH;
+    const int n_silence       = WHISPER_PARALLEL_SILENCE_MS/10;
+
+    const int n_chunk  = (i_end - i_begin)/n_chunks;
+    const int n_search = std::min((search_ms*WHISPER_SAMPLE_RATE)/1000, n_chunk/4);
+
+    std::vector<float> energy;
+
+    for (int i = 1; i < n_chunks; ++i) {
+        const int i_split = i_begin + i*n_chunk;
+
+        const int i0 = std::max(result.back() + 1, i_split - n_search);
+        const int i1 = std::min(i_end - 1, i_split + n_search);
+
+        const int n_frames = (i1 - i0)/n_frame_samples;
+        if (n_frames <= n_silence) {
+            result.push_back(i_split);
+            continue;
+        }
+
+        energy.resize(n_frames);
+        for (int j = 0; j < n_frames; ++j) {
+            const float * x = samples + i0 + j*n_frame_samples;
+
+            float sum = 0.0f;
+            for (int k = 0; k < n_frame_samples; ++k) {
+                sum += x[k]*x[k];
+            }
+            energy[j] = sum;
+        }
+
+        // sliding window over n_silence frames
+        double sum = 0.0;
+        for (int j = 0; j < n_silence; ++j) {
+            sum += energy[j];
+        }
+
+        double sum_min = sum;
+        int    j_min   = 0;
+        for (int j = n_silence; j < n_frames; ++j) {
+            sum += energy[j] - energy[j - n_silence];
+            if (sum < sum_min) {
+                sum_min = sum;
+                j_min   = j - n_silence + 1;
+            }
+        }
+
+        result.push_back(i0 + (j_min + n_silence/2)*n_frame_samples);
+    }
+
+    result.push_back(i_end);
+
+    return result;
+}
+
+// keep the words of a segment whose midpoint, from the token timestamps, is in [t_begin, t_end) - t_begin < 0 or
+// t_end < 0 for no limit. text and the timestamps of the segment are updated when words are dropped
+// returns false if no word is left
+static bool whisper_parallel_trim_segment(
+        struct whisper_context * ctx,
+        const whisper_full_params & params,
+               whisper_segment & segment,
+                       int64_t   t_begin,
+                       int64_t   t_end) {
+    const whisper_token token_eot = whisper_token_eot(ctx);
+
+    const int64_t t_seg = (segment.t0 + segment.t1)/2;
+
+    // word of each token - the special tokens go with the word before them (or the first word)
+    std::vector<int>     word(segment.tokens.size());
+    std::vector<int64_t> word_t0;
+    std::vector<int64_t> word_t1;
+
+    for (size_t i = 0; i < segment.tokens.size(); ++i) {
+        const auto & token = segment.tokens[i];
+
+        if (token.id < token_eot && (word_t0.empty() || whisper_is_word_start(whisper_token_to_str(ctx, token.id)))) {
+            word_t0.push_back(INT64_MAX);
+            word_t1.push_back(INT64_MIN);
+        }
+
+        word[i] = std::max(0, (int) word_t0.size() - 1);
+
+        if (token.id < token_eot && token.t0 >= 0 && token.t1 >= 0) {
+            word_t0.back() = std::min(word_t0.back(), token.t0);
+            word_t1.back() = std::max(word_t1.back(), token.t1);
+        }
+    }
+
+    const int n_words = word_t0.size();
+
+    std::vector<bool> keep(n_words);
+
+    int n_keep = 0;
+    for (int w = 0; w < n_words; ++w) {
+        // no timestamps for the tokens of the word - use the midpoint of the segment
+        const int64_t t_mid = word_t0[w] <= word_t1[w] ? (word_t0[w] + word_t1[w])/2 : t_seg;
+
+        keep[w] = (t_begin < 0 || t_mid >= t_begin) && (t_end < 0 || t_mid < t_end);
+        n_keep += keep[w];
+    }
+
+    if (n_words == 0) {
+        return (t_begin < 0 || t_seg >= t_begin) && (t_end < 0 || t_seg < t_end);
+    }
+
+    if (n_keep == n_words) {
+        return true;
+    }
+
+    if (n_keep == 0) {
+        return false;
+    }
+
+    std::vector<whisper_token_data> tokens;
+    std::string text;
+
+    int w_first = -1;
+    int w_last  = -1;
+
+    for (size_t i = 0; i < segment.tokens.size(); ++i) {
+        if (!keep[word[i]]) {
+            continue;
+        }
+
+        w_first = w_first < 0 ? word[i] : w_first;
+        w_last  = word[i];
+
+        if (params.print_special || segment.tokens[i].id < token_eot) {
+            text += whisper_token_to_str(ctx, segment.tokens[i].id);
+        }
+
+        tokens.push_back(segment.tokens[i]);
+    }
+
+    if (w_first > 0 && word_t0[w_first] <= word_t1[w_first]) {
+        segment.t0 = std::max(segment.t0, word_t0[w_first]);
+    }
+    if (w_last < n_words - 1 && word_t0[w_last] <= word_t1[w_last]) {
+        segment.t1 = std::min(segment.t1, word_t1[w_last]);
+    }
+
+    segment.tokens = std::move(tokens);
+    segment.text   = std::move(text);
+
+    return true;
+}
+
+// work-stealing task queues - each worker starts with a contiguous range of chunks and pops from the front of its
+// own queue; when it runs out, it steals from the back of the fullest queue of another worker
+struct whisper_parallel_queue {
+    std::mutex      mutex;
+    std::deque<int> tasks;
+};
+
+static int whisper_parallel_next_task(std::vector<whisper_parallel_queue> & queues, int iw) {
+    {
+        auto & q = queues[iw];
+
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty()) {
+            const int i = q.tasks.front();
+            q.tasks.pop_front();
+            return i;
+        }
+    }
+
+    while (true) {
+        int    jw_max = -1;
+        size_t n_max  = 0;
+
+        for (int jw = 0; jw < (int) queues.size(); ++jw) {
+            if (jw == iw) {
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(queues[jw].mutex);
+            if (queues[jw].tasks.size() > n_max) {
+                n_max  = queues[jw].tasks.size();
+                jw_max = jw;
+            }
+        }
+
+        if (jw_max < 0) {
+            return -1;
+        }
+
+        auto & q = queues[jw_max];
+
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty()) {
+            const int i = q.tasks.back();
+            q.tasks.pop_back();
+            return i;
+        }
+    }
+}
+
+int whisper_full_parallel(
+        struct whisper_context * ctx,
+        struct whisper_full_params params,
+        const float * samples,
+        int n_samples,
+        int n_processors) {
+    if (n_processors == 1) {
+        return whisper_full(ctx, params, samples, n_samples);
+    }
+
+    const int64_t t_start_us = ggml_time_us();
+
+    const int i_begin = std::min(n_samples, (int) (((int64_t) params.offset_ms*WHISPER_SAMPLE_RATE)/1000));
+    const int i_end   = params.duration_ms > 0 ? std::min(n_samples, i_begin + (int) (((int64_t) params.duration_ms*WHISPER_SAMPLE_RATE)/1000)) : n_samples;
+
+    const int n_audio = i_end - i_begin;
+
+    // without text context the windows are independent, so the audio is split in window-sized tasks and the tail
+    // latency is bounded by the slowest window instead of the slowest chunk
+    const bool per_window = params.n_max_text_ctx == 0;
+
+    int n_chunks = n_processors;
+    if (per_window) {
+        const int n_window = (WHISPER_PARALLEL_WINDOW_MS*WHISPER_SAMPLE_RATE)/1000;
+
+        n_chunks = std::max(1, (n_audio + n_window - 1)/n_window);
+    } else {
+        // at least one chunk per processor, but not longer than WHISPER_PARALLEL_CHUNK_MAX_S
+        const int n_min = WHISPER_PARALLEL_CHUNK_MIN_S*WHISPER_SAMPLE_RATE;
+        const int n_max = WHISPER_PARALLEL_CHUNK_MAX_S*WHISPER_SAMPLE_RATE;
+
+        n_chunks = std::max(n_chunks, (n_audio + n_max - 1)/n_max);
+        n_chunks = std::min(n_chunks, std::max(1, n_audio/n_min));
+    }
+
+    if (n_chunks == 1) {
+        return whisper_full(ctx, params, samples, n_samples);
+    }
+
+    n_processors = std::min(n_processors, n_chunks);
+
+    const std::vector<int> splits = whisper_parallel_split_points(samples, i_begin, i_end, n_chunks,
+            per_window ? WHISPER_PARALLEL_WINDOW_SEARCH_MS : WHISPER_PARALLEL_SEARCH_MS);
+
+    const int n_overlap = (WHISPER_PARALLEL_OVERLAP_MS*WHISPER_SAMPLE_RATE)/1000;
+
+    // the calling thread uses the default state, the other workers get their own state
+    std::vector<whisper_state *> states = { ctx->state };
+    // the workers run concurrently, so their states cannot share the compute buffers
+    for (int i = 1; i < n_processors; ++i) {
+        whisper_state * state = whisper_init_state(ctx, false);
+        if (state == nullptr) {
+            WHISPER_LOG_ERROR("%s: failed to init state for processor %d\n", __func__, i);
+            for (int j = 1; j < (int) states.size(); ++j) {
+                whisper_free_state(states[j]);
+            }
+            return -1;
+        }
+        states.push_back(state);
+    }
+
+    // the results of each chunk and the offset of the chunk in the input audio
+    std::vector<std::vector<whisper_segment>> results(n_chunks);
+    std::vector<int>                          chunk_i0(n_chunks);
+
+    std::vector<whisper_parallel_queue> queues(n_processors);
+    for (int i = 0; i < n_chunks; ++i) {
+        queues[((int64_t) i*n_processors)/n_chunks].tasks.push_back(i);
+    }
+
+    std::atomic<int> n_done(0);
+    std::atomic<int> ret(0);
+
+    auto worker = [&](int iw) {
+        whisper_state * state = states[iw];
+
+        auto params_cur = params;
+
+        params_cur.offset_ms      = 0;
+        params_cur.duration_ms    = 0;
+        params_cur.print_progress = false;
+        params_cur.print_realtime = false;
+
+        params_cur.new_segment_callback           = nullptr;
+        params_cur.new_segment_callback_user_data = nullptr;
+
+        params_cur.progress_callback           = nullptr;
+        params_cur.progress_callback_user_data = nullptr;
+
+        // the chunks are stitched word by word with the token timestamps
+        // max_len only applies with token timestamps, so it is ignored if they were not requested
+        params_cur.token_timestamps = true;
+        params_cur.max_len          = params.token_timestamps ? params.max_len : 0;
+
+        while (true) {
+            const int i = whisper_parallel_next_task(queues, iw);
+            if (i < 0 || ret != 0) {
+                break;
+            }
+
+            const int i0 = std::max(i_begin, splits[i]     - n_overlap);
+            const int i1 = std::min(i_end,   splits[i + 1] + n_overlap);
+
+            const int res = whisper_full_with_state(ctx, state, params_cur, samples + i0, i1 - i0);
+            if (res != 0) {
+                WHISPER_LOG_ERROR("%s: failed to process chunk %d, result = %d\n", __func__, i, res);
+                ret = res;
+                break;
+            }
+
+            results[i]  = std::move(state->result_all);
+            chunk_i0[i] = i0;
+
+            state->result_all.clear();
+
+            const int n_done_cur = ++n_done;
+
+            // report progress only from the calling thread
+            if (iw == 0 && params.progress_callback) {
+                params.progress_callback(ctx, ctx->state, (n_done_cur*100)/n_chunks, params.progress_callback_user_data);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers(n_processors - 1);
+    for (int iw = 1; iw < n_processors; ++iw) {
+        workers[iw - 1] = std::thread(worker, iw);
+    }
+
+    worker(0);
+
+    for (auto & w : workers) {
+        w.join();
+    }
+
+    // stitch the chunks - each word is kept by the chunk that owns the midpoint of its timestamps, so that the words
+    // transcribed twice in the overlapping audio are dropped, and the segments that cross a split are cut between words
+    auto & result_all = ctx->state->result_all;
+
+    result_all.clear();
+
+    if (ret == 0) {
+        for (int i = 0; i < n_chunks; ++i) {
+            const int64_t t_offset = (100*(int64_t) chunk_i0[i])/WHISPER_SAMPLE_RATE;
+
+            const int64_t t_begin = (100*(int64_t) splits[i])/WHISPER_SAMPLE_RATE;
+            const int64_t t_end   = (100*(int64_t) splits[i + 1])/WHISPER_SAMPLE_RATE;
+
+            for (auto & segment : results[i]) {
+                segment.t0 += t_offset;
+                segment.t1 += t_offset;
+
+                for (auto & token : segment.tokens) {
+                    if (token.t0    >= 0) token.t0    += t_offset;
+                    if (token.t1    >= 0) token.t1    += t_offset;
+                    if (token.t_dtw >= 0) token.t_dtw += t_offset;
+                }
+
+                if (!whisper_parallel_trim_segment(ctx, params, segment, i > 0 ? t_begin : -1, i < n_chunks - 1 ? t_end : -1)) {
+                    continue;
+                }
+
+                if (!params.token_timestamps) {
+                    for (auto & token : segment.tokens) {
+                        token.t0 = -1;
+                        token.t1 = -1;
+                    }
+                }
+
+                // make sure that segments are not overlapping
+                if (!result_all.empty()) {
+                    segment.t0 = std::max(segment.t0, result_all.back().t1);
+                    segment.t1 = std::max(segment.t1, segment.t0);
+                }
+
+                result_all.push_back(std::move(segment));
+
+                // call the new_segment_callback for each segment
+                if (params.new_segment_callback) {
+                    params.new_segment_callback(ctx, ctx->state, 1, params.new_segment_callback_user_data);
+                }
+            }
+        }
+    }
+
+    for (int i = 1; i < n_processors; ++i) {
+        ctx->state->t_mel_us += states[i]->t_mel_us;
+
+        ctx->state->t_sample_us += states[i]->t_sample_us;
+        ctx->state->t_encode_us += states[i]->t_encode_us;
+        ctx->state->t_decode_us += states[i]->t_decode_us;
+        ctx->state->t_batchd_us += states[i]->t_batchd_us;
+        ctx->state->t_prompt_us += states[i]->t_prompt_us;
+
+        ctx->state->n_sample += states[i]->n_sample;
+        ctx->state->n_encode += states[i]->n_encode;
+        ctx->state->n_decode += states[i]->n_decode;
+        ctx->state->n_batchd += states[i]->n_batchd;
+        ctx->state->n_prompt += states[i]->n_prompt;
+
+        whisper_free_state(states[i]);
+    }
+
+    // average the timings
+    ctx->state->t_mel_us    /= n_processors;
+    ctx->state->t_sample_us /= n_processors;
+    ctx->state->t_encode_us /= n_processors;
+    ctx->state->t_decode_us /= n_processors;
+
+    // print information about the audio boundaries
+    WHISPER_LOG_INFO("\n");
+    WHISPER_LOG_INFO("%s: the audio has been split into %d chunks on %d processors at the following times:\n", __func__, n_chunks, n_processors);
+    for (int i = 1; i < n_chunks; ++i) {
+        WHISPER_LOG_INFO("%s: split %d - %s\n", __func__, i, to_timestamp((100*(int64_t) splits[i])/WHISPER_SAMPLE_RATE).c_str());
+    }
+    WHISPER_LOG_INFO("%s: processed in %.2f ms\n", __func__, (ggml_time_us() - t_start_us)/1000.0f);
+
+    return ret;
+}
+
+//
+// streaming
+//
+
+struct whisper_stream_segment {
+    int64_t t0;
+    int64_t t1;
+
+    std::string text;
+
+    bool stable;
+};
+
+struct whisper_stream_token {
+    whisper_token id;
+
+    int64_t t0;
+    int64_t t1;
+};
+
+struct whisper_stream {
+    whisper_context * ctx   = nullptr;
+    whisper_state   * state = nullptr;
+
+    whisper_stream_params sparams;
+    whisper_full_params   params;
+
+    int64_t n_step   = 0;
+    int64_t n_length = 0;
+    int64_t n_keep   = 0;
+
+    // total number of pushed samples and the number at the last decode
+    int64_t n_pushed  = 0;
+    int64_t n_decoded = 0;
+
+    // first sample of the current window - always a multiple of WHISPER_HOP_LENGTH
+    int64_t i_window = 0;
+
+    // the pushed audio, starting at sample pcm_i0
+    int64_t            pcm_i0 = 0;
+    std::vector<float> pcm;
+
+    // not normalized log mel frames [mel_f0, mel_f1), frame-major
+    // frame f is centered at sample f*WHISPER_HOP_LENGTH
+    int64_t            mel_f0 = 0;
+    int64_t            mel_f1 = 0;
+    std::vector<float> mel_raw;
+
+    // tokens of the stable segments, used as decoder prompt
+    std::vector<whisper_token> prompt;
+
+    // the uncommitted part of the last agreement_n - 1 hypotheses
+    std::deque<std::vector<whisper_stream_token>> hyps;
+
+    std::vector<whisper_stream_segment> result;
+
+    std::vector<float> frame;
+    std::vector<float> fft_in;
+    std::vector<float> fft_out;
+};
+
+// compute the log mel values of frame f into dst, using the audio pushed so far
+static void whisper_stream_mel_frame(whisper_stream & stream, int64_t f, float * dst, int dst_stride) {
+    const auto & filters = stream.ctx->model.filters;
+
+    const int64_t i0 = f*WHISPER_HOP_LENGTH - WHISPER_N_FFT/2;
+
+    // the audio before the start of the stream is silence
+    for (int j = 0; j < WHISPER_N_FFT; ++j) {
+        const int64_t i = i0 + j;
+        stream.frame[j] = (i >= stream.pcm_i0 && i < stream.n_pushed) ? stream.pcm[i - stream.pcm_i0] : 0.0f;
+    }
+
+    const int n_x = (int) std::max<int64_t>(0, std::min<int64_t>(WHISPER_N_FFT, stream.n_pushed - i0));
+
+    log_mel_spectrogram_frame(global_cache.hann_window, stream.frame.data(), n_x, WHISPER_N_FFT, filters, filters.n_mel,
+                              stream.fft_in, stream.fft_out, dst, dst_stride);
+}
+
+// move the start of the window to sample i and drop the audio and the frames that are no longer needed
+static void whisper_stream_advance(whisper_stream & stream, int64_t i) {
+    const int n_mel = stream.ctx->model.filters.n_mel;
+
+    i = std::min(i, stream.n_pushed);
+    i = (i/WHISPER_HOP_LENGTH)*WHISPER_HOP_LENGTH;
+
+    if (i <= stream.i_window) {
+        return;
+    }
+
+    stream.i_window = i;
+
+    const int64_t pcm_i0 = std::max<int64_t>(stream.pcm_i0, i - WHISPER_N_FFT/2);
+    stream.pcm.erase(stream.pcm.begin(), stream.pcm.begin() + (pcm_i0 - stream.pcm_i0));
+    stream.pcm_i0 = pcm_i0;
+
+    const int64_t mel_f0 = std::min(i/WHISPER_HOP_LENGTH, stream.mel_f1);
+    stream.mel_raw.erase(stream.mel_raw.begin(), stream.mel_raw.begin() + (mel_f0 - stream.mel_f0)*n_mel);
+    stream.mel_f0 = mel_f0;
+
+    if (stream.mel_f1 < i/WHISPER_HOP_LENGTH) {
+        stream.mel_f0 = stream.mel_f1 = i/WHISPER_HOP_LENGTH;
+    }
+}
+
+static void whisper_stream_add_prompt(whisper_stream & stream, const std::vector<whisper_token> & tokens) {
+    stream.prompt.insert(stream.prompt.end(), tokens.begin(), tokens.end());
+
+    const int n_prompt_max = whisper_n_text_ctx(stream.ctx)/2;
+    if ((int) stream.prompt.size() > n_prompt_max) {
+        stream.prompt.erase(stream.prompt.begin(), stream.prompt.end() - n_prompt_max);
+    }
+}
+
+// commit policy without agreement: a full window makes its completed segments stable
+static void whisper_stream_commit_window(whisper_stream & stream, bool flush) {
+    whisper_context * ctx = stream.ctx;
+
+    const auto & segments = stream.state->result_all;
+
+    const int64_t n_window = stream.n_pushed - stream.i_window;
+    const int64_t t_window = (100*stream.i_window)/WHISPER_SAMPLE_RATE;
+
+    int n_stable = 0;
+    if (flush) {
+        n_stable = segments.size();
+    } else if (n_window >= stream.n_length) {
+        const int64_t t_keep = (100*(n_window - stream.n_keep))/WHISPER_SAMPLE_RATE;
+
+        while (n_stable < (int) segments.size() && segments[n_stable].t1 <= t_keep) {
+            n_stable++;
+        }
+
+        // a single segment covers the window
+        if (n_stable == 0) {
+            n_stable = segments.size();
+        }
+    }
+
+    stream.result.clear();
+    for (int i = 0; i < (int) segments.size(); ++i) {
+        stream.result.push_back({ segments[i].t0 + t_window, segments[i].t1 + t_window, segments[i].text, i < n_stable });
+    }
+
+    std::vector<whisper_token> tokens;
+    for (int i = 0; i < n_stable; ++i) {
+        for (const auto & token : segments[i].tokens) {
+            if (token.id < whisper_token_eot(ctx)) {
+                tokens.push_back(token.id);
+            }
+        }
+    }
+
+    whisper_stream_add_prompt(stream, tokens);
+
+    if (flush) {
+        whisper_stream_advance(stream, stream.n_pushed);
+    } else if (n_window >= stream.n_length) {
+        int64_t i_next = stream.n_pushed - stream.n_keep;
+        if (n_stable > 0) {
+            i_next = stream.i_window + (segments[n_stable - 1].t1*WHISPER_SAMPLE_RATE)/100;
+        }
+
+        // make sure that the next window is not full already
+        i_next = std::max(i_next, stream.n_pushed - stream.n_length + stream.n_step);
+
+        whisper_stream_advance(stream, i_next);
+    }
+}
+
+// LocalAgreement-n commit policy: the longest prefix on which the last agreement_n hypotheses agree becomes stable,
+// the window is moved to the end of that prefix and the rest of the hypothesis stays tentative
+// ref: https://arxiv.org/abs/2307.14743
+static void whisper_stream_commit_agreement(whisper_stream & stream, bool flush) {
+    whisper_context * ctx = stream.ctx;
+
+    const auto & segments = stream.state->result_all;
+
+    const int64_t t_window = (100*stream.i_window)/WHISPER_SAMPLE_RATE;
+
+    std::vector<whisper_stream_token> hyp;
+    for (const auto & segment : segments) {
+        for (const auto & token : segment.tokens) {
+            if (token.id < whisper_token_eot(ctx)) {
+                const int64_t t0 = std::max<int64_t>(0, token.t0) + t_window;
+                const int64_t t1 = std::max<int64_t>(0, token.t1) + t_window;
+
+                hyp.push_back({ token.id, t0, std::max(t0, t1) });
+            }
+        }
+    }
+
+    size_t n_agreed = 0;
+    if (flush) {
+        n_agreed = hyp.size();
+    } else if ((int) stream.hyps.size() >= stream.sparams.agreement_n - 1) {
+        n_agreed = hyp.size();
+        for (const auto & prev : stream.hyps) {
+            size_t n = 0;
+            while (n < n_agreed && n < prev.size() && prev[n].id == hyp[n].id) {
+                n++;
+            }
+            n_agreed = n;
+        }
+
+        // commit only complete words - the last word of the hypothesis can still grow
+        // the scripts without spaces are cut between characters (see whisper_is_word_start) or after punctuation
+        const auto is_boundary = [&](size_t i) {
+            if (i == hyp.size()) {
+                return false;
+            }
+
+            if (whisper_is_word_start(whisper_token_to_str(ctx, hyp[i].id))) {
+                return true;
+            }
+
+            const std::string prev = whisper_token_to_str(ctx, hyp[i - 1].id);
+
+            return !prev.empty() && std::string(".,!?;:").find(prev.back()) != std::string::npos;
+        };
+
+        while (n_agreed > 0 && !is_boundary(n_agreed)) {
+            n_agreed--;
+        }
+    }
+
+    // the agreement is too slow for the window - commit the whole hypothesis
+    const bool full = !flush && stream.n_pushed - stream.i_window >= stream.n_length;
+    if (full && n_agreed == 0) {
+        n_agreed = hyp.size();
+    }
+
+    stream.result.clear();
+
+    auto add_result = [&](size_t i0, size_t i1, bool stable) {
+        if (i0 >= i1) {
+            return;
+        }
+
+        std::string text;
+        for (size_t i = i0; i < i1; ++i) {
+            text += whisper_token_to_str(ctx, hyp[i].id);
+        }
+
+        stream.result.push_back({ hyp[i0].t0, hyp[i1 - 1].t1, std::move(text), stable });
+    };
+
+    add_result(0, n_agreed, true);
+    add_result(n_agreed, hyp.size(), false);
+
+    {
+        std::vector<whisper_token> tokens;
+        for (size_t i = 0; i < n_agreed; ++i) {
+            tokens.push_back(hyp[i].id);
+        }
+
+        whisper_stream_add_prompt(stream, tokens);
+    }
 
-                    if (params.print_special || tokens_cur[i].id < whisper_token_eot(ctx)) {
-                        text += whisper_token_to_str(ctx, tokens_cur[i].id);
-                    }
+    if (flush || (full && n_agreed == hyp.size())) {
+        stream.hyps.clear();
+    } else {
+        for (auto & prev : stream.hyps) {
+            prev.erase(prev.begin(), prev.begin() + std::min(n_agreed, prev.size()));
+        }
 
-                    // [TDRZ] record if speaker turn was predicted after current segment
-                    if (params.tdrz_enable && tokens_cur[i].id == whisper_token_solm(ctx)) {
-                        speaker_turn_next = true;
-                    }
+        stream.hyps.emplace_back(hyp.begin() + n_agreed, hyp.end());
+        while ((int) stream.hyps.size() > std::max(0, stream.sparams.agreement_n - 1)) {
+            stream.hyps.pop_front();
+        }
+    }
 
-                    if (tokens_cur[i].id > whisper_token_beg(ctx) && !params.single_segment) {
-                        const auto t1 = seek + 2*(tokens_cur[i].tid - whisper_token_beg(ctx));
+    if (flush) {
+        whisper_stream_advance(stream, stream.n_pushed);
+    } else if (n_agreed > 0 || full) {
+        int64_t i_next = n_agreed > 0 ? (hyp[n_agreed - 1].t1*WHISPER_SAMPLE_RATE)/100 : stream.i_window;
 
-                        if (!text.empty()) {
-                            const auto tt0 = t0;
-                            const auto tt1 = t1;
+        if (full) {
+            i_next = std::max(i_next, stream.n_pushed - stream.n_length + stream.n_step);
+        }
 
-                            if (params.print_realtime) {
-                                if (params.print_timestamps) {
-                                    printf("[%s --> %s]  %s\n", to_timestamp(tt0).c_str(), to_timestamp(tt1).c_str(), text.c_str());
-                                } else {
-                                    printf("%s", text.c_str());
-                                    fflush(stdout);
-                                }
-                            }
+        whisper_stream_advance(stream, i_next);
+    }
+}
 
-                            //printf("tt0 = %d, tt1 = %d, text = %s, token = %s, token_id = %d, tid = %d\n", tt0, tt1, text.c_str(), ctx->vocab.id_to_token[tokens_cur[i].id].c_str(), tokens_cur[i].id, tokens_cur[i].tid);
+static int whisper_stream_decode(whisper_stream & stream, bool flush) {
+    whisper_context * ctx   = stream.ctx;
+    whisper_state   * state = stream.state;
 
-                            result_all.push_back({ tt0, tt1, text, state->no_speech_prob, {}, speaker_turn_next });
-                            for (int j = i0; j <= i; j++) {
-                                result_all.back().tokens.push_back(tokens_cur[j]);
-                            }
+    if (stream.n_pushed <= stream.i_window) {
+        return 0;
+    }
 
-                            int n_new = 1;
+    if (!flush && stream.n_pushed - stream.n_decoded < stream.n_step) {
+        return 0;
+    }
 
-                            if (params.token_timestamps) {
-                                whisper_exp_compute_token_level_timestamps(
-                                        *ctx, *state, result_all.size() - 1, params.thold_pt, params.thold_ptsum);
+    stream.n_decoded = stream.n_pushed;
 
-                                if (params.max_len > 0) {
-                                    n_new = whisper_wrap_segment(*ctx, *state, params.max_len, params.split_on_word);
-                                }
-                            }
-                            if (params.new_segment_callback && !ctx->params.dtw_token_timestamps) {
-                                params.new_segment_callback(ctx, state, n_new, params.new_segment_callback_user_data);
-                            }
-                        }
-                        text = "";
-                        while (i < (int) tokens_cur.size() && tokens_cur[i].id > whisper_token_beg(ctx)) {
-                            i++;
-                        }
-                        i--;
-                        t0 = t1;
-                        i0 = i + 1;
-                        speaker_turn_next = false;
-                    }
-                }
+    const int64_t t_start_us = ggml_time_us();
 
-                if (!text.empty()) {
-                    const auto t1 = seek + seek_delta;
+    const int n_mel = ctx->model.filters.n_mel;
 
-                    const auto tt0 = t0;
-                    const auto tt1 = t1;
+    const int64_t n_window = stream.n_pushed - stream.i_window;
+    const int64_t f_window = stream.i_window/WHISPER_HOP_LENGTH;
 
-                    if (params.print_realtime) {
-                        if (params.print_timestamps) {
-                            printf("[%s --> %s]  %s\n", to_timestamp(tt0).c_str(), to_timestamp(tt1).c_str(), text.c_str());
-                        } else {
-                            printf("%s", text.c_str());
-                            fflush(stdout);
-                        }
-                    }
+    // frames centered in the window, the rest is 30 s of silence - same as in log_mel_spectrogram()
+    const int n_frames = (n_window + WHISPER_HOP_LENGTH - 1)/WHISPER_HOP_LENGTH;
 
-                    result_all.push_back({ tt0, tt1, text, state->no_speech_prob, {}, speaker_turn_next });
-                    for (int j = i0; j < (int) tokens_cur.size(); j++) {
-                        result_all.back().tokens.push_back(tokens_cur[j]);
-                    }
+    auto & mel = state->mel;
 
-                    int n_new = 1;
+    mel.n_mel     = n_mel;
+    mel.n_len_org = std::max(n_frames, 100);
+    mel.n_len     = mel.n_len_org + WHISPER_CHUNK_SIZE*100;
+    mel.data.assign(mel.n_mel*mel.n_len, log10(1e-10));
 
-                    if (params.token_timestamps) {
-                        whisper_exp_compute_token_level_timestamps(
-                                *ctx, *state, result_all.size() - 1, params.thold_pt, params.thold_ptsum);
+    for (int i = 0; i < n_frames; ++i) {
+        const int64_t f = f_window + i;
 
-                        if (params.max_len > 0) {
-                            n_new = whisper_wrap_segment(*ctx, *state, params.max_len, params.split_on_word);
-                        }
-                    }
-                    if (params.new_segment_callback && !ctx->params.dtw_token_timestamps) {
-                        params.new_segment_callback(ctx, state, n_new, params.new_segment_callback_user_data);
-                    }
-                }
+        if (f < stream.mel_f1) {
+            const float * src = stream.mel_raw.data() + (f - stream.mel_f0)*n_mel;
+            for (int j = 0; j < n_mel; ++j) {
+                mel.data[j*mel.n_len + i] = src[j];
             }
+        } else {
+            // the last frames are not complete yet
+            whisper_stream_mel_frame(stream, f, mel.data.data() + i, mel.n_len);
+        }
+    }
 
-            // FIXME: will timestamp offsets be correct?
-            // [EXPERIMENTAL] Token-level timestamps with DTW
-            {
-                const int n_segments = state->result_all.size() - n_segments_before;
-                if (ctx->params.dtw_token_timestamps && n_segments) {
-                    const int n_frames = std::min(std::min(WHISPER_CHUNK_SIZE * 100, seek_delta), seek_end - seek);
-                    whisper_exp_compute_token_level_timestamps_dtw(
-                            ctx, state, params, result_all.size() - n_segments, n_segments, seek, n_frames, 7, params.n_threads);
-                    if (params.new_segment_callback) {
-                        for (int seg = (int) result_all.size() - n_segments; seg < n_segments; seg++) {
-                            params.new_segment_callback(ctx, state, seg, params.new_segment_callback_user_data);
-                        }
-                    }
-                }
+    // clamping and normalization
+    {
+        double mmax = -1e20;
+        for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
+            if (mel.data[i] > mmax) {
+                mmax = mel.data[i];
             }
+        }
 
-            // ref: https://github.com/ggerganov/whisper.cpp/pull/2629
-            const bool single_timestamp_ending = tokens_cur.size() > 1 &&
-                tokens_cur[tokens_cur.size() - 2].id < whisper_token_beg(ctx) &&
-                tokens_cur[tokens_cur.size() - 1].id > whisper_token_beg(ctx);
-            if (single_timestamp_ending) {
-                WHISPER_LOG_DEBUG("single timestamp ending - skip entire chunk\n");
-                seek_delta = std::min(seek_end - seek, WHISPER_CHUNK_SIZE * 100);
-            }
+        mmax -= 8.0;
 
-            // update audio window
-            seek += seek_delta;
+        for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
+            if (mel.data[i] < mmax) {
+                mel.data[i] = mmax;
+            }
 
-            WHISPER_LOG_DEBUG("seek = %d, seek_delta = %d\n", seek, seek_delta);
+            mel.data[i] = (mel.data[i] + 4.0)/4.0;
         }
     }
 
-    return 0;
-}
+    auto params = stream.params;
 
-int whisper_full(
-        struct whisper_context * ctx,
-    struct whisper_full_params   params,
-                   const float * samples,
-                           int   n_samples) {
-    return whisper_full_with_state(ctx, ctx->state, params, samples, n_samples);
-}
+    // the agreement policy moves the window to the end of the stable tokens
+    if (stream.sparams.agreement_n > 0) {
+        params.token_timestamps = true;
+    }
 
-int whisper_full_parallel(
-        struct whisper_context * ctx,
-        struct whisper_full_params params,
-        const float * samples,
-        int n_samples,
-        int n_processors) {
-    if (n_processors == 1) {
-        return whisper_full(ctx, params, samples, n_samples);
+    if (params.token_timestamps) {
+        state->energy = get_signal_energy(stream.pcm.data() + (stream.i_window - stream.pcm_i0), n_window, 32);
     }
-    int ret = 0;
 
-    // prepare separate states for each thread
-    std::vector<whisper_state*> states;
+    state->t_mel_us += ggml_time_us() - t_start_us;
 
-    const int offset_samples = (WHISPER_SAMPLE_RATE*params.offset_ms)/1000;
-    const int n_samples_per_processor = (n_samples - offset_samples)/n_processors;
+    params.no_context      = true;
+    params.offset_ms       = 0;
+    params.duration_ms     = 0;
+    params.vad             = false;
+    params.prompt_tokens   = stream.prompt.empty() ? nullptr : stream.prompt.data();
+    params.prompt_n_tokens = stream.prompt.size();
 
-    // the calling thread will process the first chunk
-    // while the other threads will process the remaining chunks
+    params.new_segment_callback           = nullptr;
+    params.new_segment_callback_user_data = nullptr;
 
-    std::vector<std::thread> workers(n_processors - 1);
-    for (int i = 0; i < n_processors - 1; ++i) {
-        // create a new state for each thread
-        states.push_back(whisper_init_state(ctx));
+    const int ret = whisper_full_with_state(ctx, state, params, nullptr, 0);
+    if (ret != 0) {
+        WHISPER_LOG_ERROR("%s: failed to decode the stream window, result = %d\n", __func__, ret);
+        return ret;
+    }
 
-        const int start_samples = offset_samples + (i + 1)*n_samples_per_processor;
-        const int n_samples_cur = (i == n_processors - 2) ? n_samples - start_samples : n_samples_per_processor;
+    if (stream.sparams.agreement_n > 0) {
+        whisper_stream_commit_agreement(stream, flush);
+    } else {
+        whisper_stream_commit_window(stream, flush);
+    }
 
-        auto params_cur = params;
+    return 1;
+}
 
-        params_cur.offset_ms = 0;
-        params_cur.print_progress = false;
-        params_cur.print_realtime = false;
+struct whisper_stream_params whisper_stream_default_params(void) {
+    struct whisper_stream_params result = {
+        /*.step_ms   =*/ 1000,
+        /*.length_ms =*/ 10000,
+        /*.keep_ms   =*/ 200,
 
-        params_cur.new_segment_callback = nullptr;
-        params_cur.new_segment_callback_user_data = nullptr;
+        /*.agreement_n =*/ 2,
+    };
 
-        params_cur.progress_callback = nullptr;
-        params_cur.progress_callback_user_data = nullptr;
+    return result;
+}
 
-        workers[i] = std::thread(whisper_full_with_state, ctx, states[i], std::move(params_cur), samples + start_samples, n_samples_cur);
+struct whisper_stream * whisper_stream_init_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+    struct whisper_stream_params sparams,
+      struct whisper_full_params params) {
+    if (ctx == nullptr || state == nullptr) {
+        WHISPER_LOG_ERROR("%s: invalid context or state\n", __func__);
+        return nullptr;
     }
 
-    {
-        auto params_cur = params;
+    sparams.length_ms = std::min(std::max(sparams.length_ms, sparams.step_ms), WHISPER_CHUNK_SIZE*1000);
+    sparams.keep_ms   = std::min(sparams.keep_ms, sparams.step_ms);
 
-        // We need to disable the print real-time for this one as well, otherwise it will show only for the first chunk.
-        params_cur.print_realtime = false;
+    whisper_stream * stream = new whisper_stream;
+
+    stream->ctx     = ctx;
+    stream->state   = state;
+    stream->sparams = sparams;
+    stream->params  = params;
 
-        // Run the first transformation using default state but only for the first chunk.
-        ret = whisper_full_with_state(ctx, ctx->state, std::move(params_cur), samples, offset_samples + n_samples_per_processor);
+    stream->n_step   = ((int64_t) sparams.step_ms  *WHISPER_SAMPLE_RATE)/1000;
+    stream->n_length = ((int64_t) sparams.length_ms*WHISPER_SAMPLE_RATE)/1000;
+    stream->n_keep   = ((int64_t) sparams.keep_ms  *WHISPER_SAMPLE_RATE)/1000;
+
+    stream->frame.resize(WHISPER_N_FFT);
+    stream->fft_in.resize(WHISPER_N_FFT*2, 0.0f);
+    stream->fft_out.resize(WHISPER_N_FFT*2*2*2);
+
+    return stream;
+}
+
+struct whisper_stream * whisper_stream_init(
+        struct whisper_context * ctx,
+    struct whisper_stream_params sparams,
+      struct whisper_full_params params) {
+    return whisper_stream_init_with_state(ctx, ctx ? ctx->state : nullptr, sparams, params);
+}
+
+void whisper_stream_free(struct whisper_stream * stream) {
+    if (stream) {
+        delete stream;
     }
+}
 
-    for (int i = 0; i < n_processors - 1; ++i) {
-        workers[i].join();
+int whisper_stream_push(struct whisper_stream * stream, const float * samples, int n_samples) {
+    if (n_samples < 0 || (n_samples > 0 && samples == nullptr)) {
+        WHISPER_LOG_ERROR("%s: invalid input\n", __func__);
+        return -1;
     }
 
-    const int64_t offset_t = (int64_t) params.offset_ms/10.0;
+    const int n_mel = stream->ctx->model.filters.n_mel;
 
-    // combine results into result_state->result_all from all other states
-    for (int i = 0; i < n_processors - 1; ++i) {
-        auto& results_i = states[i]->result_all;
+    stream->pcm.insert(stream->pcm.end(), samples, samples + n_samples);
+    stream->n_pushed += n_samples;
 
-        for (auto& result : results_i) {
-            // correct the segment timestamp taking into account the offset
-            result.t0 += 100 * ((i + 1) * n_samples_per_processor) / WHISPER_SAMPLE_RATE + offset_t;
-            result.t1 += 100 * ((i + 1) * n_samples_per_processor) / WHISPER_SAMPLE_RATE + offset_t;
+    // compute the frames that are complete
+    while (stream->mel_f1*WHISPER_HOP_LENGTH + WHISPER_N_FFT/2 <= stream->n_pushed) {
+        stream->mel_raw.resize((stream->mel_f1 - stream->mel_f0 + 1)*n_mel);
 
-            // make sure that segments are not overlapping
-            if (!ctx->state->result_all.empty()) {
-                result.t0 = std::max(result.t0, ctx->state->result_all.back().t1);
-            }
+        whisper_stream_mel_frame(*stream, stream->mel_f1, stream->mel_raw.data() + (stream->mel_f1 - stream->mel_f0)*n_mel, 1);
 
-            ctx->state->result_all.push_back(std::move(result));
+        stream->mel_f1++;
+    }
 
-            // call the new_segment_callback for each segment
-            if (params.new_segment_callback) {
-                params.new_segment_callback(ctx, ctx->state, 1, params.new_segment_callback_user_data);
-            }
-        }
+    return 0;
+}
 
-        ctx->state->t_mel_us += states[i]->t_mel_us;
+int whisper_stream_process(struct whisper_stream * stream) {
+    return whisper_stream_decode(*stream, false);
+}
 
-        ctx->state->t_sample_us += states[i]->t_sample_us;
-        ctx->state->t_encode_us += states[i]->t_encode_us;
-        ctx->state->t_decode_us += states[i]->t_decode_us;
-        ctx->state->t_batchd_us += states[i]->t_batchd_us;
-        ctx->state->t_prompt_us += states[i]->t_prompt_us;
+int whisper_stream_flush(struct whisper_stream * stream) {
+    return whisper_stream_decode(*stream, true);
+}
 
-        ctx->state->n_sample += states[i]->n_sample;
-        ctx->state->n_encode += states[i]->n_encode;
-        ctx->state->n_decode += states[i]->n_decode;
-        ctx->state->n_batchd += states[i]->n_batchd;
-        ctx->state->n_prompt += states[i]->n_prompt;
+int whisper_stream_n_segments(struct whisper_stream * stream) {
+    return stream->result.size();
+}
 
-        whisper_free_state(states[i]);
-    }
+const char * whisper_stream_get_segment_text(struct whisper_stream * stream, int i_segment) {
+    return stream->result[i_segment].text.c_str();
+}
 
-    // average the timings
-    ctx->state->t_mel_us    /= n_processors;
-    ctx->state->t_sample_us /= n_processors;
-    ctx->state->t_encode_us /= n_processors;
-    ctx->state->t_decode_us /= n_processors;
+int64_t whisper_stream_get_segment_t0(struct whisper_stream * stream, int i_segment) {
+    return stream->result[i_segment].t0;
+}
 
-    // print information about the audio boundaries
-    WHISPER_LOG_WARN("\n");
-    WHISPER_LOG_WARN("%s: the audio has been split into %d chunks at the following times:\n", __func__, n_processors);
-    for (int i = 0; i < n_processors - 1; ++i) {
-        WHISPER_LOG_WARN("%s: split %d - %s\n", __func__, (i + 1), to_timestamp(100*((i + 1)*n_samples_per_processor)/WHISPER_SAMPLE_RATE + offset_t).c_str());
-    }
-    WHISPER_LOG_WARN("%s: the transcription quality may be degraded near these boundaries\n", __func__);
+int64_t whisper_stream_get_segment_t1(struct whisper_stream * stream, int i_segment) {
+    return stream->result[i_segment].t1;
+}
 
-    return ret;
+bool whisper_stream_get_segment_stable(struct whisper_stream * stream, int i_segment) {
+    return stream->result[i_segment].stable;
 }
 
 int whisper_full_n_segments_from_state(struct whisper_state * state) {
@@ -6684,6 +9549,7 @@ WHISPER_API const char * whisper_bench_ggml_mul_mat_str(int n_threads) {
         int n_q5_1 = 0;
         int n_q8_0 = 0;
         int n_fp16 = 0;
+        int n_bf16 = 0;
         int n_fp32 = 0;
 
         // GFLOPS/s
@@ -6693,21 +9559,23 @@ WHISPER_API const char * whisper_bench_ggml_mul_mat_str(int n_threads) {
         double s_q5_1 = 0.0;
         double s_q8_0 = 0.0;
         double s_fp16 = 0.0;
+        double s_bf16 = 0.0;
         double s_fp32 = 0.0;
 
         const size_t N = sizes[j];
 
-        for (int k = 0; k < 7; ++k) {
+        for (int k = 0; k < 8; ++k) {
             const ggml_type wtype =
                 k == 0 ? GGML_TYPE_Q4_0 :
                 k == 1 ? GGML_TYPE_Q4_1 :
                 k == 2 ? GGML_TYPE_Q5_0 :
                 k == 3 ? GGML_TYPE_Q5_1 :
                 k == 4 ? GGML_TYPE_Q8_0 :
-                k == 5 ? GGML_TYPE_F16  : GGML_TYPE_F32;
+                k == 5 ? GGML_TYPE_F16  :
+                k == 6 ? GGML_TYPE_BF16 : GGML_TYPE_F32;
 
-            double & s = k == 0 ? s_q4_0 : k == 1 ? s_q4_1 : k == 2 ? s_q5_0 : k == 3 ? s_q5_1 : k == 4 ? s_q8_0 : k == 5 ? s_fp16 : /*k == 6*/ s_fp32;
-            int    & n = k == 0 ? n_q4_0 : k == 1 ? n_q4_1 : k == 2 ? n_q5_0 : k == 3 ? n_q5_1 : k == 4 ? n_q8_0 : k == 5 ? n_fp16 : /*k == 6*/ n_fp32;
+            double & s = k == 0 ? s_q4_0 : k == 1 ? s_q4_1 : k == 2 ? s_q5_0 : k == 3 ? s_q5_1 : k == 4 ? s_q8_0 : k == 5 ? s_fp16 : k == 6 ? s_bf16 : /*k == 7*/ s_fp32;
+            int    & n = k == 0 ? n_q4_0 : k == 1 ? n_q4_1 : k == 2 ? n_q5_0 : k == 3 ? n_q5_1 : k == 4 ? n_q8_0 : k == 5 ? n_fp16 : k == 6 ? n_bf16 : /*k == 7*/ n_fp32;
 
             struct ggml_init_params gparams = {
                 /*.mem_size   =*/ buf.size(),
@@ -6761,12 +9629,139 @@ WHISPER_API const char * whisper_bench_ggml_mul_mat_str(int n_threads) {
                 N, N, s_q5_0, n_q5_0, s_q5_1, n_q5_1, s_q8_0, n_q8_0);
         s += strbuf;
 
-        // F16 | F32
-        snprintf(strbuf, sizeof(strbuf), "%4zu x %4zu: F16  %7.1f GFLOPS (%3d runs) | F32  %7.1f GFLOPS (%3d runs)\n",
-                N, N, s_fp16, n_fp16, s_fp32, n_fp32);
+        // F16 | BF16 | F32
+        snprintf(strbuf, sizeof(strbuf), "%4zu x %4zu: F16  %7.1f GFLOPS (%3d runs) | BF16 %7.1f GFLOPS (%3d runs) | F32  %7.1f GFLOPS (%3d runs)\n",
+                N, N, s_fp16, n_fp16, s_bf16, n_bf16, s_fp32, n_fp32);
+        s += strbuf;
+    }
+
+    return s.c_str();
+}
+
+WHISPER_API int whisper_bench_decoder_beams(struct whisper_context * ctx, int n_threads) {
+    fputs(whisper_bench_decoder_beams_str(ctx, n_threads), stderr);
+    return 0;
+}
+
+WHISPER_API const char * whisper_bench_decoder_beams_str(struct whisper_context * ctx, int n_threads) {
+    static std::string s;
+    s = "";
+    char strbuf[256];
+
+    if (ctx == nullptr || ctx->state == nullptr) {
+        s = "error: no whisper state\n";
+        return s.c_str();
+    }
+
+    auto * state = ctx->state;
+
+    auto & kv_self = state->kv_self;
+    auto & batch   = state->batch;
+
+    // same KV cache size as whisper_full() with WHISPER_MAX_DECODERS decoders
+    if (state->kv_self_n_dec < WHISPER_MAX_DECODERS) {
+        whisper_kv_cache_free(kv_self);
+
+        if (!whisper_kv_cache_init(kv_self, state->compute->backends[0], ctx->params.type_k, ctx->params.type_v,
+                    ctx->model.hparams.n_text_state,
+                    ctx->model.hparams.n_text_layer,
+                    GGML_PAD(ctx->model.hparams.n_text_ctx, 256)*(WHISPER_MAX_DECODERS + 2))) {
+            s = "error: failed to allocate the KV cache\n";
+            return s.c_str();
+        }
+
+        state->kv_self_n_dec = WHISPER_MAX_DECODERS;
+    }
+
+    // the longest prompt whisper_full() uses and a long segment, so that the self-attention is a visible part of a step
+    const int n_vocab  = ctx->vocab.n_vocab;
+    const int n_prompt = ctx->model.hparams.n_text_ctx/2;
+    const int n_gen    = 192;
+
+    if (whisper_set_mel(ctx, nullptr, 0, whisper_model_n_mels(ctx)) != 0 || whisper_encode(ctx, 0, n_threads) != 0) {
+        s = "error: failed to encode\n";
+        return s.c_str();
+    }
+
+    std::vector<whisper_token> prompt(n_prompt);
+    for (int i = 0; i < n_prompt; ++i) {
+        prompt[i] = (whisper_token_sot(ctx) + 7*i) % n_vocab;
+    }
+
+    snprintf(strbuf, sizeof(strbuf), "prompt = %d tokens, %d steps, KV cache %s/%s, %s\n", n_prompt, n_gen,
+            ggml_type_name(kv_self.k->type), ggml_type_name(kv_self.v->type), ctx->params.flash_attn ? "flash attention" : "no flash attention");
+    s += strbuf;
+
+    for (int n_beams = 1; n_beams <= WHISPER_MAX_DECODERS; ++n_beams) {
+        double t_ms[2] = { std::numeric_limits<double>::max(), std::numeric_limits<double>::max() };
+
+        std::vector<float> logits[2];
+
+        // 0 - masked attention over all cells, 1 - sequence-aware attention
+        // each mode runs twice, interleaved, and the fastest run is kept to reduce the noise
+        for (int run = 0; run < 4; ++run) {
+            const int mode = run % 2;
+
+            state->kv_seq_attn.disabled = mode == 0;
+
+            double t_run_ms = 0.0;
+
+            whisper_kv_cache_clear(kv_self);
+
+            whisper_batch_prep_legacy(batch, prompt.data(), n_prompt, 0, 0);
+            if (!whisper_decode_internal(*ctx, *state, batch, n_threads, false, nullptr, nullptr)) {
+                s = "error: failed to decode\n";
+                return s.c_str();
+            }
+
+            for (int j = 1; j < n_beams; ++j) {
+                whisper_kv_cache_seq_cp(kv_self, 0, j, -1, -1);
+            }
+
+            // each beam appends one token per step - the cells of the beams are interleaved as in whisper_full()
+            for (int i = 0; i < n_gen; ++i) {
+                batch.n_tokens = n_beams;
+
+                for (int j = 0; j < n_beams; ++j) {
+                    batch.token   [j]    = (prompt[i % n_prompt] + j) % n_vocab;
+                    batch.pos     [j]    = n_prompt + i;
+                    batch.n_seq_id[j]    = 1;
+                    batch.seq_id  [j][0] = j;
+                    batch.logits  [j]    = 1;
+                }
+
+                const int64_t t_start_us = ggml_time_us();
+
+                if (!whisper_decode_internal(*ctx, *state, batch, n_threads, false, nullptr, nullptr)) {
+                    s = "error: failed to decode\n";
+                    return s.c_str();
+                }
+
+                t_run_ms += (ggml_time_us() - t_start_us)*1e-3;
+            }
+
+            t_ms[mode] = std::min(t_ms[mode], t_run_ms);
+
+            logits[mode] = state->logits;
+        }
+
+        state->kv_seq_attn.disabled = false;
+
+        // relative to the largest logit
+        float max_diff = 0.0f;
+        float max_abs  = 0.0f;
+        for (size_t i = 0; i < logits[0].size() && i < logits[1].size(); ++i) {
+            max_diff = std::max(max_diff, std::fabs(logits[0][i] - logits[1][i]));
+            max_abs  = std::max(max_abs,  std::fabs(logits[0][i]));
+        }
+
+        snprintf(strbuf, sizeof(strbuf), "beams = %d: masked %8.3f ms/step | sequence-aware %8.3f ms/step | speed-up %5.2fx | max logit diff %.2e\n",
+                n_beams, t_ms[0]/n_gen, t_ms[1]/n_gen, t_ms[0]/t_ms[1], max_abs > 0.0f ? max_diff/max_abs : max_diff);
         s += strbuf;
     }
 
+    whisper_kv_cache_clear(kv_self);
+
     return s.c_str();
 }
 
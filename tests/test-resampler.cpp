@@ -0,0 +1,141 @@
+#include "whisper.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// taps on each side of the filter center are at most this many output samples (for the rates below)
+#define N_EDGE 64
+
+static int n_failed = 0;
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: FAILED: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fprintf(stderr, "\n"); \
+            n_failed++; \
+        } \
+    } while (0)
+
+static std::vector<float> resample(const std::vector<float> & in, int sr_in, int sr_out) {
+    std::vector<float> out((size_t) in.size()*sr_out/sr_in + 1);
+    const int n_out = whisper_pcm_resample(in.data(), in.size(), sr_in, out.data(), out.size(), sr_out);
+    out.resize(std::max(n_out, 0));
+    return out;
+}
+
+// a constant input stays constant, away from the zero padding at the edges
+static void test_dc_gain(int sr_in, int sr_out) {
+    const std::vector<float> in(sr_in/2, 0.5f);
+    const std::vector<float> out = resample(in, sr_in, sr_out);
+
+    float max_err = 0.0f;
+    for (size_t i = N_EDGE; i + N_EDGE < out.size(); ++i) {
+        max_err = std::max(max_err, std::fabs(out[i] - 0.5f));
+    }
+
+    CHECK(max_err < 1e-4f, "%d -> %d Hz: DC error %g", sr_in, sr_out, max_err);
+}
+
+// ceil(n*sr_out/sr_in) samples in total, the same in one call and when streamed in blocks of varying size
+static void test_length(int sr_in, int sr_out) {
+    std::vector<float> in(12345);
+    for (size_t i = 0; i < in.size(); ++i) {
+        in[i] = std::sin(0.01f*i) + 0.25f*std::sin(0.37f*i);
+    }
+
+    const std::vector<float> ref = resample(in, sr_in, sr_out);
+
+    const size_t n_exp = ((size_t) in.size()*sr_out + sr_in - 1)/sr_in;
+    CHECK(ref.size() == n_exp, "%d -> %d Hz: %zu samples, expected %zu", sr_in, sr_out, ref.size(), n_exp);
+
+    whisper_resampler * rs = whisper_resampler_init(sr_in, sr_out);
+    CHECK(rs != nullptr, "%d -> %d Hz: init failed", sr_in, sr_out);
+    if (rs == nullptr) {
+        return;
+    }
+
+    // two streams in a row, to check that the flush resets the resampler
+    for (int iter = 0; iter < 2; ++iter) {
+        std::vector<float> out;
+
+        size_t i = 0;
+        for (int n = 1; ; n = (n*7 + 3) % 5000 + 1) {
+            const int n_cur = (int) std::min<size_t>(n, in.size() - i);
+
+            std::vector<float> buf(whisper_resampler_n_out_max(rs, n_cur));
+            const int n_out = n_cur > 0 ? whisper_resampler_process(rs, in.data() + i, n_cur, buf.data(), buf.size())
+                                        : whisper_resampler_process(rs, nullptr, 0, buf.data(), buf.size());
+            CHECK(n_out >= 0, "%d -> %d Hz: process failed", sr_in, sr_out);
+            out.insert(out.end(), buf.begin(), buf.begin() + std::max(n_out, 0));
+
+            if (n_cur == 0) {
+                break;
+            }
+            i += n_cur;
+        }
+
+        bool same = out.size() == ref.size();
+        for (size_t j = 0; same && j < out.size(); ++j) {
+            same = out[j] == ref[j];
+        }
+
+        CHECK(same, "%d -> %d Hz: streamed output differs from the one-shot output (pass %d)", sr_in, sr_out, iter);
+    }
+
+    whisper_resampler_free(rs);
+}
+
+// a sine in the passband keeps its amplitude and phase
+static void test_sine(int sr_in, int sr_out, float freq) {
+    std::vector<float> in(sr_in/2);
+    for (size_t i = 0; i < in.size(); ++i) {
+        in[i] = 0.8f*std::sin(2.0*M_PI*freq*i/sr_in);
+    }
+
+    const std::vector<float> out = resample(in, sr_in, sr_out);
+
+    float max_err = 0.0f;
+    for (size_t i = N_EDGE; i + N_EDGE < out.size(); ++i) {
+        const float exp = 0.8f*std::sin(2.0*M_PI*freq*i/sr_out);
+        max_err = std::max(max_err, std::fabs(out[i] - exp));
+    }
+
+    CHECK(max_err < 1e-3f, "%d -> %d Hz: %.0f Hz sine error %g", sr_in, sr_out, freq, max_err);
+}
+
+int main(void) {
+    const int rates[][2] = {
+        {  8000, 16000 },
+        { 22050, 16000 },
+        { 44100, 16000 },
+        { 48000, 16000 },
+        { 44056, 16000 }, // more phases than the coefficient table holds
+        { 16000, 48000 },
+        { 16000, 16000 },
+    };
+
+    for (const auto & r : rates) {
+        test_dc_gain(r[0], r[1]);
+        test_length (r[0], r[1]);
+        test_sine   (r[0], r[1],  440.0f);
+        test_sine   (r[0], r[1], 3000.0f);
+    }
+
+    if (n_failed > 0) {
+        fprintf(stderr, "%d check(s) failed\n", n_failed);
+        return 1;
+    }
+
+    printf("all resampler checks passed\n");
+
+    return 0;
+}